@@ -0,0 +1,119 @@
+/*
+ * @brief Arena (bump-pointer) allocator for temporary allocations
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+#ifndef TRH_ARENA_H
+#define TRH_ARENA_H
+
+#include <stdarg.h>
+
+// c++ compatibility
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct TTrhArena;
+struct TTrhArenaChunk;
+
+/// Default size of arena chunk (bytes).
+#define TRH_ARENA_CHUNK_DEFAULT		( 64 * 1024 )
+
+/**
+ * @brief Position in the arena; memory allocated after it is released by \a trh_arena_rewind.
+ */
+typedef struct TTrhArenaMark {
+	struct TTrhArenaChunk *chunk;
+	size_t used;
+} TTrhArenaMark;
+
+
+/**
+ * @brief Create arena.
+ * @param iChunkSize Size of memory chunks; 0 for TRH_ARENA_CHUNK_DEFAULT. Larger allocations get their own chunk.
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID oArena is null.
+ * @retval TRH_OUT_OF_MEM
+ *
+ * Arena is not thread-safe; use it from one thread (see \a trh_arena_current).
+ */
+int trh_arena_init( size_t iChunkSize, struct TTrhArena **oArena );
+
+/**
+ * @brief Release arena and all its memory.
+ */
+void trh_arena_release( struct TTrhArena *iArena );
+
+/**
+ * @brief Return arena of the calling thread (created on first use), null if out of memory.
+ *
+ * The loop running on the thread rewinds the arena after every iteration (\a trh_update), so memory allocated
+ * by an event or timer handler is valid until the handler returns to the loop. Allocations made outside
+ * of the loop iteration are kept; threads without a loop call \a trh_arena_reset themselves.
+ * Arena is released when the thread exits (main thread in trh_release()).
+ */
+struct TTrhArena *trh_arena_current();
+
+/**
+ * @brief Return arena of the calling thread; create it only if iCreate is true. Used by the library.
+ */
+struct TTrhArena *trh_arena_thread( bool iCreate );
+
+/**
+ * @brief Release arena of the calling thread. Called from trh_release().
+ */
+void trh_arena_thread_release();
+
+/**
+ * @brief Allocate iSize bytes (aligned for any type). Return null if out of memory.
+ * @param iArena Arena; null for \a trh_arena_current.
+ *
+ * Memory is not released individually - use \a trh_arena_rewind or \a trh_arena_reset.
+ */
+void *trh_arena_alloc( struct TTrhArena *iArena, size_t iSize );
+
+/**
+ * @brief Copy string to the arena. Return null if out of memory or iText is null.
+ */
+char *trh_arena_strdup( struct TTrhArena *iArena, chars iText );
+
+/**
+ * @brief Copy max iLength characters of string to the arena (always terminated).
+ */
+char *trh_arena_strndup( struct TTrhArena *iArena, chars iText, size_t iLength );
+
+/**
+ * @brief Format string into the arena (printf). Return null if out of memory or the format is invalid.
+ */
+char *trh_arena_printf( struct TTrhArena *iArena, chars iFormat, ... );
+
+/**
+ * @brief Format string into the arena (vprintf). See \a trh_arena_printf.
+ */
+char *trh_arena_vprintf( struct TTrhArena *iArena, chars iFormat, va_list iArgs );
+
+/**
+ * @brief Return current position of the arena (null arena gives an empty mark).
+ */
+TTrhArenaMark trh_arena_mark( struct TTrhArena *iArena );
+
+/**
+ * @brief Release memory allocated after iMark was taken. Nested marks must be rewound in reverse order.
+ */
+void trh_arena_rewind( struct TTrhArena *iArena, TTrhArenaMark iMark );
+
+/**
+ * @brief Release all allocations of the arena.
+ *
+ * Memory is kept for the next use. If the arena has grown over several chunks, they are merged into one,
+ * so a steady workload does not allocate.
+ */
+void trh_arena_reset( struct TTrhArena *iArena );
+
+// c++ compatibility
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRH_ARENA_H
@@ -0,0 +1,112 @@
+/*
+ * @brief Application config (json-c) with hot reload
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+#ifndef TRH_CONFIG_H
+#define TRH_CONFIG_H
+
+// c++ compatibility
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct json_object;
+struct TTrhConfig;
+
+/**
+ * @brief Load config file.
+ * @param iProjectName Project name used to resolve the TRH_CONFIG path (see trh_get_path()).
+ * @param iFileName File name relative to the TRH_CONFIG path, or absolute path (iProjectName is ignored).
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID iFileName is invalid.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_JSON_LOAD_FAILED File can't be read.
+ * @retval TRH_JSON_INVALID File is not a valid JSON object.
+ *
+ * File is memory-mapped and parsed once. Every member of nested objects is indexed by its dotted key,
+ * e.g. "server.port" for { "server": { "port": 80 } }. Loaded config replaces the current one.
+ */
+int trh_config_load( chars iProjectName, chars iFileName );
+
+/**
+ * @brief Load config file again if it has been changed (inode, size or mtime).
+ * @retval TRH_OK Config has been reloaded.
+ * @retval TRH_SKIP File has not been changed.
+ * @retval TRH_UNINITIALIZED No config has been loaded.
+ * @retval TRH_JSON_LOAD_FAILED, TRH_JSON_INVALID New file is invalid; current config is kept.
+ *
+ * Called from trh_run() when TRH_RELOAD is returned (SIGHUP). New config is swapped atomically;
+ * the old one is released once no reader uses it.
+ */
+int trh_config_reload();
+
+/**
+ * @brief Reload config automatically when the file is written or replaced (see trh_watch.h).
+ * @param iWindow Coalescing window (milliseconds); a burst of writes causes one reload.
+ * @retval TRH_OK
+ * @retval TRH_UNINITIALIZED No config has been loaded.
+ * @retval TRH_OUT_OF_MEM, TRH_FILE_ERROR Failed to watch the config directory.
+ *
+ * Directory of the config is watched, so the file can be replaced by rename. Reload runs on the loop
+ * of the calling thread; SIGHUP is not needed. Call it again after a config from another directory is loaded.
+ */
+int trh_config_watch( uint32_t iWindow );
+
+/**
+ * @brief Release config. Called from trh_release().
+ */
+void trh_config_release();
+
+/**
+ * @brief Enter read section and return the current config (null if no config is loaded). Thread-safe, lock-free.
+ *
+ * Config and values returned by trh_config_get_*() stay valid until trh_config_unlock().
+ * Sections can be nested. Do not call trh_config_load() / trh_config_reload() inside the section.
+ */
+const struct TTrhConfig *trh_config_lock();
+
+/**
+ * @brief Leave read section.
+ */
+void trh_config_unlock();
+
+/**
+ * @brief Find value by its dotted key. Return null if the key does not exist or iConfig is null.
+ */
+struct json_object *trh_config_get( const struct TTrhConfig *iConfig, chars iKey );
+
+/**
+ * @brief Return integer value of the key, or iDefault if the key does not exist or is not a number.
+ */
+int64_t trh_config_get_int( const struct TTrhConfig *iConfig, chars iKey, int64_t iDefault );
+
+/**
+ * @brief Return real value of the key, or iDefault if the key does not exist or is not a number.
+ */
+double trh_config_get_double( const struct TTrhConfig *iConfig, chars iKey, double iDefault );
+
+/**
+ * @brief Return boolean value of the key, or iDefault if the key does not exist or is not a boolean.
+ */
+bool trh_config_get_bool( const struct TTrhConfig *iConfig, chars iKey, bool iDefault );
+
+/**
+ * @brief Return string value of the key, or iDefault if the key does not exist or is not a string.
+ */
+chars trh_config_get_string( const struct TTrhConfig *iConfig, chars iKey, chars iDefault );
+
+/**
+ * @brief Return generation of the config; incremented by every successful load.
+ *
+ * Values derived from the config can be cached and recomputed when the generation changes.
+ */
+uint64_t trh_config_generation( const struct TTrhConfig *iConfig );
+
+// c++ compatibility
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRH_CONFIG_H
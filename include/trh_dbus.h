@@ -7,6 +7,7 @@
 #ifndef TRH_DBUS_H
 #define TRH_DBUS_H
 
+#include <sys/uio.h>
 #include <systemd/sd-bus.h>
 
 // c++ compatibility
@@ -32,6 +33,33 @@ typedef struct TTrhDbusMessage {
 	sd_bus_message *response;
 } TTrhDbusMessage;
 
+/// Error passed to \a handle_dbus_reply when the call is cancelled by trh_dbus_release().
+#define TRH_DBUS_ERROR_CANCELLED	"org.trihlav.Error.Cancelled"
+
+/**
+ * @brief Batch of asynchronous method calls. Definition in trh_dbus.c.
+ */
+struct TTrhDbusBatch;
+
+/**
+ * @brief Callback receiving reply to asynchronous method call. Executed on the main loop.
+ * @param iReply Reply message. Owned by sd-bus; call sd_bus_message_ref() to keep it. Null if the call is cancelled.
+ * @param iError Error returned by the method or by the bus (timeout, no such service), or TRH_DBUS_ERROR_CANCELLED
+ * if the bus is released before the reply; null on success.
+ * @param iUserData User data passed to \a trh_dbus_method_async.
+ */
+typedef void (*handle_dbus_reply)( sd_bus_message *iReply, const sd_bus_error *iError, void *iUserData );
+
+/**
+ * @brief Callback executed when all replies in a batch have been received.
+ * @param iFailed Number of calls that failed or have been cancelled.
+ * @param iUserData User data passed to \a trh_dbus_batch_new.
+ */
+typedef void (*handle_dbus_batch)( int iFailed, void *iUserData );
+
+/// Default coalescing window of PropertiesChanged signals (milliseconds), see \a trh_dbus_property_changed.
+#define TRH_DBUS_SIGNAL_WINDOW_DEFAULT	50
+
 /**
  * @brief Initialize dbus interface.
  * @param iDestination Destination of the dbus.
@@ -56,6 +84,10 @@ void trh_dbus_subscribe_signal( chars iMatch, sd_bus_message_handler_t iCallback
  * @brief Process all incoming messages; send penging calls and signals.
  * @retval TRH_OK
  * @retval TRH_DBUS_PROCESS_FAILED
+ *
+ * Bus fd and bus timeout are registered with the main loop in \a trh_dbus_init, so messages are
+ * processed by \a trh_update when they arrive. Calling this function from the main loop is not required;
+ * it can be used to process the bus immediately, e.g. after messages were sent using \a trh_dbus_ptr.
  */
 int trh_dbus_process();
 
@@ -73,6 +105,50 @@ void* trh_dbus_ptr();
 //  */
 // int trh_dbus_method( TTrhDbusMessage *iMsg, ... );
 
+/**
+ * @brief Call dbus method in a different service without waiting for the reply.
+ * @param iMsg Data identifying the target process, executed method, types of arguments. Member \a response is not used.
+ * @param iCallback Callback receiving the reply. Can be null, if reply is not needed.
+ * @param iUserData User data passed to \a iCallback.
+ * @param ... Arguments, see \a iMsg->types.
+ * @retval TRH_OK Call has been queued.
+ * @retval TRH_ARG_INVALID \a iMsg is invalid.
+ * @retval TRH_UNINITIALIZED dbus is not initialized.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_DBUS_ARG_FAILED Failed to append arguments.
+ * @retval TRH_DBUS_SEND_FAILED Failed to send the call.
+ *
+ * Reply is dispatched from the main loop, see \a trh_update.
+ */
+int trh_dbus_method_async( TTrhDbusMessage *iMsg, handle_dbus_reply iCallback, void *iUserData, ... );
+
+/**
+ * @brief Create a batch of asynchronous method calls.
+ * @param iDone Callback executed once, when replies to all calls in the batch have been received.
+ * @param iUserData User data passed to \a iDone.
+ * @return Batch object or null (out of memory).
+ *
+ * Add calls with \a trh_dbus_batch_method, then call \a trh_dbus_batch_commit. Batch is released after \a iDone.
+ * trh_dbus_release() cancels calls waiting for reply and completes all batches, also those not committed.
+ * All calls are sent at once, so the batch completes after ~one round trip instead of the sum of them.
+ */
+struct TTrhDbusBatch *trh_dbus_batch_new( handle_dbus_batch iDone, void *iUserData );
+
+/**
+ * @brief Add asynchronous method call to a batch. See \a trh_dbus_method_async.
+ * @retval TRH_ARG_INVALID \a iBatch is null or already committed.
+ */
+int trh_dbus_batch_method( struct TTrhDbusBatch *iBatch, TTrhDbusMessage *iMsg, handle_dbus_reply iCallback, void *iUserData, ... );
+
+/**
+ * @brief Close the batch; no more calls can be added.
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID \a iBatch is null or already committed.
+ *
+ * If all replies have been already received (or the batch is empty), \a iDone is executed immediately.
+ */
+int trh_dbus_batch_commit( struct TTrhDbusBatch *iBatch );
+
 /**
  * @brief Send response to received dbus message.
  * @param iMsg Response must be created using function sd_bus_message_new_method_return.
@@ -88,6 +164,115 @@ int trh_dbus_reply( sd_bus_message *iMsg );
  */
 int trh_dbus_reply_error( sd_bus_error *iError, chars iText, int iErrno );
 
+/**
+ * @brief Reply to method call with an array payload, created, appended and sent in one call.
+ * @param iCall Method call being answered.
+ * @param iTypes Types of leading arguments passed in ...; null or empty if the reply holds only the array.
+ * @param iType Element type of the array (trivial type: 'y', 'i', 't', 'd', ...).
+ * @param iData Array data; iSize bytes, copied into the message once.
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID
+ * @retval TRH_DBUS_REPLY_FAILED Failed to create the reply.
+ * @retval TRH_DBUS_ARG_FAILED Failed to append arguments.
+ * @retval TRH_DBUS_SEND_FAILED
+ *
+ * E.g. trh_dbus_reply_array( call, "s", 'd', samples, count * sizeof( double ), "cpu" ) replies "sad".
+ */
+int trh_dbus_reply_array( sd_bus_message *iCall, chars iTypes, char iType, const void *iData, size_t iSize, ... );
+
+/**
+ * @brief Reply to method call with an array gathered from iCount buffers. See \a trh_dbus_reply_array.
+ */
+int trh_dbus_reply_iovec( sd_bus_message *iCall, chars iTypes, char iType, const struct iovec *iVector, unsigned iCount, ... );
+
+/**
+ * @brief Reply to method call with an array stored in memfd. See \a trh_dbus_reply_array.
+ * @param iMemfd Memfd (memfd_create) holding the data; sd-bus seals it, so it can't be written afterwards.
+ * @param iOffset, iSize Part of the memfd sent.
+ *
+ * Large payloads are not copied through the application; keep one sealed memfd per blob and reply from it.
+ */
+int trh_dbus_reply_memfd( sd_bus_message *iCall, chars iTypes, char iType, int iMemfd, uint64_t iOffset, uint64_t iSize, ... );
+
+/**
+ * @brief Serve property from the cache of the connection; build it with iGetter on a miss.
+ * @return >= 0 on success, negative errno on failure (sd-bus convention).
+ *
+ * Call it from a property getter (SD_BUS_PROPERTY) with the getter arguments and the function that appends the value:
+ * @code
+ * static int local_get_stats( sd_bus *b, chars p, chars i, chars n, sd_bus_message *r, void *u, sd_bus_error *e )
+ * {
+ *     return trh_dbus_property_cached( r, p, i, n, local_build_stats, u, e );
+ * }
+ * @endcode
+ * Value is built once and copied to every reply until it is invalidated with \a trh_dbus_property_invalidate
+ * or \a trh_dbus_emit_properties_changed. Call from the dbus loop.
+ */
+int trh_dbus_property_cached( sd_bus_message *oReply, chars iPath, chars iInterface, chars iProperty,
+	sd_bus_property_get_t iGetter, void *iUserData, sd_bus_error *oError );
+
+/**
+ * @brief Drop cached property values. Null iProperty matches all properties, null iInterface all interfaces
+ * and null iPath all objects.
+ */
+void trh_dbus_property_invalidate( chars iPath, chars iInterface, chars iProperty );
+
+/**
+ * @brief Emit PropertiesChanged signal now; cached values of the properties are invalidated first.
+ * @param iNames Null-terminated list of changed properties; null for all properties of the interface.
+ * Nothing is emitted for an empty list.
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID
+ * @retval TRH_UNINITIALIZED dbus is not initialized.
+ * @retval TRH_DBUS_SEND_FAILED
+ */
+int trh_dbus_emit_properties_changed( chars iPath, chars iInterface, char **iNames );
+
+/**
+ * @brief Set coalescing window of \a trh_dbus_property_changed (milliseconds).
+ *
+ * Window 0 merges only changes made in the same loop iteration.
+ */
+void trh_dbus_set_signal_window( uint32_t iMilliseconds );
+
+/**
+ * @brief Report changed property; PropertiesChanged signal is emitted once per coalescing window.
+ * @param iProperty Changed property; null if all properties of the interface have been changed.
+ * @retval TRH_OK Change has been queued.
+ * @retval TRH_ARG_INVALID
+ * @retval TRH_UNINITIALIZED dbus is not initialized.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_TIMER_FAILED Failed to create flush timer.
+ *
+ * Changes of one object interface are merged into one signal. The signal is emitted when the window
+ * started by the first change expires, so each object sends at most one signal per window. Values
+ * are read from the property getters at that time. Cached value of the property
+ * (\a trh_dbus_property_cached) is invalidated immediately. Call from the dbus loop.
+ */
+int trh_dbus_property_changed( chars iPath, chars iInterface, chars iProperty );
+
+/**
+ * @brief Emit all queued PropertiesChanged signals now, e.g. before a method reply that depends on them.
+ * @retval TRH_OK
+ * @retval TRH_DBUS_SEND_FAILED Some signal has not been emitted; queued changes are dropped anyway.
+ */
+int trh_dbus_flush_signals();
+
+/**
+ * @brief Return number of operations in progress - method calls waiting for reply, scheduled signals and
+ * messages waiting to be sent (counted as one). Used by trh_shutdown().
+ */
+size_t trh_dbus_pending();
+
+/**
+ * @brief Method handler publishing loop metrics (trh_stats.h) of the dbus loop.
+ *
+ * Add it to the vtable, e.g. SD_BUS_METHOD( "Stats", "", "a(sttttt)", trh_dbus_stats_method, 0 ).
+ * Reply contains entries (name, count, p50, p90, p99, max); values are nanoseconds except "loop.events".
+ * Fails with org.freedesktop.DBus.Error.NotSupported if the library is built without TRH_LOOP_STATS.
+ */
+int trh_dbus_stats_method( sd_bus_message *iMsg, void *iUserData, sd_bus_error *oError );
+
 /**
  * @brief Close dbus link.
  */
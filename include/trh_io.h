@@ -0,0 +1,90 @@
+/*
+ * @brief Asynchronous file operations (io_uring)
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+#ifndef TRH_IO_H
+#define TRH_IO_H
+
+#include <sys/types.h>
+
+// c++ compatibility
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct TTrhIo;
+struct TTrhLoop;
+
+/// Completion of asynchronous file operation. iResult is >= 0 on success (bytes copied for trh_io_copy_file)
+/// or negative errno value on failure.
+typedef void (*handle_io)( int64_t iResult, void *iArg );
+
+
+/**
+ * @brief Create io context of the loop. Called on the first use from trh_loop_io().
+ * @retval TRH_OK
+ * @retval TRH_OUT_OF_MEM
+ *
+ * With io_uring backend (built with TRH_IO_URING and supported by the kernel) operations are queued as SQEs
+ * and submitted once per loop iteration. Operations the kernel ring does not support (probed at init) and all
+ * operations without io_uring are executed synchronously. Completions are always posted to the loop.
+ */
+int trh_io_init( struct TTrhLoop *iLoop, struct TTrhIo **oIo );
+
+/**
+ * @brief Submit queued operations. Called by the loop before it waits for events.
+ */
+void trh_io_submit( struct TTrhIo *iIo );
+
+/**
+ * @brief Release io context. Called from trh_loop_release(); operations in progress are cancelled without completion.
+ */
+void trh_io_release( struct TTrhIo *iIo );
+
+/**
+ * @brief Return number of operations in progress (0 for null context). Used by trh_loop_drain().
+ */
+size_t trh_io_pending( struct TTrhIo *iIo );
+
+/**
+ * @brief Return true if the io context of the calling thread's loop uses io_uring.
+ */
+bool trh_io_uring_enabled();
+
+
+/**
+ * @brief Delete file (or empty directory with AT_REMOVEDIR in iFlags) asynchronously.
+ * @retval TRH_OK Operation has been queued; iDone is called from the loop of the calling thread.
+ * @retval TRH_ARG_INVALID iPath is null.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_UNINITIALIZED No loop.
+ *
+ * Paths are copied. Operations of one loop must be requested from its thread.
+ */
+int trh_io_unlink( chars iPath, int iFlags, handle_io iDone, void *iArg );
+
+/**
+ * @brief Create directory asynchronously. See \a trh_io_unlink.
+ */
+int trh_io_mkdir( chars iPath, mode_t iMode, handle_io iDone, void *iArg );
+
+/**
+ * @brief Rename file asynchronously. See \a trh_io_unlink.
+ */
+int trh_io_rename( chars iOldPath, chars iNewPath, handle_io iDone, void *iArg );
+
+/**
+ * @brief Copy file asynchronously (splice through a pipe). See \a trh_io_unlink.
+ *
+ * Destination is created (or truncated) with the mode of the source. Result is number of copied bytes.
+ */
+int trh_io_copy_file( chars iSrcPath, chars iDstPath, handle_io iDone, void *iArg );
+
+// c++ compatibility
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRH_IO_H
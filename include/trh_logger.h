@@ -7,6 +7,9 @@
 #ifndef TRH_LOGGER_H
 #define TRH_LOGGER_H
 
+#include <limits.h>
+#include <sys/uio.h>
+
 // c++ compatibility
 #ifdef __cplusplus
 extern "C" {
@@ -26,6 +29,22 @@ extern "C" {
 		return ret; \
 	}
 
+/**
+ * @brief True if message with severity \a sev would be logged (see trh_log_set_min_severity).
+ *
+ * Use to skip preparation of arguments for disabled messages.
+ */
+#define TRH_LOG_ENABLED( sev ) trh_log_enabled( sev )
+
+/**
+ * @brief Log message only if its severity is enabled; arguments are not evaluated otherwise.
+ */
+#define TRH_LOG( sev, ... ) \
+	do { \
+		if( TRH_LOG_ENABLED( sev ) ) \
+			trh_log( sev, __VA_ARGS__ ); \
+	} while( 0 )
+
 typedef enum LogSeverity
 {
 	LOG_DEBUG,
@@ -34,6 +53,17 @@ typedef enum LogSeverity
 	LOG_ERROR
 } LogSeverity;
 
+/**
+ * @brief Policy applied by asynchronous logger when its buffer is full.
+ */
+typedef enum LogOverflow
+{
+	/// Drop the message and increase counter of dropped messages (see trh_log_async_dropped).
+	LOG_OVERFLOW_DROP,
+	/// Wait until the writer thread releases space in the buffer.
+	LOG_OVERFLOW_BLOCK
+} LogOverflow;
+
 /**
  * @brief Initialize logging.
  * @param iFileName Name of the log file.
@@ -45,6 +75,243 @@ typedef enum LogSeverity
  */
 int trh_log_init( chars iFileName );
 
+/**
+ * @brief Switch to asynchronous logging. Call after trh_log_init().
+ * @param iCapacity Number of messages buffered in memory. Rounded up to power of two.
+ * @param iOverflow Policy applied when the buffer is full.
+ * @param iFlushInterval Max time (in milliseconds) a message waits in the buffer.
+ * @retval TRH_OK on success.
+ * @retval TRH_SKIP Asynchronous logging is already enabled.
+ * @retval TRH_ARG_INVALID iCapacity or iFlushInterval is zero.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_FAILED Failed to start the writer thread.
+ *
+ * Messages are formatted once by the caller into a lock-free ring buffer. Writer thread adds
+ * date and severity, and writes batches of messages to stdout and log file with writev().
+ * Writer is woken up before the flush interval expires when a batch is full or a warning (or error) is logged.
+ * Messages longer than 479 characters are truncated. trh_log_release() writes all buffered messages.
+ */
+int trh_log_async_init( size_t iCapacity, LogOverflow iOverflow, int iFlushInterval );
+
+/**
+ * @brief Return number of messages dropped by asynchronous logger (LOG_OVERFLOW_DROP).
+ */
+uint64_t trh_log_async_dropped();
+
+// #region Rotation
+
+/**
+ * @brief Rotation of the log file (see trh_log_rotation_init).
+ */
+typedef struct TTrhLogRotation {
+	/// Rotate when the file reaches this size (bytes); 0 - no size limit.
+	/// File overshoots it by the last line, and by up to 5 seconds of logging when the previous
+	/// rotated file is still being compressed or the rotation failed.
+	uint64_t max_size;
+	/// Rotate when the file is older than this (seconds); 0 - no time limit.
+	uint32_t max_age;
+	/// Number of rotated files kept; name.1 is the newest. If 0, rotated file is deleted.
+	uint32_t keep;
+	/// Compress rotated files (name.N.gz) on the rotation thread. Requires build option TRIHLAV_LOG_COMPRESS.
+	bool compress;
+	/// Reserve max_size bytes for every log file (fallocate), so a full partition does not stop logging.
+	bool preallocate;
+} TTrhLogRotation;
+
+/**
+ * @brief Rotate log file by size and/or age. Call after trh_log_init().
+ * @retval TRH_OK on success.
+ * @retval TRH_SKIP Rotation is already enabled.
+ * @retval TRH_UNINITIALIZED Logging to file is disabled.
+ * @retval TRH_ARG_INVALID iRotation is null or it has neither max_size nor max_age.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_FAILED Failed to start the rotation thread.
+ *
+ * Rotation renames the log file (no copy) and switches the log descriptor to the next file with dup2();
+ * concurrent writers continue to the old or to the new file, no message is lost. The next file is opened
+ * (O_APPEND) and preallocated in advance by the rotation thread, which also shifts and compresses rotated files.
+ * Lines are not split; rotation is checked after messages ending with end-line.
+ */
+int trh_log_rotation_init( const TTrhLogRotation *iRotation );
+
+/**
+ * @brief Rotate log file now.
+ * @retval TRH_OK on success.
+ * @retval TRH_UNINITIALIZED Rotation is not enabled.
+ * @retval TRH_SKIP Previous rotated file is still being processed, or rotation is in progress.
+ * @retval TRH_FILE_ERROR
+ */
+int trh_log_rotate();
+
+/**
+ * @brief Reopen log file (after external rotation, e.g. logrotate without copytruncate).
+ * @retval TRH_OK on success.
+ * @retval TRH_UNINITIALIZED Logging to file is disabled.
+ * @retval TRH_FILE_ERROR
+ *
+ * Called by trh_reload() on reload (SIGHUP).
+ */
+int trh_log_reopen();
+
+// #endregion // Rotation
+
+// #region Binary log
+
+/// Magic at the beginning of binary log file.
+#define TRH_LOG_BIN_MAGIC		"TRHBLOG1"
+/// Max number of registered formats.
+#define TRH_LOG_BIN_FORMATS		4096
+/// Max number of arguments of one format.
+#define TRH_LOG_BIN_ARGS		32
+/// Max size of arguments of one message (strings are truncated).
+#define TRH_LOG_BIN_PAYLOAD		1024
+
+/**
+ * @brief Log message using binary format. Format is registered once per call site.
+ *
+ * Concurrent first calls from several threads can register the format more than once; this is harmless.
+ * Failed registration (unsupported or too long format, full format table) is not retried - the call site
+ * logs one error and its messages are dropped.
+ */
+#define TRH_LOG_BIN( sev, fmt, ... ) \
+	do { \
+		static int lsTrhFormatId = INT_MIN; \
+		if( lsTrhFormatId == INT_MIN ) lsTrhFormatId = trh_log_format_register( fmt ); \
+		trh_log_binary( sev, lsTrhFormatId, ##__VA_ARGS__ ); \
+	} while( 0 )
+
+/**
+ * @brief Type of binary log record.
+ */
+typedef enum LogBinType
+{
+	/// Start of logging session. Payload: CLOCK_REALTIME and CLOCK_MONOTONIC (uint64_t, ns) at the same instant.
+	/// Format ids are valid until the next session.
+	LOG_BIN_SESSION = 1,
+	/// Format registration. Payload: format string (not terminated).
+	LOG_BIN_FORMAT = 2,
+	/// Message. Payload: arguments encoded as described by \a trh_log_format_types.
+	LOG_BIN_MESSAGE = 3
+} LogBinType;
+
+/**
+ * @brief Header of binary log record; followed by \a length bytes of payload. Native byte order.
+ */
+typedef struct __attribute__((packed)) TTrhLogBinRecord {
+	/// LogBinType.
+	uint8_t type;
+	/// LogSeverity (LOG_BIN_MESSAGE).
+	uint8_t severity;
+	/// Format id (LOG_BIN_FORMAT, LOG_BIN_MESSAGE).
+	uint16_t format;
+	/// Size of payload.
+	uint16_t length;
+	/// CLOCK_MONOTONIC time in nanoseconds.
+	uint64_t time;
+} TTrhLogBinRecord;
+
+/**
+ * @brief Open binary log file. Binary messages are not printed to stdout.
+ * @param iFileName Name of the binary log file. Data are appended.
+ * @retval TRH_OK on success.
+ * @retval TRH_ARG_INVALID iFileName is empty.
+ * @retval TRH_FAILED failed to open log file.
+ *
+ * Formats registered so far are written to the file. Use tool trihlav_logdecode to render the file as text.
+ */
+int trh_log_binary_init( chars iFileName );
+
+/**
+ * @brief Register printf-like format for binary logging.
+ * @param iFormat Format string; must stay valid until trh_log_release(). Supports conversions
+ * d i u x X o c s p f F e E g G a A, flags, width, precision, '*' and length modifiers hh h l ll z j t L.
+ * @return Format id (>= 0), TRH_ARG_INVALID (unsupported conversion, or format longer than TRH_LOG_BIN_PAYLOAD)
+ * or TRH_OUT_OF_MEM (too many formats).
+ */
+int trh_log_format_register( chars iFormat );
+
+/**
+ * @brief Write message to binary log file.
+ * @param iSeverity Severity of the message. Filtered by trh_log_set_severity_level and trh_log_set_min_severity.
+ * @param iFormatId Format returned by \a trh_log_format_register.
+ * @param ... Arguments of the format.
+ *
+ * Message is stored as a timestamp, severity, format id and raw argument bytes; no text is formatted.
+ * Message whose arguments do not fit TRH_LOG_BIN_PAYLOAD is dropped. Thread-safe; messages logged
+ * concurrently with trh_log_release() are dropped.
+ */
+void trh_log_binary( LogSeverity iSeverity, int iFormatId, ... );
+
+/**
+ * @brief Describe arguments of printf-like format.
+ * @param iFormat Format string.
+ * @param oTypes Receives one code per argument (TRH_LOG_BIN_ARGS + 1 bytes).
+ * @retval Number of arguments, or TRH_ARG_INVALID if format is not supported.
+ *
+ * Argument codes and their encoding in LOG_BIN_MESSAGE payload:
+ * - i, I - int, unsigned int: 4 bytes
+ * - l, L - long, unsigned long; q, Q - long long; z, Z - size_t, ptrdiff_t; j, J - intmax_t: 8 bytes (sign or zero extended)
+ * - d - double; D - long double (stored as double): 8 bytes
+ * - p - pointer: 8 bytes
+ * - s - string: uint16_t length followed by characters (not terminated)
+ */
+int trh_log_format_types( chars iFormat, char *oTypes );
+
+// #endregion // Binary log
+
+// #region Journal
+
+/// Max number of custom fields of one journal record; extra fields are ignored.
+#define TRH_LOG_JOURNAL_FIELDS	32
+
+#define TRH_LOG_STRINGIFY_( x )	#x
+#define TRH_LOG_STRINGIFY( x )	TRH_LOG_STRINGIFY_( x )
+
+/**
+ * @brief Journal field from a string literal "KEY=value" (struct iovec initializer).
+ */
+#define TRH_LOG_FIELD( text )	{ (void*)( text ), sizeof( text ) - 1 }
+
+/**
+ * @brief Log message with code location and custom journal fields. Fields are not evaluated if the severity is disabled.
+ *
+ * CODE_FILE and CODE_LINE are string literals built by the compiler.
+ */
+#define TRH_LOG_FIELDS( sev, fields, count, ... ) \
+	do { \
+		if( TRH_LOG_ENABLED( sev ) ) \
+			trh_log_record( sev, "CODE_FILE=" __FILE__, "CODE_LINE=" TRH_LOG_STRINGIFY( __LINE__ ), fields, count, __VA_ARGS__ ); \
+	} while( 0 )
+
+/**
+ * @brief Send messages to systemd journal (sd_journal_sendv) instead of stdout.
+ * @param iEnable If false, messages are printed to stdout again.
+ * @param iIdentifier SYSLOG_IDENTIFIER of the records; null - journald uses the process name.
+ * @retval TRH_OK on success.
+ * @retval TRH_OUT_OF_MEM
+ *
+ * Records carry MESSAGE (without the trailing end-line) and PRIORITY mapped from the severity
+ * (DEBUG 7, NOTE 6, WARNING 4, ERROR 3). Log file is written as before. Message split by trh_log_more
+ * is collected per thread and sent at end-line; continuations longer than 1023 characters are sent
+ * in several records. Records are sent by the calling thread, also in asynchronous mode.
+ * Enable it before other threads log. Identifier can be changed later; the previous one is freed by trh_log_release().
+ */
+int trh_log_set_journal( bool iEnable, chars iIdentifier );
+
+/**
+ * @brief Log message with structured fields. See \a TRH_LOG_FIELDS.
+ * @param iCodeFile "CODE_FILE=..." field or null.
+ * @param iCodeLine "CODE_LINE=..." field or null.
+ * @param iFields Custom fields "KEY=value" (KEY in upper case); sent as they are. May be null.
+ * @param iCount Number of custom fields.
+ *
+ * Message is a complete record (not continued by trh_log_more). Fields are used only by the journal;
+ * stdout and log file get the text of the message.
+ */
+void trh_log_record( LogSeverity iSeverity, chars iCodeFile, chars iCodeLine, const struct iovec *iFields, size_t iCount, chars iMessage, ... );
+
+// #endregion // Journal
+
 /**
  * @brief Log library version.
  */
@@ -83,12 +350,35 @@ void trh_log_end();
  * @param iSeverity New severity level.
  *
  * Messages with lower severity level then \a iSeverity won't be written to log file.
- * Severity has no effect on stdout output.
+ * Severity has no effect on stdout output; see \a trh_log_set_min_severity.
  */
 void trh_log_set_severity_level( LogSeverity iSeverity );
 
+/**
+ * @brief Set minimal severity of messages written to any output (stdout and log file).
+ * @param iSeverity Messages with lower severity are discarded before formatting. Default is LOG_DEBUG.
+ */
+void trh_log_set_min_severity( LogSeverity iSeverity );
+
+/**
+ * @brief Return true if message with severity \a iSeverity would be written to any output.
+ */
+bool trh_log_enabled( LogSeverity iSeverity );
+
+/**
+ * @brief Write buffered messages; wait max \a iTimeout milliseconds for the async writer.
+ * @retval TRH_OK Messages logged before the call have been written.
+ * @retval TRH_WAITING Timeout expired before the writer has written them.
+ *
+ * Stdio buffers of stdout, log file and binary log file are flushed too. Called from trh_shutdown().
+ */
+int trh_log_flush( int iTimeout );
+
 /**
  * @brief Close the log file.
+ *
+ * In asynchronous mode, the writer thread is stopped after all buffered messages are written.
+ * Rotation thread is stopped after the rotated file is processed. Binary log file is closed too.
  */
 void trh_log_release();
 
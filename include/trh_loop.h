@@ -0,0 +1,303 @@
+/*
+ * @brief Event loops (reactors) - one epoll instance per thread
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+#ifndef TRH_LOOP_H
+#define TRH_LOOP_H
+
+// c++ compatibility
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct TTrhEvent;
+struct TTrhIo;
+struct TTrhLoop;
+struct TTrhLoopPool;
+struct TTrhLoopStats;
+struct TTrhTimerQueue;
+struct TTrhWatcher;
+
+/// Callback executed on the worker thread before its loop starts; it can register events and create timers.
+/// Return value other than TRH_OK stops the loop.
+typedef int (*handle_loop_start)( struct TTrhLoop *iLoop, size_t iIndex, void *iData );
+
+/// Callback returning number of operations in progress outside of the loop (e.g. dbus calls), see \a trh_loop_drain.
+typedef size_t (*handle_loop_pending)();
+
+/// Callback updating application clock, see \a trh_loop_set_clock_handler.
+typedef void (*handle_loop_clock)();
+
+
+// #region Loop
+
+/**
+ * @brief Create a new event loop.
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID oLoop is null.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_EPOLL_FAILED Failed to create epoll or wake-up event.
+ * @retval TRH_TIMER_FAILED Failed to create timer queue.
+ *
+ * Every loop has its own epoll instance, wake-up event and timer queue.
+ * Default loop is created in trh_init(); global API (trh_update_wait, trh_event_register, ...) works with it.
+ * oLoop must be released with trh_loop_release().
+ */
+int trh_loop_init( struct TTrhLoop **oLoop );
+
+/**
+ * @brief Release loop resources. Events registered with the loop are not released (see \a trh_loop_close).
+ */
+void trh_loop_release( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Return default loop created in trh_init().
+ */
+struct TTrhLoop *trh_loop_default();
+
+/**
+ * @brief Return loop running on the calling thread, or the default loop.
+ *
+ * Used by trh_event_register() and trh_timer_init().
+ */
+struct TTrhLoop *trh_loop_current();
+
+/**
+ * @brief Return true if the calling thread owns the loop - it has created the loop and no other thread
+ * has run it yet, or it runs the loop (trh_loop_wait, loop pool worker).
+ *
+ * Loop internals (timers) are not thread-safe; other threads use trh_post_on().
+ */
+bool trh_loop_owned( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Wait for events up to \a iTimeout milliseconds; events are not dispatched.
+ * @retval TRH_OK Events are ready - see \a trh_loop_pending and \a trh_loop_dispatch.
+ * @retval TRH_WAITING No events - timeout expired, or wait was interrupted by a signal.
+ * @retval TRH_END Loop is stopped (or application is terminating), wait has been skipped.
+ * @retval TRH_OUT_OF_MEM Failed to resize event buffer.
+ * @retval TRH_EPOLL_FAILED Failed to wait for events.
+ */
+int trh_loop_wait( struct TTrhLoop *iLoop, int iTimeout );
+
+/**
+ * @brief Return number of events returned by the last \a trh_loop_wait and not dispatched yet.
+ */
+size_t trh_loop_pending( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Dispatch events returned by the last \a trh_loop_wait.
+ */
+void trh_loop_dispatch( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Wait for events up to \a iTimeout milliseconds and dispatch them.
+ * @retval TRH_OK on success.
+ * @retval TRH_WAITING, TRH_END, TRH_OUT_OF_MEM, TRH_EPOLL_FAILED see \a trh_loop_wait.
+ */
+int trh_loop_update_wait( struct TTrhLoop *iLoop, int iTimeout );
+
+/**
+ * @brief Run the loop on the calling thread until \a trh_loop_stop or trh_terminate() is called.
+ * @retval TRH_OK Loop has been stopped.
+ * @retval TRH_EPOLL_FAILED Failed to wait for events.
+ */
+int trh_loop_run( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Request the loop to stop. Thread-safe.
+ */
+void trh_loop_stop( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Finish work of the loop before shutdown. Call it from the thread running the loop.
+ * @param iDeadline Absolute deadline (monotonic clock, nanoseconds - see trh_time_ns()).
+ * @param iPending Optional callback returning number of operations in progress outside of the loop.
+ * @retval TRH_OK No work is pending.
+ * @retval TRH_WAITING Deadline has expired and some work is still pending.
+ * @retval TRH_ARG_INVALID iLoop is null.
+ * @retval TRH_OUT_OF_MEM, TRH_EPOLL_FAILED see \a trh_loop_wait.
+ *
+ * Loop does not accept new events from now on (trh_event_register_on() returns TRH_END). Events of registered
+ * fds, timers, posted and deferred tasks are dispatched until the loop has no posted or deferred task, no file
+ * operation is in progress and iPending returns 0. Wait blocks although the application is terminating.
+ */
+int trh_loop_drain( struct TTrhLoop *iLoop, uint64_t iDeadline, handle_loop_pending iPending );
+
+/**
+ * @brief Release events and timers of the loop, typically after \a trh_loop_drain. Call it from the thread running the loop.
+ *
+ * File operations in progress are cancelled and file watches are released. Started timers are released
+ * (\a handle_timer_stopped is executed). Events still registered are unregistered and their \a handle_released
+ * is executed. Loop must be released with trh_loop_release() afterwards.
+ */
+void trh_loop_close( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Interrupt blocking wait of the loop. Thread-safe and async-signal-safe.
+ */
+void trh_loop_wakeup( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Set maximal number of epoll events dispatched in one iteration of the loop.
+ * @retval TRH_OK on success.
+ * @retval TRH_ARG_INVALID iLoop is null, iCount is 0 or too large.
+ */
+int trh_loop_set_event_batch( struct TTrhLoop *iLoop, size_t iCount );
+
+/**
+ * @brief Set callback that will be executed on loop (epoll) error.
+ */
+void trh_loop_set_error_handler( struct TTrhLoop *iLoop, handle_loop_error iHandler );
+
+/**
+ * @brief Set callback updating application clock during \a trh_loop_drain.
+ *
+ * It is executed before every wait of the drain and after the wait returns events, the same as
+ * trh_update_wait() updates the time. trh_init() sets it for the default loop.
+ */
+void trh_loop_set_clock_handler( struct TTrhLoop *iLoop, handle_loop_clock iHandler );
+
+/**
+ * @brief Return timer queue of the loop.
+ */
+struct TTrhTimerQueue *trh_loop_timers( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Return io context of the loop (trh_io.h). Context is created on the first use.
+ */
+struct TTrhIo *trh_loop_io( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Return file watcher of the loop (trh_watch.h). Watcher is created on the first use.
+ */
+struct TTrhWatcher *trh_loop_watcher( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Copy loop metrics (trh_stats.h) to oStats.
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID iLoop or oStats is null.
+ * @retval TRH_NOT_IMPLEMENTED Library is built without TRH_LOOP_STATS; oStats is cleared.
+ *
+ * Metrics are written by the loop without locking - call it from the thread running the loop
+ * (handler, timer, or task posted with trh_post_on()).
+ */
+int trh_loop_stats( struct TTrhLoop *iLoop, struct TTrhLoopStats *oStats );
+
+/**
+ * @brief Clear loop metrics. Call it from the thread running the loop.
+ */
+void trh_loop_stats_reset( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Return live metrics of the loop, null if the library is built without TRH_LOOP_STATS. Used by the library.
+ */
+struct TTrhLoopStats *trh_loop_stats_data( struct TTrhLoop *iLoop );
+
+/**
+ * @brief Post a task to be executed on the thread running \a iLoop. Thread-safe, lock-free.
+ * @retval TRH_OK on success.
+ * @retval TRH_ARG_INVALID iTask is null.
+ * @retval TRH_UNINITIALIZED iLoop is null.
+ * @retval TRH_OUT_OF_MEM
+ *
+ * Tasks are executed in the order they were posted by one thread. Only the first task posted since the
+ * loop has drained its queue signals the loop; a burst of posts costs one wake-up.
+ * Use it to create or control timers of a pool loop from another thread.
+ */
+int trh_post_on( struct TTrhLoop *iLoop, handle_task iTask, void *iArg );
+
+/**
+ * @brief Execute a task in the next iteration of \a iLoop. No system call is made.
+ * @retval TRH_OK on success.
+ * @retval TRH_ARG_INVALID iTask is null.
+ * @retval TRH_UNINITIALIZED iLoop is null.
+ * @retval TRH_OUT_OF_MEM
+ *
+ * Call it from the thread running the loop (use trh_post_on() from other threads). Deferred tasks are executed
+ * in order at the beginning of the next iteration, before prepare hooks; the loop does not block while tasks
+ * are deferred. Task deferred by a deferred task is executed in the following iteration.
+ */
+int trh_defer_on( struct TTrhLoop *iLoop, handle_task iTask, void *iArg );
+
+/**
+ * @brief Add hook executed in phase \a iPhase of every iteration of \a iLoop.
+ * @retval TRH_OK on success.
+ * @retval TRH_ARG_INVALID iHook is null or iPhase is invalid.
+ * @retval TRH_UNINITIALIZED iLoop is null.
+ * @retval TRH_OUT_OF_MEM
+ *
+ * Hooks are executed in the order they were added. Call it from the thread running the loop; hook added
+ * by a hook of the same phase is executed from the next iteration.
+ */
+int trh_hook_add_on( struct TTrhLoop *iLoop, LoopPhase iPhase, handle_task iHook, void *iArg );
+
+/**
+ * @brief Remove hook added by \a trh_hook_add_on (hook and argument must match). Hook can remove itself.
+ * @retval TRH_OK on success.
+ * @retval TRH_SKIP Hook is not registered.
+ * @retval TRH_ARG_INVALID iPhase is invalid.
+ * @retval TRH_UNINITIALIZED iLoop is null.
+ */
+int trh_hook_remove_on( struct TTrhLoop *iLoop, LoopPhase iPhase, handle_task iHook, void *iArg );
+
+/**
+ * @brief Register event with epoll of the loop.
+ * @retval TRH_OK on success.
+ * @retval TRH_ARG_INVALID iLoop or iEvent is null.
+ * @retval TRH_END Loop is shutting down (\a trh_loop_drain).
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_EPOLL_FAILED Failed to register the event.
+ *
+ * Events can be registered from any thread; handlers are executed on the thread running the loop.
+ * Loop keeps the list of registered events for \a trh_loop_close.
+ */
+int trh_event_register_on( struct TTrhLoop *iLoop, struct TTrhEvent *iEvent );
+
+// #endregion // Loop
+
+
+// #region Loop pool
+
+/**
+ * @brief Start \a iCount loops, each on its own thread.
+ * @param iCount Number of loops. If 0, one loop per online CPU is started.
+ * @param iPin If true, thread of loop N is pinned to CPU N (modulo number of CPUs).
+ * @param iStart Optional callback executed on every worker thread before its loop runs.
+ * @param iData User data passed to \a iStart.
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID oPool is null.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_FAILED Failed to start a thread.
+ *
+ * Fds can be distributed over the loops with \a trh_event_register_on (e.g. fd % count for affinity).
+ * Timers of a loop must be created and controlled from its thread (\a iStart, event handlers).
+ * oPool must be stopped with trh_loop_pool_stop().
+ */
+int trh_loop_pool_start( size_t iCount, bool iPin, handle_loop_start iStart, void *iData, struct TTrhLoopPool **oPool );
+
+/**
+ * @brief Return number of loops in the pool.
+ */
+size_t trh_loop_pool_size( struct TTrhLoopPool *iPool );
+
+/**
+ * @brief Return loop at \a iIndex, or null if index is out of range.
+ */
+struct TTrhLoop *trh_loop_pool_get( struct TTrhLoopPool *iPool, size_t iIndex );
+
+/**
+ * @brief Stop all loops of the pool, join their threads and release the pool.
+ */
+void trh_loop_pool_stop( struct TTrhLoopPool *iPool );
+
+// #endregion // Loop pool
+
+// c++ compatibility
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRH_LOOP_H
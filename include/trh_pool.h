@@ -0,0 +1,107 @@
+/*
+ * @brief Worker thread pool (work-stealing) for blocking jobs
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+#ifndef TRH_POOL_H
+#define TRH_POOL_H
+
+// c++ compatibility
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct TTrhPool;
+
+/// Job executed on a worker thread. Return value is passed to \a handle_job_done.
+typedef int (*handle_job)( void *iArg );
+
+/// Completion of the job, executed on the loop that submitted the job.
+typedef void (*handle_job_done)( int iResult, void *iArg );
+
+/**
+ * @brief Pool properties; passed to trh_pool_init().
+ */
+typedef struct TTrhPoolProperties {
+	/// Number of worker threads. If 0, one worker per online CPU is started.
+	size_t threads;
+
+	/// If true, worker N is pinned to CPU (cpu_first + N) modulo number of CPUs.
+	bool pin;
+	int cpu_first;
+
+	/// Capacity of the work-stealing deque of every worker (rounded up to power of 2). If 0, 1024 is used.
+	/// Jobs that do not fit are queued in the shared queue.
+	size_t deque_size;
+} TTrhPoolProperties;
+
+/**
+ * @brief Pool metrics; returned by trh_pool_stats().
+ */
+typedef struct TTrhPoolStats {
+	/// Jobs waiting for a worker (queue depth).
+	size_t queued;
+	/// Jobs being executed.
+	size_t running;
+
+	/// Number of submitted / completed jobs since the pool has started.
+	uint64_t submitted;
+	uint64_t completed;
+	/// Number of jobs taken from the deque of another worker.
+	uint64_t stolen;
+
+	/// Time (ns) between submission and start of the job - average and maximum.
+	uint64_t wait_avg;
+	uint64_t wait_max;
+	/// Run time (ns) of the job - average and maximum.
+	uint64_t run_avg;
+	uint64_t run_max;
+} TTrhPoolStats;
+
+
+/**
+ * @brief Start worker thread pool.
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID iProperties or oPool is null.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_FAILED Failed to start a thread.
+ *
+ * Every worker owns a work-stealing deque. Jobs submitted from a worker go to its own deque,
+ * jobs submitted from other threads go to the shared queue; idle workers steal from each other.
+ * oPool must be released with trh_pool_release().
+ */
+int trh_pool_init( TTrhPoolProperties *iProperties, struct TTrhPool **oPool );
+
+/**
+ * @brief Submit a job. Thread-safe.
+ * @param iJob Job executed on a worker thread.
+ * @param iDone Optional completion, executed on the loop of the calling thread (see trh_loop_current()).
+ * @param iArg Argument passed to \a iJob and \a iDone.
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID iPool or iJob is null.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_END Pool is being released.
+ *
+ * Completion is posted to the loop with trh_post_on(); it is executed in trh_update() of that loop.
+ */
+int trh_pool_submit( struct TTrhPool *iPool, handle_job iJob, handle_job_done iDone, void *iArg );
+
+/**
+ * @brief Return pool metrics. Lock-free, values are not a consistent snapshot.
+ */
+void trh_pool_stats( struct TTrhPool *iPool, TTrhPoolStats *oStats );
+
+/**
+ * @brief Stop the pool. Queued jobs are executed, then worker threads are joined and resources released.
+ *
+ * Completions of the executed jobs are still posted to their loops.
+ */
+void trh_pool_release( struct TTrhPool *iPool );
+
+// c++ compatibility
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRH_POOL_H
@@ -0,0 +1,101 @@
+/*
+ * @brief Latency histograms and loop instrumentation (TRH_LOOP_STATS)
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+#ifndef TRH_STATS_H
+#define TRH_STATS_H
+
+// c++ compatibility
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Every power of 2 is split into 2^TRH_HISTOGRAM_SUB_BITS buckets (relative error of a bucket <= 25 %).
+#define TRH_HISTOGRAM_SUB_BITS		2
+/// Number of buckets; values up to UINT64_MAX.
+#define TRH_HISTOGRAM_BUCKETS		( 64 << TRH_HISTOGRAM_SUB_BITS )
+
+/// Number of handlers with their own runtime histogram; other handlers share the last slot.
+#define TRH_LOOP_STATS_HANDLERS		32
+
+/**
+ * @brief Histogram with logarithmic buckets (HDR-style). Values are nanoseconds unless stated otherwise.
+ */
+typedef struct TTrhHistogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[TRH_HISTOGRAM_BUCKETS];
+} TTrhHistogram;
+
+/**
+ * @brief Runtime of one event (or timer) handler.
+ */
+typedef struct TTrhHandlerStats {
+	/// Handler function; null for the slot shared by handlers that did not fit.
+	const void *handler;
+	TTrhHistogram runtime;
+} TTrhHandlerStats;
+
+/**
+ * @brief Loop metrics; returned by trh_loop_stats().
+ */
+typedef struct TTrhLoopStats {
+	/// Number of dispatched iterations.
+	uint64_t iterations;
+
+	/// Events dispatched in one iteration (count, not ns).
+	TTrhHistogram events;
+	/// Run time of all handlers of one iteration.
+	TTrhHistogram dispatch;
+	/// Timer lateness - time the timer handler was called minus its deadline.
+	TTrhHistogram timer_lateness;
+	/// Time spent in sd_bus_process() (trh_dbus.h).
+	TTrhHistogram dbus;
+
+	/// Run time per handler (handle_triggered / handle_writable / handle_error, handle_timer_event for timers).
+	size_t handler_count;
+	TTrhHandlerStats handlers[TRH_LOOP_STATS_HANDLERS];
+} TTrhLoopStats;
+
+
+/**
+ * @brief Add value to the histogram.
+ */
+void trh_histogram_record( TTrhHistogram *iHistogram, uint64_t iValue );
+
+/**
+ * @brief Return value at quantile iQuantile (0.0 - 1.0); upper bound of the bucket. 0 if the histogram is empty.
+ */
+uint64_t trh_histogram_quantile( const TTrhHistogram *iHistogram, double iQuantile );
+
+/**
+ * @brief Return the largest value that falls into bucket iIndex.
+ */
+uint64_t trh_histogram_bucket_max( size_t iIndex );
+
+/**
+ * @brief Return mean value, 0 if the histogram is empty.
+ */
+uint64_t trh_histogram_mean( const TTrhHistogram *iHistogram );
+
+/**
+ * @brief Write name of the handler (symbol name if available, otherwise its address) to oName.
+ *
+ * Symbol names of the executable are available when it is linked with -rdynamic.
+ */
+chars trh_stats_handler_name( const void *iHandler, char *oName, size_t iSize );
+
+/**
+ * @brief Record run time of the handler. Called by the loop from its thread.
+ */
+void trh_stats_handler( TTrhLoopStats *iStats, const void *iHandler, uint64_t iRuntime );
+
+// c++ compatibility
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRH_STATS_H
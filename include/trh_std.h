@@ -12,6 +12,11 @@
 extern "C" {
 #endif
 
+/// Nanoseconds per second.
+#define TRH_NSEC_PER_SEC		1000000000ull
+/// Nanoseconds per millisecond.
+#define TRH_NSEC_PER_MSEC		1000000ull
+
 /**
  * @brief File type is mandatory argument passed to \a trh_file_exists.
  */
@@ -48,9 +53,26 @@ int trh_std_init();
 
 /**
  * @brief Get current system time as real number.
+ *
+ * System time (CLOCK_REALTIME) can jump when the clock is set (NTP). Use \a trh_time_ns to measure intervals.
  */
 double trh_time();
 
+/**
+ * @brief Get monotonic time (CLOCK_MONOTONIC) in nanoseconds.
+ *
+ * Time is not affected by system clock changes; it is the time base of timers and application time.
+ * Read through vDSO - no syscall.
+ */
+uint64_t trh_time_ns();
+
+/**
+ * @brief Get coarse monotonic time (CLOCK_MONOTONIC_COARSE) in nanoseconds.
+ *
+ * Cheaper than \a trh_time_ns, resolution is one kernel tick (1-10 ms).
+ */
+uint64_t trh_time_coarse_ns();
+
 /**
  * @brief Return system or local path.
  * @param iProjectName Name of the project. If empty, default path will be used.
@@ -81,11 +103,57 @@ bool trh_file_exists( chars iFilePath, FileType iFileType );
  * @param iDestFileName Name of the destination file.
  * @retval TRH_OK File has been successfully copied.
  * @retval TRH_ARG_INVALID One of the arguments is invalid.
- * @retval TRH_SKIP Source file does not exist.
- * @retval TRH_FILE_ERROR if iSourceFile does not exists or iDestFile is not accessible.
+ * @retval TRH_SKIP Source file does not exist or is not a regular file.
+ * @retval TRH_FILE_ERROR Source or destination is not accessible or the copy failed.
+ *
+ * Same as \a trh_copy_file_ex without options.
  */
 int trh_copy_file( chars iSourceFileName, chars iDestFileName );
 
+/// Preallocate destination (fallocate) before copying; fails early if there is not enough space.
+#define TRH_COPY_FALLOCATE		0x01
+/// Do not try to clone the file (FICLONE) - always copy the data.
+#define TRH_COPY_NO_REFLINK		0x02
+
+/// Default number of bytes copied between two progress reports.
+#define TRH_COPY_CHUNK_DEFAULT	( 16u << 20 )
+
+/// Copy progress. iCopied == iTotal in the last report.
+typedef void (*handle_copy_progress)( uint64_t iCopied, uint64_t iTotal, void *iArg );
+
+/**
+ * @brief Options of \a trh_copy_file_ex.
+ */
+typedef struct TTrhCopyOptions {
+	/// TRH_COPY_* flags.
+	int flags;
+
+	/// Bytes copied between two progress reports. If 0, TRH_COPY_CHUNK_DEFAULT is used.
+	size_t chunk;
+
+	/// Optional progress callback.
+	handle_copy_progress handle_progress;
+	void *arg;
+
+	/// If set, progress is posted to this loop (trh_post_on) instead of being called from the copying thread.
+	struct TTrhLoop *loop;
+} TTrhCopyOptions;
+
+/**
+ * @brief Copy file to a new destination.
+ * @param iOptions Optional (may be null).
+ * @retval TRH_OK File has been successfully copied.
+ * @retval TRH_ARG_INVALID One of the arguments is invalid.
+ * @retval TRH_SKIP Source file does not exist or is not a regular file.
+ * @retval TRH_FILE_ERROR Source or destination is not accessible or the copy failed (errno is preserved);
+ *         ENODATA if the source has shrunk while copying.
+ *
+ * File is cloned (FICLONE) if the filesystem supports it, otherwise it is copied in kernel
+ * with copy_file_range(), falling back to sendfile(). Destination is created (or truncated)
+ * with the mode of the source. Partially copied destination is left in place, cut to the copied size.
+ */
+int trh_copy_file_ex( chars iSourceFileName, chars iDestFileName, const TTrhCopyOptions *iOptions );
+
 /**
  * @brief Delete a file.
  * @param iFilepath Name of the file to delete.
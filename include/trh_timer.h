@@ -13,7 +13,9 @@ extern "C" {
 #endif
 
 struct TTrhEvent;
+struct TTrhLoop;
 struct TTrhTimer;
+struct TTrhTimerQueue;
 
 typedef enum TTrhTimerState {
 	TRH_TIMER_STOPPED,
@@ -29,6 +31,10 @@ typedef struct TTrhTimerProperties {
 	/// If true, timer will be repeated.
 	bool repeat;
 
+	/// If true, repeated timer is re-armed relative to its previous deadline instead of the end of \a handle_timer_event.
+	/// Period does not drift with handler run time; missed periods are reported in \a expirations.
+	bool absolute;
+
 	/// - RUNNING state is managed internally.
 	/// - STOPPED state is set when timer is stopped in \a trh_timer_stop() or \a repeat is false.
 	/// - EXPIRED state can be set in timer event handler ( \a handle_timer_event) to release the timer resources.
@@ -41,41 +47,113 @@ typedef struct TTrhTimerProperties {
 	handle_event handle_timer_event;
 	// Called when timer event is released from memory.
 	handle_event handle_timer_stopped;
+
+	/// Number of periods elapsed since the last call of \a handle_timer_event. Always 1 unless \a absolute
+	/// timer has missed some periods; handler can catch up in one batch. Set before \a handle_timer_event is called.
+	uint64_t expirations;
+
+	/// Absolute expiration time (CLOCK_MONOTONIC, nanoseconds). Managed internally.
+	uint64_t deadline;
+	/// Position of the timer in the timer queue. Managed internally.
+	size_t queue_index;
+	/// Timer queue of the loop the timer belongs to. Managed internally.
+	struct TTrhTimerQueue *queue;
 } TTrhTimerProperties;
 
 
+/**
+ * @brief Initialize timer queue of the loop. Called from trh_loop_init().
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID iLoop or oQueue is null.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_TIMER_FAILED Failed to create timer.
+ * @retval TRH_EPOLL_FAILED Failed to register timer with epoll.
+ *
+ * All timers of the loop share one timerfd armed for the earliest deadline.
+ */
+int trh_timer_queue_init( struct TTrhLoop *iLoop, struct TTrhTimerQueue **oQueue );
+
+/**
+ * @brief Release timer queue. Called from trh_loop_release().
+ *
+ * Timers still present in the queue are stopped, but their memory is not released.
+ */
+void trh_timer_queue_release( struct TTrhTimerQueue *iQueue );
+
+/**
+ * @brief Release timers present in the queue (started timers). Called from trh_loop_close().
+ * @return Number of released timers.
+ *
+ * \a handle_timer_stopped of every timer is executed; the timer must not be used afterwards.
+ */
+size_t trh_timer_queue_clear( struct TTrhTimerQueue *iQueue );
+
+/**
+ * @brief Pre-allocate timer objects, typically right after trh_init().
+ * @param iCount Number of timers available without further allocation.
+ * @retval TRH_OK
+ * @retval TRH_OUT_OF_MEM
+ *
+ * Timer object (event with inline timer properties) is taken from a pool; released timers return to the pool.
+ * Pool grows on demand, reserve only avoids allocations at run time.
+ */
+int trh_timer_reserve( size_t iCount );
+
+/**
+ * @brief Release memory of the timer pool. Called from trh_release().
+ *
+ * Memory is not released while some timers are still in use.
+ */
+void trh_timer_pool_release();
+
+
 /**
  * @brief Create a new timer. New timer is by default created in enabled state.
  * @retval TRH_INVALID_ARG iProperties or oEvent is null.
  * @retval TRH_OK
  *
- * - allocate memory for timer event
+ * - take timer event (with inline copy of iProperties) from the timer pool
  * - initialize timer 
- * - register timer with epoll
+ * - insert timer into the timer queue
  * 
  * If iProperties has been allocated in memory, it can be released after this function.
  * oEvent must be released with trh_timer_release().
+ *
+ * Timer belongs to the loop running on the calling thread, or to the default loop (see trh_loop_current()).
+ * Timers are not thread-safe: other threads get TRH_ARG_INVALID (see trh_loop_owned()) and use trh_post_on().
  */
 int trh_timer_init( TTrhTimerProperties *iProperties, TTrhEvent **oEvent );
 
 /**
- * @brief Start timer. Timer will be removed from epoll
+ * @brief Create a new timer in the timer queue of \a iLoop.
+ * @retval TRH_INVALID_ARG iProperties or oEvent is null, or iLoop is not initialized.
+ * @retval TRH_OK
+ *
+ * Timer handlers are executed on the thread running \a iLoop; the timer must be started, stopped
+ * and released only from that thread (checked, see trh_loop_owned()).
+ */
+int trh_timer_init_on( struct TTrhLoop *iLoop, TTrhTimerProperties *iProperties, TTrhEvent **oEvent );
+
+/**
+ * @brief Start timer. Timer will be inserted into the timer queue.
  * @retval TRH_INVALID_ARG iEvent is null.
  * @retval TRH_OK
+ *
+ * Running timer is restarted. Timer with zero duration is not scheduled.
+ * If called from \a handle_timer_event, the new deadline is kept (also for non-repeating timers).
  */
 int trh_timer_start( TTrhEvent *oEvent );
 
 /**
- * @brief Stop the timer. Timer will be added to epoll.
+ * @brief Stop the timer. Timer will be removed from the timer queue.
  */
 void trh_timer_stop( TTrhEvent *oEvent );
 
 /**
  * @brief Release timer resources.
  * 
- * - unregister timer from epoll
- * - close timer
- * - free memory
+ * - remove timer from the timer queue
+ * - return timer object to the timer pool
  */
 void trh_timer_release( TTrhEvent *iEvent );
 
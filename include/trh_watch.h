@@ -0,0 +1,102 @@
+/*
+ * @brief File watching (inotify)
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+#ifndef TRH_WATCH_H
+#define TRH_WATCH_H
+
+#include <sys/inotify.h>
+
+// c++ compatibility
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct TTrhLoop;
+struct TTrhWatch;
+struct TTrhWatcher;
+
+// Watch flags (\a trh_watch_add).
+/// File has been modified.
+#define TRH_WATCH_MODIFY			IN_MODIFY
+/// File opened for writing has been closed - preferred over TRH_WATCH_MODIFY for complete writes.
+#define TRH_WATCH_CLOSE_WRITE		IN_CLOSE_WRITE
+/// Metadata (permissions, timestamps, ...) has been changed.
+#define TRH_WATCH_ATTRIB			IN_ATTRIB
+/// File has been created in the watched directory.
+#define TRH_WATCH_CREATE			IN_CREATE
+/// File has been deleted from the watched directory.
+#define TRH_WATCH_DELETE			IN_DELETE
+/// File has been moved out of / into the watched directory.
+#define TRH_WATCH_MOVED_FROM		IN_MOVED_FROM
+#define TRH_WATCH_MOVED_TO			IN_MOVED_TO
+/// Watched path itself has been deleted or moved.
+#define TRH_WATCH_SELF				( IN_DELETE_SELF | IN_MOVE_SELF )
+
+// Flags that are always reported.
+/// Event queue of the kernel has overflowed; events were lost and the watched paths should be rescanned.
+#define TRH_WATCH_OVERFLOW			IN_Q_OVERFLOW
+/// Watch has been removed by the kernel (path deleted, filesystem unmounted); it does not report anything more.
+#define TRH_WATCH_REMOVED			IN_IGNORED
+
+/// Changes of the watched path (or of the file in the watched directory) are reported once per window.
+/// Window 0 coalesces only events read at once.
+#define TRH_WATCH_WINDOW_DEFAULT	0
+
+/// Watch callback. iMask contains all TRH_WATCH_* flags coalesced in the window (and IN_ISDIR),
+/// iName is the name of the file in the watched directory, or null for the watched path itself.
+typedef void (*handle_watch)( struct TTrhWatch *iWatch, uint32_t iMask, chars iName, void *iArg );
+
+
+/**
+ * @brief Create watcher of the loop (one inotify fd registered with the loop). Called on the first use from trh_loop_watcher().
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID iLoop or oWatcher is null.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_EPOLL_FAILED Failed to create or register inotify fd.
+ * @retval TRH_TIMER_FAILED Failed to create timer of the coalescing window.
+ */
+int trh_watcher_init( struct TTrhLoop *iLoop, struct TTrhWatcher **oWatcher );
+
+/**
+ * @brief Release watcher and all its watches. Called from trh_loop_release(); pending events are dropped.
+ */
+void trh_watcher_release( struct TTrhWatcher *iWatcher );
+
+/**
+ * @brief Watch file or directory.
+ * @param iPath Watched path.
+ * @param iMask TRH_WATCH_* flags.
+ * @param iCallback Called from the loop of the calling thread.
+ * @param oWatch Optional; watch handle for trh_watch_remove() and trh_watch_set_window().
+ * @retval TRH_OK
+ * @retval TRH_ARG_INVALID iPath, iMask or iCallback is invalid.
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_UNINITIALIZED No loop.
+ * @retval TRH_FILE_ERROR Path can't be watched (does not exist, inotify limit reached).
+ *
+ * Watches of one loop must be added and removed from its thread. One path can be watched several times.
+ */
+int trh_watch_add( chars iPath, uint32_t iMask, handle_watch iCallback, void *iArg, struct TTrhWatch **oWatch );
+
+/**
+ * @brief Set coalescing window of the watch (milliseconds).
+ *
+ * Events of the same file are merged until the window of its first event expires, so a burst of writes
+ * is reported once.
+ */
+void trh_watch_set_window( struct TTrhWatch *iWatch, uint32_t iMilliseconds );
+
+/**
+ * @brief Stop watching and release the watch. Can be called from the watch callback.
+ */
+void trh_watch_remove( struct TTrhWatch *iWatch );
+
+// c++ compatibility
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRH_WATCH_H
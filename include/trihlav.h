@@ -17,6 +17,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sys/epoll.h>
 
 // #endregion
 
@@ -101,6 +102,21 @@ typedef void (*handle_signal_usr)( int );
 /// Callback for handling main loop (epoll) errors
 typedef int (*handle_loop_error)();
 
+/// Task posted to the main loop with \a trh_post.
+typedef void (*handle_task)( void *iArg );
+
+/**
+ * @brief Phase of loop iteration in which a hook is executed (see \a trh_hook_add).
+ */
+typedef enum LoopPhase {
+	/// Before the loop waits for events (epoll_wait); file operations are submitted after the hooks.
+	TRH_LOOP_PREPARE = 0,
+	/// After events of the iteration have been dispatched (or the wait has found no events).
+	TRH_LOOP_CHECK,
+	/// Loop has no work - before a blocking wait, or after a non-blocking wait has found no events.
+	TRH_LOOP_IDLE
+} LoopPhase;
+
 /**
  * @brief Get version of Trihlav library.
  */
@@ -123,6 +139,20 @@ struct TApplication *trh_init( void *iExt );
  */
 int trh_set_signal_handler( int iSignal, handle_signal_usr iHandler );
 
+/**
+ * @brief Enable (or disable) delivery of signals through signalfd registered with the default loop.
+ * @retval TRH_OK on success.
+ * @retval TRH_UNINITIALIZED Application has not been initialized.
+ * @retval TRH_SIGNAL_FAILED Failed to block signals or create signalfd.
+ * @retval TRH_EPOLL_FAILED Failed to register signalfd.
+ *
+ * SIGINT, SIGTERM, SIGQUIT, SIGHUP, SIGUSR1 and SIGUSR2 are blocked and read by the main loop; burst of signals
+ * is handled in one read. Handlers set by \a trh_set_signal_handler run on the main loop thread, so they can log,
+ * lock and allocate; epoll_wait is not interrupted. Call it right after trh_init(), before other threads
+ * are started - threads inherit the signal mask. Fatal signals (SIGSEGV, ...) keep their handlers.
+ */
+int trh_set_signal_fd( bool iEnable );
+
 /**
  * @brief Set callback that will be executed on main loop error.
  * 
@@ -143,20 +173,98 @@ void trh_set_loop_error_handler( handle_loop_error iHandler );
 int trh_update();
 
 /**
- * @brief Return system time.
+ * @brief Update application state; wait for events up to \a iTimeout milliseconds.
+ * @param iTimeout Maximum time to sleep in milliseconds. -1 waits until an event is received, 0 does not block.
+ * @retval TRH_OK on success.
+ * @retval TRH_WAITING No events to process - timeout expired, or wait was interrupted by a signal.
+ * @retval TRH_END Application is terminating, wait has been skipped.
+ * @retval TRH_RELOAD Application should reload its settings. Returned until \a trh_reload() is called.
+ * @retval TRH_EPOLL_FAILED Failed to wait for events.
+ *
+ * Timers are registered with epoll, so the wait ends at the latest on the next timer deadline.
+ * Wait is interrupted by \a trh_terminate() or \a trh_wakeup() called from any thread.
+ */
+int trh_update_wait( int iTimeout );
+
+/**
+ * @brief Run main loop until the application is terminated.
+ * @retval TRH_OK Application has been terminated.
+ * @retval TRH_RELOAD Application should reload its settings. Call trh_run() again afterwards.
+ * @retval TRH_EPOLL_FAILED Failed to wait for events.
+ *
+ * Loop sleeps in epoll between the events (see \a trh_update_wait).
+ */
+int trh_run();
+
+/**
+ * @brief Interrupt blocking wait in the main loop. Thread-safe and async-signal-safe.
+ */
+void trh_wakeup();
+
+/**
+ * @brief Post a task to be executed by the main loop (in \a trh_update / \a trh_update_wait). Thread-safe, lock-free.
+ * @retval TRH_OK on success.
+ * @retval TRH_ARG_INVALID iTask is null.
+ * @retval TRH_UNINITIALIZED Application has not been initialized.
+ * @retval TRH_OUT_OF_MEM
+ *
+ * Tasks posted by one thread are executed in order. Burst of posts costs one wake-up of the main loop.
+ */
+int trh_post( handle_task iTask, void *iArg );
+
+/**
+ * @brief Execute a task in the next iteration of the main loop, without waking it up by a system call.
+ * Call it from the main thread. See \a trh_defer_on.
+ */
+int trh_defer( handle_task iTask, void *iArg );
+
+/**
+ * @brief Add hook executed in phase \a iPhase of every iteration of the main loop. See \a trh_hook_add_on.
+ */
+int trh_hook_add( LoopPhase iPhase, handle_task iHook, void *iArg );
+
+/**
+ * @brief Remove hook of the main loop. See \a trh_hook_remove_on.
+ */
+int trh_hook_remove( LoopPhase iPhase, handle_task iHook, void *iArg );
+
+/**
+ * @brief Set maximal number of epoll events dispatched in one iteration of main application loop.
+ * @retval TRH_OK on success.
+ * @retval TRH_ARG_INVALID iCount is 0 or too large.
+ *
+ * Default is TRH_EVENT_BATCH_DEFAULT. Larger batch reduces number of epoll_wait() calls when many fds are active.
+ * Change takes effect in the next iteration - it is safe to call from event handler.
+ */
+int trh_set_event_batch( size_t iCount );
+
+/**
+ * @brief Return system time. Lock-free, can be called from any thread.
  */
 double trh_get_sys_time();
 
 /**
- * @brief Get application time.
+ * @brief Get application time. Lock-free, can be called from any thread.
+ *
+ * Application time is measured by monotonic clock, it is not affected by system clock changes.
  */
 double trh_get_app_time();
 
+/**
+ * @brief Get application time in nanoseconds (monotonic clock). Lock-free.
+ */
+uint64_t trh_get_app_time_ns();
+
 /**
  * @brief Get time difference between two calls of trh_update().
  */
 double trh_get_dt();
 
+/**
+ * @brief Get time difference between two calls of trh_update() in nanoseconds (monotonic clock). Lock-free.
+ */
+uint64_t trh_get_dt_ns();
+
 /**
  * @brief Lock application mutex.
  */
@@ -169,14 +277,44 @@ void trh_app_unlock();
 
 /**
  * @brief Stop the application. Thread-safe.
+ *
+ * Blocking wait in \a trh_update_wait is interrupted.
  */
 void trh_terminate();
 
 /**
- * @brief Check if application is terminating.
+ * @brief Check if application is terminating. Lock-free.
  */
 bool trh_is_terminating();
 
+/**
+ * @brief Check if application should reload its settings.
+ */
+bool trh_is_reloading();
+
+/**
+ * @brief Handle reload request (SIGHUP): clear the flag, reload config and reopen the log file.
+ *
+ * Called by \a trh_run(). Applications driving the loop with \a trh_update() / \a trh_update_wait()
+ * call it when they get TRH_RELOAD.
+ */
+void trh_reload();
+
+/**
+ * @brief Shut the application down gracefully; wait max \a iTimeout milliseconds. Call it before trh_release().
+ * @retval TRH_OK All work has been finished.
+ * @retval TRH_WAITING Timeout expired; work still pending is dropped.
+ * @retval TRH_UNINITIALIZED Application is not initialized.
+ * @retval TRH_OUT_OF_MEM, TRH_EPOLL_FAILED see \a trh_update_wait.
+ *
+ * Application is terminated and the default loop does not accept new events. Queued PropertiesChanged signals
+ * are emitted. The loop dispatches events until posted and deferred tasks, file operations, dbus calls waiting
+ * for reply and dbus messages waiting to be sent are finished, or the timeout expires. Then config, signalfd and
+ * dbus are released, started timers and registered events are released (see trh_loop_close()), and messages
+ * buffered by the logger are written. Pool loops are not drained - stop them before.
+ */
+int trh_shutdown( int iTimeout );
+
 /**
  * @brief Release application resources.
  */
@@ -188,17 +326,39 @@ void trh_release();
 // #region Events
 
 struct TTrhEvent;
+struct TTrhLoop;
 
 /// Callback function handling timer event.
 typedef int (*handle_event)( struct TTrhEvent *iEvent );
 
+// Event interest flags (\a TTrhEvent::events).
+/// Fd is readable (or peer closed the connection).
+#define TRH_EVENT_READ				EPOLLIN
+/// Fd is writable - register only while there is pending output.
+#define TRH_EVENT_WRITE				EPOLLOUT
+/// Peer closed its writing half of the connection. Reported to \a handle_triggered.
+#define TRH_EVENT_RDHUP				EPOLLRDHUP
+/// Edge-triggered - handler must read/write until EAGAIN.
+#define TRH_EVENT_EDGE				EPOLLET
+/// Event is disabled after it fires once; re-arm with \a trh_event_modify.
+#define TRH_EVENT_ONESHOT			EPOLLONESHOT
+/// Wake only one of the epoll instances sharing the fd. Can be set only in \a trh_event_register.
+#define TRH_EVENT_EXCLUSIVE			EPOLLEXCLUSIVE
+
+/// Default number of epoll events dispatched in one iteration of main application loop.
+#define TRH_EVENT_BATCH_DEFAULT		16
+
 /**
  * @brief Event object registered with epoll.
+ *
+ * Event must be zero-initialized (calloc or `= { 0 }`) - members not set by the caller keep their default
+ * (0 or null) meaning. Members added after \a ext are set by name.
  */
 typedef struct TTrhEvent {
 	/// File descriptor registered with epoll.
 	int fd;
-	/// Callback function executed when event is triggered.
+	/// Callback function executed when event is triggered (fd is readable).
+	/// Also called for writable fd when \a handle_writable is null.
 	handle_event handle_triggered;
 	/// Callback function executed on error.
 	handle_event handle_error;
@@ -210,15 +370,47 @@ typedef struct TTrhEvent {
 		/// Pointer to user data.
 		void *data;
 	} ext;
+
+	/// Epoll events (TRH_EVENT_* flags) the fd is registered for. If 0, TRH_EVENT_READ is used.
+	/// Apply changes with \a trh_event_modify.
+	uint32_t events;
+	/// Callback function executed when fd is writable (TRH_EVENT_WRITE). Called before \a handle_triggered,
+	/// so only \a handle_triggered may release the event.
+	handle_event handle_writable;
+	/// Callback function executed when the event is released by the shutdown (trh_shutdown) while it is still
+	/// registered. Event has been unregistered already, so the callback may close fd and free the event.
+	handle_event handle_released;
+
+	/// Loop the event is registered with (see trh_loop.h). Managed internally.
+	struct TTrhLoop *loop;
+	/// Position of the event in the list of events registered with the loop. Managed internally.
+	size_t index;
 } TTrhEvent;
 
 
 /**
  * @brief Register event with epoll
  * @param iEvent Event properties.
+ * @retval TRH_OK on success.
+ * @retval TRH_END Loop is shutting down (trh_shutdown).
+ * @retval TRH_OUT_OF_MEM
+ * @retval TRH_EPOLL_FAILED
+ *
+ * Event is registered with the loop running on the calling thread, or with the default loop (see trh_loop.h).
+ * Unregister the event before its memory is released.
  */
 int trh_event_register( TTrhEvent *iEvent );
 
+/**
+ * @brief Update epoll registration of the event after \a events has been changed.
+ *
+ * Used also to re-arm TRH_EVENT_ONESHOT event. TRH_EVENT_EXCLUSIVE event can't be modified.
+ * @retval TRH_OK on success.
+ * @retval TRH_ARG_INVALID iEvent is null.
+ * @retval TRH_EPOLL_FAILED Failed to modify the event.
+ */
+int trh_event_modify( TTrhEvent *iEvent );
+
 /**
  * @brief Unregister event from epoll.
  */
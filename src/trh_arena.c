@@ -0,0 +1,319 @@
+/*
+ * @brief Arena (bump-pointer) allocator for temporary allocations
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+// #region Includes
+
+#include <string.h>
+#include <stddef.h>
+#include <stdalign.h>
+#include <pthread.h>
+
+#include "trihlav.h"
+#include "trh_logger.h"
+#include "trh_arena.h"
+
+// #endregion
+
+// Alignment of allocations.
+#define ARENA_ALIGN				alignof( max_align_t )
+
+// #region Typedefs
+
+/**
+ * @brief Block of arena memory. Chunks are chained from the newest one.
+ */
+typedef struct TTrhArenaChunk {
+	struct TTrhArenaChunk *next;
+	size_t size;
+	size_t used;
+	alignas( max_align_t ) unsigned char data[];
+} TTrhArenaChunk;
+
+typedef struct TTrhArena {
+	/// Current (newest) chunk; null if the arena has no memory.
+	TTrhArenaChunk *chunk;
+	/// Size of new chunks.
+	size_t chunk_size;
+} TTrhArena;
+
+// #endregion
+
+
+// #region Static functions
+
+static TTrhArenaChunk *local_arena_chunk( TTrhArena *iArena, size_t iSize );
+static void local_arena_thread_free( void *iArena );
+static void local_arena_thread_key();
+
+// #endregion
+
+
+// #region Static globals
+
+/// Arena of the calling thread.
+static __thread TTrhArena *gsArenaThread = 0;
+
+/// Releases thread arenas when threads exit.
+static pthread_key_t gsArenaKey;
+static pthread_once_t gsArenaOnce = PTHREAD_ONCE_INIT;
+
+// #endregion
+
+
+// #region Exported functions
+
+int trh_arena_init( size_t iChunkSize, TTrhArena **oArena )
+{
+	TRH_ASSERT_ARG( oArena != 0, "Failed to create arena - invalid argument." );
+
+	TTrhArena *lArena = (TTrhArena*)calloc( 1, sizeof( TTrhArena ) );
+	if( lArena == 0 ) return TRH_OUT_OF_MEM;
+
+	lArena->chunk_size = iChunkSize > 0 ? iChunkSize : TRH_ARENA_CHUNK_DEFAULT;
+
+	*oArena = lArena;
+
+	return TRH_OK;
+}
+
+void trh_arena_release( TTrhArena *iArena )
+{
+	if( iArena == 0 )
+		return;
+
+	while( iArena->chunk != 0 ) {
+		TTrhArenaChunk *lNext = iArena->chunk->next;
+		free( iArena->chunk );
+		iArena->chunk = lNext;
+	}
+
+	free( iArena );
+}
+
+TTrhArena *trh_arena_current()
+{
+	return trh_arena_thread( true );
+}
+
+TTrhArena *trh_arena_thread( bool iCreate )
+{
+	if( gsArenaThread != 0 || ! iCreate )
+		return gsArenaThread;
+
+	pthread_once( &gsArenaOnce, local_arena_thread_key );
+
+	if( trh_arena_init( 0, &gsArenaThread ) != TRH_OK )
+		return 0;
+
+	pthread_setspecific( gsArenaKey, gsArenaThread );
+
+	return gsArenaThread;
+}
+
+void trh_arena_thread_release()
+{
+	if( gsArenaThread == 0 )
+		return;
+
+	pthread_setspecific( gsArenaKey, 0 );
+	trh_arena_release( gsArenaThread );
+	gsArenaThread = 0;
+}
+
+void *trh_arena_alloc( TTrhArena *iArena, size_t iSize )
+{
+	if( iArena == 0 && ( iArena = trh_arena_current() ) == 0 )
+		return 0;
+
+	// Round up, so the next allocation stays aligned.
+	const size_t lSize = ( iSize + ARENA_ALIGN - 1 ) & ~( ARENA_ALIGN - 1 );
+	if( lSize < iSize ) return 0;
+
+	TTrhArenaChunk *lChunk = iArena->chunk;
+
+	if( lChunk == 0 || lChunk->size - lChunk->used < lSize ) {
+		if( ( lChunk = local_arena_chunk( iArena, lSize ) ) == 0 )
+			return 0;
+	}
+
+	void *lPtr = lChunk->data + lChunk->used;
+	lChunk->used += lSize;
+
+	return lPtr;
+}
+
+char *trh_arena_strdup( TTrhArena *iArena, chars iText )
+{
+	if( iText == 0 )
+		return 0;
+
+	const size_t lLength = strlen( iText );
+	char *lCopy = (char*)trh_arena_alloc( iArena, lLength + 1 );
+	if( lCopy != 0 )
+		memcpy( lCopy, iText, lLength + 1 );
+
+	return lCopy;
+}
+
+char *trh_arena_strndup( TTrhArena *iArena, chars iText, size_t iLength )
+{
+	if( iText == 0 )
+		return 0;
+
+	const size_t lLength = strnlen( iText, iLength );
+	char *lCopy = (char*)trh_arena_alloc( iArena, lLength + 1 );
+	if( lCopy != 0 ) {
+		memcpy( lCopy, iText, lLength );
+		lCopy[lLength] = 0;
+	}
+
+	return lCopy;
+}
+
+char *trh_arena_printf( TTrhArena *iArena, chars iFormat, ... )
+{
+	va_list args;
+
+	va_start( args, iFormat );
+	char *lText = trh_arena_vprintf( iArena, iFormat, args );
+	va_end( args );
+
+	return lText;
+}
+
+char *trh_arena_vprintf( TTrhArena *iArena, chars iFormat, va_list iArgs )
+{
+	va_list lArgs;
+
+	if( iArena == 0 && ( iArena = trh_arena_current() ) == 0 )
+		return 0;
+
+	// Format directly into the free space of the current chunk; most messages fit.
+	TTrhArenaChunk *lChunk = iArena->chunk;
+	const size_t lFree = lChunk != 0 ? lChunk->size - lChunk->used : 0;
+
+	va_copy( lArgs, iArgs );
+	int lLength = vsnprintf( lFree > 0 ? (char*)lChunk->data + lChunk->used : 0, lFree, iFormat, lArgs );
+	va_end( lArgs );
+
+	if( lLength < 0 )
+		return 0;
+
+	if( (size_t)lLength < lFree )
+		return (char*)trh_arena_alloc( iArena, (size_t)lLength + 1 );
+
+	char *lText = (char*)trh_arena_alloc( iArena, (size_t)lLength + 1 );
+	if( lText == 0 )
+		return 0;
+
+	va_copy( lArgs, iArgs );
+	vsnprintf( lText, (size_t)lLength + 1, iFormat, lArgs );
+	va_end( lArgs );
+
+	return lText;
+}
+
+TTrhArenaMark trh_arena_mark( TTrhArena *iArena )
+{
+	TTrhArenaMark lMark = { 0, 0 };
+
+	if( iArena != 0 && iArena->chunk != 0 ) {
+		lMark.chunk = iArena->chunk;
+		lMark.used = iArena->chunk->used;
+	}
+
+	return lMark;
+}
+
+void trh_arena_rewind( TTrhArena *iArena, TTrhArenaMark iMark )
+{
+	if( iArena == 0 )
+		return;
+
+	if( iMark.chunk == 0 ) {
+		trh_arena_reset( iArena );
+		return;
+	}
+
+	// Release chunks created after the mark.
+	size_t lFreed = 0;
+
+	while( iArena->chunk != 0 && iArena->chunk != iMark.chunk ) {
+		TTrhArenaChunk *lNext = iArena->chunk->next;
+		lFreed += iArena->chunk->size;
+		free( iArena->chunk );
+		iArena->chunk = lNext;
+	}
+
+	// Mark is not part of the arena (it has been reset meanwhile).
+	if( iArena->chunk == 0 )
+		return;
+
+	iArena->chunk->used = iMark.used;
+
+	// Arena is empty again - grow it, so the same workload fits into one chunk next time.
+	if( lFreed > 0 && iMark.used == 0 && iArena->chunk->next == 0 ) {
+		lFreed += iArena->chunk->size;
+		free( iArena->chunk );
+		iArena->chunk = 0;
+		local_arena_chunk( iArena, lFreed );
+	}
+}
+
+void trh_arena_reset( TTrhArena *iArena )
+{
+	if( iArena == 0 || iArena->chunk == 0 )
+		return;
+
+	if( iArena->chunk->next == 0 ) {
+		iArena->chunk->used = 0;
+		return;
+	}
+
+	// Arena has overflowed - replace chunks by one chunk of their total size.
+	size_t lSize = 0;
+
+	while( iArena->chunk != 0 ) {
+		TTrhArenaChunk *lNext = iArena->chunk->next;
+		lSize += iArena->chunk->size;
+		free( iArena->chunk );
+		iArena->chunk = lNext;
+	}
+
+	local_arena_chunk( iArena, lSize );
+}
+
+// #endregion
+
+
+// #region Static functions
+
+TTrhArenaChunk *local_arena_chunk( TTrhArena *iArena, size_t iSize )
+{
+	const size_t lSize = iSize > iArena->chunk_size ? iSize : iArena->chunk_size;
+
+	TTrhArenaChunk *lChunk = (TTrhArenaChunk*)malloc( sizeof( TTrhArenaChunk ) + lSize );
+	if( lChunk == 0 ) return 0;
+
+	lChunk->next = iArena->chunk;
+	lChunk->size = lSize;
+	lChunk->used = 0;
+	iArena->chunk = lChunk;
+
+	return lChunk;
+}
+
+void local_arena_thread_free( void *iArena )
+{
+	trh_arena_release( (TTrhArena*)iArena );
+}
+
+void local_arena_thread_key()
+{
+	pthread_key_create( &gsArenaKey, local_arena_thread_free );
+}
+
+// #endregion
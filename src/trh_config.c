@@ -0,0 +1,528 @@
+/*
+ * @brief Application config (json-c) with hot reload
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+// #region Includes
+
+#include "trihlav.h"
+#include "trh_logger.h"
+#include "trh_std.h"
+#include "trh_config.h"
+#include "trh_watch.h"
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <json-c/json.h>
+
+// #endregion
+
+// Maximal length of dotted key.
+#define CONFIG_KEY_MAX			512
+// FNV-1a (64 bit)
+#define CONFIG_HASH_OFFSET		14695981039346656037ull
+#define CONFIG_HASH_PRIME		1099511628211ull
+
+// #region Typedefs
+
+/**
+ * @brief Item of key index (open addressing). Empty slot has null key.
+ */
+typedef struct TTrhConfigEntry {
+	uint64_t hash;
+	chars key;
+	json_object *value;
+} TTrhConfigEntry;
+
+/**
+ * @brief Parsed config - immutable snapshot shared by readers.
+ */
+typedef struct TTrhConfig {
+	json_object *root;
+
+	/// Key index; capacity is power of 2.
+	TTrhConfigEntry *index;
+	size_t mask;
+	/// Storage of all keys of the index.
+	char *keys;
+
+	uint64_t generation;
+
+	/// Identity of the loaded file.
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+} TTrhConfig;
+
+/**
+ * @brief Config state. Readers use sleepable RCU: they increment the reader counter of the current epoch,
+ * writer swaps the config and waits until counters of both epochs drop to zero before the old config is freed.
+ */
+typedef struct TTrhConfigState {
+	/// Serialize writers (load, reload, release).
+	pthread_mutex_t mutex;
+
+	_Atomic( TTrhConfig* ) current;
+
+	atomic_uint epoch;
+	atomic_uint readers[2];
+
+	/// Path of the loaded file.
+	char *path;
+	uint64_t generation;
+
+	/// Watch of the config directory (trh_config_watch) and file name it reloads for.
+	struct TTrhWatch *watch;
+	char *watch_name;
+} TTrhConfigState;
+
+// #endregion
+
+
+// #region Static functions
+
+static uint64_t local_config_hash( chars iKey, size_t iLength );
+static int local_config_parse( chars iPath, TTrhConfig **oConfig );
+static void local_config_count( json_object *iObject, size_t iPrefix, size_t *oCount, size_t *oBytes );
+static void local_config_index( TTrhConfig *iConfig, json_object *iObject, char *iKey, size_t iPrefix, char **ioKeys );
+static void local_config_insert( TTrhConfig *iConfig, chars iKey, size_t iLength, json_object *iValue );
+static void local_config_swap( TTrhConfig *iConfig );
+static void local_config_synchronize();
+static void local_config_free( TTrhConfig *iConfig );
+static void local_config_changed( struct TTrhWatch *iWatch, uint32_t iMask, chars iName, void *iArg );
+
+// #endregion
+
+
+// #region Static variables
+
+static TTrhConfigState gsConfig = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.current = 0,
+	.path = 0,
+	.generation = 0,
+	.watch = 0,
+	.watch_name = 0
+};
+
+/// Nesting of read sections of the thread, and epoch of the outermost one.
+static __thread unsigned gsReadDepth = 0;
+static __thread unsigned gsReadEpoch = 0;
+
+// #endregion
+
+
+// #region Exported functions
+
+int trh_config_load( chars iProjectName, chars iFileName )
+{
+	TRH_ASSERT_ARG( iFileName != 0 && iFileName[0] != 0, "Failed to load config - file name invalid" );
+
+	char *lPath;
+
+	if( iFileName[0] == '/' ) {
+		lPath = strdup( iFileName );
+	}
+	else {
+		chars lDir = 0;
+		TRH_ASSERT_ARG( iProjectName != 0, "Failed to load config - project name invalid" );
+		trh_get_path( iProjectName, TRH_CONFIG, &lDir );
+		if( lDir == 0 )
+			return TRH_JSON_LOAD_FAILED;
+
+		if( ( lPath = malloc( strlen( lDir ) + strlen( iFileName ) + 1 ) ) != 0 )
+			sprintf( lPath, "%s%s", lDir, iFileName );
+	}
+
+	if( lPath == 0 )
+		return TRH_OUT_OF_MEM;
+
+	TTrhConfig *lConfig;
+	int lCode;
+
+	pthread_mutex_lock( &gsConfig.mutex );
+
+	if( ( lCode = local_config_parse( lPath, &lConfig ) ) == TRH_OK ) {
+		free( gsConfig.path );
+		gsConfig.path = lPath;
+		local_config_swap( lConfig );
+	}
+	else
+		free( lPath );
+
+	pthread_mutex_unlock( &gsConfig.mutex );
+
+	return lCode;
+}
+
+int trh_config_reload()
+{
+	struct stat lStat;
+	int lCode = TRH_SKIP;
+
+	pthread_mutex_lock( &gsConfig.mutex );
+
+	TTrhConfig *lCurrent = atomic_load( &gsConfig.current );
+
+	if( gsConfig.path == 0 || lCurrent == 0 )
+		lCode = TRH_UNINITIALIZED;
+
+	// Editors usually replace the file (new inode); in-place writes change mtime or size.
+	else if( stat( gsConfig.path, &lStat ) != 0 ||
+		lStat.st_dev != lCurrent->dev || lStat.st_ino != lCurrent->ino || lStat.st_size != lCurrent->size ||
+		lStat.st_mtim.tv_sec != lCurrent->mtime.tv_sec || lStat.st_mtim.tv_nsec != lCurrent->mtime.tv_nsec ) {
+		TTrhConfig *lConfig;
+
+		if( ( lCode = local_config_parse( gsConfig.path, &lConfig ) ) == TRH_OK ) {
+			trh_log( LOG_NOTE, "Config '%s' has been reloaded.\n", gsConfig.path );
+			local_config_swap( lConfig );
+		}
+		else
+			trh_log( LOG_WARNING, "Failed to reload config '%s'; keeping the current config.\n", gsConfig.path );
+	}
+
+	pthread_mutex_unlock( &gsConfig.mutex );
+
+	return lCode;
+}
+
+int trh_config_watch( uint32_t iWindow )
+{
+	int lCode = TRH_OK;
+
+	pthread_mutex_lock( &gsConfig.mutex );
+
+	chars lName = gsConfig.path != 0 ? strrchr( gsConfig.path, '/' ) : 0;
+
+	if( lName == 0 ) {
+		pthread_mutex_unlock( &gsConfig.mutex );
+		return TRH_UNINITIALIZED;
+	}
+
+	trh_watch_remove( gsConfig.watch );
+	gsConfig.watch = 0;
+	FREE_PTR( gsConfig.watch_name );
+
+	char *lDir = strndup( gsConfig.path, lName == gsConfig.path ? 1 : (size_t)( lName - gsConfig.path ) );
+
+	if( lDir == 0 || ( gsConfig.watch_name = strdup( lName + 1 ) ) == 0 )
+		lCode = TRH_OUT_OF_MEM;
+	else if( ( lCode = trh_watch_add( lDir, TRH_WATCH_CLOSE_WRITE | TRH_WATCH_MOVED_TO, local_config_changed, 0, &gsConfig.watch ) ) == TRH_OK )
+		trh_watch_set_window( gsConfig.watch, iWindow );
+
+	free( lDir );
+	pthread_mutex_unlock( &gsConfig.mutex );
+
+	return lCode;
+}
+
+void trh_config_release()
+{
+	pthread_mutex_lock( &gsConfig.mutex );
+
+	trh_watch_remove( gsConfig.watch );
+	gsConfig.watch = 0;
+	FREE_PTR( gsConfig.watch_name );
+
+	local_config_swap( 0 );
+	FREE_PTR( gsConfig.path );
+
+	pthread_mutex_unlock( &gsConfig.mutex );
+}
+
+const TTrhConfig *trh_config_lock()
+{
+	if( gsReadDepth++ == 0 ) {
+		gsReadEpoch = atomic_load( &gsConfig.epoch ) & 1;
+		atomic_fetch_add( &gsConfig.readers[gsReadEpoch], 1 );
+	}
+
+	return atomic_load( &gsConfig.current );
+}
+
+void trh_config_unlock()
+{
+	assert( gsReadDepth > 0 );
+
+	if( gsReadDepth > 0 && --gsReadDepth == 0 )
+		atomic_fetch_sub( &gsConfig.readers[gsReadEpoch], 1 );
+}
+
+json_object *trh_config_get( const TTrhConfig *iConfig, chars iKey )
+{
+	if( iConfig == 0 || iKey == 0 )
+		return 0;
+
+	size_t lLength = strlen( iKey );
+	uint64_t lHash = local_config_hash( iKey, lLength );
+
+	for( size_t ii = lHash & iConfig->mask; iConfig->index[ii].key != 0; ii = ( ii + 1 ) & iConfig->mask ) {
+		if( iConfig->index[ii].hash == lHash && strcmp( iConfig->index[ii].key, iKey ) == 0 )
+			return iConfig->index[ii].value;
+	}
+
+	return 0;
+}
+
+int64_t trh_config_get_int( const TTrhConfig *iConfig, chars iKey, int64_t iDefault )
+{
+	json_object *lValue = trh_config_get( iConfig, iKey );
+
+	if( json_object_is_type( lValue, json_type_int ) || json_object_is_type( lValue, json_type_double ) )
+		return json_object_get_int64( lValue );
+
+	return iDefault;
+}
+
+double trh_config_get_double( const TTrhConfig *iConfig, chars iKey, double iDefault )
+{
+	json_object *lValue = trh_config_get( iConfig, iKey );
+
+	if( json_object_is_type( lValue, json_type_int ) || json_object_is_type( lValue, json_type_double ) )
+		return json_object_get_double( lValue );
+
+	return iDefault;
+}
+
+bool trh_config_get_bool( const TTrhConfig *iConfig, chars iKey, bool iDefault )
+{
+	json_object *lValue = trh_config_get( iConfig, iKey );
+
+	if( json_object_is_type( lValue, json_type_boolean ) )
+		return json_object_get_boolean( lValue );
+
+	return iDefault;
+}
+
+chars trh_config_get_string( const TTrhConfig *iConfig, chars iKey, chars iDefault )
+{
+	json_object *lValue = trh_config_get( iConfig, iKey );
+
+	if( json_object_is_type( lValue, json_type_string ) )
+		return json_object_get_string( lValue );
+
+	return iDefault;
+}
+
+uint64_t trh_config_generation( const TTrhConfig *iConfig )
+{
+	return iConfig != 0 ? iConfig->generation : 0;
+}
+
+// #endregion
+
+
+// #region Static functions
+
+uint64_t local_config_hash( chars iKey, size_t iLength )
+{
+	uint64_t lHash = CONFIG_HASH_OFFSET;
+
+	for( size_t ii = 0; ii < iLength; ii++ ) {
+		lHash ^= (unsigned char)iKey[ii];
+		lHash *= CONFIG_HASH_PRIME;
+	}
+
+	return lHash;
+}
+
+int local_config_parse( chars iPath, TTrhConfig **oConfig )
+{
+	struct stat lStat;
+	int lFile;
+
+	if( ( lFile = open( iPath, O_RDONLY | O_CLOEXEC ) ) < 0 || fstat( lFile, &lStat ) != 0 ) {
+		trh_log( LOG_WARNING, "Failed to open config '%s'. Error: %s\n", iPath, strerror(errno) );
+		if( lFile >= 0 ) close( lFile );
+		return TRH_JSON_LOAD_FAILED;
+	}
+
+	if( lStat.st_size <= 0 || lStat.st_size > INT_MAX ) {
+		trh_log( LOG_WARNING, "Config '%s' is empty or too large.\n", iPath );
+		close( lFile );
+		return TRH_JSON_INVALID;
+	}
+
+	// Parse directly from the page cache; no read buffer.
+	void *lData = mmap( 0, lStat.st_size, PROT_READ, MAP_PRIVATE, lFile, 0 );
+	close( lFile );
+
+	if( lData == MAP_FAILED ) {
+		trh_log( LOG_WARNING, "Failed to map config '%s'. Error: %s\n", iPath, strerror(errno) );
+		return TRH_JSON_LOAD_FAILED;
+	}
+
+	json_tokener *lTokener = json_tokener_new();
+	json_object *lRoot = 0;
+
+	if( lTokener != 0 ) {
+		lRoot = json_tokener_parse_ex( lTokener, (chars)lData, (int)lStat.st_size );
+
+		if( lRoot == 0 )
+			trh_log( LOG_WARNING, "Failed to parse config '%s'. Error: %s\n", iPath, json_tokener_error_desc( json_tokener_get_error( lTokener ) ) );
+
+		json_tokener_free( lTokener );
+	}
+
+	munmap( lData, lStat.st_size );
+
+	if( lTokener == 0 )
+		return TRH_OUT_OF_MEM;
+
+	if( ! json_object_is_type( lRoot, json_type_object ) ) {
+		if( lRoot != 0 )
+			trh_log( LOG_WARNING, "Config '%s' is not a JSON object.\n", iPath );
+		json_object_put( lRoot );
+		return TRH_JSON_INVALID;
+	}
+
+	// Size the index for load factor <= 0.5 and store all keys in one block.
+	size_t lCount = 0;
+	size_t lBytes = 0;
+	size_t lCapacity = 16;
+	local_config_count( lRoot, 0, &lCount, &lBytes );
+
+	while( lCapacity < lCount * 2 )
+		lCapacity <<= 1;
+
+	TTrhConfig *lConfig = calloc( 1, sizeof( TTrhConfig ) );
+	if( lConfig != 0 ) {
+		lConfig->index = calloc( lCapacity, sizeof( TTrhConfigEntry ) );
+		lConfig->keys = malloc( lBytes + 1 );
+	}
+
+	if( lConfig == 0 || lConfig->index == 0 || lConfig->keys == 0 ) {
+		if( lConfig != 0 ) {
+			free( lConfig->index );
+			free( lConfig->keys );
+			free( lConfig );
+		}
+		json_object_put( lRoot );
+		return TRH_OUT_OF_MEM;
+	}
+
+	char lKey[CONFIG_KEY_MAX];
+	char *lKeys = lConfig->keys;
+
+	lConfig->root = lRoot;
+	lConfig->mask = lCapacity - 1;
+	lConfig->dev = lStat.st_dev;
+	lConfig->ino = lStat.st_ino;
+	lConfig->size = lStat.st_size;
+	lConfig->mtime = lStat.st_mtim;
+	local_config_index( lConfig, lRoot, lKey, 0, &lKeys );
+
+	*oConfig = lConfig;
+	return TRH_OK;
+}
+
+void local_config_count( json_object *iObject, size_t iPrefix, size_t *oCount, size_t *oBytes )
+{
+	json_object_object_foreach( iObject, lName, lValue ) {
+		size_t lLength = iPrefix + strlen( lName );
+
+		if( lLength >= CONFIG_KEY_MAX )
+			continue;
+
+		*oCount += 1;
+		*oBytes += lLength + 1;
+
+		if( json_object_is_type( lValue, json_type_object ) )
+			local_config_count( lValue, lLength + 1, oCount, oBytes );
+	}
+}
+
+void local_config_index( TTrhConfig *iConfig, json_object *iObject, char *iKey, size_t iPrefix, char **ioKeys )
+{
+	json_object_object_foreach( iObject, lName, lValue ) {
+		size_t lNameLength = strlen( lName );
+		size_t lLength = iPrefix + lNameLength;
+
+		if( lLength >= CONFIG_KEY_MAX ) {
+			trh_log( LOG_WARNING, "Config key '%.*s%s' is too long; skipped.\n", (int)iPrefix, iKey, lName );
+			continue;
+		}
+
+		memcpy( iKey + iPrefix, lName, lNameLength + 1 );
+
+		// Copy the key to the key storage of the config.
+		memcpy( *ioKeys, iKey, lLength + 1 );
+		local_config_insert( iConfig, *ioKeys, lLength, lValue );
+		*ioKeys += lLength + 1;
+
+		if( json_object_is_type( lValue, json_type_object ) ) {
+			iKey[lLength] = '.';
+			local_config_index( iConfig, lValue, iKey, lLength + 1, ioKeys );
+		}
+	}
+}
+
+void local_config_insert( TTrhConfig *iConfig, chars iKey, size_t iLength, json_object *iValue )
+{
+	uint64_t lHash = local_config_hash( iKey, iLength );
+	size_t ii = lHash & iConfig->mask;
+
+	// Key containing '.' can collide with a nested key - the later one wins.
+	while( iConfig->index[ii].key != 0 && ( iConfig->index[ii].hash != lHash || strcmp( iConfig->index[ii].key, iKey ) != 0 ) )
+		ii = ( ii + 1 ) & iConfig->mask;
+
+	iConfig->index[ii].hash = lHash;
+	iConfig->index[ii].key = iKey;
+	iConfig->index[ii].value = iValue;
+}
+
+// Publish new config and free the old one once there are no readers. Called with the writer mutex locked.
+void local_config_swap( TTrhConfig *iConfig )
+{
+	if( iConfig != 0 )
+		iConfig->generation = ++gsConfig.generation;
+
+	TTrhConfig *lOld = atomic_exchange( &gsConfig.current, iConfig );
+
+	if( lOld != 0 ) {
+		local_config_synchronize();
+		local_config_free( lOld );
+	}
+}
+
+void local_config_synchronize()
+{
+	// Reader can load the epoch before the flip and increment its counter after the writer checked it;
+	// the second flip waits for such a reader as well.
+	for( int ii = 0; ii < 2; ii++ ) {
+		unsigned lEpoch = atomic_fetch_add( &gsConfig.epoch, 1 ) & 1;
+
+		while( atomic_load( &gsConfig.readers[lEpoch] ) != 0 )
+			sched_yield();
+	}
+}
+
+// Watch callback - executed on the loop that called trh_config_watch().
+void local_config_changed( struct TTrhWatch *iWatch, uint32_t iMask, chars iName, void *iArg )
+{
+	pthread_mutex_lock( &gsConfig.mutex );
+	bool lMatch = iName != 0 && gsConfig.watch_name != 0 && strcmp( iName, gsConfig.watch_name ) == 0;
+	pthread_mutex_unlock( &gsConfig.mutex );
+
+	// Reload checks inode, size and mtime - unchanged file is not parsed again.
+	if( lMatch )
+		trh_config_reload();
+}
+
+void local_config_free( TTrhConfig *iConfig )
+{
+	json_object_put( iConfig->root );
+	free( iConfig->index );
+	free( iConfig->keys );
+	free( iConfig );
+}
+
+// #endregion
@@ -6,16 +6,61 @@
 
 // #region Includes
 
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
+
 #include "trihlav.h"
 #include "trh_logger.h"
+#include "trh_std.h"
+#include "trh_timer.h"
 #include "trh_dbus.h"
+#include "trh_loop.h"
+#include "trh_stats.h"
 
 
 // #endregion
 
 
+// Initial number of cached properties.
+#define DBUS_PROPERTY_CACHE_SIZE	16
+// Initial number of objects / properties with coalesced PropertiesChanged signal.
+#define DBUS_SIGNAL_SIZE			8
+// FNV-1a (64 bit)
+#define DBUS_HASH_OFFSET			14695981039346656037ull
+#define DBUS_HASH_PRIME				1099511628211ull
+
 // #region Structures
 
+// Cached value of a property (trh_dbus_property_cached).
+typedef struct TTrhDbusProperty {
+	uint64_t hash;
+	// Path, interface and property name in one block ("path\0interface\0property").
+	char *path;
+	chars interface;
+	chars property;
+	// Sealed message holding the value; null once the value has been invalidated.
+	sd_bus_message *value;
+} TTrhDbusProperty;
+
+// Coalesced PropertiesChanged signal of one object interface (trh_dbus_property_changed).
+typedef struct TTrhDbusSignal {
+	// Path and interface in one block ("path\0interface").
+	char *path;
+	chars interface;
+	// Changed properties; null-terminated.
+	char **names;
+	size_t name_count;
+	size_t name_size;
+	// All properties have been changed - names are not used.
+	bool all;
+	// Signal waits for the flush.
+	bool pending;
+} TTrhDbusSignal;
+
 typedef struct TTrhDbus {
 	// Pointer to dbus object.
 	sd_bus *ptr;
@@ -27,8 +72,187 @@ typedef struct TTrhDbus {
 	chars obj_path;
 	chars interface;
 
+	// Bus fd registered with epoll.
+	TTrhEvent event;
+
+	// Timer processing bus timeouts (sd_bus_get_timeout).
+	TTrhEvent *timeout;
+
+	// Absolute bus timeout (CLOCK_MONOTONIC, usec) the timer is armed for.
+	uint64_t timeout_usec;
+
+	// Property cache; entries are kept for the life of the connection, values are dropped on invalidation.
+	TTrhDbusProperty *properties;
+	size_t property_count;
+	size_t property_size;
+
+	// Coalesced signals; entries are kept for the life of the connection.
+	TTrhDbusSignal *signals;
+	size_t signal_count;
+	size_t signal_size;
+	// Coalescing window (ms); 0 flushes after the current loop iteration.
+	uint32_t signal_window;
+	// Flush timer (created on first use) or posted task is pending.
+	TTrhEvent *signal_timer;
+	bool signal_scheduled;
+
+	// Number of asynchronous method calls waiting for reply.
+	size_t calls;
+	// Batches not released yet.
+	struct TTrhDbusBatch *batches;
+
 } TTrhDbus;
 
+// Batch of asynchronous method calls.
+typedef struct TTrhDbusBatch {
+	// Number of calls waiting for reply.
+	int pending;
+	// Number of failed calls.
+	int failed;
+	// If true, no more calls can be added.
+	bool committed;
+
+	handle_dbus_batch handle_done;
+	void *ext;
+
+	// List of batches released by trh_dbus_release().
+	struct TTrhDbusBatch *prev;
+	struct TTrhDbusBatch *next;
+} TTrhDbusBatch;
+
+// Asynchronous method call waiting for reply.
+typedef struct TTrhDbusCall {
+	handle_dbus_reply handle_reply;
+	void *ext;
+	// Batch the call belongs to. Can be null.
+	TTrhDbusBatch *batch;
+	// Reply callback has been executed.
+	bool replied;
+} TTrhDbusCall;
+
+// #endregion
+
+
+// #region Static functions
+
+/**
+ * @brief Register bus fd with epoll and create timeout timer.
+ */
+static int local_dbus_register();
+
+/**
+ * @brief Process pending bus messages. Executed when bus fd is ready.
+ */
+static int local_dbus_event( TTrhEvent *iEvent );
+
+/**
+ * @brief Process pending bus messages. Executed when bus timeout expires.
+ */
+static int local_dbus_timeout( TTrhEvent *iEvent );
+
+/**
+ * @brief Update epoll events and timeout timer from bus state.
+ *
+ * Must be called whenever sd-bus could have queued outgoing messages.
+ */
+static void local_dbus_arm();
+
+/**
+ * @brief Validate message describing a method call.
+ */
+static int local_dbus_validate_message( TTrhDbusMessage *iMsg );
+
+/**
+ * @brief Create method call message and send it asynchronously.
+ */
+static int local_dbus_call_async( TTrhDbusMessage *iMsg, TTrhDbusCall *iCall, va_list iArgs );
+
+/**
+ * @brief Receive reply to asynchronous method call.
+ */
+static int local_dbus_reply( sd_bus_message *iReply, void *iUserData, sd_bus_error *oError );
+
+/**
+ * @brief Release asynchronous method call. Executed when its slot is released - after the reply,
+ * or when the bus is closed before the reply arrives (the call is cancelled).
+ */
+static void local_dbus_call_destroy( void *iUserData );
+
+/**
+ * @brief Release the batch after its callback.
+ */
+static void local_dbus_batch_free( TTrhDbusBatch *iBatch );
+
+/**
+ * @brief Count finished call in a batch; execute batch callback when all calls are finished.
+ */
+static void local_dbus_batch_done( TTrhDbusBatch *iBatch, bool iFailed );
+
+/**
+ * @brief Create method return with leading arguments described by iTypes (can be null).
+ */
+static int local_dbus_reply_new( sd_bus_message *iCall, chars iTypes, va_list iArgs, sd_bus_message **oReply );
+
+/**
+ * @brief Send reply created by local_dbus_reply_new, if iCode is success; release it.
+ */
+static int local_dbus_reply_send( sd_bus_message *iReply, int iCode );
+
+/**
+ * @brief Hash of property key.
+ */
+static uint64_t local_dbus_property_hash( chars iPath, chars iInterface, chars iProperty );
+
+/**
+ * @brief Find cached property; create the entry if iCreate is true. Return null if not found / out of memory.
+ */
+static TTrhDbusProperty *local_dbus_property_find( chars iPath, chars iInterface, chars iProperty, bool iCreate );
+
+/**
+ * @brief Release all cached properties.
+ */
+static void local_dbus_property_release();
+
+/**
+ * @brief Find coalesced signal of the object interface; create it if it does not exist.
+ */
+static TTrhDbusSignal *local_dbus_signal_find( chars iPath, chars iInterface );
+
+/**
+ * @brief Add property to coalesced signal.
+ */
+static int local_dbus_signal_add( TTrhDbusSignal *iSignal, chars iProperty );
+
+/**
+ * @brief Arm flush timer, or post flush task if the window is 0.
+ */
+static int local_dbus_signal_schedule();
+
+/**
+ * @brief Flush coalesced signals. Executed when flush timer expires.
+ */
+static int local_dbus_signal_timer( TTrhEvent *iEvent );
+
+/**
+ * @brief Flush coalesced signals. Posted to the bus loop.
+ */
+static void local_dbus_signal_task( void *iArg );
+
+/**
+ * @brief Drop changed properties of the signal.
+ */
+static void local_dbus_signal_clear( TTrhDbusSignal *iSignal );
+
+/**
+ * @brief Release all coalesced signals and the flush timer.
+ */
+static void local_dbus_signal_release();
+
+/**
+ * @brief Append one (sttttt) entry of trh_dbus_stats_method to the reply.
+ */
+static int local_dbus_stats_append( sd_bus_message *iReply, chars iName, const TTrhHistogram *iHistogram );
+
 // #endregion
 
 
@@ -39,7 +263,21 @@ static TTrhDbus gsBus = {
 	.slot = 0,
 	.destination = 0,
 	.obj_path = 0,
-	.interface = 0
+	.interface = 0,
+	.event = { .fd = -1 },
+	.timeout = 0,
+	.timeout_usec = UINT64_MAX,
+	.properties = 0,
+	.property_count = 0,
+	.property_size = 0,
+	.signals = 0,
+	.signal_count = 0,
+	.signal_size = 0,
+	.signal_window = TRH_DBUS_SIGNAL_WINDOW_DEFAULT,
+	.signal_timer = 0,
+	.signal_scheduled = false,
+	.calls = 0,
+	.batches = 0
 };
 
 // #endregion
@@ -76,6 +314,10 @@ int trh_dbus_init( chars iDestination, chars iPath, chars iInterface, const sd_b
 		return TRH_DBUS_INIT_FAILED;
 	}
 
+	// Process bus messages from the main loop.
+	if( local_dbus_register() != TRH_OK )
+		return TRH_DBUS_INIT_FAILED;
+
 	return lRetCode;
 }
 
@@ -86,6 +328,8 @@ void trh_dbus_subscribe_signal( chars iMatch, sd_bus_message_handler_t iCallback
 	if( ( lRetCode = sd_bus_add_match( gsBus.ptr, 0, iMatch, iCallback, 0 ) ) < 0 ) {
 		trh_log( LOG_ERROR, "Failed to subscribe to signal %s. Error: %s\n", iWarning, strerror( -lRetCode ) );
 	}
+
+	local_dbus_arm();
 }
 
 // Process all incoming messages; send penging calls and signals.
@@ -96,6 +340,10 @@ int trh_dbus_process()
 	if( gsBus.ptr == 0 )
 		return TRH_OK;
 
+#ifdef TRH_LOOP_STATS
+	const uint64_t lStart = trh_time_ns();
+#endif
+
 	do {
 		if( ( lRetCode = sd_bus_process( gsBus.ptr, 0 ) ) < 0 ) {
 			trh_log( LOG_ERROR, "SDBUS failed to process. Error: %s\n", strerror( -lRetCode ) );
@@ -103,6 +351,14 @@ int trh_dbus_process()
 		}
 	} while( lRetCode > 0 );
 
+#ifdef TRH_LOOP_STATS
+	TTrhLoopStats *lStats = trh_loop_stats_data( gsBus.event.loop );
+	if( lStats != 0 )
+		trh_histogram_record( &lStats->dbus, trh_time_ns() - lStart );
+#endif
+
+	local_dbus_arm();
+
 	return TRH_OK;
 }
 
@@ -111,6 +367,90 @@ void* trh_dbus_ptr()
 	return gsBus.ptr;
 }
 
+int trh_dbus_method_async( TTrhDbusMessage *iMsg, handle_dbus_reply iCallback, void *iUserData, ... )
+{
+	int lCode = TRH_OK;
+	va_list args;
+
+	TTrhDbusCall *lCall = (TTrhDbusCall*)malloc( sizeof( TTrhDbusCall ) );
+	if( lCall == 0 ) return TRH_OUT_OF_MEM;
+
+	lCall->handle_reply = iCallback;
+	lCall->ext = iUserData;
+	lCall->batch = 0;
+	lCall->replied = false;
+
+	va_start( args, iUserData );
+	lCode = local_dbus_call_async( iMsg, lCall, args );
+	va_end( args );
+
+	if( lCode != TRH_OK )
+		free( lCall );
+
+	return lCode;
+}
+
+TTrhDbusBatch *trh_dbus_batch_new( handle_dbus_batch iDone, void *iUserData )
+{
+	TTrhDbusBatch *lBatch = (TTrhDbusBatch*)malloc( sizeof( TTrhDbusBatch ) );
+	if( lBatch == 0 ) return 0;
+
+	memset( lBatch, 0, sizeof( TTrhDbusBatch ) );
+	lBatch->handle_done = iDone;
+	lBatch->ext = iUserData;
+
+	lBatch->next = gsBus.batches;
+	if( gsBus.batches != 0 )
+		gsBus.batches->prev = lBatch;
+	gsBus.batches = lBatch;
+
+	return lBatch;
+}
+
+int trh_dbus_batch_method( TTrhDbusBatch *iBatch, TTrhDbusMessage *iMsg, handle_dbus_reply iCallback, void *iUserData, ... )
+{
+	int lCode = TRH_OK;
+	va_list args;
+
+	TRH_ASSERT_ARG( iBatch != 0 && ! iBatch->committed, "Failed to add dbus call - invalid batch." );
+
+	TTrhDbusCall *lCall = (TTrhDbusCall*)malloc( sizeof( TTrhDbusCall ) );
+	if( lCall == 0 ) return TRH_OUT_OF_MEM;
+
+	lCall->handle_reply = iCallback;
+	lCall->ext = iUserData;
+	lCall->batch = iBatch;
+	lCall->replied = false;
+
+	va_start( args, iUserData );
+	lCode = local_dbus_call_async( iMsg, lCall, args );
+	va_end( args );
+
+	if( lCode != TRH_OK ) {
+		free( lCall );
+		return lCode;
+	}
+
+	iBatch->pending++;
+
+	return TRH_OK;
+}
+
+int trh_dbus_batch_commit( TTrhDbusBatch *iBatch )
+{
+	TRH_ASSERT_ARG( iBatch != 0 && ! iBatch->committed, "Failed to commit dbus batch - invalid batch." );
+
+	iBatch->committed = true;
+
+	// All replies could have been received already. Pending count is not changed.
+	if( iBatch->pending == 0 ) {
+		iBatch->pending = 1;
+		local_dbus_batch_done( iBatch, false );
+	}
+
+	return TRH_OK;
+}
+
 // static int local_dbus_validate_message( TTrhDbusMessage *iMsg )
 // {
 //	TRH_ASSERT_ARG( iMsg != 0 && iMsg->destination != 0 && iMsg->path != 0 && iMsg->interface != 0 && iMsg->member != 0 && iMsg->response != 0, "Failed to validate dbus message." );
@@ -161,6 +501,9 @@ int trh_dbus_reply( sd_bus_message *iMsg )
 		return TRH_DBUS_SEND_FAILED;
 	}
 
+	// Response could be queued - wait until the bus is writable.
+	local_dbus_arm();
+
 	return TRH_OK;
 }
 
@@ -171,22 +514,761 @@ int trh_dbus_reply_error( sd_bus_error *iError, chars iText, int iErrno )
 	return TRH_DBUS_ARG_FAILED;
 }
 
+int trh_dbus_reply_array( sd_bus_message *iCall, chars iTypes, char iType, const void *iData, size_t iSize, ... )
+{
+	sd_bus_message *lReply = 0;
+	va_list args;
+
+	TRH_ASSERT_ARG( iCall != 0 && ( iData != 0 || iSize == 0 ), "Failed to reply - invalid argument." );
+
+	va_start( args, iSize );
+	int lCode = local_dbus_reply_new( iCall, iTypes, args, &lReply );
+	va_end( args );
+	if( lCode != TRH_OK ) return lCode;
+
+	return local_dbus_reply_send( lReply, sd_bus_message_append_array( lReply, iType, iData, iSize ) );
+}
+
+int trh_dbus_reply_iovec( sd_bus_message *iCall, chars iTypes, char iType, const struct iovec *iVector, unsigned iCount, ... )
+{
+	sd_bus_message *lReply = 0;
+	va_list args;
+
+	TRH_ASSERT_ARG( iCall != 0 && ( iVector != 0 || iCount == 0 ), "Failed to reply - invalid argument." );
+
+	va_start( args, iCount );
+	int lCode = local_dbus_reply_new( iCall, iTypes, args, &lReply );
+	va_end( args );
+	if( lCode != TRH_OK ) return lCode;
+
+	return local_dbus_reply_send( lReply, sd_bus_message_append_array_iovec( lReply, iType, iVector, iCount ) );
+}
+
+int trh_dbus_reply_memfd( sd_bus_message *iCall, chars iTypes, char iType, int iMemfd, uint64_t iOffset, uint64_t iSize, ... )
+{
+	sd_bus_message *lReply = 0;
+	va_list args;
+
+	TRH_ASSERT_ARG( iCall != 0 && iMemfd >= 0, "Failed to reply - invalid argument." );
+
+	va_start( args, iSize );
+	int lCode = local_dbus_reply_new( iCall, iTypes, args, &lReply );
+	va_end( args );
+	if( lCode != TRH_OK ) return lCode;
+
+	return local_dbus_reply_send( lReply, sd_bus_message_append_array_memfd( lReply, iType, iMemfd, iOffset, iSize ) );
+}
+
+int trh_dbus_property_cached( sd_bus_message *oReply, chars iPath, chars iInterface, chars iProperty,
+	sd_bus_property_get_t iGetter, void *iUserData, sd_bus_error *oError )
+{
+	sd_bus_message *lValue = 0;
+	int lCode;
+
+	if( oReply == 0 || iPath == 0 || iInterface == 0 || iProperty == 0 || iGetter == 0 )
+		return -EINVAL;
+
+	TTrhDbusProperty *lEntry = local_dbus_property_find( iPath, iInterface, iProperty, true );
+
+	// Out of memory - serve the value without caching.
+	if( lEntry == 0 )
+		return iGetter( gsBus.ptr, iPath, iInterface, iProperty, oReply, iUserData, oError );
+
+	if( lEntry->value == 0 ) {
+		// Value is built once into a detached message; the message is never sent.
+		if( sd_bus_message_new_signal( gsBus.ptr, &lValue, iPath, iInterface, iProperty ) < 0 )
+			return iGetter( gsBus.ptr, iPath, iInterface, iProperty, oReply, iUserData, oError );
+
+		if( ( lCode = iGetter( gsBus.ptr, iPath, iInterface, iProperty, lValue, iUserData, oError ) ) < 0
+		 || ( lCode = sd_bus_message_seal( lValue, 1, 0 ) ) < 0 ) {
+			sd_bus_message_unref( lValue );
+			return lCode;
+		}
+
+		lEntry->value = lValue;
+	}
+
+	if( ( lCode = sd_bus_message_rewind( lEntry->value, true ) ) < 0 )
+		return lCode;
+
+	return sd_bus_message_copy( oReply, lEntry->value, false );
+}
+
+void trh_dbus_property_invalidate( chars iPath, chars iInterface, chars iProperty )
+{
+	// Single property - hash lookup.
+	if( iPath != 0 && iInterface != 0 && iProperty != 0 ) {
+		TTrhDbusProperty *lEntry = local_dbus_property_find( iPath, iInterface, iProperty, false );
+		if( lEntry != 0 )
+			lEntry->value = sd_bus_message_unref( lEntry->value );
+		return;
+	}
+
+	for( size_t ii = 0; ii < gsBus.property_count; ii++ ) {
+		TTrhDbusProperty *lEntry = &gsBus.properties[ii];
+
+		if( ( iPath == 0 || strcmp( lEntry->path, iPath ) == 0 ) && ( iInterface == 0 || strcmp( lEntry->interface, iInterface ) == 0 ) )
+			lEntry->value = sd_bus_message_unref( lEntry->value );
+	}
+}
+
+int trh_dbus_emit_properties_changed( chars iPath, chars iInterface, char **iNames )
+{
+	TRH_ASSERT_ARG( iPath != 0 && iInterface != 0, "Failed to emit PropertiesChanged - invalid argument." );
+
+	if( gsBus.ptr == 0 )
+		return TRH_UNINITIALIZED;
+
+	// Empty list - nothing has changed.
+	if( iNames != 0 && iNames[0] == 0 )
+		return TRH_OK;
+
+	if( iNames == 0 )
+		trh_dbus_property_invalidate( iPath, iInterface, 0 );
+	else {
+		for( char **lName = iNames; *lName != 0; lName++ )
+			trh_dbus_property_invalidate( iPath, iInterface, *lName );
+	}
+
+	int lCode = sd_bus_emit_properties_changed_strv( gsBus.ptr, iPath, iInterface, iNames );
+	if( lCode < 0 ) {
+		trh_log( LOG_ERROR, "SDBUS failed to emit PropertiesChanged. Error: %s\n", strerror( -lCode ) );
+		return TRH_DBUS_SEND_FAILED;
+	}
+
+	local_dbus_arm();
+
+	return TRH_OK;
+}
+
+void trh_dbus_set_signal_window( uint32_t iMilliseconds )
+{
+	gsBus.signal_window = iMilliseconds;
+}
+
+int trh_dbus_property_changed( chars iPath, chars iInterface, chars iProperty )
+{
+	TRH_ASSERT_ARG( iPath != 0 && iInterface != 0, "Failed to queue PropertiesChanged - invalid argument." );
+
+	if( gsBus.ptr == 0 )
+		return TRH_UNINITIALIZED;
+
+	// Getters see the new value before the signal is sent.
+	trh_dbus_property_invalidate( iPath, iInterface, iProperty );
+
+	TTrhDbusSignal *lSignal = local_dbus_signal_find( iPath, iInterface );
+	if( lSignal == 0 ) return TRH_OUT_OF_MEM;
+
+	int lCode = local_dbus_signal_add( lSignal, iProperty );
+	if( lCode != TRH_OK ) return lCode;
+
+	lSignal->pending = true;
+
+	return local_dbus_signal_schedule();
+}
+
+int trh_dbus_flush_signals()
+{
+	int lResult = TRH_OK;
+
+	if( gsBus.signal_scheduled ) {
+		gsBus.signal_scheduled = false;
+		if( gsBus.signal_timer != 0 )
+			trh_timer_stop( gsBus.signal_timer );
+	}
+
+	if( gsBus.ptr == 0 )
+		return TRH_OK;
+
+	for( size_t ii = 0; ii < gsBus.signal_count; ii++ ) {
+		TTrhDbusSignal *lSignal = &gsBus.signals[ii];
+		if( ! lSignal->pending ) continue;
+
+		// Values are read by the property getters now - the signal carries the latest ones.
+		int lCode = sd_bus_emit_properties_changed_strv( gsBus.ptr, lSignal->path, lSignal->interface, lSignal->all ? 0 : lSignal->names );
+		if( lCode < 0 ) {
+			trh_log( LOG_ERROR, "SDBUS failed to emit PropertiesChanged of %s. Error: %s\n", lSignal->path, strerror( -lCode ) );
+			lResult = TRH_DBUS_SEND_FAILED;
+		}
+
+		local_dbus_signal_clear( lSignal );
+	}
+
+	local_dbus_arm();
+
+	return lResult;
+}
+
+size_t trh_dbus_pending()
+{
+	if( gsBus.ptr == 0 )
+		return 0;
+
+	// Messages waiting in the output queue count as one operation.
+	const int lEvents = sd_bus_get_events( gsBus.ptr );
+
+	return gsBus.calls + ( gsBus.signal_scheduled ? 1 : 0 ) + ( lEvents > 0 && ( lEvents & POLLOUT ) ? 1 : 0 );
+}
+
+int trh_dbus_stats_method( sd_bus_message *iMsg, void *iUserData, sd_bus_error *oError )
+{
+	sd_bus_message *lReply = 0;
+	TTrhLoopStats *lStats = trh_loop_stats_data( gsBus.event.loop );
+	char lName[128];
+	int lCode;
+
+	(void)iUserData;
+
+	if( lStats == 0 )
+		return sd_bus_error_set( oError, SD_BUS_ERROR_NOT_SUPPORTED, "Library is built without TRH_LOOP_STATS." );
+
+	if( ( lCode = sd_bus_message_new_method_return( iMsg, &lReply ) ) < 0 )
+		return lCode;
+
+	if( ( lCode = sd_bus_message_open_container( lReply, 'a', "(sttttt)" ) ) >= 0
+	 && ( lCode = local_dbus_stats_append( lReply, "loop.events", &lStats->events ) ) >= 0
+	 && ( lCode = local_dbus_stats_append( lReply, "loop.dispatch", &lStats->dispatch ) ) >= 0
+	 && ( lCode = local_dbus_stats_append( lReply, "loop.timer_lateness", &lStats->timer_lateness ) ) >= 0
+	 && ( lCode = local_dbus_stats_append( lReply, "loop.dbus", &lStats->dbus ) ) >= 0 ) {
+		for( size_t ii = 0; ii < lStats->handler_count && lCode >= 0; ii++ ) {
+			trh_stats_handler_name( lStats->handlers[ii].handler, lName, sizeof( lName ) );
+			lCode = local_dbus_stats_append( lReply, lName, &lStats->handlers[ii].runtime );
+		}
+	}
+
+	if( lCode >= 0 )
+		lCode = sd_bus_message_close_container( lReply );
+	if( lCode >= 0 )
+		lCode = sd_bus_send( 0, lReply, 0 );
+
+	sd_bus_message_unref( lReply );
+
+	return lCode < 0 ? lCode : 1;
+}
+
 // Close dbus link.
 void trh_dbus_release()
 {
 	trh_log( LOG_DEBUG, "Releasing dbus...\n" );
 
+	if( gsBus.event.fd != -1 ) {
+		trh_event_unregister( &gsBus.event );
+		gsBus.event.fd = -1;
+	}
+
+	if( gsBus.timeout != 0 ) {
+		trh_timer_release( gsBus.timeout );
+		gsBus.timeout = 0;
+		gsBus.timeout_usec = UINT64_MAX;
+	}
+
 	if( gsBus.slot != 0 ) {
 		sd_bus_slot_unref( gsBus.slot );
 		gsBus.slot = 0;
 	}
 
+	local_dbus_signal_release();
+	local_dbus_property_release();
+
+	if( gsBus.calls > 0 )
+		trh_log( LOG_WARNING, "DBUS released with %zu calls waiting for reply; they are cancelled.\n", gsBus.calls );
+
 	if( gsBus.ptr != 0 ) {
-		sd_bus_release_name( gsBus.ptr, gsBus.destination );
-		sd_bus_close( gsBus.ptr );
-		sd_bus_unref( gsBus.ptr );
+		// Reply callbacks of cancelled calls see the bus closed already.
+		sd_bus *lBus = gsBus.ptr;
 		gsBus.ptr = 0;
+
+		sd_bus_release_name( lBus, gsBus.destination );
+		sd_bus_close( lBus );
+		sd_bus_unref( lBus );
+	}
+
+	// Batches which have not been committed are completed, too.
+	while( gsBus.batches != 0 ) {
+		TTrhDbusBatch *lBatch = gsBus.batches;
+
+		if( lBatch->handle_done != 0 )
+			lBatch->handle_done( lBatch->failed + lBatch->pending, lBatch->ext );
+
+		local_dbus_batch_free( lBatch );
+	}
+
+	gsBus.calls = 0;
+}
+
+// #endregion
+
+
+// #region Static functions
+
+int local_dbus_register()
+{
+	int lFd = sd_bus_get_fd( gsBus.ptr );
+
+	if( lFd < 0 ) {
+		trh_log( LOG_ERROR, "SDBUS failed to get fd. Error: %s\n", strerror( -lFd ) );
+		return TRH_DBUS_INIT_FAILED;
+	}
+
+	// Timer with zero duration is created in disarmed state.
+	TTrhTimerProperties lTimeout = {
+		.sec = 0,
+		.nsec = 0,
+		.repeat = false,
+		.handle_timer_event = local_dbus_timeout
+	};
+
+	if( trh_timer_init( &lTimeout, &gsBus.timeout ) != TRH_OK )
+		return TRH_DBUS_INIT_FAILED;
+
+	gsBus.timeout_usec = UINT64_MAX;
+
+	gsBus.event.fd = lFd;
+	gsBus.event.events = EPOLLIN;
+	gsBus.event.handle_triggered = local_dbus_event;
+	gsBus.event.handle_error = local_dbus_event;
+	gsBus.event.ext.data = &gsBus;
+
+	if( trh_event_register( &gsBus.event ) != TRH_OK ) {
+		gsBus.event.fd = -1;
+		return TRH_DBUS_INIT_FAILED;
+	}
+
+	// Messages could be already queued during initialization.
+	local_dbus_arm();
+
+	return TRH_OK;
+}
+
+int local_dbus_event( TTrhEvent *iEvent )
+{
+	return trh_dbus_process();
+}
+
+int local_dbus_timeout( TTrhEvent *iEvent )
+{
+	// Timer is not repeating; it is re-armed by trh_dbus_process() if needed.
+	gsBus.timeout_usec = UINT64_MAX;
+	return trh_dbus_process();
+}
+
+void local_dbus_arm()
+{
+	if( gsBus.ptr == 0 || gsBus.event.fd == -1 )
+		return;
+
+	// Poll for writing only when sd-bus has queued outgoing messages.
+	int lEvents = sd_bus_get_events( gsBus.ptr );
+	if( lEvents >= 0 ) {
+		uint32_t lMask = ( lEvents & POLLIN ? EPOLLIN : 0 ) | ( lEvents & POLLOUT ? EPOLLOUT : 0 );
+		if( lMask == 0 ) lMask = EPOLLIN;
+
+		if( lMask != gsBus.event.events ) {
+			gsBus.event.events = lMask;
+			trh_event_modify( &gsBus.event );
+		}
+	}
+
+	// Arm timer for the earliest pending bus timeout (method call replies, authentication).
+	uint64_t lTimeout = UINT64_MAX;
+	if( sd_bus_get_timeout( gsBus.ptr, &lTimeout ) < 0 )
+		lTimeout = UINT64_MAX;
+
+	if( lTimeout == gsBus.timeout_usec )
+		return;
+
+	gsBus.timeout_usec = lTimeout;
+
+	if( lTimeout == UINT64_MAX ) {
+		trh_timer_stop( gsBus.timeout );
+		return;
+	}
+
+	const uint64_t lNowUsec = trh_time_ns() / 1000ull;
+
+	// Timeout in the past must be processed as soon as possible; zero duration would disarm the timer.
+	const uint64_t lRelUsec = lTimeout > lNowUsec ? lTimeout - lNowUsec : 1;
+	gsBus.timeout->ext.timer->sec = lRelUsec / 1000000ull;
+	gsBus.timeout->ext.timer->nsec = ( lRelUsec % 1000000ull ) * 1000ull;
+	trh_timer_start( gsBus.timeout );
+}
+
+int local_dbus_validate_message( TTrhDbusMessage *iMsg )
+{
+	TRH_ASSERT_ARG( iMsg != 0 && iMsg->destination != 0 && iMsg->path != 0 && iMsg->interface != 0 && iMsg->member != 0, "Failed to validate dbus message." );
+
+	return TRH_OK;
+}
+
+int local_dbus_call_async( TTrhDbusMessage *iMsg, TTrhDbusCall *iCall, va_list iArgs )
+{
+	int lCode = TRH_OK;
+	_cleanup_(sd_bus_message_unrefp) sd_bus_message *lCall = 0;
+	sd_bus_slot *lSlot = 0;
+
+	if( ( lCode = local_dbus_validate_message( iMsg ) ) != TRH_OK )
+		return lCode;
+
+	if( gsBus.ptr == 0 )
+		return TRH_UNINITIALIZED;
+
+	if( ( lCode = sd_bus_message_new_method_call( gsBus.ptr, &lCall, iMsg->destination, iMsg->path, iMsg->interface, iMsg->member ) ) < 0 ) {
+		trh_log( LOG_ERROR, "DBUS method %s failed. Error: %s\n", iMsg->member, strerror( -lCode ) );
+		return TRH_DBUS_SEND_FAILED;
+	}
+
+	if( iMsg->types != 0 && iMsg->types[0] != 0 && ( lCode = sd_bus_message_appendv( lCall, iMsg->types, iArgs ) ) < 0 ) {
+		trh_log( LOG_ERROR, "DBUS method %s - invalid arguments. Error: %s\n", iMsg->member, strerror( -lCode ) );
+		return TRH_DBUS_ARG_FAILED;
+	}
+
+	if( ( lCode = sd_bus_call_async( gsBus.ptr, &lSlot, lCall, local_dbus_reply, iCall, 0 ) ) < 0 ) {
+		trh_log( LOG_ERROR, "DBUS method %s failed. Error: %s\n", iMsg->member, strerror( -lCode ) );
+		return TRH_DBUS_SEND_FAILED;
+	}
+
+	// Slot is owned by the bus. Reply callback is executed at most once (reply, error or timeout);
+	// the call is released with the slot, also when the bus is closed without reply.
+	sd_bus_slot_set_destroy_callback( lSlot, local_dbus_call_destroy );
+	sd_bus_slot_set_floating( lSlot, 1 );
+	sd_bus_slot_unref( lSlot );
+
+	trh_log( LOG_DEBUG, "DBUS method %s... \n", iMsg->member );
+	gsBus.calls++;
+
+	// Call is queued - wait until the bus is writable, and arm the reply timeout.
+	local_dbus_arm();
+
+	return TRH_OK;
+}
+
+int local_dbus_reply( sd_bus_message *iReply, void *iUserData, sd_bus_error *oError )
+{
+	TTrhDbusCall *lCall = (TTrhDbusCall*)iUserData;
+	const sd_bus_error *lError = sd_bus_message_is_method_error( iReply, 0 ) ? sd_bus_message_get_error( iReply ) : 0;
+
+	lCall->replied = true;
+
+	if( lError != 0 )
+		trh_log( LOG_WARNING, "DBUS method failed. Error: %s\n", lError->message != 0 ? lError->message : lError->name );
+
+	if( lCall->handle_reply != 0 )
+		lCall->handle_reply( iReply, lError, lCall->ext );
+
+	if( lCall->batch != 0 )
+		local_dbus_batch_done( lCall->batch, lError != 0 );
+
+	return 0;
+}
+
+void local_dbus_call_destroy( void *iUserData )
+{
+	static const sd_bus_error lsCancelled = { TRH_DBUS_ERROR_CANCELLED, "Connection has been closed before the reply.", 0 };
+	TTrhDbusCall *lCall = (TTrhDbusCall*)iUserData;
+
+	if( gsBus.calls > 0 )
+		gsBus.calls--;
+
+	if( ! lCall->replied ) {
+		if( lCall->handle_reply != 0 )
+			lCall->handle_reply( 0, &lsCancelled, lCall->ext );
+
+		if( lCall->batch != 0 )
+			local_dbus_batch_done( lCall->batch, true );
+	}
+
+	free( lCall );
+}
+
+int local_dbus_reply_new( sd_bus_message *iCall, chars iTypes, va_list iArgs, sd_bus_message **oReply )
+{
+	int lCode;
+
+	if( ( lCode = sd_bus_message_new_method_return( iCall, oReply ) ) < 0 ) {
+		trh_log( LOG_ERROR, "SDBUS failed to create reply. Error: %s\n", strerror( -lCode ) );
+		return TRH_DBUS_REPLY_FAILED;
+	}
+
+	if( iTypes != 0 && *iTypes != 0 && ( lCode = sd_bus_message_appendv( *oReply, iTypes, iArgs ) ) < 0 ) {
+		trh_log( LOG_ERROR, "SDBUS failed to append reply arguments. Error: %s\n", strerror( -lCode ) );
+		*oReply = sd_bus_message_unref( *oReply );
+		return TRH_DBUS_ARG_FAILED;
+	}
+
+	return TRH_OK;
+}
+
+int local_dbus_reply_send( sd_bus_message *iReply, int iCode )
+{
+	if( iCode < 0 ) {
+		trh_log( LOG_ERROR, "SDBUS failed to append reply payload. Error: %s\n", strerror( -iCode ) );
+		sd_bus_message_unref( iReply );
+		return TRH_DBUS_ARG_FAILED;
 	}
+
+	int lCode = trh_dbus_reply( iReply );
+	sd_bus_message_unref( iReply );
+
+	return lCode;
+}
+
+uint64_t local_dbus_property_hash( chars iPath, chars iInterface, chars iProperty )
+{
+	chars lParts[3] = { iPath, iInterface, iProperty };
+	uint64_t lHash = DBUS_HASH_OFFSET;
+
+	// Terminating zeros are hashed too - characters can't shift between the parts.
+	for( size_t ii = 0; ii < 3; ii++ ) {
+		chars lChar = lParts[ii];
+		do {
+			lHash ^= (unsigned char)*lChar;
+			lHash *= DBUS_HASH_PRIME;
+		} while( *lChar++ != 0 );
+	}
+
+	return lHash;
+}
+
+TTrhDbusProperty *local_dbus_property_find( chars iPath, chars iInterface, chars iProperty, bool iCreate )
+{
+	const uint64_t lHash = local_dbus_property_hash( iPath, iInterface, iProperty );
+
+	// Services expose tens of properties - linear scan over hashes.
+	for( size_t ii = 0; ii < gsBus.property_count; ii++ ) {
+		TTrhDbusProperty *lEntry = &gsBus.properties[ii];
+
+		if( lEntry->hash == lHash && strcmp( lEntry->property, iProperty ) == 0
+		 && strcmp( lEntry->interface, iInterface ) == 0 && strcmp( lEntry->path, iPath ) == 0 )
+			return lEntry;
+	}
+
+	if( ! iCreate )
+		return 0;
+
+	if( gsBus.property_count == gsBus.property_size ) {
+		size_t lSize = gsBus.property_size > 0 ? gsBus.property_size * 2 : DBUS_PROPERTY_CACHE_SIZE;
+		TTrhDbusProperty *lProperties = (TTrhDbusProperty*)realloc( gsBus.properties, lSize * sizeof( TTrhDbusProperty ) );
+		if( lProperties == 0 ) return 0;
+
+		gsBus.properties = lProperties;
+		gsBus.property_size = lSize;
+	}
+
+	const size_t lPath = strlen( iPath ) + 1;
+	const size_t lInterface = strlen( iInterface ) + 1;
+	const size_t lProperty = strlen( iProperty ) + 1;
+
+	char *lKey = (char*)malloc( lPath + lInterface + lProperty );
+	if( lKey == 0 ) return 0;
+
+	memcpy( lKey, iPath, lPath );
+	memcpy( lKey + lPath, iInterface, lInterface );
+	memcpy( lKey + lPath + lInterface, iProperty, lProperty );
+
+	TTrhDbusProperty *lEntry = &gsBus.properties[gsBus.property_count++];
+	lEntry->hash = lHash;
+	lEntry->path = lKey;
+	lEntry->interface = lKey + lPath;
+	lEntry->property = lKey + lPath + lInterface;
+	lEntry->value = 0;
+
+	return lEntry;
+}
+
+void local_dbus_property_release()
+{
+	for( size_t ii = 0; ii < gsBus.property_count; ii++ ) {
+		sd_bus_message_unref( gsBus.properties[ii].value );
+		free( gsBus.properties[ii].path );
+	}
+
+	FREE_PTR( gsBus.properties );
+	gsBus.property_count = 0;
+	gsBus.property_size = 0;
+}
+
+TTrhDbusSignal *local_dbus_signal_find( chars iPath, chars iInterface )
+{
+	for( size_t ii = 0; ii < gsBus.signal_count; ii++ ) {
+		TTrhDbusSignal *lSignal = &gsBus.signals[ii];
+
+		if( strcmp( lSignal->interface, iInterface ) == 0 && strcmp( lSignal->path, iPath ) == 0 )
+			return lSignal;
+	}
+
+	if( gsBus.signal_count == gsBus.signal_size ) {
+		size_t lSize = gsBus.signal_size > 0 ? gsBus.signal_size * 2 : DBUS_SIGNAL_SIZE;
+		TTrhDbusSignal *lSignals = (TTrhDbusSignal*)realloc( gsBus.signals, lSize * sizeof( TTrhDbusSignal ) );
+		if( lSignals == 0 ) return 0;
+
+		gsBus.signals = lSignals;
+		gsBus.signal_size = lSize;
+	}
+
+	const size_t lPath = strlen( iPath ) + 1;
+	const size_t lInterface = strlen( iInterface ) + 1;
+
+	char *lKey = (char*)malloc( lPath + lInterface );
+	if( lKey == 0 ) return 0;
+
+	memcpy( lKey, iPath, lPath );
+	memcpy( lKey + lPath, iInterface, lInterface );
+
+	TTrhDbusSignal *lSignal = &gsBus.signals[gsBus.signal_count++];
+	memset( lSignal, 0, sizeof( TTrhDbusSignal ) );
+	lSignal->path = lKey;
+	lSignal->interface = lKey + lPath;
+
+	return lSignal;
+}
+
+int local_dbus_signal_add( TTrhDbusSignal *iSignal, chars iProperty )
+{
+	if( iProperty == 0 ) {
+		iSignal->all = true;
+		return TRH_OK;
+	}
+
+	if( iSignal->all )
+		return TRH_OK;
+
+	// Property changed again within the window - merged.
+	for( size_t ii = 0; ii < iSignal->name_count; ii++ )
+		if( strcmp( iSignal->names[ii], iProperty ) == 0 )
+			return TRH_OK;
+
+	// One slot more for the terminating null.
+	if( iSignal->name_count + 1 >= iSignal->name_size ) {
+		size_t lSize = iSignal->name_size > 0 ? iSignal->name_size * 2 : DBUS_SIGNAL_SIZE;
+		char **lNames = (char**)realloc( iSignal->names, lSize * sizeof( char* ) );
+		if( lNames == 0 ) return TRH_OUT_OF_MEM;
+
+		iSignal->names = lNames;
+		iSignal->name_size = lSize;
+	}
+
+	if( ( iSignal->names[iSignal->name_count] = strdup( iProperty ) ) == 0 )
+		return TRH_OUT_OF_MEM;
+
+	iSignal->names[++iSignal->name_count] = 0;
+
+	return TRH_OK;
+}
+
+int local_dbus_signal_schedule()
+{
+	if( gsBus.signal_scheduled )
+		return TRH_OK;
+
+	if( gsBus.signal_window == 0 ) {
+		if( trh_post_on( gsBus.event.loop, local_dbus_signal_task, 0 ) != TRH_OK )
+			return TRH_OUT_OF_MEM;
+
+		gsBus.signal_scheduled = true;
+		return TRH_OK;
+	}
+
+	if( gsBus.signal_timer == 0 ) {
+		// Timer with zero duration is created in disarmed state.
+		TTrhTimerProperties lFlush = {
+			.sec = 0,
+			.nsec = 0,
+			.repeat = false,
+			.handle_timer_event = local_dbus_signal_timer
+		};
+
+		if( trh_timer_init_on( gsBus.event.loop, &lFlush, &gsBus.signal_timer ) != TRH_OK ) {
+			gsBus.signal_timer = 0;
+			return TRH_TIMER_FAILED;
+		}
+	}
+
+	gsBus.signal_timer->ext.timer->sec = gsBus.signal_window / 1000;
+	gsBus.signal_timer->ext.timer->nsec = ( gsBus.signal_window % 1000 ) * 1000000l;
+	trh_timer_start( gsBus.signal_timer );
+
+	gsBus.signal_scheduled = true;
+
+	return TRH_OK;
+}
+
+int local_dbus_signal_timer( TTrhEvent *iEvent )
+{
+	return trh_dbus_flush_signals();
+}
+
+void local_dbus_signal_task( void *iArg )
+{
+	// Task can run after trh_dbus_flush_signals() or trh_dbus_release(); then there is nothing to flush.
+	trh_dbus_flush_signals();
+}
+
+void local_dbus_signal_clear( TTrhDbusSignal *iSignal )
+{
+	for( size_t ii = 0; ii < iSignal->name_count; ii++ )
+		free( iSignal->names[ii] );
+
+	iSignal->name_count = 0;
+	if( iSignal->names != 0 )
+		iSignal->names[0] = 0;
+
+	iSignal->all = false;
+	iSignal->pending = false;
+}
+
+void local_dbus_signal_release()
+{
+	if( gsBus.signal_timer != 0 ) {
+		trh_timer_release( gsBus.signal_timer );
+		gsBus.signal_timer = 0;
+	}
+	gsBus.signal_scheduled = false;
+
+	for( size_t ii = 0; ii < gsBus.signal_count; ii++ ) {
+		local_dbus_signal_clear( &gsBus.signals[ii] );
+		free( gsBus.signals[ii].names );
+		free( gsBus.signals[ii].path );
+	}
+
+	FREE_PTR( gsBus.signals );
+	gsBus.signal_count = 0;
+	gsBus.signal_size = 0;
+}
+
+int local_dbus_stats_append( sd_bus_message *iReply, chars iName, const TTrhHistogram *iHistogram )
+{
+	return sd_bus_message_append( iReply, "(sttttt)", iName, iHistogram->count,
+		trh_histogram_quantile( iHistogram, 0.5 ),
+		trh_histogram_quantile( iHistogram, 0.9 ),
+		trh_histogram_quantile( iHistogram, 0.99 ),
+		iHistogram->max );
+}
+
+void local_dbus_batch_done( TTrhDbusBatch *iBatch, bool iFailed )
+{
+	if( iFailed )
+		iBatch->failed++;
+
+	if( --iBatch->pending > 0 || ! iBatch->committed )
+		return;
+
+	if( iBatch->handle_done != 0 )
+		iBatch->handle_done( iBatch->failed, iBatch->ext );
+
+	local_dbus_batch_free( iBatch );
+}
+
+void local_dbus_batch_free( TTrhDbusBatch *iBatch )
+{
+	if( iBatch->prev != 0 )
+		iBatch->prev->next = iBatch->next;
+	else
+		gsBus.batches = iBatch->next;
+
+	if( iBatch->next != 0 )
+		iBatch->next->prev = iBatch->prev;
+
+	free( iBatch );
 }
 
 // #endregion
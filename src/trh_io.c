@@ -0,0 +1,766 @@
+/*
+ * @brief Asynchronous file operations (io_uring)
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+// splice, F_SETPIPE_SZ
+#define _GNU_SOURCE
+
+// #region Includes
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#ifdef TRH_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "trihlav.h"
+#include "trh_logger.h"
+#include "trh_loop.h"
+#include "trh_io.h"
+
+// #endregion
+
+// Number of submission queue entries.
+#define IO_RING_ENTRIES			256
+// Maximal number of bytes moved by one splice (pipe is resized to this size).
+#define IO_COPY_CHUNK			( 1024 * 1024 )
+// Number of operation types (TTrhIoOp).
+#define IO_OP_COUNT				( IO_COPY + 1 )
+
+// #region Typedefs
+
+typedef enum TTrhIoOp {
+	IO_UNLINK,
+	IO_MKDIR,
+	IO_RENAME,
+	IO_COPY
+} TTrhIoOp;
+
+/**
+ * @brief Asynchronous operation. Pointer is the user_data of its SQEs.
+ */
+typedef struct TTrhIoRequest {
+	struct TTrhIo *io;
+	TTrhIoOp op;
+
+	handle_io handle_done;
+	void *arg;
+
+	char *path;
+	char *path2;
+	int flags;
+	mode_t mode;
+
+	/// Copy state: source, destination, pipe between them, copied bytes, source size and bytes in the pipe.
+	int src_fd;
+	int dst_fd;
+	int pipe_fd[2];
+	int64_t offset;
+	int64_t size;
+	int64_t in_pipe;
+
+	int64_t result;
+
+	/// Next request in the list of requests in progress.
+	struct TTrhIoRequest *next;
+	struct TTrhIoRequest *prev;
+} TTrhIoRequest;
+
+#ifdef TRH_IO_URING
+/**
+ * @brief Mapped io_uring rings.
+ */
+typedef struct TTrhIoRing {
+	int fd;
+
+	_Atomic unsigned *sq_head;
+	_Atomic unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	_Atomic unsigned *cq_head;
+	_Atomic unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+
+	/// SQEs queued since the last submit.
+	unsigned queued;
+} TTrhIoRing;
+#endif
+
+/**
+ * @brief Io context of the loop.
+ */
+typedef struct TTrhIo {
+	struct TTrhLoop *loop;
+
+	/// True if io_uring is used; otherwise operations are executed synchronously.
+	bool uring;
+
+#ifdef TRH_IO_URING
+	TTrhIoRing ring;
+	/// True for operations supported by the kernel ring (IORING_REGISTER_PROBE); others are executed synchronously.
+	bool ring_ops[IO_OP_COUNT];
+	/// Eventfd signalled by the kernel on completion; registered with the loop.
+	TTrhEvent event;
+#endif
+
+	/// Requests in progress.
+	TTrhIoRequest *requests;
+} TTrhIo;
+
+// #endregion
+
+
+// #region Static functions
+
+static TTrhIoRequest *local_io_request( TTrhIoOp iOp, chars iPath, chars iPath2, handle_io iDone, void *iArg );
+static int local_io_start( TTrhIoRequest *iRequest );
+static void local_io_free( TTrhIoRequest *iRequest );
+
+/**
+ * @brief Finish the request: call completion and release it.
+ */
+static void local_io_complete( TTrhIoRequest *iRequest, int64_t iResult );
+
+/**
+ * @brief Post completion of the request to its loop - handler is never called from the starting function.
+ */
+static void local_io_post( TTrhIoRequest *iRequest, int64_t iResult );
+
+/**
+ * @brief Execute the request synchronously and post its completion (no io_uring).
+ */
+static void local_io_sync( TTrhIoRequest *iRequest );
+static void local_io_sync_done( void *iRequest );
+
+/**
+ * @brief Open source and destination file of the copy request. Return 0 or negative errno.
+ */
+static int local_io_copy_open( TTrhIoRequest *iRequest );
+
+#ifdef TRH_IO_URING
+static int local_ring_init( TTrhIo *iIo );
+static void local_ring_probe( TTrhIo *iIo );
+static void local_ring_release( TTrhIo *iIo );
+static int local_ring_queue( TTrhIo *iIo, const struct io_uring_sqe *iSqe );
+static int local_ring_event( TTrhEvent *iEvent );
+static int local_ring_prepare( TTrhIoRequest *iRequest );
+static void local_ring_completion( TTrhIoRequest *iRequest, int iResult );
+#endif
+
+// #endregion
+
+
+// #region Exported functions
+
+int trh_io_init( struct TTrhLoop *iLoop, TTrhIo **oIo )
+{
+	TRH_ASSERT_ARG( iLoop != 0 && oIo != 0, "Failed to create io context - invalid argument." );
+
+	TTrhIo *lIo = (TTrhIo*)calloc( 1, sizeof( TTrhIo ) );
+	if( lIo == 0 ) return TRH_OUT_OF_MEM;
+
+	lIo->loop = iLoop;
+
+#ifdef TRH_IO_URING
+	lIo->ring.fd = -1;
+	lIo->event.fd = -1;
+
+	// Kernel without io_uring (or seccomp policy) - fall back to synchronous operations.
+	lIo->uring = local_ring_init( lIo ) == TRH_OK;
+	if( ! lIo->uring ) {
+		trh_log( LOG_NOTE, "io_uring is not available, file operations are synchronous.\n" );
+		local_ring_release( lIo );
+	}
+	else
+		local_ring_probe( lIo );
+#endif
+
+	*oIo = lIo;
+
+	return TRH_OK;
+}
+
+void trh_io_submit( TTrhIo *iIo )
+{
+#ifdef TRH_IO_URING
+	if( iIo == 0 || ! iIo->uring || iIo->ring.queued == 0 )
+		return;
+
+	// One io_uring_enter for all operations queued during the iteration.
+	int lSubmitted = (int)syscall( __NR_io_uring_enter, iIo->ring.fd, iIo->ring.queued, 0, 0, 0, 0 );
+
+	if( lSubmitted < 0 ) {
+		if( errno != EAGAIN && errno != EBUSY && errno != EINTR )
+			trh_log( LOG_ERROR, "Failed to submit io operations. Error: %s\n", strerror( errno ) );
+		return;
+	}
+
+	iIo->ring.queued -= (unsigned)lSubmitted < iIo->ring.queued ? (unsigned)lSubmitted : iIo->ring.queued;
+#else
+	(void)iIo;
+#endif
+}
+
+void trh_io_release( TTrhIo *iIo )
+{
+	if( iIo == 0 )
+		return;
+
+#ifdef TRH_IO_URING
+	// Closing the ring cancels operations in progress.
+	local_ring_release( iIo );
+#endif
+
+	while( iIo->requests != 0 )
+		local_io_free( iIo->requests );
+
+	free( iIo );
+}
+
+size_t trh_io_pending( TTrhIo *iIo )
+{
+	size_t lCount = 0;
+
+	if( iIo == 0 )
+		return 0;
+
+	for( TTrhIoRequest *lRequest = iIo->requests; lRequest != 0; lRequest = lRequest->next )
+		lCount++;
+
+	return lCount;
+}
+
+bool trh_io_uring_enabled()
+{
+	TTrhIo *lIo = trh_loop_io( trh_loop_current() );
+	return lIo != 0 && lIo->uring;
+}
+
+int trh_io_unlink( chars iPath, int iFlags, handle_io iDone, void *iArg )
+{
+	TRH_ASSERT_ARG( iPath != 0, "Failed to delete file - path is null." );
+
+	TTrhIoRequest *lRequest = local_io_request( IO_UNLINK, iPath, 0, iDone, iArg );
+	if( lRequest == 0 ) return TRH_OUT_OF_MEM;
+
+	lRequest->flags = iFlags;
+
+	return local_io_start( lRequest );
+}
+
+int trh_io_mkdir( chars iPath, mode_t iMode, handle_io iDone, void *iArg )
+{
+	TRH_ASSERT_ARG( iPath != 0, "Failed to create directory - path is null." );
+
+	TTrhIoRequest *lRequest = local_io_request( IO_MKDIR, iPath, 0, iDone, iArg );
+	if( lRequest == 0 ) return TRH_OUT_OF_MEM;
+
+	lRequest->mode = iMode;
+
+	return local_io_start( lRequest );
+}
+
+int trh_io_rename( chars iOldPath, chars iNewPath, handle_io iDone, void *iArg )
+{
+	TRH_ASSERT_ARG( iOldPath != 0 && iNewPath != 0, "Failed to rename file - path is null." );
+
+	TTrhIoRequest *lRequest = local_io_request( IO_RENAME, iOldPath, iNewPath, iDone, iArg );
+	if( lRequest == 0 ) return TRH_OUT_OF_MEM;
+
+	return local_io_start( lRequest );
+}
+
+int trh_io_copy_file( chars iSrcPath, chars iDstPath, handle_io iDone, void *iArg )
+{
+	TRH_ASSERT_ARG( iSrcPath != 0 && iDstPath != 0, "Failed to copy file - path is null." );
+
+	TTrhIoRequest *lRequest = local_io_request( IO_COPY, iSrcPath, iDstPath, iDone, iArg );
+	if( lRequest == 0 ) return TRH_OUT_OF_MEM;
+
+	return local_io_start( lRequest );
+}
+
+// #endregion
+
+
+// #region Requests
+
+TTrhIoRequest *local_io_request( TTrhIoOp iOp, chars iPath, chars iPath2, handle_io iDone, void *iArg )
+{
+	TTrhIoRequest *lRequest = (TTrhIoRequest*)calloc( 1, sizeof( TTrhIoRequest ) );
+	if( lRequest == 0 ) return 0;
+
+	lRequest->op = iOp;
+	lRequest->handle_done = iDone;
+	lRequest->arg = iArg;
+	lRequest->src_fd = -1;
+	lRequest->dst_fd = -1;
+	lRequest->pipe_fd[0] = -1;
+	lRequest->pipe_fd[1] = -1;
+	lRequest->path = strdup( iPath );
+	lRequest->path2 = iPath2 != 0 ? strdup( iPath2 ) : 0;
+
+	if( lRequest->path == 0 || ( iPath2 != 0 && lRequest->path2 == 0 ) ) {
+		local_io_free( lRequest );
+		return 0;
+	}
+
+	return lRequest;
+}
+
+int local_io_start( TTrhIoRequest *iRequest )
+{
+	TTrhIo *lIo = trh_loop_io( trh_loop_current() );
+
+	if( lIo == 0 ) {
+		local_io_free( iRequest );
+		return TRH_UNINITIALIZED;
+	}
+
+	// Track the request - the context releases requests in progress.
+	iRequest->io = lIo;
+	iRequest->next = lIo->requests;
+	if( lIo->requests != 0 )
+		lIo->requests->prev = iRequest;
+	lIo->requests = iRequest;
+
+#ifdef TRH_IO_URING
+	if( lIo->uring && lIo->ring_ops[iRequest->op] ) {
+		int lCode = local_ring_prepare( iRequest );
+
+		// Error is reported through the completion, same as a failed SQE.
+		if( lCode < 0 )
+			local_io_post( iRequest, lCode );
+		return TRH_OK;
+	}
+#endif
+
+	local_io_sync( iRequest );
+
+	return TRH_OK;
+}
+
+void local_io_free( TTrhIoRequest *iRequest )
+{
+	TTrhIo *lIo = iRequest->io;
+
+	if( lIo != 0 ) {
+		if( iRequest->prev != 0 )
+			iRequest->prev->next = iRequest->next;
+		else
+			lIo->requests = iRequest->next;
+
+		if( iRequest->next != 0 )
+			iRequest->next->prev = iRequest->prev;
+	}
+
+	CLOSE_FD( iRequest->src_fd );
+	CLOSE_FD( iRequest->dst_fd );
+	CLOSE_FD( iRequest->pipe_fd[0] );
+	CLOSE_FD( iRequest->pipe_fd[1] );
+	FREE_PTR( iRequest->path );
+	FREE_PTR( iRequest->path2 );
+	free( iRequest );
+}
+
+void local_io_complete( TTrhIoRequest *iRequest, int64_t iResult )
+{
+	if( iRequest->handle_done != 0 )
+		iRequest->handle_done( iResult, iRequest->arg );
+
+	local_io_free( iRequest );
+}
+
+int local_io_copy_open( TTrhIoRequest *iRequest )
+{
+	struct stat lStat;
+
+	if( ( iRequest->src_fd = open( iRequest->path, O_RDONLY | O_CLOEXEC ) ) < 0 )
+		return -errno;
+
+	if( fstat( iRequest->src_fd, &lStat ) != 0 )
+		return -errno;
+
+	if( ( iRequest->dst_fd = open( iRequest->path2, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, lStat.st_mode & 07777 ) ) < 0 )
+		return -errno;
+
+	iRequest->size = lStat.st_size;
+
+	return 0;
+}
+
+void local_io_sync( TTrhIoRequest *iRequest )
+{
+	int64_t lResult = 0;
+
+	switch( iRequest->op ) {
+		case IO_UNLINK:
+			lResult = unlinkat( AT_FDCWD, iRequest->path, iRequest->flags ) == 0 ? 0 : -errno;
+			break;
+
+		case IO_MKDIR:
+			lResult = mkdirat( AT_FDCWD, iRequest->path, iRequest->mode ) == 0 ? 0 : -errno;
+			break;
+
+		case IO_RENAME:
+			lResult = renameat( AT_FDCWD, iRequest->path, AT_FDCWD, iRequest->path2 ) == 0 ? 0 : -errno;
+			break;
+
+		case IO_COPY:
+			if( ( lResult = local_io_copy_open( iRequest ) ) < 0 )
+				break;
+
+			while( iRequest->offset < iRequest->size ) {
+				ssize_t lCopied = sendfile( iRequest->dst_fd, iRequest->src_fd, 0, (size_t)( iRequest->size - iRequest->offset ) );
+
+				if( lCopied <= 0 ) {
+					lResult = lCopied < 0 ? -errno : -EIO;
+					break;
+				}
+
+				iRequest->offset += lCopied;
+			}
+
+			if( lResult == 0 )
+				lResult = iRequest->offset;
+			break;
+	}
+
+	local_io_post( iRequest, lResult );
+}
+
+void local_io_post( TTrhIoRequest *iRequest, int64_t iResult )
+{
+	iRequest->result = iResult;
+
+	// Completion is always asynchronous - post it to the loop.
+	if( trh_post_on( iRequest->io->loop, local_io_sync_done, iRequest ) != TRH_OK )
+		local_io_complete( iRequest, iRequest->result );
+}
+
+void local_io_sync_done( void *iRequest )
+{
+	TTrhIoRequest *lRequest = (TTrhIoRequest*)iRequest;
+	local_io_complete( lRequest, lRequest->result );
+}
+
+// #endregion
+
+
+#ifdef TRH_IO_URING
+
+// #region io_uring
+
+int local_ring_init( TTrhIo *iIo )
+{
+	TTrhIoRing *lRing = &iIo->ring;
+	struct io_uring_params lParams;
+
+	memset( &lParams, 0, sizeof( lParams ) );
+
+	if( ( lRing->fd = (int)syscall( __NR_io_uring_setup, IO_RING_ENTRIES, &lParams ) ) < 0 )
+		return TRH_FAILED;
+
+	// Rings are mapped once; with single mmap the completion ring shares the submission ring mapping.
+	lRing->sq_size = lParams.sq_off.array + lParams.sq_entries * sizeof( unsigned );
+	lRing->cq_size = lParams.cq_off.cqes + lParams.cq_entries * sizeof( struct io_uring_cqe );
+
+	if( lParams.features & IORING_FEAT_SINGLE_MMAP ) {
+		if( lRing->cq_size > lRing->sq_size )
+			lRing->sq_size = lRing->cq_size;
+		lRing->cq_size = 0;
+	}
+
+	lRing->sq_ptr = mmap( 0, lRing->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, lRing->fd, IORING_OFF_SQ_RING );
+	if( lRing->sq_ptr == MAP_FAILED ) {
+		lRing->sq_ptr = 0;
+		return TRH_FAILED;
+	}
+
+	if( lRing->cq_size > 0 ) {
+		lRing->cq_ptr = mmap( 0, lRing->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, lRing->fd, IORING_OFF_CQ_RING );
+		if( lRing->cq_ptr == MAP_FAILED ) {
+			lRing->cq_ptr = 0;
+			return TRH_FAILED;
+		}
+	}
+
+	lRing->sqes_size = lParams.sq_entries * sizeof( struct io_uring_sqe );
+	lRing->sqes = (struct io_uring_sqe*)mmap( 0, lRing->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, lRing->fd, IORING_OFF_SQES );
+	if( lRing->sqes == MAP_FAILED ) {
+		lRing->sqes = 0;
+		return TRH_FAILED;
+	}
+
+	uint8_t *lSq = (uint8_t*)lRing->sq_ptr;
+	uint8_t *lCq = lRing->cq_ptr != 0 ? (uint8_t*)lRing->cq_ptr : lSq;
+
+	lRing->sq_head = (_Atomic unsigned*)( lSq + lParams.sq_off.head );
+	lRing->sq_tail = (_Atomic unsigned*)( lSq + lParams.sq_off.tail );
+	lRing->sq_mask = *(unsigned*)( lSq + lParams.sq_off.ring_mask );
+	lRing->sq_entries = *(unsigned*)( lSq + lParams.sq_off.ring_entries );
+	lRing->sq_array = (unsigned*)( lSq + lParams.sq_off.array );
+
+	lRing->cq_head = (_Atomic unsigned*)( lCq + lParams.cq_off.head );
+	lRing->cq_tail = (_Atomic unsigned*)( lCq + lParams.cq_off.tail );
+	lRing->cq_mask = *(unsigned*)( lCq + lParams.cq_off.ring_mask );
+	lRing->cqes = (struct io_uring_cqe*)( lCq + lParams.cq_off.cqes );
+
+	// Completions wake the loop through eventfd.
+	iIo->event.fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	iIo->event.handle_triggered = local_ring_event;
+	iIo->event.ext.data = iIo;
+
+	if( iIo->event.fd == -1 )
+		return TRH_FAILED;
+
+	if( syscall( __NR_io_uring_register, lRing->fd, IORING_REGISTER_EVENTFD, &iIo->event.fd, 1 ) != 0 )
+		return TRH_FAILED;
+
+	return trh_event_register_on( iIo->loop, &iIo->event );
+}
+
+// Kernels before 5.18 lack some opcodes (UNLINKAT, RENAMEAT 5.11, MKDIRAT 5.15) - mark the supported ones.
+void local_ring_probe( TTrhIo *iIo )
+{
+	const size_t lCount = IORING_OP_LAST;
+	struct io_uring_probe *lProbe = (struct io_uring_probe*)calloc( 1, sizeof( struct io_uring_probe ) + lCount * sizeof( struct io_uring_probe_op ) );
+
+	if( lProbe == 0 )
+		return;
+
+	// Probe is available since 5.6; older kernels support none of the operations.
+	if( syscall( __NR_io_uring_register, iIo->ring.fd, IORING_REGISTER_PROBE, lProbe, (unsigned)lCount ) == 0 ) {
+		const unsigned lOps[IO_OP_COUNT] = {
+			[IO_UNLINK] = IORING_OP_UNLINKAT,
+			[IO_MKDIR] = IORING_OP_MKDIRAT,
+			[IO_RENAME] = IORING_OP_RENAMEAT,
+			[IO_COPY] = IORING_OP_SPLICE
+		};
+
+		for( int lOp = 0; lOp < IO_OP_COUNT; lOp++ )
+			iIo->ring_ops[lOp] = lOps[lOp] <= lProbe->last_op && ( lProbe->ops[lOps[lOp]].flags & IO_URING_OP_SUPPORTED ) != 0;
+
+		// Empty file is copied with NOP.
+		iIo->ring_ops[IO_COPY] = iIo->ring_ops[IO_COPY] && ( lProbe->ops[IORING_OP_NOP].flags & IO_URING_OP_SUPPORTED ) != 0;
+	}
+
+	for( int lOp = 0; lOp < IO_OP_COUNT; lOp++ ) {
+		if( ! iIo->ring_ops[lOp] ) {
+			trh_log( LOG_NOTE, "Some io_uring operations are not supported, they are executed synchronously.\n" );
+			break;
+		}
+	}
+
+	free( lProbe );
+}
+
+void local_ring_release( TTrhIo *iIo )
+{
+	TTrhIoRing *lRing = &iIo->ring;
+
+	if( iIo->event.loop != 0 )
+		trh_event_unregister( &iIo->event );
+	CLOSE_FD( iIo->event.fd );
+
+	if( lRing->sqes != 0 )
+		munmap( lRing->sqes, lRing->sqes_size );
+	if( lRing->cq_ptr != 0 )
+		munmap( lRing->cq_ptr, lRing->cq_size );
+	if( lRing->sq_ptr != 0 )
+		munmap( lRing->sq_ptr, lRing->sq_size );
+
+	lRing->sqes = 0;
+	lRing->cq_ptr = 0;
+	lRing->sq_ptr = 0;
+	CLOSE_FD( lRing->fd );
+
+	iIo->uring = false;
+}
+
+// Copy SQE to the submission ring. It is submitted by trh_io_submit() before the loop waits.
+int local_ring_queue( TTrhIo *iIo, const struct io_uring_sqe *iSqe )
+{
+	TTrhIoRing *lRing = &iIo->ring;
+	unsigned lTail = atomic_load_explicit( lRing->sq_tail, memory_order_relaxed );
+
+	// Ring is full - submit now to make room.
+	if( lTail - atomic_load_explicit( lRing->sq_head, memory_order_acquire ) >= lRing->sq_entries ) {
+		trh_io_submit( iIo );
+
+		if( lTail - atomic_load_explicit( lRing->sq_head, memory_order_acquire ) >= lRing->sq_entries )
+			return -EBUSY;
+	}
+
+	const unsigned lIndex = lTail & lRing->sq_mask;
+	memcpy( &lRing->sqes[lIndex], iSqe, sizeof( struct io_uring_sqe ) );
+	lRing->sq_array[lIndex] = lIndex;
+
+	// Publish the entry to the kernel.
+	atomic_store_explicit( lRing->sq_tail, lTail + 1, memory_order_release );
+	lRing->queued++;
+
+	return 0;
+}
+
+// Queue first SQE of the request. Return 0 or negative errno.
+int local_ring_prepare( TTrhIoRequest *iRequest )
+{
+	struct io_uring_sqe lSqe;
+
+	memset( &lSqe, 0, sizeof( lSqe ) );
+	lSqe.user_data = (uint64_t)(uintptr_t)iRequest;
+	lSqe.fd = AT_FDCWD;
+
+	switch( iRequest->op ) {
+		case IO_UNLINK:
+			lSqe.opcode = IORING_OP_UNLINKAT;
+			lSqe.addr = (uint64_t)(uintptr_t)iRequest->path;
+			lSqe.unlink_flags = (uint32_t)iRequest->flags;
+			break;
+
+		case IO_MKDIR:
+			lSqe.opcode = IORING_OP_MKDIRAT;
+			lSqe.addr = (uint64_t)(uintptr_t)iRequest->path;
+			lSqe.len = iRequest->mode;
+			break;
+
+		case IO_RENAME:
+			lSqe.opcode = IORING_OP_RENAMEAT;
+			lSqe.addr = (uint64_t)(uintptr_t)iRequest->path;
+			lSqe.len = (uint32_t)AT_FDCWD;
+			lSqe.addr2 = (uint64_t)(uintptr_t)iRequest->path2;
+			break;
+
+		case IO_COPY: {
+			int lCode = local_io_copy_open( iRequest );
+			if( lCode < 0 ) return lCode;
+
+			// Empty file - nothing to splice, completion still comes from the ring.
+			if( iRequest->size == 0 ) {
+				lSqe.opcode = IORING_OP_NOP;
+				break;
+			}
+
+			if( pipe2( iRequest->pipe_fd, O_CLOEXEC ) != 0 )
+				return -errno;
+
+			// Larger pipe - fewer splices. Failure only means smaller chunks.
+			fcntl( iRequest->pipe_fd[1], F_SETPIPE_SZ, IO_COPY_CHUNK );
+
+			// Source -> pipe; completion queues pipe -> destination.
+			lSqe.opcode = IORING_OP_SPLICE;
+			lSqe.splice_fd_in = iRequest->src_fd;
+			lSqe.splice_off_in = (uint64_t)iRequest->offset;
+			lSqe.fd = iRequest->pipe_fd[1];
+			lSqe.off = (uint64_t)-1;
+			lSqe.len = (uint32_t)( iRequest->size - iRequest->offset < IO_COPY_CHUNK ? iRequest->size - iRequest->offset : IO_COPY_CHUNK );
+			break;
+		}
+	}
+
+	return local_ring_queue( iRequest->io, &lSqe );
+}
+
+// Handle CQE of the request.
+void local_ring_completion( TTrhIoRequest *iRequest, int iResult )
+{
+	if( iRequest->op != IO_COPY || iResult < 0 ) {
+		local_io_complete( iRequest, iResult );
+		return;
+	}
+
+	struct io_uring_sqe lSqe;
+	memset( &lSqe, 0, sizeof( lSqe ) );
+	lSqe.user_data = (uint64_t)(uintptr_t)iRequest;
+	lSqe.opcode = IORING_OP_SPLICE;
+
+	// Data has been moved into the pipe (in_pipe == 0), or from the pipe to the destination.
+	if( iRequest->in_pipe == 0 ) {
+		// Source is shorter than expected.
+		if( iResult == 0 ) {
+			local_io_complete( iRequest, iRequest->offset );
+			return;
+		}
+		iRequest->in_pipe = iResult;
+	}
+	else {
+		iRequest->offset += iResult;
+		iRequest->in_pipe -= iResult;
+	}
+
+	if( iRequest->in_pipe > 0 ) {
+		// Pipe -> destination
+		lSqe.splice_fd_in = iRequest->pipe_fd[0];
+		lSqe.splice_off_in = (uint64_t)-1;
+		lSqe.fd = iRequest->dst_fd;
+		lSqe.off = (uint64_t)iRequest->offset;
+		lSqe.len = (uint32_t)iRequest->in_pipe;
+	}
+	else if( iRequest->offset < iRequest->size ) {
+		// Source -> pipe
+		lSqe.splice_fd_in = iRequest->src_fd;
+		lSqe.splice_off_in = (uint64_t)iRequest->offset;
+		lSqe.fd = iRequest->pipe_fd[1];
+		lSqe.off = (uint64_t)-1;
+		lSqe.len = (uint32_t)( iRequest->size - iRequest->offset < IO_COPY_CHUNK ? iRequest->size - iRequest->offset : IO_COPY_CHUNK );
+	}
+	else {
+		local_io_complete( iRequest, iRequest->offset );
+		return;
+	}
+
+	int lCode = local_ring_queue( iRequest->io, &lSqe );
+	if( lCode < 0 )
+		local_io_complete( iRequest, lCode );
+}
+
+// Reap all completions.
+int local_ring_event( TTrhEvent *iEvent )
+{
+	TTrhIo *lIo = (TTrhIo*)iEvent->ext.data;
+	TTrhIoRing *lRing = &lIo->ring;
+	uint64_t lValue = 0;
+
+	if( read( iEvent->fd, &lValue, sizeof( lValue ) ) != sizeof( lValue ) && errno != EAGAIN )
+		return TRH_WAITING;
+
+	unsigned lHead = atomic_load_explicit( lRing->cq_head, memory_order_relaxed );
+
+	while( lHead != atomic_load_explicit( lRing->cq_tail, memory_order_acquire ) ) {
+		const struct io_uring_cqe *lCqe = &lRing->cqes[lHead & lRing->cq_mask];
+		TTrhIoRequest *lRequest = (TTrhIoRequest*)(uintptr_t)lCqe->user_data;
+		const int lResult = lCqe->res;
+
+		// Release the entry before the completion - handler can queue new operations.
+		atomic_store_explicit( lRing->cq_head, ++lHead, memory_order_release );
+
+		local_ring_completion( lRequest, lResult );
+	}
+
+	return TRH_OK;
+}
+
+// #endregion
+
+#endif // TRH_IO_URING
@@ -6,11 +6,28 @@
 
 // #region Includes
 
+#define _GNU_SOURCE
+
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <systemd/sd-journal.h>
+
+#ifdef TRH_LOG_ZLIB
+#include <zlib.h>
+#endif
 
 #include "trihlav.h"
+#include "trh_arena.h"
 #include "trh_std.h"
 #include "trh_logger.h"
 
@@ -29,20 +46,321 @@
 #define TRH_LOG_OK				"[OK]"
 #define TRH_LOG_FAILED			"[FAILED]"
 
+// Max length of a message in asynchronous mode. Longer messages are truncated.
+#define TRH_LOG_SLOT_SIZE		480
+// Max number of messages written by the writer thread in one writev() call.
+#define TRH_LOG_BATCH			64
+// Severity which wakes the writer thread immediately.
+#define TRH_LOG_URGENT			LOG_WARNING
+// Suffix of the pre-opened next log file and of the rotated file waiting for the rotation thread.
+#define TRH_LOG_NEXT			".next"
+#define TRH_LOG_STAGED			".0"
+// Delay (seconds) of the next rotation attempt after a failure or a skipped rotation (see TTrhLogRotation::max_size).
+#define TRH_LOG_ROTATE_RETRY	5
+// Size of the compression buffer.
+#define TRH_LOG_COMPRESS_BLOCK	( 64 * 1024 )
+// Journal field of the message text.
+#define TRH_LOG_JOURNAL_MESSAGE	"MESSAGE="
+// Size of the per-thread buffer collecting message continuations for the journal (including the field name).
+#define TRH_LOG_JOURNAL_LINE	( 1024 + sizeof( TRH_LOG_JOURNAL_MESSAGE ) - 1 )
+
 // #region Structs
 
+typedef enum LogRecordType {
+	/// Message starting with time and severity (trh_log).
+	LOG_RECORD_MESSAGE,
+	/// Continuation of the previous message (trh_log_more, trh_log_end).
+	LOG_RECORD_MORE
+} LogRecordType;
+
+/**
+ * @brief Message formatted by the caller, waiting in the ring buffer for the writer thread.
+ */
+typedef struct TAppLogRecord {
+	/// Slot sequence number (bounded MPSC queue). Synchronizes producers with the writer.
+	atomic_size_t sequence;
+
+	double time;
+	LogSeverity severity;
+	LogRecordType type;
+	/// If true, record is written also to the log file.
+	bool to_file;
+	/// If true, record is written to stdout (not replaced by the journal).
+	bool to_console;
+
+	uint16_t length;
+	char text[TRH_LOG_SLOT_SIZE];
+} TAppLogRecord;
+
+/**
+ * @brief Asynchronous logger - ring buffer and writer thread.
+ */
+typedef struct TAppLogAsync {
+	/// Ring buffer; capacity is power of two.
+	TAppLogRecord *ring;
+	size_t mask;
+
+	/// Next slot reserved by producers.
+	_Alignas( 64 ) atomic_size_t enqueue_pos;
+	/// Next slot read by the writer. Written only by the writer thread.
+	_Alignas( 64 ) atomic_size_t dequeue_pos;
+
+	/// Number of dropped messages (LOG_OVERFLOW_DROP).
+	atomic_uint_fast64_t dropped;
+	/// Writer thread is waiting for wake-up.
+	atomic_bool sleeping;
+	/// Writer thread should keep running.
+	atomic_bool running;
+
+	/// Producers waiting for a free slot (LOG_OVERFLOW_BLOCK); woken by the writer through \a space.
+	atomic_int blocked;
+	pthread_mutex_t mutex;
+	pthread_cond_t space;
+
+	LogOverflow overflow;
+	/// Max time (ms) a message waits in the buffer.
+	int flush_interval;
+
+	/// Wake-up eventfd of the writer thread.
+	int wake_fd;
+	pthread_t thread;
+
+	/// Time of the last message written to stdout (writer thread).
+	double time;
+} TAppLogAsync;
+
+/**
+ * @brief Code location and custom fields of a journal record (trh_log_record).
+ */
+typedef struct TAppLogCode {
+	chars file;
+	chars line;
+	const struct iovec *fields;
+	size_t count;
+} TAppLogCode;
+
+/**
+ * @brief "SYSLOG_IDENTIFIER=..." field of journal records. Replaced identifiers are kept until trh_log_release()
+ * - other threads could be sending records with them.
+ */
+typedef struct TAppLogJournalId {
+	struct TAppLogJournalId *prev;
+	char field[];
+} TAppLogJournalId;
+
+/**
+ * @brief Message collected from continuations (trh_log_more) until end-line - journal records are atomic.
+ */
+typedef struct TAppLogLine {
+	LogSeverity severity;
+	/// Length of text including the field name; the line is empty if it equals the field name.
+	size_t length;
+	char text[TRH_LOG_JOURNAL_LINE];
+} TAppLogLine;
+
+/**
+ * @brief Log rotation - size/age accounting and rotation thread.
+ */
+typedef struct TAppLogRotation {
+	TTrhLogRotation props;
+
+	/// Bytes written to the current file.
+	atomic_uint_fast64_t size;
+	/// Time (seconds) the current file has been opened.
+	atomic_llong opened;
+	/// Rotation is not attempted before this time (seconds) - set after a failure.
+	atomic_llong retry;
+	/// A writer is rotating the file.
+	atomic_bool rotating;
+
+	/// Protect fields below; signalled when the rotation thread has work.
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/// Pre-opened next file (O_APPEND, preallocated); -1 if not ready.
+	int next_fd;
+	/// Rotated file (name.0) waits for the rotation thread.
+	bool staged;
+	bool running;
+	pthread_t thread;
+} TAppLogRotation;
+
+/**
+ * @brief Format registered for binary logging.
+ */
+typedef struct TAppLogFormat {
+	chars format;
+	/// Argument codes, see trh_log_format_types.
+	char types[TRH_LOG_BIN_ARGS + 1];
+} TAppLogFormat;
+
+/**
+ * @brief Binary log sink.
+ */
+typedef struct TAppLogBinary {
+	FILE *file;
+
+	/// Registered formats. Allocated once; entries are never moved.
+	TAppLogFormat *formats;
+	/// Number of registered formats.
+	atomic_int count;
+
+	/// Protect format registration.
+	pthread_mutex_t mutex;
+} TAppLogBinary;
+
 typedef struct TAppLog {
 	FILE *file;
+	/// Name of the log file (reopen, rotation).
+	char *path;
 	LogSeverity severity;
 
 	LogSeverity current_message_severity;
 
+	/// Messages with lower severity are discarded before formatting (all outputs).
+	LogSeverity min_severity;
+
 	double time;
+
+	/// Asynchronous mode. If null, messages are written by the caller.
+	TAppLogAsync *async;
+
+	/// Rotation of the log file. If null, file grows without limit.
+	TAppLogRotation *rotation;
+
+	/// Messages are sent to the journal instead of stdout.
+	bool journal;
+	/// Identifier of journal records; null if not set. Swapped atomically, read without lock.
+	_Atomic( TAppLogJournalId* ) journal_id;
+	/// All identifiers set so far (newest first); freed by trh_log_release().
+	TAppLogJournalId *journal_ids;
+
+	/// Binary log sink.
+	TAppLogBinary binary;
 } TAppLog;
 
 // #endregion
 
 
+// #region Static functions
+
+/**
+ * @brief Return severity tag for log file and for terminal.
+ */
+static void local_log_severity_text( LogSeverity iSeverity, chars *oTextFile, chars *oTextCli );
+
+/**
+ * @brief Return date "YYYY-MM-DD HH:MM:SS". Text is cached per thread and rendered only when the second changes.
+ */
+static chars local_log_date( time_t iTime );
+
+/**
+ * @brief Write message (or its continuation) to all outputs. Shared by trh_log, trh_log_more and trh_log_record.
+ */
+static void local_log_message( LogRecordType iType, LogSeverity iSeverity, const TAppLogCode *iCode, chars iMessage, va_list iArgs );
+
+/**
+ * @brief Format message into the ring buffer (asynchronous mode).
+ */
+static void local_log_push( LogRecordType iType, LogSeverity iSeverity, bool iToFile, bool iToConsole, chars iMessage, va_list iArgs );
+
+/**
+ * @brief Wake the writer thread.
+ */
+static void local_log_wake();
+
+/**
+ * @brief Wait until the writer releases slot of the record at position iPos (LOG_OVERFLOW_BLOCK).
+ */
+static void local_log_wait_space( TAppLogAsync *iAsync, TAppLogRecord *iRecord, size_t iPos );
+
+/**
+ * @brief Write all iovecs (retried after partial write). Return number of written bytes, -1 if nothing has been written.
+ */
+static ssize_t local_log_writev( int iFd, struct iovec *iIov, int iCount );
+
+/**
+ * @brief Report failure of the logger itself. Written to stderr - stdout is owned by the writer thread.
+ */
+static void local_log_fault( chars iMessage, ... );
+
+/**
+ * @brief Writer thread (asynchronous mode).
+ */
+static void *local_log_writer( void *iArg );
+
+/**
+ * @brief Write all buffered messages; return number of written messages.
+ */
+static size_t local_log_drain( TAppLogAsync *iAsync );
+
+/**
+ * @brief Write record to binary log file.
+ */
+static void local_log_binary_write( LogBinType iType, LogSeverity iSeverity, uint16_t iFormat, const void *iPayload, uint16_t iLength );
+
+/**
+ * @brief Return time of the clock in nanoseconds.
+ */
+static uint64_t local_log_clock( clockid_t iClock );
+
+/**
+ * @brief Add bytes written to the log file; rotate the file if it exceeds limits (end of line only).
+ */
+static void local_log_written( size_t iBytes, bool iEndLine );
+
+/**
+ * @brief Switch log file to the next file; current file is renamed to name.0 for the rotation thread.
+ */
+static int local_log_rotate( TAppLogRotation *iRotation );
+
+/**
+ * @brief Replace log descriptor by iFd (dup2); buffered data are written to the previous file first.
+ */
+static int local_log_switch( int iFd );
+
+/**
+ * @brief Rotation thread - processes rotated files and pre-opens the next file.
+ */
+static void *local_log_rotation_thread( void *iArg );
+
+/**
+ * @brief Shift rotated files and move name.0 to name.1 (compressed if configured).
+ */
+static void local_log_rotation_archive( const TTrhLogRotation *iProps );
+
+/**
+ * @brief Open and preallocate the next log file; return the descriptor or -1.
+ */
+static int local_log_rotation_prepare( const TTrhLogRotation *iProps );
+
+/**
+ * @brief Compress file iSource to iTarget (gzip). Return TRH_OK or TRH_FILE_ERROR.
+ */
+static int local_log_compress( chars iSource, chars iTarget );
+
+/**
+ * @brief Release space preallocated beyond the end of the file.
+ */
+static void local_log_trim( int iFd );
+
+/**
+ * @brief Pass formatted text to the journal; continuations are collected in the line of the thread.
+ */
+static void local_log_journal( LogRecordType iType, LogSeverity iSeverity, const TAppLogCode *iCode, chars iText );
+
+/**
+ * @brief Send collected line of the calling thread to the journal.
+ */
+static void local_log_journal_flush();
+
+/**
+ * @brief Send record to the journal. iField is "MESSAGE=..." without end-line.
+ */
+static void local_log_journal_send( LogSeverity iSeverity, const TAppLogCode *iCode, chars iField, size_t iLength );
+
+// #endregion
+
+
 // #region Static globals
 
 // Application object
@@ -50,7 +368,26 @@ static TAppLog gsLog = {
 	.file = 0,
 	.severity = LOG_NOTE,
 	.current_message_severity = LOG_DEBUG,
-	.time = 0
+	.min_severity = LOG_DEBUG,
+	.time = 0,
+	.async = 0,
+	.rotation = 0,
+	.journal = false,
+	.journal_id = 0,
+	.journal_ids = 0,
+	.binary = {
+		.file = 0,
+		.formats = 0,
+		.count = 0,
+		.mutex = PTHREAD_MUTEX_INITIALIZER
+	}
+};
+
+/// Journal line of the calling thread.
+static __thread TAppLogLine gsLogLine = {
+	.severity = LOG_NOTE,
+	.length = sizeof( TRH_LOG_JOURNAL_MESSAGE ) - 1,
+	.text = TRH_LOG_JOURNAL_MESSAGE
 };
 
 // #endregion
@@ -67,132 +404,1447 @@ int trh_log_init( chars iFilename )
 
 	gsLog.time = trh_time();
 
-	if( ( gsLog.file = fopen( iFilename, "a" ) ) == 0 ) {
+	if( ( gsLog.file = fopen( iFilename, "ae" ) ) == 0 ) {
 		printf( TRH_LOG_WARN "Failed to open log file '%s'. Logging disabled.\n", iFilename );
 		return TRH_FAILED;
 	}
 
+	FREE_PTR( gsLog.path );
+	gsLog.path = strdup( iFilename );
+
 	printf( TRH_LOG_NOTE "Logging to file '%s'.\n", iFilename );
 
 	return TRH_OK;
 }
 
-void trh_log_version()
+int trh_log_async_init( size_t iCapacity, LogOverflow iOverflow, int iFlushInterval )
 {
-	TAppVersion lAppVersion = { 0 };
-	trh_version( &lAppVersion );
-	trh_log(
-		LOG_NOTE, "libtrihlav v.%u.%u.%u (0x%08x)\n",
-		lAppVersion.major,
-		lAppVersion.minor,
-		lAppVersion.patch,
-		lAppVersion.ver
-	);
+	TRH_ASSERT_ARG( iCapacity > 0 && iFlushInterval > 0, "Failed to init async logger - invalid arguments." );
+
+	if( gsLog.async != 0 )
+		return TRH_SKIP;
+
+	// Round capacity up to power of two.
+	size_t lCapacity = 1;
+	while( lCapacity < iCapacity ) lCapacity <<= 1;
+
+	TAppLogAsync *lAsync = (TAppLogAsync*)aligned_alloc( 64, sizeof( TAppLogAsync ) );
+	if( lAsync == 0 ) return TRH_OUT_OF_MEM;
+	memset( lAsync, 0, sizeof( TAppLogAsync ) );
+
+	lAsync->ring = (TAppLogRecord*)malloc( lCapacity * sizeof( TAppLogRecord ) );
+	if( lAsync->ring == 0 ) {
+		free( lAsync );
+		return TRH_OUT_OF_MEM;
+	}
+
+	for( size_t ii = 0; ii < lCapacity; ii++ )
+		atomic_init( &lAsync->ring[ii].sequence, ii );
+
+	lAsync->mask = lCapacity - 1;
+	lAsync->overflow = iOverflow;
+	lAsync->flush_interval = iFlushInterval;
+	lAsync->time = gsLog.time;
+	atomic_init( &lAsync->enqueue_pos, 0 );
+	atomic_init( &lAsync->dequeue_pos, 0 );
+	atomic_init( &lAsync->dropped, 0 );
+	atomic_init( &lAsync->sleeping, false );
+	atomic_init( &lAsync->running, true );
+	atomic_init( &lAsync->blocked, 0 );
+
+	if( ( lAsync->wake_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) == -1 ) {
+		printf( TRH_LOG_WARN "Failed to create async logger. Error: %s\n", strerror( errno ) );
+		free( lAsync->ring );
+		free( lAsync );
+		return TRH_FAILED;
+	}
+
+	pthread_mutex_init( &lAsync->mutex, 0 );
+	pthread_cond_init( &lAsync->space, 0 );
+
+	// Writer thread writes directly to file descriptors; flush data buffered by stdio so far.
+	fflush( stdout );
+	if( gsLog.file != 0 ) fflush( gsLog.file );
+
+	if( pthread_create( &lAsync->thread, 0, local_log_writer, lAsync ) != 0 ) {
+		printf( TRH_LOG_WARN "Failed to start async logger thread.\n" );
+		pthread_cond_destroy( &lAsync->space );
+		pthread_mutex_destroy( &lAsync->mutex );
+		close( lAsync->wake_fd );
+		free( lAsync->ring );
+		free( lAsync );
+		return TRH_FAILED;
+	}
+
+	gsLog.async = lAsync;
+
+	return TRH_OK;
 }
 
-void trh_log( LogSeverity iSeverity, chars iMessage, ... )
+uint64_t trh_log_async_dropped()
 {
-	const int TimeLength = strlen( "YYYY-MM-DD HH:MM:SS" );
+	return gsLog.async != 0 ? atomic_load_explicit( &gsLog.async->dropped, memory_order_relaxed ) : 0;
+}
 
-	if( iMessage == 0 || *iMessage == 0 )
-		iMessage = "\n";
+// #region Rotation
 
-	va_list args;
-	double lTime = trh_time();
-	chars lTextSeverityFile = 0;
-	chars lTextSeverityCli = 0;
+int trh_log_rotation_init( const TTrhLogRotation *iRotation )
+{
+	TRH_ASSERT_ARG( iRotation != 0 && ( iRotation->max_size > 0 || iRotation->max_age > 0 ), "Failed to init log rotation - invalid arguments." );
 
-	switch( iSeverity )
-	{
-	case LOG_DEBUG:   lTextSeverityFile = TRH_LOG_DEBUG; lTextSeverityCli = TRH_LOG_DEBUG_CLI; break;
-	case LOG_NOTE:    lTextSeverityFile = TRH_LOG_NOTE;  lTextSeverityCli = TRH_LOG_NOTE_CLI;  break;
-	case LOG_WARNING: lTextSeverityFile = TRH_LOG_WARN;  lTextSeverityCli = TRH_LOG_WARN_CLI;  break;
-	case LOG_ERROR:   lTextSeverityFile = TRH_LOG_ERROR; lTextSeverityCli = TRH_LOG_ERROR_CLI; break;
+	if( gsLog.rotation != 0 )
+		return TRH_SKIP;
+
+	if( gsLog.file == 0 || gsLog.path == 0 )
+		return TRH_UNINITIALIZED;
+
+	TAppLogRotation *lRotation = (TAppLogRotation*)calloc( 1, sizeof( TAppLogRotation ) );
+	if( lRotation == 0 ) return TRH_OUT_OF_MEM;
+
+	lRotation->props = *iRotation;
+	lRotation->next_fd = -1;
+	lRotation->running = true;
+
+#ifndef TRH_LOG_ZLIB
+	if( lRotation->props.compress ) {
+		printf( TRH_LOG_WARN "Log compression is not available (TRIHLAV_LOG_COMPRESS); rotated files are kept uncompressed.\n" );
+		lRotation->props.compress = false;
 	}
+#endif
 
-	va_start( args, iMessage );
-	if( lTime - gsLog.time > 0.1 )
-		printf( "\033[0;33m%06.3f\033[0m ", lTime - gsLog.time );
-	else
-		printf( "%06.3f ", lTime - gsLog.time );
-	printf( "%s", lTextSeverityCli );
-	vprintf( iMessage, args );
-	gsLog.time = lTime;
-	va_end( args );
+	fflush( gsLog.file );
 
-	if( gsLog.file != 0 && gsLog.severity <= iSeverity ) {
-		char lTimeBuffer[TimeLength+1]; // YYYY-MM-DD HH:MM:SS
-		time_t lUnixTimestamp = time(0);
+	struct stat lStat;
+	const int lFd = fileno( gsLog.file );
 
-		memset( lTimeBuffer, 0, TimeLength+1 );
-		strftime( lTimeBuffer, sizeof(lTimeBuffer), "%Y-%m-%d %T", localtime( &lUnixTimestamp ) );
+	atomic_init( &lRotation->size, fstat( lFd, &lStat ) == 0 ? (uint64_t)lStat.st_size : 0 );
+	atomic_init( &lRotation->opened, (long long)time( 0 ) );
+	atomic_init( &lRotation->retry, 0 );
+	atomic_init( &lRotation->rotating, false );
 
-		va_start( args, iMessage );
+	if( lRotation->props.preallocate && lRotation->props.max_size > 0 )
+		fallocate( lFd, FALLOC_FL_KEEP_SIZE, 0, (off_t)lRotation->props.max_size );
 
-		fprintf( gsLog.file, "%s %s", lTimeBuffer, lTextSeverityFile );
-		vfprintf( gsLog.file, iMessage, args );
+	// Rotated file left by a previous run is processed first.
+	char lStaged[PATH_MAX];
+	snprintf( lStaged, sizeof( lStaged ), "%s" TRH_LOG_STAGED, gsLog.path );
+	lRotation->staged = access( lStaged, F_OK ) == 0;
 
-		va_end( args );
+	pthread_mutex_init( &lRotation->mutex, 0 );
+	pthread_cond_init( &lRotation->cond, 0 );
 
-		if( strchr( iMessage, '\n' ) != 0 )
-			fflush( gsLog.file );
+	if( pthread_create( &lRotation->thread, 0, local_log_rotation_thread, lRotation ) != 0 ) {
+		printf( TRH_LOG_WARN "Failed to start log rotation thread.\n" );
+		pthread_cond_destroy( &lRotation->cond );
+		pthread_mutex_destroy( &lRotation->mutex );
+		free( lRotation );
+		return TRH_FAILED;
 	}
 
-	gsLog.current_message_severity = iSeverity;
+	gsLog.rotation = lRotation;
+
+	return TRH_OK;
 }
 
-void trh_log_more( chars iMessage, ... )
+int trh_log_rotate()
 {
-	if( iMessage == 0 || *iMessage == 0 ) return;
+	TAppLogRotation *lRotation = gsLog.rotation;
 
-	va_list args;
+	if( lRotation == 0 )
+		return TRH_UNINITIALIZED;
 
-	va_start( args, iMessage );
+	if( atomic_exchange( &lRotation->rotating, true ) )
+		return TRH_SKIP;
 
-	vprintf( iMessage, args );
+	int lCode = local_log_rotate( lRotation );
+	atomic_store( &lRotation->rotating, false );
 
-	va_end( args );
+	return lCode;
+}
 
-	if( gsLog.file != 0 && gsLog.severity <= gsLog.current_message_severity ) {
-		va_start( args, iMessage );
-		vfprintf( gsLog.file, iMessage, args );
+int trh_log_reopen()
+{
+	if( gsLog.file == 0 || gsLog.path == 0 )
+		return TRH_UNINITIALIZED;
 
-		if( strchr( iMessage, '\n' ) != 0 )
-			fflush( gsLog.file );
+	int lFd = open( gsLog.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+	if( lFd == -1 ) {
+		printf( TRH_LOG_WARN "Failed to reopen log file '%s'. Error: %s\n", gsLog.path, strerror( errno ) );
+		return TRH_FILE_ERROR;
+	}
+
+	int lCode = local_log_switch( lFd );
+	close( lFd );
 
-		va_end( args );
+	if( lCode == TRH_OK && gsLog.rotation != 0 ) {
+		struct stat lStat;
+		atomic_store( &gsLog.rotation->size, fstat( fileno( gsLog.file ), &lStat ) == 0 ? (uint64_t)lStat.st_size : 0 );
+		atomic_store( &gsLog.rotation->opened, (long long)time( 0 ) );
 	}
+
+	return lCode;
 }
 
-void trh_log_end()
+// #endregion // Rotation
+
+// #region Journal
+
+int trh_log_set_journal( bool iEnable, chars iIdentifier )
 {
-	printf( "\n" );
+	if( ! iEnable ) {
+		if( gsLog.journal )
+			local_log_journal_flush();
 
-	if( gsLog.file != 0 && gsLog.severity <= gsLog.current_message_severity ) {
-		fprintf( gsLog.file, "\n" );
-		fflush( gsLog.file );
+		gsLog.journal = false;
+		atomic_store( &gsLog.journal_id, 0 );
+		return TRH_OK;
 	}
+
+	TAppLogJournalId *lIdentifier = 0;
+
+	if( iIdentifier != 0 && *iIdentifier != 0 ) {
+		const size_t lLength = strlen( "SYSLOG_IDENTIFIER=" ) + strlen( iIdentifier ) + 1;
+
+		if( ( lIdentifier = (TAppLogJournalId*)malloc( sizeof( TAppLogJournalId ) + lLength ) ) == 0 )
+			return TRH_OUT_OF_MEM;
+
+		snprintf( lIdentifier->field, lLength, "SYSLOG_IDENTIFIER=%s", iIdentifier );
+		lIdentifier->prev = gsLog.journal_ids;
+		gsLog.journal_ids = lIdentifier;
+	}
+
+	// Text printed so far is not mixed with journal records.
+	fflush( stdout );
+
+	atomic_store( &gsLog.journal_id, lIdentifier );
+	gsLog.journal = true;
+
+	return TRH_OK;
 }
 
-void trh_log_set_severity_level( LogSeverity iSeverity )
+void trh_log_record( LogSeverity iSeverity, chars iCodeFile, chars iCodeLine, const struct iovec *iFields, size_t iCount, chars iMessage, ... )
 {
-	gsLog.severity = iSeverity;
+	gsLog.current_message_severity = iSeverity;
 
-	switch( iSeverity )
-	{
-	case LOG_DEBUG: printf( TRH_LOG_OK "Log severity set to DEBUG.\n" ); break;
-	case LOG_NOTE: printf( TRH_LOG_OK "Log severity set to NOTE.\n" ); break;
-	case LOG_WARNING: printf( TRH_LOG_OK "Log severity set to WARNING.\n" ); break;
-	case LOG_ERROR: printf( TRH_LOG_OK "Log severity set to ERROR.\n" ); break;
+	if( iSeverity < gsLog.min_severity )
+		return;
+
+	if( iMessage == 0 || *iMessage == 0 )
+		iMessage = "\n";
+
+	const TAppLogCode lCode = { iCodeFile, iCodeLine, iFields, iFields != 0 ? iCount : 0 };
+	va_list args;
+
+	va_start( args, iMessage );
+	local_log_message( LOG_RECORD_MESSAGE, iSeverity, &lCode, iMessage, args );
+	va_end( args );
+}
+
+// #endregion // Journal
+
+// #region Binary log
+
+int trh_log_binary_init( chars iFileName )
+{
+	TRH_ASSERT_ARG( iFileName != 0 && iFileName[0] != 0, "Failed to open binary log - file name is empty." );
+
+	pthread_mutex_lock( &gsLog.binary.mutex );
+
+	if( gsLog.binary.file != 0 )
+		fclose( gsLog.binary.file );
+
+	if( ( gsLog.binary.file = fopen( iFileName, "ab" ) ) == 0 ) {
+		pthread_mutex_unlock( &gsLog.binary.mutex );
+		printf( TRH_LOG_WARN "Failed to open binary log file '%s'. Binary logging disabled.\n", iFileName );
+		return TRH_FAILED;
 	}
+
+	// New file starts with magic.
+	fseek( gsLog.binary.file, 0, SEEK_END );
+	if( ftell( gsLog.binary.file ) == 0 )
+		fwrite( TRH_LOG_BIN_MAGIC, 1, strlen( TRH_LOG_BIN_MAGIC ), gsLog.binary.file );
+
+	// Session anchors monotonic timestamps to wall clock.
+	uint64_t lAnchor[2] = { local_log_clock( CLOCK_REALTIME ), trh_time_ns() };
+	local_log_binary_write( LOG_BIN_SESSION, LOG_NOTE, 0, lAnchor, sizeof( lAnchor ) );
+
+	// Formats registered before the file has been opened.
+	for( int ii = 0; ii < atomic_load( &gsLog.binary.count ); ii++ )
+		local_log_binary_write( LOG_BIN_FORMAT, LOG_NOTE, ii, gsLog.binary.formats[ii].format, strlen( gsLog.binary.formats[ii].format ) );
+
+	fflush( gsLog.binary.file );
+
+	pthread_mutex_unlock( &gsLog.binary.mutex );
+
+	printf( TRH_LOG_NOTE "Binary logging to file '%s'.\n", iFileName );
+
+	return TRH_OK;
 }
 
-void trh_log_release()
+int trh_log_format_register( chars iFormat )
 {
-	if( gsLog.file != 0 ) {
-		fclose( gsLog.file );
-		gsLog.file = 0;
+	TAppLogFormat lFormat = { .format = iFormat };
+	int lId = 0;
+
+	TRH_ASSERT_ARG( iFormat != 0, "Failed to register log format - format is null." );
+
+	if( trh_log_format_types( iFormat, lFormat.types ) < 0 ) {
+		trh_log( LOG_ERROR, "Unsupported binary log format '%s'.\n", iFormat );
+		return TRH_ARG_INVALID;
+	}
+
+	// Format is written to the file as one record; decoder could not render messages without it.
+	if( strlen( iFormat ) > TRH_LOG_BIN_PAYLOAD ) {
+		trh_log( LOG_ERROR, "Binary log format is longer than %d characters.\n", TRH_LOG_BIN_PAYLOAD );
+		return TRH_ARG_INVALID;
+	}
+
+	pthread_mutex_lock( &gsLog.binary.mutex );
+
+	if( gsLog.binary.formats == 0 )
+		gsLog.binary.formats = (TAppLogFormat*)malloc( TRH_LOG_BIN_FORMATS * sizeof( TAppLogFormat ) );
+
+	if( gsLog.binary.formats == 0 || ( lId = atomic_load( &gsLog.binary.count ) ) >= TRH_LOG_BIN_FORMATS ) {
+		pthread_mutex_unlock( &gsLog.binary.mutex );
+		trh_log( LOG_ERROR, "Failed to register binary log format '%s'.\n", iFormat );
+		return TRH_OUT_OF_MEM;
+	}
+
+	gsLog.binary.formats[lId] = lFormat;
+	atomic_store( &gsLog.binary.count, lId + 1 );
+
+	if( gsLog.binary.file != 0 )
+		local_log_binary_write( LOG_BIN_FORMAT, LOG_NOTE, lId, iFormat, strlen( iFormat ) );
+
+	pthread_mutex_unlock( &gsLog.binary.mutex );
+
+	return lId;
+}
+
+void trh_log_binary( LogSeverity iSeverity, int iFormatId, ... )
+{
+	if( iSeverity < gsLog.min_severity || iSeverity < gsLog.severity )
+		return;
+
+	// File and formats are released by trh_log_release() and replaced by trh_log_binary_init().
+	pthread_mutex_lock( &gsLog.binary.mutex );
+
+	if( gsLog.binary.file == 0 || iFormatId < 0 || iFormatId >= atomic_load_explicit( &gsLog.binary.count, memory_order_acquire ) ) {
+		pthread_mutex_unlock( &gsLog.binary.mutex );
+		return;
+	}
+
+	uint8_t lPayload[TRH_LOG_BIN_PAYLOAD];
+	size_t lLength = 0;
+	chars lTypes = gsLog.binary.formats[iFormatId].types;
+	va_list args;
+
+	va_start( args, iFormatId );
+
+	for( ; *lTypes != 0; lTypes++ ) {
+		union { int32_t i32; int64_t i64; double f64; uint16_t u16; } lValue;
+		size_t lSize = 8;
+
+		switch( *lTypes ) {
+			case 'i': lValue.i32 = va_arg( args, int ); lSize = 4; break;
+			case 'I': lValue.i32 = (int32_t)va_arg( args, unsigned int ); lSize = 4; break;
+			case 'l': lValue.i64 = va_arg( args, long ); break;
+			case 'L': lValue.i64 = (int64_t)va_arg( args, unsigned long ); break;
+			case 'q': lValue.i64 = va_arg( args, long long ); break;
+			case 'Q': lValue.i64 = (int64_t)va_arg( args, unsigned long long ); break;
+			case 'z': lValue.i64 = va_arg( args, ssize_t ); break;
+			case 'Z': lValue.i64 = (int64_t)va_arg( args, size_t ); break;
+			case 'j': lValue.i64 = va_arg( args, intmax_t ); break;
+			case 'J': lValue.i64 = (int64_t)va_arg( args, uintmax_t ); break;
+			case 'd': lValue.f64 = va_arg( args, double ); break;
+			case 'D': lValue.f64 = (double)va_arg( args, long double ); break;
+			case 'p': lValue.i64 = (int64_t)(uintptr_t)va_arg( args, void* ); break;
+			case 's': {
+				chars lText = va_arg( args, chars );
+				if( lText == 0 ) lText = "(null)";
+				size_t lTextLen = strlen( lText );
+
+				// No room for the length - message is dropped as truncated.
+				if( lLength + 2 > sizeof( lPayload ) ) {
+					lSize = sizeof( lPayload ) + 1;
+					break;
+				}
+
+				// String is truncated to fit the payload.
+				if( lTextLen > sizeof( lPayload ) - lLength - 2 )
+					lTextLen = sizeof( lPayload ) - lLength - 2;
+
+				lValue.u16 = (uint16_t)lTextLen;
+				memcpy( lPayload + lLength, &lValue.u16, 2 );
+				memcpy( lPayload + lLength + 2, lText, lTextLen );
+				lLength += 2 + lTextLen;
+				continue;
+			}
+		}
+
+		if( lSize > sizeof( lPayload ) - lLength )
+			break;
+
+		memcpy( lPayload + lLength, &lValue, lSize );
+		lLength += lSize;
+	}
+
+	va_end( args );
+
+	// Truncated message is not written - decoder could not parse it.
+	if( *lTypes == 0 ) {
+		local_log_binary_write( LOG_BIN_MESSAGE, iSeverity, (uint16_t)iFormatId, lPayload, (uint16_t)lLength );
+
+		if( iSeverity >= LOG_ERROR )
+			fflush( gsLog.binary.file );
 	}
+
+	pthread_mutex_unlock( &gsLog.binary.mutex );
 }
 
+int trh_log_format_types( chars iFormat, char *oTypes )
+{
+	int lCount = 0;
+
+	TRH_ASSERT_ARG( iFormat != 0 && oTypes != 0, "Failed to parse log format." );
+
+	for( chars lPtr = iFormat; *lPtr != 0; lPtr++ ) {
+		if( *lPtr != '%' )
+			continue;
+
+		if( *++lPtr == '%' )
+			continue;
+
+		// Flags, width, precision.
+		while( *lPtr != 0 && strchr( "-+ #0123456789.*'", *lPtr ) != 0 ) {
+			if( *lPtr == '*' ) {
+				if( lCount >= TRH_LOG_BIN_ARGS ) return TRH_ARG_INVALID;
+				oTypes[lCount++] = 'i';
+			}
+			lPtr++;
+		}
+
+		// Length modifier.
+		char lLength = 0;
+		switch( *lPtr ) {
+			case 'h': lPtr += lPtr[1] == 'h' ? 2 : 1; break;
+			case 'l': if( lPtr[1] == 'l' ) { lLength = 'q'; lPtr += 2; } else { lLength = 'l'; lPtr++; } break;
+			case 'q': lLength = 'q'; lPtr++; break;
+			case 'z': case 't': lLength = 'z'; lPtr++; break;
+			case 'j': lLength = 'j'; lPtr++; break;
+			case 'L': lLength = 'L'; lPtr++; break;
+		}
+
+		char lType = 0;
+		switch( *lPtr ) {
+			case 'd': case 'i': lType = lLength == 0 || lLength == 'L' ? 'i' : lLength; break;
+			case 'c': lType = 'i'; break;
+			case 'u': case 'x': case 'X': case 'o':
+				lType = lLength == 0 || lLength == 'L' ? 'I' : lLength - 'a' + 'A'; break;
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+				lType = lLength == 'L' ? 'D' : 'd'; break;
+			case 's': lType = 's'; break;
+			case 'p': lType = 'p'; break;
+			default: return TRH_ARG_INVALID;
+		}
+
+		if( lCount >= TRH_LOG_BIN_ARGS ) return TRH_ARG_INVALID;
+		oTypes[lCount++] = lType;
+	}
+
+	oTypes[lCount] = 0;
+
+	return lCount;
+}
+
+// #endregion // Binary log
+
+void trh_log_version()
+{
+	TAppVersion lAppVersion = { 0 };
+	trh_version( &lAppVersion );
+	trh_log(
+		LOG_NOTE, "libtrihlav v.%u.%u.%u (0x%08x)\n",
+		lAppVersion.major,
+		lAppVersion.minor,
+		lAppVersion.patch,
+		lAppVersion.ver
+	);
+}
+
+void trh_log( LogSeverity iSeverity, chars iMessage, ... )
+{
+	// Continuation (trh_log_more) follows the severity of the message.
+	gsLog.current_message_severity = iSeverity;
+
+	// Disabled message - skip formatting and argument processing entirely.
+	if( iSeverity < gsLog.min_severity )
+		return;
+
+	if( iMessage == 0 || *iMessage == 0 )
+		iMessage = "\n";
+
+	va_list args;
+
+	va_start( args, iMessage );
+	local_log_message( LOG_RECORD_MESSAGE, iSeverity, 0, iMessage, args );
+	va_end( args );
+}
+
+void trh_log_more( chars iMessage, ... )
+{
+	if( iMessage == 0 || *iMessage == 0 ) return;
+	if( gsLog.current_message_severity < gsLog.min_severity ) return;
+
+	va_list args;
+
+	va_start( args, iMessage );
+	local_log_message( LOG_RECORD_MORE, gsLog.current_message_severity, 0, iMessage, args );
+	va_end( args );
+}
+
+void trh_log_end()
+{
+	if( gsLog.current_message_severity < gsLog.min_severity ) return;
+
+	if( gsLog.async != 0 || gsLog.journal ) {
+		trh_log_more( "\n" );
+		return;
+	}
+
+	printf( "\n" );
+
+	if( gsLog.file != 0 && gsLog.severity <= gsLog.current_message_severity ) {
+		fprintf( gsLog.file, "\n" );
+		fflush( gsLog.file );
+		local_log_written( 1, true );
+	}
+}
+
+void trh_log_set_severity_level( LogSeverity iSeverity )
+{
+	gsLog.severity = iSeverity;
+
+	switch( iSeverity )
+	{
+	case LOG_DEBUG: printf( TRH_LOG_OK "Log severity set to DEBUG.\n" ); break;
+	case LOG_NOTE: printf( TRH_LOG_OK "Log severity set to NOTE.\n" ); break;
+	case LOG_WARNING: printf( TRH_LOG_OK "Log severity set to WARNING.\n" ); break;
+	case LOG_ERROR: printf( TRH_LOG_OK "Log severity set to ERROR.\n" ); break;
+	}
+}
+
+void trh_log_set_min_severity( LogSeverity iSeverity )
+{
+	gsLog.min_severity = iSeverity;
+}
+
+bool trh_log_enabled( LogSeverity iSeverity )
+{
+	return iSeverity >= gsLog.min_severity;
+}
+
+int trh_log_flush( int iTimeout )
+{
+	int lCode = TRH_OK;
+
+	if( gsLog.async != 0 ) {
+		TAppLogAsync *lAsync = gsLog.async;
+		const size_t lTarget = atomic_load( &lAsync->enqueue_pos );
+		const uint64_t lDeadline = trh_time_ns() + (uint64_t)( iTimeout > 0 ? iTimeout : 0 ) * TRH_NSEC_PER_MSEC;
+		const struct timespec lPause = { .tv_sec = 0, .tv_nsec = TRH_NSEC_PER_MSEC };
+
+		// Slots reserved before the call are published by their producers shortly.
+		while( atomic_load_explicit( &lAsync->dequeue_pos, memory_order_relaxed ) < lTarget ) {
+			if( trh_time_ns() >= lDeadline ) {
+				lCode = TRH_WAITING;
+				break;
+			}
+
+			local_log_wake();
+			nanosleep( &lPause, 0 );
+		}
+	}
+
+	fflush( stdout );
+
+	if( gsLog.file != 0 )
+		fflush( gsLog.file );
+
+	pthread_mutex_lock( &gsLog.binary.mutex );
+	if( gsLog.binary.file != 0 )
+		fflush( gsLog.binary.file );
+	pthread_mutex_unlock( &gsLog.binary.mutex );
+
+	return lCode;
+}
+
+void trh_log_release()
+{
+	// Stop the writer thread; all buffered messages are written before the thread exits.
+	if( gsLog.async != 0 ) {
+		TAppLogAsync *lAsync = gsLog.async;
+
+		atomic_store( &lAsync->running, false );
+		local_log_wake();
+		pthread_join( lAsync->thread, 0 );
+
+		gsLog.async = 0;
+		gsLog.time = lAsync->time;
+
+		if( atomic_load( &lAsync->dropped ) > 0 )
+			printf( TRH_LOG_WARN "Async logger dropped %" PRIu64 " messages.\n", (uint64_t)atomic_load( &lAsync->dropped ) );
+
+		pthread_cond_destroy( &lAsync->space );
+		pthread_mutex_destroy( &lAsync->mutex );
+		close( lAsync->wake_fd );
+		free( lAsync->ring );
+		free( lAsync );
+	}
+
+	// Stop the rotation thread; rotated file is processed before the thread exits.
+	if( gsLog.rotation != 0 ) {
+		TAppLogRotation *lRotation = gsLog.rotation;
+
+		pthread_mutex_lock( &lRotation->mutex );
+		lRotation->running = false;
+		pthread_cond_signal( &lRotation->cond );
+		pthread_mutex_unlock( &lRotation->mutex );
+		pthread_join( lRotation->thread, 0 );
+
+		gsLog.rotation = 0;
+
+		if( lRotation->next_fd != -1 ) {
+			char lNext[PATH_MAX];
+			snprintf( lNext, sizeof( lNext ), "%s" TRH_LOG_NEXT, gsLog.path );
+			close( lRotation->next_fd );
+			unlink( lNext );
+		}
+
+		if( gsLog.file != 0 ) {
+			fflush( gsLog.file );
+			local_log_trim( fileno( gsLog.file ) );
+		}
+
+		pthread_cond_destroy( &lRotation->cond );
+		pthread_mutex_destroy( &lRotation->mutex );
+		free( lRotation );
+	}
+
+	if( gsLog.file != 0 ) {
+		fclose( gsLog.file );
+		gsLog.file = 0;
+	}
+
+	FREE_PTR( gsLog.path );
+
+	trh_log_set_journal( false, 0 );
+
+	while( gsLog.journal_ids != 0 ) {
+		TAppLogJournalId *lIdentifier = gsLog.journal_ids;
+		gsLog.journal_ids = lIdentifier->prev;
+		free( lIdentifier );
+	}
+
+	pthread_mutex_lock( &gsLog.binary.mutex );
+	if( gsLog.binary.file != 0 ) {
+		fclose( gsLog.binary.file );
+		gsLog.binary.file = 0;
+	}
+	FREE_PTR( gsLog.binary.formats );
+	atomic_store( &gsLog.binary.count, 0 );
+	pthread_mutex_unlock( &gsLog.binary.mutex );
+}
+
+// #endregion
+
+
+// #region Static functions
+
+void local_log_severity_text( LogSeverity iSeverity, chars *oTextFile, chars *oTextCli )
+{
+	switch( iSeverity )
+	{
+	case LOG_DEBUG:   *oTextFile = TRH_LOG_DEBUG; *oTextCli = TRH_LOG_DEBUG_CLI; break;
+	case LOG_NOTE:    *oTextFile = TRH_LOG_NOTE;  *oTextCli = TRH_LOG_NOTE_CLI;  break;
+	case LOG_WARNING: *oTextFile = TRH_LOG_WARN;  *oTextCli = TRH_LOG_WARN_CLI;  break;
+	case LOG_ERROR:   *oTextFile = TRH_LOG_ERROR; *oTextCli = TRH_LOG_ERROR_CLI; break;
+	default:          *oTextFile = TRH_LOG_NOTE;  *oTextCli = TRH_LOG_NOTE_CLI;  break;
+	}
+}
+
+chars local_log_date( time_t iTime )
+{
+	// localtime_r() takes glibc timezone lock; call it at most once per second and thread.
+	static __thread time_t tsSecond = -1;
+	static __thread char tsText[sizeof( "YYYY-MM-DD HH:MM:SS" )];
+
+	if( iTime != tsSecond ) {
+		struct tm lTm;
+		localtime_r( &iTime, &lTm );
+		strftime( tsText, sizeof( tsText ), "%Y-%m-%d %T", &lTm );
+		tsSecond = iTime;
+	}
+
+	return tsText;
+}
+
+void local_log_message( LogRecordType iType, LogSeverity iSeverity, const TAppLogCode *iCode, chars iMessage, va_list iArgs )
+{
+	const bool lToFile = gsLog.file != 0 && gsLog.severity <= iSeverity;
+	va_list lArgs;
+
+	// Asynchronous mode - format the message once; writer thread adds time and severity.
+	if( gsLog.async != 0 && ! gsLog.journal ) {
+		local_log_push( iType, iSeverity, lToFile, true, iMessage, iArgs );
+		return;
+	}
+
+	// Format the message once (scratch arena) for all outputs.
+	struct TTrhArena *lArena = trh_arena_current();
+	const TTrhArenaMark lMark = trh_arena_mark( lArena );
+
+	va_copy( lArgs, iArgs );
+	chars lText = lArena != 0 ? trh_arena_vprintf( lArena, iMessage, lArgs ) : 0;
+	va_end( lArgs );
+
+	// Journal replaces stdout; record is sent by the calling thread.
+	if( gsLog.journal ) {
+		// No scratch arena (or it is full) - format the message on the stack, long message is truncated.
+		if( lText == 0 ) {
+			char lBuffer[TRH_LOG_JOURNAL_LINE];
+
+			va_copy( lArgs, iArgs );
+			const int lLength = vsnprintf( lBuffer, sizeof( lBuffer ), iMessage, lArgs );
+			va_end( lArgs );
+
+			// Truncated text keeps its end-line, so the record is not held as a continuation.
+			if( lLength >= (int)sizeof( lBuffer ) && iMessage[strlen( iMessage ) - 1] == '\n' )
+				lBuffer[sizeof( lBuffer ) - 2] = '\n';
+
+			local_log_journal( iType, iSeverity, iCode, lBuffer );
+		}
+		else
+			local_log_journal( iType, iSeverity, iCode, lText );
+	}
+
+	if( gsLog.async != 0 ) {
+		if( lToFile )
+			local_log_push( iType, iSeverity, true, false, iMessage, iArgs );
+
+		trh_arena_rewind( lArena, lMark );
+		return;
+	}
+
+	double lTime = trh_time();
+	chars lTextSeverityFile = 0;
+	chars lTextSeverityCli = 0;
+
+	local_log_severity_text( iSeverity, &lTextSeverityFile, &lTextSeverityCli );
+
+	if( ! gsLog.journal ) {
+		if( iType == LOG_RECORD_MESSAGE ) {
+			if( lTime - gsLog.time > 0.1 )
+				printf( "\033[0;33m%06.3f\033[0m ", lTime - gsLog.time );
+			else
+				printf( "%06.3f ", lTime - gsLog.time );
+			printf( "%s", lTextSeverityCli );
+			gsLog.time = lTime;
+		}
+
+		if( lText != 0 )
+			fputs( lText, stdout );
+		else {
+			va_copy( lArgs, iArgs );
+			vprintf( iMessage, lArgs );
+			va_end( lArgs );
+		}
+	}
+
+	if( lToFile ) {
+		// Date and text of the message stay together (other threads, rotation).
+		flockfile( gsLog.file );
+
+		int lWritten = 0;
+
+		if( iType == LOG_RECORD_MESSAGE )
+			lWritten = fprintf( gsLog.file, "%s %s", local_log_date( (time_t)lTime ), lTextSeverityFile );
+
+		if( lText != 0 )
+			lWritten += fputs( lText, gsLog.file ) >= 0 ? (int)strlen( lText ) : 0;
+		else {
+			va_copy( lArgs, iArgs );
+			lWritten += vfprintf( gsLog.file, iMessage, lArgs );
+			va_end( lArgs );
+		}
+
+		const bool lEndLine = strchr( iMessage, '\n' ) != 0;
+
+		if( lEndLine )
+			fflush( gsLog.file );
+
+		funlockfile( gsLog.file );
+
+		local_log_written( lWritten > 0 ? (size_t)lWritten : 0, lEndLine );
+	}
+
+	trh_arena_rewind( lArena, lMark );
+}
+
+void local_log_push( LogRecordType iType, LogSeverity iSeverity, bool iToFile, bool iToConsole, chars iMessage, va_list iArgs )
+{
+	TAppLogAsync *lAsync = gsLog.async;
+	TAppLogRecord *lRecord = 0;
+	size_t lPos = atomic_load_explicit( &lAsync->enqueue_pos, memory_order_relaxed );
+
+	// Reserve a slot (Vyukov's bounded queue).
+	for( ;; ) {
+		lRecord = &lAsync->ring[lPos & lAsync->mask];
+		size_t lSeq = atomic_load_explicit( &lRecord->sequence, memory_order_acquire );
+		intptr_t lDiff = (intptr_t)lSeq - (intptr_t)lPos;
+
+		if( lDiff == 0 ) {
+			if( atomic_compare_exchange_weak_explicit( &lAsync->enqueue_pos, &lPos, lPos + 1, memory_order_relaxed, memory_order_relaxed ) )
+				break;
+		}
+		else if( lDiff < 0 ) {
+			// Buffer is full.
+			if( lAsync->overflow == LOG_OVERFLOW_DROP ) {
+				atomic_fetch_add_explicit( &lAsync->dropped, 1, memory_order_relaxed );
+				local_log_wake();
+				return;
+			}
+
+			local_log_wake();
+			local_log_wait_space( lAsync, lRecord, lPos );
+			lPos = atomic_load_explicit( &lAsync->enqueue_pos, memory_order_relaxed );
+		}
+		else {
+			lPos = atomic_load_explicit( &lAsync->enqueue_pos, memory_order_relaxed );
+		}
+	}
+
+	lRecord->time = trh_time();
+	lRecord->severity = iSeverity;
+	lRecord->type = iType;
+	lRecord->to_file = iToFile;
+	lRecord->to_console = iToConsole;
+
+	int lLength = vsnprintf( lRecord->text, TRH_LOG_SLOT_SIZE, iMessage, iArgs );
+	if( lLength < 0 ) lLength = 0;
+
+	// Truncated message keeps its end-line.
+	if( lLength >= TRH_LOG_SLOT_SIZE ) {
+		lLength = TRH_LOG_SLOT_SIZE - 1;
+		if( strchr( iMessage, '\n' ) != 0 )
+			lRecord->text[lLength - 1] = '\n';
+	}
+
+	lRecord->length = (uint16_t)lLength;
+
+	// Publish the record.
+	atomic_store_explicit( &lRecord->sequence, lPos + 1, memory_order_release );
+
+	// Writer sleeps between flush intervals; wake it only for a full batch or an urgent message.
+	if( atomic_load_explicit( &lAsync->sleeping, memory_order_relaxed ) ) {
+		size_t lPending = lPos + 1 - atomic_load_explicit( &lAsync->dequeue_pos, memory_order_relaxed );
+		if( lPending >= TRH_LOG_BATCH || iSeverity >= TRH_LOG_URGENT )
+			local_log_wake();
+	}
+}
+
+void local_log_wake()
+{
+	const uint64_t lValue = 1;
+
+	if( write( gsLog.async->wake_fd, &lValue, sizeof( lValue ) ) != sizeof( lValue ) )
+		return;
+}
+
+void local_log_wait_space( TAppLogAsync *iAsync, TAppLogRecord *iRecord, size_t iPos )
+{
+	atomic_fetch_add( &iAsync->blocked, 1 );
+	pthread_mutex_lock( &iAsync->mutex );
+
+	// Writer releases slots before it takes the mutex to signal, so the wake-up can't be missed.
+	while( (intptr_t)atomic_load_explicit( &iRecord->sequence, memory_order_acquire ) - (intptr_t)iPos < 0
+		&& atomic_load_explicit( &iAsync->enqueue_pos, memory_order_relaxed ) == iPos )
+		pthread_cond_wait( &iAsync->space, &iAsync->mutex );
+
+	pthread_mutex_unlock( &iAsync->mutex );
+	atomic_fetch_sub( &iAsync->blocked, 1 );
+}
+
+ssize_t local_log_writev( int iFd, struct iovec *iIov, int iCount )
+{
+	ssize_t lTotal = 0;
+
+	while( iCount > 0 ) {
+		const ssize_t lWritten = writev( iFd, iIov, iCount );
+
+		if( lWritten < 0 ) {
+			if( errno == EINTR )
+				continue;
+			// EAGAIN, EPIPE, ENOSPC... - the rest of the batch is lost.
+			return lTotal > 0 ? lTotal : -1;
+		}
+
+		lTotal += lWritten;
+
+		// Skip written iovecs and move into the partially written one.
+		size_t lLeft = (size_t)lWritten;
+		while( iCount > 0 && lLeft >= iIov->iov_len ) {
+			lLeft -= iIov->iov_len;
+			iIov++;
+			iCount--;
+		}
+
+		if( iCount > 0 ) {
+			iIov->iov_base = (char*)iIov->iov_base + lLeft;
+			iIov->iov_len -= lLeft;
+		}
+	}
+
+	return lTotal;
+}
+
+void local_log_fault( chars iMessage, ... )
+{
+	va_list args;
+
+	va_start( args, iMessage );
+	fputs( TRH_LOG_WARN, stderr );
+	vfprintf( stderr, iMessage, args );
+	va_end( args );
+}
+
+void *local_log_writer( void *iArg )
+{
+	TAppLogAsync *lAsync = (TAppLogAsync*)iArg;
+	struct pollfd lPoll = { .fd = lAsync->wake_fd, .events = POLLIN };
+	uint64_t lValue = 0;
+
+	pthread_setname_np( pthread_self(), "trh-log" );
+
+	while( atomic_load( &lAsync->running ) ) {
+		if( local_log_drain( lAsync ) > 0 )
+			continue;
+
+		// Buffer is empty; sleep until flush interval expires or producer wakes the thread.
+		atomic_store( &lAsync->sleeping, true );
+		poll( &lPoll, 1, lAsync->flush_interval );
+		atomic_store( &lAsync->sleeping, false );
+
+		if( read( lAsync->wake_fd, &lValue, sizeof( lValue ) ) < 0 && errno != EAGAIN )
+			break;
+	}
+
+	// Drain the rest of the buffer before exit.
+	while( local_log_drain( lAsync ) > 0 );
+
+	return 0;
+}
+
+size_t local_log_drain( TAppLogAsync *iAsync )
+{
+	TAppLogAsync *lAsync = iAsync;
+
+	// Time and severity prefix of each record (terminal and file).
+	char lPrefixCli[TRH_LOG_BATCH][64];
+	char lPrefixFile[TRH_LOG_BATCH][40];
+	struct iovec lIovCli[TRH_LOG_BATCH * 2];
+	struct iovec lIovFile[TRH_LOG_BATCH * 2];
+	int lCountCli = 0;
+	int lCountFile = 0;
+
+	const size_t lStart = atomic_load_explicit( &lAsync->dequeue_pos, memory_order_relaxed );
+	size_t lPos = lStart;
+
+	// Collect published records.
+	for( ; lPos - lStart < TRH_LOG_BATCH; lPos++ ) {
+		TAppLogRecord *lRecord = &lAsync->ring[lPos & lAsync->mask];
+
+		if( atomic_load_explicit( &lRecord->sequence, memory_order_acquire ) != lPos + 1 )
+			break;
+
+		const size_t lIdx = lPos - lStart;
+
+		if( lRecord->type == LOG_RECORD_MESSAGE ) {
+			chars lTextSeverityFile = 0;
+			chars lTextSeverityCli = 0;
+			const double lDelta = lRecord->time - lAsync->time;
+			int lLength = 0;
+
+			local_log_severity_text( lRecord->severity, &lTextSeverityFile, &lTextSeverityCli );
+
+			if( lRecord->to_console ) {
+				lLength = lDelta > 0.1
+					? snprintf( lPrefixCli[lIdx], sizeof( lPrefixCli[lIdx] ), "\033[0;33m%06.3f\033[0m %s", lDelta, lTextSeverityCli )
+					: snprintf( lPrefixCli[lIdx], sizeof( lPrefixCli[lIdx] ), "%06.3f %s", lDelta, lTextSeverityCli );
+
+				if( lLength >= (int)sizeof( lPrefixCli[lIdx] ) ) lLength = sizeof( lPrefixCli[lIdx] ) - 1;
+				lIovCli[lCountCli++] = (struct iovec){ lPrefixCli[lIdx], (size_t)lLength };
+				lAsync->time = lRecord->time;
+			}
+
+			if( lRecord->to_file ) {
+				lLength = snprintf( lPrefixFile[lIdx], sizeof( lPrefixFile[lIdx] ), "%s %s", local_log_date( (time_t)lRecord->time ), lTextSeverityFile );
+				if( lLength >= (int)sizeof( lPrefixFile[lIdx] ) ) lLength = sizeof( lPrefixFile[lIdx] ) - 1;
+				lIovFile[lCountFile++] = (struct iovec){ lPrefixFile[lIdx], (size_t)lLength };
+			}
+		}
+
+		if( lRecord->to_console )
+			lIovCli[lCountCli++] = (struct iovec){ lRecord->text, lRecord->length };
+
+		if( lRecord->to_file )
+			lIovFile[lCountFile++] = (struct iovec){ lRecord->text, lRecord->length };
+	}
+
+	const size_t lCount = lPos - lStart;
+	if( lCount == 0 )
+		return 0;
+
+	// One syscall per sink and batch (more after partial write).
+	if( lCountCli > 0 && local_log_writev( STDOUT_FILENO, lIovCli, lCountCli ) < 0 ) { /* Terminal is gone; keep logging to file. */ }
+	if( lCountFile > 0 && gsLog.file != 0 ) {
+		const struct iovec lLast = lIovFile[lCountFile - 1];
+		size_t lSize = 0;
+
+		for( int ii = 0; ii < lCountFile; ii++ )
+			lSize += lIovFile[ii].iov_len;
+
+		const ssize_t lWritten = local_log_writev( fileno( gsLog.file ), lIovFile, lCountFile );
+
+		if( lWritten < (ssize_t)lSize )
+			local_log_fault( "Failed to write log file; %zu bytes lost. Error: %s\n", lSize - (size_t)( lWritten > 0 ? lWritten : 0 ), strerror( errno ) );
+
+		if( lWritten > 0 )
+			local_log_written( (size_t)lWritten, (size_t)lWritten == lSize && lLast.iov_len > 0 && ( (chars)lLast.iov_base )[lLast.iov_len - 1] == '\n' );
+	}
+
+	// Release slots to producers.
+	for( size_t ii = lStart; ii < lPos; ii++ )
+		atomic_store_explicit( &lAsync->ring[ii & lAsync->mask].sequence, ii + lAsync->mask + 1, memory_order_release );
+
+	atomic_store_explicit( &lAsync->dequeue_pos, lPos, memory_order_relaxed );
+
+	// Producers blocked on the full buffer (LOG_OVERFLOW_BLOCK).
+	atomic_thread_fence( memory_order_seq_cst );
+	if( atomic_load_explicit( &lAsync->blocked, memory_order_relaxed ) > 0 ) {
+		pthread_mutex_lock( &lAsync->mutex );
+		pthread_cond_broadcast( &lAsync->space );
+		pthread_mutex_unlock( &lAsync->mutex );
+	}
+
+	return lCount;
+}
+
+void local_log_binary_write( LogBinType iType, LogSeverity iSeverity, uint16_t iFormat, const void *iPayload, uint16_t iLength )
+{
+	uint8_t lBuffer[sizeof( TTrhLogBinRecord ) + TRH_LOG_BIN_PAYLOAD];
+	TTrhLogBinRecord lRecord = {
+		.type = (uint8_t)iType,
+		.severity = (uint8_t)iSeverity,
+		.format = iFormat,
+		.length = iLength,
+		.time = trh_time_ns()
+	};
+
+	if( iLength > TRH_LOG_BIN_PAYLOAD )
+		return;
+
+	// Single fwrite() per record - stdio lock keeps records from different threads intact.
+	memcpy( lBuffer, &lRecord, sizeof( lRecord ) );
+	memcpy( lBuffer + sizeof( lRecord ), iPayload, iLength );
+	fwrite( lBuffer, 1, sizeof( lRecord ) + iLength, gsLog.binary.file );
+}
+
+uint64_t local_log_clock( clockid_t iClock )
+{
+	struct timespec lTime;
+	clock_gettime( iClock, &lTime );
+	return (uint64_t)lTime.tv_sec * 1000000000ull + (uint64_t)lTime.tv_nsec;
+}
+
+// #region Rotation
+
+void local_log_written( size_t iBytes, bool iEndLine )
+{
+	TAppLogRotation *lRotation = gsLog.rotation;
+
+	if( lRotation == 0 )
+		return;
+
+	const uint64_t lSize = atomic_fetch_add_explicit( &lRotation->size, iBytes, memory_order_relaxed ) + iBytes;
+
+	if( ! iEndLine || lSize == 0 )
+		return;
+
+	const TTrhLogRotation *lProps = &lRotation->props;
+	bool lRotate = lProps->max_size > 0 && lSize >= lProps->max_size;
+	long long lNow = 0;
+
+	if( ! lRotate && lProps->max_age > 0 ) {
+		lNow = (long long)time( 0 );
+		lRotate = lNow - atomic_load_explicit( &lRotation->opened, memory_order_relaxed ) >= (long long)lProps->max_age;
+	}
+
+	if( ! lRotate )
+		return;
+
+	if( lNow == 0 )
+		lNow = (long long)time( 0 );
+
+	if( lNow < atomic_load_explicit( &lRotation->retry, memory_order_relaxed ) )
+		return;
+
+	// One writer rotates; the others keep writing to the current file.
+	if( atomic_exchange( &lRotation->rotating, true ) )
+		return;
+
+	// Rotated file is still being processed, or rename failed - do not retry on every line.
+	const int lCode = local_log_rotate( lRotation );
+	if( lCode == TRH_FILE_ERROR || lCode == TRH_SKIP )
+		atomic_store( &lRotation->retry, lNow + TRH_LOG_ROTATE_RETRY );
+
+	atomic_store( &lRotation->rotating, false );
+}
+
+int local_log_rotate( TAppLogRotation *iRotation )
+{
+	char lStaged[PATH_MAX];
+	char lNext[PATH_MAX];
+
+	snprintf( lStaged, sizeof( lStaged ), "%s" TRH_LOG_STAGED, gsLog.path );
+	snprintf( lNext, sizeof( lNext ), "%s" TRH_LOG_NEXT, gsLog.path );
+
+	pthread_mutex_lock( &iRotation->mutex );
+
+	// Previous rotated file is still being compressed; current file grows a bit over the limit.
+	if( iRotation->staged ) {
+		pthread_mutex_unlock( &iRotation->mutex );
+		return TRH_SKIP;
+	}
+
+	int lFd = iRotation->next_fd;
+	iRotation->next_fd = -1;
+
+	// Writers keep appending to the renamed file until the descriptor is switched.
+	if( rename( gsLog.path, lStaged ) != 0 ) {
+		pthread_mutex_unlock( &iRotation->mutex );
+		if( lFd != -1 ) { close( lFd ); unlink( lNext ); }
+		printf( TRH_LOG_WARN "Failed to rotate log file '%s'. Error: %s\n", gsLog.path, strerror( errno ) );
+		return TRH_FILE_ERROR;
+	}
+
+	if( lFd != -1 && rename( lNext, gsLog.path ) != 0 )
+		CLOSE_FD( lFd );
+
+	// Next file has not been prepared - open it here.
+	if( lFd == -1 && ( lFd = open( gsLog.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 ) ) == -1 ) {
+		const int lError = errno;
+		if( rename( lStaged, gsLog.path ) != 0 ) { /* Keep writing to the staged file. */ }
+		pthread_mutex_unlock( &iRotation->mutex );
+		printf( TRH_LOG_WARN "Failed to create log file '%s'. Error: %s\n", gsLog.path, strerror( lError ) );
+		return TRH_FILE_ERROR;
+	}
+
+	local_log_switch( lFd );
+	close( lFd );
+
+	atomic_store( &iRotation->size, 0 );
+	atomic_store( &iRotation->opened, (long long)time( 0 ) );
+
+	iRotation->staged = true;
+	pthread_cond_signal( &iRotation->cond );
+	pthread_mutex_unlock( &iRotation->mutex );
+
+	return TRH_OK;
+}
+
+int local_log_switch( int iFd )
+{
+	int lCode = TRH_OK;
+
+	// Message being written by another thread is finished in the previous file.
+	flockfile( gsLog.file );
+	fflush( gsLog.file );
+
+	if( dup2( iFd, fileno( gsLog.file ) ) == -1 ) {
+		printf( TRH_LOG_WARN "Failed to switch log file. Error: %s\n", strerror( errno ) );
+		lCode = TRH_FILE_ERROR;
+	}
+
+	funlockfile( gsLog.file );
+
+	return lCode;
+}
+
+void *local_log_rotation_thread( void *iArg )
+{
+	TAppLogRotation *lRotation = (TAppLogRotation*)iArg;
+	const TTrhLogRotation *lProps = &lRotation->props;
+
+	pthread_setname_np( pthread_self(), "trh-logrotate" );
+
+	pthread_mutex_lock( &lRotation->mutex );
+
+	for( ;; ) {
+		if( lRotation->staged ) {
+			pthread_mutex_unlock( &lRotation->mutex );
+			local_log_rotation_archive( lProps );
+			pthread_mutex_lock( &lRotation->mutex );
+			lRotation->staged = false;
+			continue;
+		}
+
+		if( ! lRotation->running )
+			break;
+
+		// Next file is ready before it is needed - rotation does not wait for open() and fallocate().
+		if( lRotation->next_fd == -1 ) {
+			pthread_mutex_unlock( &lRotation->mutex );
+			int lFd = local_log_rotation_prepare( lProps );
+			pthread_mutex_lock( &lRotation->mutex );
+
+			lRotation->next_fd = lFd;
+
+			if( lFd != -1 )
+				continue;
+		}
+
+		pthread_cond_wait( &lRotation->cond, &lRotation->mutex );
+	}
+
+	pthread_mutex_unlock( &lRotation->mutex );
+
+	return 0;
+}
+
+void local_log_rotation_archive( const TTrhLogRotation *iProps )
+{
+	chars lSuffix = iProps->compress ? ".gz" : "";
+	char lSource[PATH_MAX];
+	char lTarget[PATH_MAX];
+
+	snprintf( lSource, sizeof( lSource ), "%s" TRH_LOG_STAGED, gsLog.path );
+
+	// Preallocated space of the rotated file is not needed anymore.
+	int lFd = open( lSource, O_WRONLY | O_CLOEXEC );
+	if( lFd != -1 ) {
+		local_log_trim( lFd );
+		close( lFd );
+	}
+
+	if( iProps->keep == 0 ) {
+		unlink( lSource );
+		return;
+	}
+
+	// name.N-1 -> name.N ... name.1 -> name.2; the oldest file is deleted.
+	snprintf( lTarget, sizeof( lTarget ), "%s.%u%s", gsLog.path, iProps->keep, lSuffix );
+	unlink( lTarget );
+
+	for( uint32_t ii = iProps->keep; ii > 1; ii-- ) {
+		char lOlder[PATH_MAX];
+		snprintf( lOlder, sizeof( lOlder ), "%s.%u%s", gsLog.path, ii - 1, lSuffix );
+		snprintf( lTarget, sizeof( lTarget ), "%s.%u%s", gsLog.path, ii, lSuffix );
+		if( rename( lOlder, lTarget ) != 0 && errno != ENOENT )
+			printf( TRH_LOG_WARN "Failed to rename log file '%s'. Error: %s\n", lOlder, strerror( errno ) );
+	}
+
+	snprintf( lTarget, sizeof( lTarget ), "%s.1%s", gsLog.path, lSuffix );
+
+	if( iProps->compress && local_log_compress( lSource, lTarget ) == TRH_OK ) {
+		unlink( lSource );
+		return;
+	}
+
+	// Not compressed (or compression failed) - keep the plain file.
+	if( iProps->compress )
+		snprintf( lTarget, sizeof( lTarget ), "%s.1", gsLog.path );
+
+	if( rename( lSource, lTarget ) != 0 )
+		printf( TRH_LOG_WARN "Failed to rename log file '%s'. Error: %s\n", lSource, strerror( errno ) );
+}
+
+int local_log_rotation_prepare( const TTrhLogRotation *iProps )
+{
+	char lNext[PATH_MAX];
+	snprintf( lNext, sizeof( lNext ), "%s" TRH_LOG_NEXT, gsLog.path );
+
+	int lFd = open( lNext, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644 );
+	if( lFd == -1 ) {
+		printf( TRH_LOG_WARN "Failed to prepare log file '%s'. Error: %s\n", lNext, strerror( errno ) );
+		return -1;
+	}
+
+	// Space is reserved, file size stays 0 (O_APPEND writes from the beginning).
+	if( iProps->preallocate && iProps->max_size > 0 )
+		fallocate( lFd, FALLOC_FL_KEEP_SIZE, 0, (off_t)iProps->max_size );
+
+	return lFd;
+}
+
+int local_log_compress( chars iSource, chars iTarget )
+{
+#ifdef TRH_LOG_ZLIB
+	char lTemp[PATH_MAX + sizeof( ".tmp" )];
+	snprintf( lTemp, sizeof( lTemp ), "%s.tmp", iTarget );
+
+	int lIn = open( iSource, O_RDONLY | O_CLOEXEC );
+	if( lIn == -1 )
+		return TRH_FILE_ERROR;
+
+	gzFile lOut = gzopen( lTemp, "wbe" );
+	if( lOut == 0 ) {
+		close( lIn );
+		return TRH_FILE_ERROR;
+	}
+
+	char *lBuffer = (char*)malloc( TRH_LOG_COMPRESS_BLOCK );
+	ssize_t lRead = lBuffer != 0 ? 0 : -1;
+
+	while( lBuffer != 0 && ( lRead = read( lIn, lBuffer, TRH_LOG_COMPRESS_BLOCK ) ) > 0 ) {
+		if( gzwrite( lOut, lBuffer, (unsigned)lRead ) != (int)lRead ) {
+			lRead = -1;
+			break;
+		}
+	}
+
+	free( lBuffer );
+	close( lIn );
+
+	if( gzclose( lOut ) != Z_OK || lRead < 0 || rename( lTemp, iTarget ) != 0 ) {
+		printf( TRH_LOG_WARN "Failed to compress log file '%s'.\n", iSource );
+		unlink( lTemp );
+		return TRH_FILE_ERROR;
+	}
+
+	return TRH_OK;
+#else
+	return TRH_NOT_IMPLEMENTED;
+#endif
+}
+
+void local_log_trim( int iFd )
+{
+	struct stat lStat;
+
+	if( fstat( iFd, &lStat ) == 0 && ftruncate( iFd, lStat.st_size ) != 0 ) { /* Space is released when the file is deleted. */ }
+}
+
+// #endregion // Rotation
+
+// #region Journal
+
+void local_log_journal( LogRecordType iType, LogSeverity iSeverity, const TAppLogCode *iCode, chars iText )
+{
+	TAppLogLine *lLine = &gsLogLine;
+	const size_t lPrefix = sizeof( TRH_LOG_JOURNAL_MESSAGE ) - 1;
+	size_t lLength = strlen( iText );
+
+	// New message - unfinished line of the thread is sent first.
+	if( iType == LOG_RECORD_MESSAGE ) {
+		if( lLine->length > lPrefix )
+			local_log_journal_flush();
+
+		lLine->severity = iSeverity;
+	}
+
+	// Complete message (the usual case, and records with fields) is sent directly from the scratch arena.
+	if( iType == LOG_RECORD_MESSAGE && ( iCode != 0 || ( lLength > 0 && iText[lLength - 1] == '\n' ) ) ) {
+		const bool lEndLine = lLength > 0 && iText[lLength - 1] == '\n';
+		if( lEndLine )
+			lLength--;
+
+		char *lField = (char*)trh_arena_alloc( 0, lPrefix + lLength );
+
+		if( lField != 0 ) {
+			memcpy( lField, TRH_LOG_JOURNAL_MESSAGE, lPrefix );
+			memcpy( lField + lPrefix, iText, lLength );
+			local_log_journal_send( iSeverity, iCode, lField, lPrefix + lLength );
+			return;
+		}
+
+		// Out of scratch memory - record with fields is sent from the (empty) line, long text is truncated.
+		if( iCode != 0 ) {
+			const size_t lCopy = lLength < sizeof( lLine->text ) - lPrefix ? lLength : sizeof( lLine->text ) - lPrefix;
+
+			memcpy( lLine->text + lPrefix, iText, lCopy );
+			local_log_journal_send( iSeverity, iCode, lLine->text, lPrefix + lCopy );
+			return;
+		}
+
+		// End-line is collected too - it flushes the line.
+		if( lEndLine )
+			lLength++;
+	}
+
+	// Continuation - collect the line; full buffer is sent as a separate record.
+	while( lLength > 0 ) {
+		size_t lCopy = sizeof( lLine->text ) - lLine->length;
+		if( lCopy > lLength ) lCopy = lLength;
+
+		memcpy( lLine->text + lLine->length, iText, lCopy );
+		lLine->length += lCopy;
+		iText += lCopy;
+		lLength -= lCopy;
+
+		if( lLine->length == sizeof( lLine->text ) || lLine->text[lLine->length - 1] == '\n' )
+			local_log_journal_flush();
+	}
+}
+
+void local_log_journal_flush()
+{
+	TAppLogLine *lLine = &gsLogLine;
+	const size_t lPrefix = sizeof( TRH_LOG_JOURNAL_MESSAGE ) - 1;
+
+	if( lLine->length <= lPrefix )
+		return;
+
+	size_t lLength = lLine->length;
+	if( lLine->text[lLength - 1] == '\n' )
+		lLength--;
+
+	local_log_journal_send( lLine->severity, 0, lLine->text, lLength );
+	lLine->length = lPrefix;
+}
+
+void local_log_journal_send( LogSeverity iSeverity, const TAppLogCode *iCode, chars iField, size_t iLength )
+{
+	// syslog(3) priorities: debug 7, info 6, warning 4, err 3.
+	static const struct iovec lsPriority[] = {
+		TRH_LOG_FIELD( "PRIORITY=7" ),
+		TRH_LOG_FIELD( "PRIORITY=6" ),
+		TRH_LOG_FIELD( "PRIORITY=4" ),
+		TRH_LOG_FIELD( "PRIORITY=3" )
+	};
+
+	struct iovec lIov[TRH_LOG_JOURNAL_FIELDS + 5];
+	int lCount = 0;
+
+	lIov[lCount++] = (struct iovec){ (void*)iField, iLength };
+	lIov[lCount++] = lsPriority[iSeverity <= LOG_ERROR ? iSeverity : LOG_NOTE];
+
+	TAppLogJournalId *lIdentifier = atomic_load_explicit( &gsLog.journal_id, memory_order_acquire );
+	if( lIdentifier != 0 )
+		lIov[lCount++] = (struct iovec){ lIdentifier->field, strlen( lIdentifier->field ) };
+
+	if( iCode != 0 ) {
+		if( iCode->file != 0 ) lIov[lCount++] = (struct iovec){ (void*)iCode->file, strlen( iCode->file ) };
+		if( iCode->line != 0 ) lIov[lCount++] = (struct iovec){ (void*)iCode->line, strlen( iCode->line ) };
+
+		for( size_t ii = 0; ii < iCode->count && ii < TRH_LOG_JOURNAL_FIELDS; ii++ )
+			lIov[lCount++] = iCode->fields[ii];
+	}
+
+	// Journal is not available - nothing else to do, log file (if any) still gets the message.
+	if( sd_journal_sendv( lIov, lCount ) < 0 ) { /* Dropped. */ }
+}
+
+// #endregion // Journal
+
 // #endregion
@@ -0,0 +1,1331 @@
+/*
+ * @brief Event loops (reactors) - one epoll instance per thread
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+// pthread_setaffinity_np, pthread_setname_np
+#define _GNU_SOURCE
+
+// #region Includes
+
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "trihlav.h"
+#include "trh_arena.h"
+#include "trh_io.h"
+#include "trh_watch.h"
+#include "trh_logger.h"
+#include "trh_loop.h"
+#include "trh_std.h"
+#include "trh_stats.h"
+#include "trh_timer.h"
+
+// #endregion
+
+// Upper limit of epoll events per iteration.
+#define EPOLL_EVENTS_MAX		65536
+// Maximal number of posted tasks executed in one wake-up; the rest is executed in the next iteration.
+#define POST_BATCH_MAX			4096
+// Number of loop phases with hooks (LoopPhase).
+#define LOOP_PHASES				3
+// Initial capacity of hook and deferred task arrays.
+#define LOOP_HOOKS_SIZE			8
+// Initial capacity of the list of registered events.
+#define LOOP_EVENTS_SIZE		16
+
+// #region Typedefs
+
+/**
+ * @brief Task posted to the loop (node of MPSC queue).
+ */
+typedef struct TTrhTask {
+	_Atomic( struct TTrhTask* ) next;
+	handle_task handle;
+	void *arg;
+} TTrhTask;
+
+/**
+ * @brief Hook of a loop phase, or deferred task.
+ */
+typedef struct TTrhLoopHook {
+	handle_task handle;
+	void *arg;
+} TTrhLoopHook;
+
+/**
+ * @brief Hooks of one loop phase.
+ */
+typedef struct TTrhLoopHooks {
+	TTrhLoopHook *items;
+	size_t count;
+	size_t size;
+	/// Hooks are being executed - removed hooks are only cleared.
+	bool running;
+	/// Some hooks have been cleared while running; array is compacted afterwards.
+	bool removed;
+} TTrhLoopHooks;
+
+/**
+ * @brief Event loop - epoll instance with its own wake-up event and timer queue.
+ */
+typedef struct TTrhLoop {
+	/// Epoll file descriptor.
+	int epoll_fd;
+
+	/// Buffer for events returned by epoll_wait(); reallocated when \a event_batch changes.
+	struct epoll_event *events;
+	/// Capacity of \a events buffer.
+	size_t event_capacity;
+	/// Requested number of events dispatched in one iteration.
+	size_t event_batch;
+	/// Number of events returned by the last wait and not dispatched yet.
+	size_t event_count;
+
+	/// Scratch arena position at the start of the iteration (trh_loop_wait); rewound when the iteration ends.
+	TTrhArenaMark arena_mark;
+	/// True if \a arena_mark has been taken and not rewound yet.
+	bool arena_marked;
+	/// Number of callbacks in progress. Iteration nested in a callback (e.g. trh_loop_drain) keeps the mark.
+	unsigned callback_depth;
+
+	/// Wake-up event (eventfd) used to interrupt blocking wait and to signal posted tasks.
+	TTrhEvent wake_event;
+
+	/// Posted tasks - intrusive MPSC queue (Vyukov). Producers exchange \a post_head, the loop pops \a post_tail.
+	_Atomic( TTrhTask* ) post_head;
+	TTrhTask *post_tail;
+	TTrhTask post_stub;
+	/// True if the eventfd has been signalled for posted tasks and the loop has not drained them yet.
+	/// Burst of posts costs one wake-up.
+	atomic_bool post_pending;
+
+	/// Phase hooks (LoopPhase).
+	TTrhLoopHooks hooks[LOOP_PHASES];
+	/// Tasks deferred to the next iteration; swapped with \a defer_run when they are executed.
+	TTrhLoopHooks defer;
+	TTrhLoopHooks defer_run;
+
+	/// Timers of this loop.
+	struct TTrhTimerQueue *timers;
+
+	/// Asynchronous file operations (trh_io.h); created on first use.
+	struct TTrhIo *io;
+
+	/// File watches (trh_watch.h); created on first use.
+	struct TTrhWatcher *watcher;
+
+	/// Events registered with the loop (TTrhEvent::index is the position); guarded by \a registered_mutex.
+	TTrhEvent **registered;
+	size_t registered_count;
+	size_t registered_size;
+	pthread_mutex_t registered_mutex;
+	/// If true, the loop does not accept new events (trh_loop_drain).
+	atomic_bool closing;
+	/// If true, wait blocks although the application is terminating (trh_loop_drain).
+	bool draining;
+
+#ifdef TRH_LOOP_STATS
+	/// Instrumentation (trh_stats.h). Written only by the thread running the loop.
+	TTrhLoopStats *stats;
+#endif
+
+	/// If true, \a trh_loop_run returns.
+	atomic_bool stop;
+
+	/// Thread owning the loop - the creator, then the thread running it (trh_loop_wait). See trh_loop_owned().
+	pthread_t thread;
+
+	/// Callback function executed on loop error.
+	handle_loop_error handle_error;
+	/// Callback updating application clock during the drain; null if not set.
+	handle_loop_clock handle_clock;
+} TTrhLoop;
+
+/**
+ * @brief Worker thread of the loop pool.
+ */
+typedef struct TTrhLoopWorker {
+	struct TTrhLoopPool *pool;
+	TTrhLoop *loop;
+	size_t index;
+
+	pthread_t thread;
+	bool started;
+} TTrhLoopWorker;
+
+/**
+ * @brief Pool of loops running on worker threads.
+ */
+typedef struct TTrhLoopPool {
+	TTrhLoopWorker *workers;
+	size_t count;
+
+	/// Pin worker N to CPU N.
+	bool pin;
+	/// Number of online CPUs.
+	long cpus;
+
+	/// Executed on every worker thread before its loop runs.
+	handle_loop_start handle_start;
+	void *data;
+} TTrhLoopPool;
+
+// #endregion
+
+
+// #region Static functions
+
+/**
+ * @brief Executed when epoll_wait() returns -1.
+ * @return TRH_WAITING An interrupt signal has been received and callback handler returned OK.
+ * @return TRH_EPOLL_FAILED An error has been detected or callback handler did not return OK.
+ */
+static int local_loop_error( TTrhLoop *iLoop );
+
+/**
+ * @brief Reallocate buffer of epoll events to requested batch size.
+ */
+static int local_loop_resize( TTrhLoop *iLoop );
+
+/**
+ * @brief Handle epoll event.
+ */
+static int local_loop_event( TTrhLoop *iLoop, struct epoll_event *iEvent );
+
+/**
+ * @brief Call event handler; measure its run time if the loop is instrumented.
+ */
+static void local_loop_call( TTrhLoop *iLoop, handle_event iHandler, TTrhEvent *iEvent );
+
+/**
+ * @brief Drain wake-up eventfd and execute posted tasks.
+ */
+static int local_wake_event( TTrhEvent *iEvent );
+
+/**
+ * @brief Pop a task from the queue. Return null if the queue is empty (or a producer is in the middle of push).
+ */
+static TTrhTask *local_post_pop( TTrhLoop *iLoop );
+
+/**
+ * @brief Execute up to POST_BATCH_MAX posted tasks.
+ */
+static void local_post_drain( TTrhLoop *iLoop );
+
+/**
+ * @brief Execute hooks of the phase.
+ */
+static void local_loop_hooks( TTrhLoop *iLoop, LoopPhase iPhase );
+
+/**
+ * @brief Execute tasks deferred in the previous iteration.
+ */
+static void local_loop_defer_run( TTrhLoop *iLoop );
+
+/**
+ * @brief Remember scratch arena position at the start of the iteration.
+ */
+static void local_loop_mark( TTrhLoop *iLoop );
+
+/**
+ * @brief Release scratch memory allocated during the iteration (hooks, deferred tasks and handlers).
+ */
+static void local_loop_rewind( TTrhLoop *iLoop );
+
+/**
+ * @brief Append hook to the array.
+ */
+static int local_loop_hook_push( TTrhLoopHooks *iHooks, handle_task iHandle, void *iArg );
+
+/**
+ * @brief Return true if the loop has posted or deferred tasks, or file operations in progress.
+ */
+static bool local_loop_busy( TTrhLoop *iLoop );
+
+/**
+ * @brief Add event to the list of registered events.
+ */
+static int local_loop_track( TTrhLoop *iLoop, TTrhEvent *iEvent );
+
+/**
+ * @brief Remove event from the list of registered events; return false if it is not there.
+ */
+static bool local_loop_untrack( TTrhLoop *iLoop, TTrhEvent *iEvent );
+
+/**
+ * @brief Thread function of the loop pool worker.
+ */
+static void *local_pool_thread( void *iWorker );
+
+// #endregion
+
+
+// #region Static variables
+
+// Loop running on the calling thread (trh_loop_run).
+static __thread TTrhLoop *gsLoopCurrent = 0;
+
+// #endregion
+
+
+// #region Exported functions
+
+// #region Loop
+
+int trh_loop_init( TTrhLoop **oLoop )
+{
+	TRH_ASSERT_ARG( oLoop != 0, "Failed to create loop - invalid output argument." );
+
+	TTrhLoop *lLoop = (TTrhLoop*)calloc( 1, sizeof( TTrhLoop ) );
+	int lCode = TRH_OK;
+
+	if( lLoop == 0 ) return TRH_OUT_OF_MEM;
+
+#ifdef TRH_LOOP_STATS
+	if( ( lLoop->stats = (TTrhLoopStats*)calloc( 1, sizeof( TTrhLoopStats ) ) ) == 0 ) {
+		free( lLoop );
+		return TRH_OUT_OF_MEM;
+	}
+#endif
+
+	lLoop->wake_event.fd = -1;
+	lLoop->event_batch = TRH_EVENT_BATCH_DEFAULT;
+	lLoop->thread = pthread_self();
+	atomic_init( &lLoop->stop, false );
+	atomic_init( &lLoop->closing, false );
+	pthread_mutex_init( &lLoop->registered_mutex, 0 );
+
+	// Empty task queue contains only the stub node.
+	atomic_init( &lLoop->post_stub.next, 0 );
+	atomic_init( &lLoop->post_head, &lLoop->post_stub );
+	atomic_init( &lLoop->post_pending, false );
+	lLoop->post_tail = &lLoop->post_stub;
+
+	// Create epoll object
+	lLoop->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+	if( lLoop->epoll_fd == -1 ) {
+		trh_log( LOG_ERROR, "Failed to create epoll. Error: %s\n", strerror( errno ) );
+		trh_loop_release( lLoop );
+		return TRH_EPOLL_FAILED;
+	}
+
+	if( ( lCode = local_loop_resize( lLoop ) ) != TRH_OK ) {
+		trh_loop_release( lLoop );
+		return lCode;
+	}
+
+	// Create wake-up event for blocking wait
+	lLoop->wake_event.fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	lLoop->wake_event.handle_triggered = local_wake_event;
+	lLoop->wake_event.ext.data = lLoop;
+
+	if( lLoop->wake_event.fd == -1 ) {
+		trh_log( LOG_ERROR, "Failed to create wake-up event. Error: %s\n", strerror( errno ) );
+		trh_loop_release( lLoop );
+		return TRH_EPOLL_FAILED;
+	}
+
+	if( ( lCode = trh_event_register_on( lLoop, &lLoop->wake_event ) ) != TRH_OK ) {
+		trh_loop_release( lLoop );
+		return lCode;
+	}
+
+	// Create timer queue
+	if( ( lCode = trh_timer_queue_init( lLoop, &lLoop->timers ) ) != TRH_OK ) {
+		trh_loop_release( lLoop );
+		return lCode;
+	}
+
+	*oLoop = lLoop;
+
+	return TRH_OK;
+}
+
+void trh_loop_release( TTrhLoop *iLoop )
+{
+	if( iLoop == 0 )
+		return;
+
+	// Release io context
+	trh_io_release( iLoop->io );
+	iLoop->io = 0;
+
+	// Release watcher (its timer belongs to the timer queue)
+	trh_watcher_release( iLoop->watcher );
+	iLoop->watcher = 0;
+
+	// Release timer queue
+	trh_timer_queue_release( iLoop->timers );
+	iLoop->timers = 0;
+
+	// Release wake-up event
+	if( iLoop->wake_event.fd != -1 ) {
+		trh_event_unregister( &iLoop->wake_event );
+		CLOSE_FD( iLoop->wake_event.fd );
+	}
+
+	// Release epoll object
+	CLOSE_FD( iLoop->epoll_fd );
+	FREE_PTR( iLoop->events );
+
+	// Events are owned by the application; only forget them.
+	FREE_PTR( iLoop->registered );
+	pthread_mutex_destroy( &iLoop->registered_mutex );
+
+	// Release hooks
+	for( size_t ii = 0; ii < LOOP_PHASES; ii++ )
+		FREE_PTR( iLoop->hooks[ii].items );
+
+	if( iLoop->defer.count > 0 )
+		trh_log( LOG_WARNING, "%zu deferred tasks have not been executed.\n", iLoop->defer.count );
+
+	FREE_PTR( iLoop->defer.items );
+	FREE_PTR( iLoop->defer_run.items );
+
+	// Tasks posted after the loop has stopped are not executed.
+	size_t lDropped = 0;
+	for( TTrhTask *lTask = local_post_pop( iLoop ); lTask != 0; lTask = local_post_pop( iLoop ), lDropped++ )
+		free( lTask );
+
+	if( lDropped > 0 )
+		trh_log( LOG_WARNING, "%zu posted tasks have not been executed.\n", lDropped );
+
+	if( gsLoopCurrent == iLoop )
+		gsLoopCurrent = 0;
+
+#ifdef TRH_LOOP_STATS
+	free( iLoop->stats );
+#endif
+
+	free( iLoop );
+}
+
+TTrhLoop *trh_loop_current()
+{
+	return gsLoopCurrent != 0 ? gsLoopCurrent : trh_loop_default();
+}
+
+int trh_loop_wait( TTrhLoop *iLoop, int iTimeout )
+{
+	TRH_ASSERT_ARG( iLoop != 0, "Failed to wait for events. Loop is null." );
+
+	// Loop created on one thread and run on another (loop pool) - the running thread owns it.
+	if( ! pthread_equal( iLoop->thread, pthread_self() ) )
+		iLoop->thread = pthread_self();
+
+	iLoop->event_count = 0;
+
+	// Batch size could be changed since last iteration; no event from the old buffer is in use now.
+	if( iLoop->event_capacity != iLoop->event_batch && local_loop_resize( iLoop ) != TRH_OK )
+		return TRH_OUT_OF_MEM;
+
+	// Do not fall asleep if the loop has been already stopped.
+	if( iTimeout != 0 && ! iLoop->draining && ( atomic_load( &iLoop->stop ) || trh_is_terminating() ) )
+		return TRH_END;
+
+	// Scratch memory of deferred tasks and hooks is released with the memory of the handlers.
+	local_loop_mark( iLoop );
+
+	local_loop_defer_run( iLoop );
+	local_loop_hooks( iLoop, TRH_LOOP_PREPARE );
+
+	// Loop has no work before it falls asleep.
+	if( iTimeout != 0 && iLoop->defer.count == 0 )
+		local_loop_hooks( iLoop, TRH_LOOP_IDLE );
+
+	// Deferred tasks are executed in the next iteration - do not block.
+	if( iLoop->defer.count > 0 )
+		iTimeout = 0;
+
+	// File operations queued during the iteration are submitted at once.
+	trh_io_submit( iLoop->io );
+
+	int lEventCount = epoll_wait( iLoop->epoll_fd, iLoop->events, (int)iLoop->event_capacity, iTimeout );
+
+	if( lEventCount == -1 ) {
+		// Stop, termination or reload has been requested by a signal handler - this is not an error.
+		if( errno == EINTR && ( atomic_load( &iLoop->stop ) || trh_is_terminating() || trh_is_reloading() ) ) {
+			local_loop_hooks( iLoop, TRH_LOOP_CHECK );
+			local_loop_rewind( iLoop );
+			return TRH_WAITING;
+		}
+
+		const int lCode = local_loop_error( iLoop );
+		local_loop_rewind( iLoop );
+		return lCode;
+	}
+
+	// Iteration without events - nothing is dispatched.
+	if( lEventCount == 0 ) {
+		if( iTimeout == 0 && iLoop->defer.count == 0 )
+			local_loop_hooks( iLoop, TRH_LOOP_IDLE );
+
+		local_loop_hooks( iLoop, TRH_LOOP_CHECK );
+		local_loop_rewind( iLoop );
+		return TRH_WAITING;
+	}
+
+	iLoop->event_count = (size_t)lEventCount;
+
+	return TRH_OK;
+}
+
+size_t trh_loop_pending( TTrhLoop *iLoop )
+{
+	return iLoop != 0 ? iLoop->event_count : 0;
+}
+
+void trh_loop_dispatch( TTrhLoop *iLoop )
+{
+	if( iLoop == 0 )
+		return;
+
+	const size_t lCount = iLoop->event_count;
+	iLoop->event_count = 0;
+
+	// Scratch memory allocated by handlers is released at the end of the iteration (mark is taken by the wait).
+	if( ! iLoop->arena_marked )
+		local_loop_mark( iLoop );
+
+#ifdef TRH_LOOP_STATS
+	const uint64_t lStart = trh_time_ns();
+#endif
+
+	iLoop->callback_depth++;
+	for( size_t ii = 0; ii < lCount; ii++ )
+		local_loop_event( iLoop, &iLoop->events[ii] );
+	iLoop->callback_depth--;
+
+	// Work batched by the handlers (scratch memory is still valid).
+	local_loop_hooks( iLoop, TRH_LOOP_CHECK );
+
+	local_loop_rewind( iLoop );
+
+#ifdef TRH_LOOP_STATS
+	if( lCount > 0 ) {
+		iLoop->stats->iterations++;
+		trh_histogram_record( &iLoop->stats->events, lCount );
+		trh_histogram_record( &iLoop->stats->dispatch, trh_time_ns() - lStart );
+	}
+#endif
+}
+
+int trh_loop_update_wait( TTrhLoop *iLoop, int iTimeout )
+{
+	int lCode = trh_loop_wait( iLoop, iTimeout );
+
+	if( lCode != TRH_OK )
+		return lCode;
+
+	trh_loop_dispatch( iLoop );
+
+	return TRH_OK;
+}
+
+int trh_loop_run( TTrhLoop *iLoop )
+{
+	TRH_ASSERT_ARG( iLoop != 0, "Failed to run loop. Loop is null." );
+
+	TTrhLoop *lPrevious = gsLoopCurrent;
+	int lCode = TRH_OK;
+
+	// Events and timers created from handlers belong to this loop.
+	gsLoopCurrent = iLoop;
+
+	while( ! atomic_load( &iLoop->stop ) && ! trh_is_terminating() ) {
+		lCode = trh_loop_update_wait( iLoop, -1 );
+
+		if( lCode < TRH_OK )
+			break;
+
+		lCode = TRH_OK;
+	}
+
+	gsLoopCurrent = lPrevious;
+
+	return lCode;
+}
+
+void trh_loop_stop( TTrhLoop *iLoop )
+{
+	if( iLoop == 0 )
+		return;
+
+	atomic_store( &iLoop->stop, true );
+	trh_loop_wakeup( iLoop );
+}
+
+int trh_loop_drain( TTrhLoop *iLoop, uint64_t iDeadline, handle_loop_pending iPending )
+{
+	TRH_ASSERT_ARG( iLoop != 0, "Failed to drain loop. Loop is null." );
+
+	TTrhLoop *lPrevious = gsLoopCurrent;
+	int lCode = TRH_OK;
+
+	atomic_store( &iLoop->closing, true );
+	iLoop->draining = true;
+	gsLoopCurrent = iLoop;
+
+	while( local_loop_busy( iLoop ) || ( iPending != 0 && iPending() > 0 ) ) {
+		const uint64_t lNow = trh_time_ns();
+
+		if( lNow >= iDeadline ) {
+			lCode = TRH_WAITING;
+			break;
+		}
+
+		// Round up, so the last wait does not return just before the deadline.
+		uint64_t lTimeout = ( iDeadline - lNow + TRH_NSEC_PER_MSEC - 1 ) / TRH_NSEC_PER_MSEC;
+
+		// Deferred tasks are executed by the wait itself - check the result before falling asleep.
+		if( iLoop->defer.count > 0 )
+			lTimeout = 0;
+
+		// Timers and handlers measure the grace period with the application clock.
+		if( iLoop->handle_clock != 0 )
+			iLoop->handle_clock();
+
+		lCode = trh_loop_wait( iLoop, lTimeout < INT32_MAX ? (int)lTimeout : INT32_MAX );
+		if( lCode < TRH_OK )
+			break;
+
+		if( lCode == TRH_OK ) {
+			// Loop could sleep for a while - handlers see the wake-up time.
+			if( lTimeout != 0 && iLoop->handle_clock != 0 )
+				iLoop->handle_clock();
+
+			trh_loop_dispatch( iLoop );
+		}
+
+		lCode = TRH_OK;
+	}
+
+	gsLoopCurrent = lPrevious;
+	iLoop->draining = false;
+
+	return lCode;
+}
+
+void trh_loop_close( TTrhLoop *iLoop )
+{
+	if( iLoop == 0 )
+		return;
+
+	atomic_store( &iLoop->closing, true );
+
+	// Owners of internal events and timers release them first.
+	trh_io_release( iLoop->io );
+	iLoop->io = 0;
+	trh_watcher_release( iLoop->watcher );
+	iLoop->watcher = 0;
+
+	const size_t lTimers = trh_timer_queue_clear( iLoop->timers );
+	size_t lEvents = 0;
+
+	// Handler may unregister other events - take them one by one, without the lock held.
+	for( ;; ) {
+		TTrhEvent *lEvent = 0;
+
+		pthread_mutex_lock( &iLoop->registered_mutex );
+		for( size_t ii = iLoop->registered_count; ii > 0 && lEvent == 0; ii-- ) {
+			if( iLoop->registered[ii - 1] != &iLoop->wake_event )
+				lEvent = iLoop->registered[ii - 1];
+		}
+		pthread_mutex_unlock( &iLoop->registered_mutex );
+
+		if( lEvent == 0 )
+			break;
+
+		trh_event_unregister( lEvent );
+		lEvents++;
+
+		if( lEvent->handle_released != 0 )
+			lEvent->handle_released( lEvent );
+	}
+
+	if( lTimers > 0 || lEvents > 0 )
+		trh_log( LOG_DEBUG, "Loop closed - %zu timers and %zu events released.\n", lTimers, lEvents );
+}
+
+void trh_loop_wakeup( TTrhLoop *iLoop )
+{
+	const uint64_t lValue = 1;
+
+	if( iLoop == 0 || iLoop->wake_event.fd == -1 )
+		return;
+
+	// write() is async-signal-safe; eventfd counter saturates only after 2^64-2 calls.
+	if( write( iLoop->wake_event.fd, &lValue, sizeof( lValue ) ) != sizeof( lValue ) )
+		return;
+}
+
+int trh_loop_set_event_batch( TTrhLoop *iLoop, size_t iCount )
+{
+	if( iLoop == 0 || iCount == 0 || iCount > EPOLL_EVENTS_MAX ) {
+		trh_log( LOG_ERROR, "Invalid epoll event batch size %zu.\n", iCount );
+		return TRH_ARG_INVALID;
+	}
+
+	iLoop->event_batch = iCount;
+	return TRH_OK;
+}
+
+void trh_loop_set_error_handler( TTrhLoop *iLoop, handle_loop_error iHandler )
+{
+	if( iLoop != 0 )
+		iLoop->handle_error = iHandler;
+}
+
+void trh_loop_set_clock_handler( TTrhLoop *iLoop, handle_loop_clock iHandler )
+{
+	if( iLoop != 0 )
+		iLoop->handle_clock = iHandler;
+}
+
+bool trh_loop_owned( TTrhLoop *iLoop )
+{
+	return iLoop != 0 && pthread_equal( iLoop->thread, pthread_self() );
+}
+
+struct TTrhTimerQueue *trh_loop_timers( TTrhLoop *iLoop )
+{
+	return iLoop != 0 ? iLoop->timers : 0;
+}
+
+struct TTrhIo *trh_loop_io( TTrhLoop *iLoop )
+{
+	if( iLoop == 0 )
+		return 0;
+
+	if( iLoop->io == 0 && trh_io_init( iLoop, &iLoop->io ) != TRH_OK )
+		return 0;
+
+	return iLoop->io;
+}
+
+int trh_loop_stats( TTrhLoop *iLoop, TTrhLoopStats *oStats )
+{
+	TRH_ASSERT_ARG( iLoop != 0 && oStats != 0, "Failed to get loop stats - invalid argument." );
+
+#ifdef TRH_LOOP_STATS
+	memcpy( oStats, iLoop->stats, sizeof( TTrhLoopStats ) );
+	return TRH_OK;
+#else
+	memset( oStats, 0, sizeof( TTrhLoopStats ) );
+	return TRH_NOT_IMPLEMENTED;
+#endif
+}
+
+void trh_loop_stats_reset( TTrhLoop *iLoop )
+{
+#ifdef TRH_LOOP_STATS
+	if( iLoop != 0 )
+		memset( iLoop->stats, 0, sizeof( TTrhLoopStats ) );
+#else
+	(void)iLoop;
+#endif
+}
+
+TTrhLoopStats *trh_loop_stats_data( TTrhLoop *iLoop )
+{
+#ifdef TRH_LOOP_STATS
+	return iLoop != 0 ? iLoop->stats : 0;
+#else
+	(void)iLoop;
+	return 0;
+#endif
+}
+
+struct TTrhWatcher *trh_loop_watcher( TTrhLoop *iLoop )
+{
+	if( iLoop == 0 )
+		return 0;
+
+	if( iLoop->watcher == 0 && trh_watcher_init( iLoop, &iLoop->watcher ) != TRH_OK )
+		return 0;
+
+	return iLoop->watcher;
+}
+
+int trh_post_on( TTrhLoop *iLoop, handle_task iTask, void *iArg )
+{
+	TRH_ASSERT_ARG( iTask != 0, "Failed to post task. Task is null." );
+
+	if( iLoop == 0 )
+		return TRH_UNINITIALIZED;
+
+	TTrhTask *lTask = (TTrhTask*)malloc( sizeof( TTrhTask ) );
+	if( lTask == 0 ) return TRH_OUT_OF_MEM;
+
+	lTask->handle = iTask;
+	lTask->arg = iArg;
+	atomic_store_explicit( &lTask->next, 0, memory_order_relaxed );
+
+	// Push: swing the head, then link the previous head. Wait-free for producers.
+	TTrhTask *lPrev = atomic_exchange_explicit( &iLoop->post_head, lTask, memory_order_acq_rel );
+	atomic_store_explicit( &lPrev->next, lTask, memory_order_release );
+
+	// Only the first post since the last drain signals the eventfd.
+	if( ! atomic_exchange( &iLoop->post_pending, true ) )
+		trh_loop_wakeup( iLoop );
+
+	return TRH_OK;
+}
+
+int trh_post( handle_task iTask, void *iArg )
+{
+	return trh_post_on( trh_loop_default(), iTask, iArg );
+}
+
+int trh_defer_on( TTrhLoop *iLoop, handle_task iTask, void *iArg )
+{
+	TRH_ASSERT_ARG( iTask != 0, "Failed to defer task. Task is null." );
+
+	if( iLoop == 0 )
+		return TRH_UNINITIALIZED;
+
+	return local_loop_hook_push( &iLoop->defer, iTask, iArg );
+}
+
+int trh_defer( handle_task iTask, void *iArg )
+{
+	return trh_defer_on( trh_loop_default(), iTask, iArg );
+}
+
+int trh_hook_add_on( TTrhLoop *iLoop, LoopPhase iPhase, handle_task iHook, void *iArg )
+{
+	TRH_ASSERT_ARG( iHook != 0 && (unsigned)iPhase < LOOP_PHASES, "Failed to add loop hook - invalid arguments." );
+
+	if( iLoop == 0 )
+		return TRH_UNINITIALIZED;
+
+	return local_loop_hook_push( &iLoop->hooks[iPhase], iHook, iArg );
+}
+
+int trh_hook_add( LoopPhase iPhase, handle_task iHook, void *iArg )
+{
+	return trh_hook_add_on( trh_loop_default(), iPhase, iHook, iArg );
+}
+
+int trh_hook_remove_on( TTrhLoop *iLoop, LoopPhase iPhase, handle_task iHook, void *iArg )
+{
+	TRH_ASSERT_ARG( (unsigned)iPhase < LOOP_PHASES, "Failed to remove loop hook - invalid phase." );
+
+	if( iLoop == 0 )
+		return TRH_UNINITIALIZED;
+
+	TTrhLoopHooks *lHooks = &iLoop->hooks[iPhase];
+
+	for( size_t ii = 0; ii < lHooks->count; ii++ ) {
+		if( lHooks->items[ii].handle != iHook || lHooks->items[ii].arg != iArg )
+			continue;
+
+		// Running hooks are only cleared; array is compacted after the phase.
+		if( lHooks->running ) {
+			lHooks->items[ii].handle = 0;
+			lHooks->removed = true;
+		}
+		else {
+			memmove( &lHooks->items[ii], &lHooks->items[ii + 1], ( lHooks->count - ii - 1 ) * sizeof( TTrhLoopHook ) );
+			lHooks->count--;
+		}
+
+		return TRH_OK;
+	}
+
+	return TRH_SKIP;
+}
+
+int trh_hook_remove( LoopPhase iPhase, handle_task iHook, void *iArg )
+{
+	return trh_hook_remove_on( trh_loop_default(), iPhase, iHook, iArg );
+}
+
+// #endregion // Loop
+
+
+// #region Events
+
+int trh_event_register_on( TTrhLoop *iLoop, TTrhEvent *iEvent )
+{
+	TRH_ASSERT_ARG( iEvent != 0, "Failed to register event. Event is null.\n" );
+	TRH_ASSERT_ARG( iLoop != 0, "Failed to register event. Loop is null.\n" );
+
+	struct epoll_event lEvent = {
+		.events = iEvent->events != 0 ? iEvent->events : EPOLLIN,
+		.data.ptr = iEvent
+	};
+
+	if( atomic_load( &iLoop->closing ) ) {
+		trh_log( LOG_WARNING, "Event has not been registered - loop is shutting down.\n" );
+		return TRH_END;
+	}
+
+	if( epoll_ctl( iLoop->epoll_fd, EPOLL_CTL_ADD, iEvent->fd, &lEvent ) == -1 ) {
+		trh_log( LOG_ERROR, "Failed to register event: %s.\n", strerror( errno ) );
+		return TRH_EPOLL_FAILED;
+	}
+
+	if( local_loop_track( iLoop, iEvent ) != TRH_OK ) {
+		epoll_ctl( iLoop->epoll_fd, EPOLL_CTL_DEL, iEvent->fd, 0 );
+		return TRH_OUT_OF_MEM;
+	}
+
+	iEvent->loop = iLoop;
+
+	return TRH_OK;
+}
+
+int trh_event_modify( TTrhEvent *iEvent )
+{
+	TRH_ASSERT_ARG( iEvent != 0, "Failed to modify event. Event is null.\n" );
+
+	TTrhLoop *lLoop = iEvent->loop != 0 ? iEvent->loop : trh_loop_default();
+
+	struct epoll_event lEvent = {
+		.events = iEvent->events != 0 ? iEvent->events : EPOLLIN,
+		.data.ptr = iEvent
+	};
+
+	if( lLoop == 0 || epoll_ctl( lLoop->epoll_fd, EPOLL_CTL_MOD, iEvent->fd, &lEvent ) == -1 ) {
+		trh_log( LOG_ERROR, "Failed to modify event: %s.\n", strerror( errno ) );
+		return TRH_EPOLL_FAILED;
+	}
+
+	return TRH_OK;
+}
+
+void trh_event_unregister( TTrhEvent *iEvent )
+{
+	if( iEvent == 0 ) {
+		trh_log( LOG_ERROR, "Failed to unregister event. Event is null.\n" );
+		return;
+	}
+
+	TTrhLoop *lLoop = iEvent->loop != 0 ? iEvent->loop : trh_loop_default();
+	iEvent->loop = 0;
+
+	if( lLoop == 0 || lLoop->epoll_fd == -1 )
+		return;
+
+	// Event released by trh_loop_close is unregistered already.
+	if( local_loop_untrack( lLoop, iEvent ) )
+		epoll_ctl( lLoop->epoll_fd, EPOLL_CTL_DEL, iEvent->fd, 0 );
+}
+
+// #endregion // Events
+
+
+// #region Loop pool
+
+int trh_loop_pool_start( size_t iCount, bool iPin, handle_loop_start iStart, void *iData, TTrhLoopPool **oPool )
+{
+	TRH_ASSERT_ARG( oPool != 0, "Failed to start loop pool - invalid output argument." );
+
+	TTrhLoopPool *lPool = (TTrhLoopPool*)calloc( 1, sizeof( TTrhLoopPool ) );
+	int lCode = TRH_OK;
+
+	if( lPool == 0 ) return TRH_OUT_OF_MEM;
+
+	lPool->cpus = sysconf( _SC_NPROCESSORS_ONLN );
+	if( lPool->cpus < 1 ) lPool->cpus = 1;
+
+	lPool->count = iCount != 0 ? iCount : (size_t)lPool->cpus;
+	lPool->pin = iPin;
+	lPool->handle_start = iStart;
+	lPool->data = iData;
+
+	lPool->workers = (TTrhLoopWorker*)calloc( lPool->count, sizeof( TTrhLoopWorker ) );
+	if( lPool->workers == 0 ) {
+		free( lPool );
+		return TRH_OUT_OF_MEM;
+	}
+
+	// Create all loops first - they can be used by the caller as soon as this function returns.
+	for( size_t ii = 0; ii < lPool->count; ii++ ) {
+		lPool->workers[ii].pool = lPool;
+		lPool->workers[ii].index = ii;
+
+		if( ( lCode = trh_loop_init( &lPool->workers[ii].loop ) ) != TRH_OK ) {
+			trh_loop_pool_stop( lPool );
+			return lCode;
+		}
+	}
+
+	for( size_t ii = 0; ii < lPool->count; ii++ ) {
+		if( pthread_create( &lPool->workers[ii].thread, 0, local_pool_thread, &lPool->workers[ii] ) != 0 ) {
+			trh_log( LOG_ERROR, "Failed to start loop thread %zu.\n", ii );
+			trh_loop_pool_stop( lPool );
+			return TRH_FAILED;
+		}
+
+		lPool->workers[ii].started = true;
+	}
+
+	*oPool = lPool;
+
+	return TRH_OK;
+}
+
+size_t trh_loop_pool_size( TTrhLoopPool *iPool )
+{
+	return iPool != 0 ? iPool->count : 0;
+}
+
+TTrhLoop *trh_loop_pool_get( TTrhLoopPool *iPool, size_t iIndex )
+{
+	if( iPool == 0 || iIndex >= iPool->count )
+		return 0;
+
+	return iPool->workers[iIndex].loop;
+}
+
+void trh_loop_pool_stop( TTrhLoopPool *iPool )
+{
+	if( iPool == 0 )
+		return;
+
+	// Request all loops to stop first, then wait for them - loops are stopped in parallel.
+	for( size_t ii = 0; ii < iPool->count; ii++ )
+		trh_loop_stop( iPool->workers[ii].loop );
+
+	for( size_t ii = 0; ii < iPool->count; ii++ ) {
+		if( iPool->workers[ii].started )
+			pthread_join( iPool->workers[ii].thread, 0 );
+
+		trh_loop_release( iPool->workers[ii].loop );
+	}
+
+	FREE_PTR( iPool->workers );
+	free( iPool );
+}
+
+// #endregion // Loop pool
+
+// #endregion // Exported functions
+
+
+// #region Static functions
+
+int local_loop_error( TTrhLoop *iLoop )
+{
+	if( errno == EINTR && iLoop->handle_error != 0 && iLoop->handle_error() == TRH_OK )
+		return TRH_WAITING;
+
+	if( errno == EINTR )
+		trh_log( LOG_WARNING, "Application loop terminated by interrupt signal.\n" );
+	else
+		trh_log( LOG_ERROR, "Error while checking for epoll events. Error: %s\n", strerror( errno ) );
+
+	return TRH_EPOLL_FAILED;
+}
+
+int local_loop_resize( TTrhLoop *iLoop )
+{
+	struct epoll_event *lEvents = (struct epoll_event*)realloc( iLoop->events, iLoop->event_batch * sizeof( struct epoll_event ) );
+
+	if( lEvents == 0 ) {
+		trh_log( LOG_ERROR, "Failed to allocate %zu epoll events.\n", iLoop->event_batch );
+		return TRH_OUT_OF_MEM;
+	}
+
+	iLoop->events = lEvents;
+	iLoop->event_capacity = iLoop->event_batch;
+	return TRH_OK;
+}
+
+int local_loop_event( TTrhLoop *iLoop, struct epoll_event *iEvent )
+{
+	TTrhEvent *lEvent = (TTrhEvent*)iEvent->data.ptr;
+
+	// Check if file descriptor has been closed, or network connection has been lost.
+	if( iEvent->events & EPOLLERR ) {
+		trh_log( LOG_WARNING, "EPOLLERR on fd %d\n", lEvent->fd );
+		if( lEvent->handle_error != 0 )
+			local_loop_call( iLoop, lEvent->handle_error, lEvent );
+		return TRH_EPOLL_ERROR;
+	}
+
+	// Writable fd has its own handler. It is called first - readable handler may close the fd and release the event.
+	uint32_t lReadable = iEvent->events & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP );
+	if( iEvent->events & EPOLLOUT ) {
+		if( lEvent->handle_writable != 0 )
+			local_loop_call( iLoop, lEvent->handle_writable, lEvent );
+		else
+			lReadable |= EPOLLOUT;
+	}
+
+	// Check if file descriptor is ready for reading, or the peer has closed the connection.
+	if( lReadable != 0 ) {
+		assert( lEvent->handle_triggered != 0 );
+		local_loop_call( iLoop, lEvent->handle_triggered, lEvent );
+	}
+
+	return TRH_OK;
+}
+
+void local_loop_call( TTrhLoop *iLoop, handle_event iHandler, TTrhEvent *iEvent )
+{
+#ifdef TRH_LOOP_STATS
+	const uint64_t lStart = trh_time_ns();
+	iHandler( iEvent );
+	trh_stats_handler( iLoop->stats, (const void*)(uintptr_t)iHandler, trh_time_ns() - lStart );
+#else
+	(void)iLoop;
+	iHandler( iEvent );
+#endif
+}
+
+int local_wake_event( TTrhEvent *iEvent )
+{
+	uint64_t lValue = 0;
+
+	// Reset eventfd counter; all wake-up requests since last wait are handled at once.
+	if( read( iEvent->fd, &lValue, sizeof( lValue ) ) != sizeof( lValue ) )
+		return TRH_WAITING;
+
+	local_post_drain( (TTrhLoop*)iEvent->ext.data );
+
+	return TRH_OK;
+}
+
+TTrhTask *local_post_pop( TTrhLoop *iLoop )
+{
+	TTrhTask *lTail = iLoop->post_tail;
+	TTrhTask *lNext = atomic_load_explicit( &lTail->next, memory_order_acquire );
+
+	// Skip the stub node.
+	if( lTail == &iLoop->post_stub ) {
+		if( lNext == 0 )
+			return 0;
+		iLoop->post_tail = lTail = lNext;
+		lNext = atomic_load_explicit( &lTail->next, memory_order_acquire );
+	}
+
+	if( lNext != 0 ) {
+		iLoop->post_tail = lNext;
+		return lTail;
+	}
+
+	// Tail is the last node; a producer could be between exchange and link.
+	if( lTail != atomic_load_explicit( &iLoop->post_head, memory_order_acquire ) )
+		return 0;
+
+	// Re-insert the stub so the last node can be popped.
+	atomic_store_explicit( &iLoop->post_stub.next, 0, memory_order_relaxed );
+	TTrhTask *lPrev = atomic_exchange_explicit( &iLoop->post_head, &iLoop->post_stub, memory_order_acq_rel );
+	atomic_store_explicit( &lPrev->next, &iLoop->post_stub, memory_order_release );
+
+	lNext = atomic_load_explicit( &lTail->next, memory_order_acquire );
+	if( lNext == 0 )
+		return 0;
+
+	iLoop->post_tail = lNext;
+	return lTail;
+}
+
+void local_post_drain( TTrhLoop *iLoop )
+{
+	// Clear the flag before draining - a task posted from now on signals the eventfd again.
+	atomic_store( &iLoop->post_pending, false );
+
+	for( size_t ii = 0; ii < POST_BATCH_MAX; ii++ ) {
+		TTrhTask *lTask = local_post_pop( iLoop );
+
+		if( lTask == 0 )
+			return;
+
+		lTask->handle( lTask->arg );
+		free( lTask );
+	}
+
+	// Tasks are left in the queue (maybe posted by tasks themselves) - continue in the next iteration.
+	if( ! atomic_exchange( &iLoop->post_pending, true ) )
+		trh_loop_wakeup( iLoop );
+}
+
+void local_loop_hooks( TTrhLoop *iLoop, LoopPhase iPhase )
+{
+	TTrhLoopHooks *lHooks = &iLoop->hooks[iPhase];
+
+	if( lHooks->count == 0 )
+		return;
+
+	// Hooks added meanwhile are executed from the next iteration; array can be reallocated by them.
+	const size_t lCount = lHooks->count;
+
+	lHooks->running = true;
+	iLoop->callback_depth++;
+
+	for( size_t ii = 0; ii < lCount; ii++ ) {
+		const TTrhLoopHook lHook = lHooks->items[ii];
+		if( lHook.handle != 0 )
+			lHook.handle( lHook.arg );
+	}
+
+	iLoop->callback_depth--;
+	lHooks->running = false;
+
+	if( lHooks->removed ) {
+		size_t lKept = 0;
+
+		for( size_t ii = 0; ii < lHooks->count; ii++ )
+			if( lHooks->items[ii].handle != 0 )
+				lHooks->items[lKept++] = lHooks->items[ii];
+
+		lHooks->count = lKept;
+		lHooks->removed = false;
+	}
+}
+
+void local_loop_defer_run( TTrhLoop *iLoop )
+{
+	if( iLoop->defer.count == 0 )
+		return;
+
+	// Swap the arrays - tasks deferred by deferred tasks wait for the next iteration.
+	TTrhLoopHooks lRun = iLoop->defer;
+	iLoop->defer = iLoop->defer_run;
+	iLoop->defer.count = 0;
+
+	iLoop->callback_depth++;
+	for( size_t ii = 0; ii < lRun.count; ii++ )
+		lRun.items[ii].handle( lRun.items[ii].arg );
+	iLoop->callback_depth--;
+
+	lRun.count = 0;
+	iLoop->defer_run = lRun;
+}
+
+void local_loop_mark( TTrhLoop *iLoop )
+{
+	// Nested iteration - its memory is released with the memory of the outer one.
+	if( iLoop->callback_depth > 0 )
+		return;
+
+	// Previous wait returned events that have not been dispatched - its iteration ends here.
+	local_loop_rewind( iLoop );
+
+	// Arena created later in the iteration gives an empty mark - rewinding it resets the arena.
+	iLoop->arena_mark = trh_arena_mark( trh_arena_thread( false ) );
+	iLoop->arena_marked = true;
+}
+
+void local_loop_rewind( TTrhLoop *iLoop )
+{
+	if( ! iLoop->arena_marked || iLoop->callback_depth > 0 )
+		return;
+
+	iLoop->arena_marked = false;
+	trh_arena_rewind( trh_arena_thread( false ), iLoop->arena_mark );
+}
+
+bool local_loop_busy( TTrhLoop *iLoop )
+{
+	// Empty task queue contains only the stub node.
+	if( iLoop->post_tail != &iLoop->post_stub || atomic_load( &iLoop->post_head ) != &iLoop->post_stub )
+		return true;
+
+	return iLoop->defer.count > 0 || trh_io_pending( iLoop->io ) > 0;
+}
+
+int local_loop_track( TTrhLoop *iLoop, TTrhEvent *iEvent )
+{
+	pthread_mutex_lock( &iLoop->registered_mutex );
+
+	if( iLoop->registered_count == iLoop->registered_size ) {
+		size_t lSize = iLoop->registered_size > 0 ? iLoop->registered_size * 2 : LOOP_EVENTS_SIZE;
+		TTrhEvent **lItems = (TTrhEvent**)realloc( iLoop->registered, lSize * sizeof( TTrhEvent* ) );
+
+		if( lItems == 0 ) {
+			pthread_mutex_unlock( &iLoop->registered_mutex );
+			return TRH_OUT_OF_MEM;
+		}
+
+		iLoop->registered = lItems;
+		iLoop->registered_size = lSize;
+	}
+
+	iEvent->index = iLoop->registered_count;
+	iLoop->registered[iLoop->registered_count++] = iEvent;
+
+	pthread_mutex_unlock( &iLoop->registered_mutex );
+
+	return TRH_OK;
+}
+
+bool local_loop_untrack( TTrhLoop *iLoop, TTrhEvent *iEvent )
+{
+	bool lFound = false;
+
+	pthread_mutex_lock( &iLoop->registered_mutex );
+
+	// Index of an event which is not registered can be stale - check the position.
+	const size_t lIndex = iEvent->index;
+	if( lIndex < iLoop->registered_count && iLoop->registered[lIndex] == iEvent ) {
+		// Move the last event to the vacant position.
+		iLoop->registered[lIndex] = iLoop->registered[--iLoop->registered_count];
+		iLoop->registered[lIndex]->index = lIndex;
+		lFound = true;
+	}
+
+	pthread_mutex_unlock( &iLoop->registered_mutex );
+
+	return lFound;
+}
+
+int local_loop_hook_push( TTrhLoopHooks *iHooks, handle_task iHandle, void *iArg )
+{
+	if( iHooks->count == iHooks->size ) {
+		size_t lSize = iHooks->size > 0 ? iHooks->size * 2 : LOOP_HOOKS_SIZE;
+		TTrhLoopHook *lItems = (TTrhLoopHook*)realloc( iHooks->items, lSize * sizeof( TTrhLoopHook ) );
+		if( lItems == 0 ) return TRH_OUT_OF_MEM;
+
+		iHooks->items = lItems;
+		iHooks->size = lSize;
+	}
+
+	iHooks->items[iHooks->count++] = (TTrhLoopHook){ iHandle, iArg };
+
+	return TRH_OK;
+}
+
+void *local_pool_thread( void *iWorker )
+{
+	TTrhLoopWorker *lWorker = (TTrhLoopWorker*)iWorker;
+	TTrhLoopPool *lPool = lWorker->pool;
+	char lName[16];
+
+	snprintf( lName, sizeof( lName ), "trh-loop-%zu", lWorker->index );
+	pthread_setname_np( pthread_self(), lName );
+
+	if( lPool->pin ) {
+		cpu_set_t lCpus;
+		CPU_ZERO( &lCpus );
+		CPU_SET( (int)( lWorker->index % (size_t)lPool->cpus ), &lCpus );
+
+		if( pthread_setaffinity_np( pthread_self(), sizeof( lCpus ), &lCpus ) != 0 )
+			trh_log( LOG_WARNING, "Failed to pin loop thread %zu to CPU.\n", lWorker->index );
+	}
+
+	// Timers created in start callback belong to the worker loop.
+	gsLoopCurrent = lWorker->loop;
+	lWorker->loop->thread = pthread_self();
+
+	if( lPool->handle_start != 0 && lPool->handle_start( lWorker->loop, lWorker->index, lPool->data ) != TRH_OK ) {
+		trh_log( LOG_WARNING, "Loop thread %zu has not been started.\n", lWorker->index );
+		return 0;
+	}
+
+	trh_loop_run( lWorker->loop );
+
+	return 0;
+}
+
+// #endregion // Static functions
@@ -0,0 +1,545 @@
+/*
+ * @brief Worker thread pool (work-stealing) for blocking jobs
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+// pthread_setaffinity_np, pthread_setname_np
+#define _GNU_SOURCE
+
+// #region Includes
+
+#include <string.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "trihlav.h"
+#include "trh_logger.h"
+#include "trh_loop.h"
+#include "trh_pool.h"
+#include "trh_std.h"
+
+// #endregion
+
+// Default capacity of the worker deque.
+#define POOL_DEQUE_SIZE			1024
+// Number of retries while a job is in flight (counted, but not queued yet) before the worker parks.
+#define POOL_SPIN_MAX			64
+// Time (ns) a parked worker waits for the in-flight job before it retries.
+#define POOL_PARK_NSEC			1000000
+
+// #region Typedefs
+
+/**
+ * @brief Submitted job.
+ */
+typedef struct TTrhJob {
+	handle_job handle;
+	handle_job_done handle_done;
+	void *arg;
+	int result;
+
+	/// Loop executing the completion.
+	struct TTrhLoop *loop;
+	/// Submission time (ns).
+	uint64_t submitted;
+
+	/// Next job in the shared queue.
+	struct TTrhJob *next;
+} TTrhJob;
+
+/**
+ * @brief Work-stealing deque (Chase-Lev). Owner pushes and takes at the bottom, thieves steal at the top.
+ */
+typedef struct TTrhDeque {
+	_Atomic int64_t top;
+	_Atomic int64_t bottom;
+	int64_t mask;
+	_Atomic( TTrhJob* ) *buffer;
+} TTrhDeque;
+
+typedef struct TTrhPoolWorker {
+	struct TTrhPool *pool;
+	size_t index;
+
+	TTrhDeque deque;
+
+	pthread_t thread;
+	bool started;
+} TTrhPoolWorker;
+
+/**
+ * @brief Worker thread pool.
+ */
+typedef struct TTrhPool {
+	TTrhPoolProperties properties;
+
+	TTrhPoolWorker *workers;
+	size_t count;
+
+	/// Shared FIFO for jobs submitted from non-worker threads; protected by \a mutex.
+	TTrhJob *queue_head;
+	TTrhJob *queue_tail;
+
+	/// Idle workers sleep on \a cond.
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	atomic_size_t idle;
+
+	/// Number of jobs queued (deques and shared queue).
+	atomic_size_t pending;
+	atomic_size_t running;
+	atomic_bool stop;
+
+	// Metrics
+	_Atomic uint64_t submitted;
+	_Atomic uint64_t completed;
+	_Atomic uint64_t stolen;
+	_Atomic uint64_t wait_sum;
+	_Atomic uint64_t wait_max;
+	_Atomic uint64_t run_sum;
+	_Atomic uint64_t run_max;
+} TTrhPool;
+
+// #endregion
+
+
+// #region Static functions
+
+static int local_deque_init( TTrhDeque *iDeque, size_t iSize );
+static bool local_deque_push( TTrhDeque *iDeque, TTrhJob *iJob );
+static TTrhJob *local_deque_take( TTrhDeque *iDeque );
+static TTrhJob *local_deque_steal( TTrhDeque *iDeque );
+
+/**
+ * @brief Return next job for the worker: own deque, shared queue, then steal.
+ */
+static TTrhJob *local_pool_next( TTrhPoolWorker *iWorker );
+
+/**
+ * @brief Wake one idle worker, if any.
+ */
+static void local_pool_signal( TTrhPool *iPool );
+
+/**
+ * @brief Execute the job and post its completion.
+ */
+static void local_pool_run( TTrhPool *iPool, TTrhJob *iJob );
+
+/**
+ * @brief Completion executed on the loop (trh_post_on).
+ */
+static void local_pool_done( void *iJob );
+
+static void local_pool_max( _Atomic uint64_t *oMax, uint64_t iValue );
+
+static void *local_pool_thread( void *iWorker );
+
+// #endregion
+
+
+// #region Static variables
+
+// Worker of the calling thread - jobs submitted by a job go to its own deque.
+static __thread TTrhPoolWorker *gsPoolWorker = 0;
+
+// #endregion
+
+
+// #region Exported functions
+
+int trh_pool_init( TTrhPoolProperties *iProperties, TTrhPool **oPool )
+{
+	TRH_ASSERT_ARG( iProperties != 0, "Failed to start pool - invalid setup." );
+	TRH_ASSERT_ARG( oPool != 0, "Failed to start pool - invalid output argument." );
+
+	TTrhPool *lPool = (TTrhPool*)calloc( 1, sizeof( TTrhPool ) );
+	if( lPool == 0 ) return TRH_OUT_OF_MEM;
+
+	long lCpus = sysconf( _SC_NPROCESSORS_ONLN );
+	if( lCpus < 1 ) lCpus = 1;
+
+	memcpy( &lPool->properties, iProperties, sizeof( TTrhPoolProperties ) );
+	lPool->count = iProperties->threads != 0 ? iProperties->threads : (size_t)lCpus;
+
+	pthread_mutex_init( &lPool->mutex, 0 );
+	pthread_cond_init( &lPool->cond, 0 );
+	atomic_init( &lPool->idle, 0 );
+	atomic_init( &lPool->pending, 0 );
+	atomic_init( &lPool->running, 0 );
+	atomic_init( &lPool->stop, false );
+
+	lPool->workers = (TTrhPoolWorker*)calloc( lPool->count, sizeof( TTrhPoolWorker ) );
+	if( lPool->workers == 0 ) {
+		trh_pool_release( lPool );
+		return TRH_OUT_OF_MEM;
+	}
+
+	for( size_t ii = 0; ii < lPool->count; ii++ ) {
+		lPool->workers[ii].pool = lPool;
+		lPool->workers[ii].index = ii;
+
+		if( local_deque_init( &lPool->workers[ii].deque, iProperties->deque_size ) != TRH_OK ) {
+			trh_pool_release( lPool );
+			return TRH_OUT_OF_MEM;
+		}
+	}
+
+	for( size_t ii = 0; ii < lPool->count; ii++ ) {
+		if( pthread_create( &lPool->workers[ii].thread, 0, local_pool_thread, &lPool->workers[ii] ) != 0 ) {
+			trh_log( LOG_ERROR, "Failed to start pool thread %zu.\n", ii );
+			trh_pool_release( lPool );
+			return TRH_FAILED;
+		}
+
+		lPool->workers[ii].started = true;
+	}
+
+	*oPool = lPool;
+
+	return TRH_OK;
+}
+
+int trh_pool_submit( TTrhPool *iPool, handle_job iJob, handle_job_done iDone, void *iArg )
+{
+	TRH_ASSERT_ARG( iPool != 0 && iJob != 0, "Failed to submit job - invalid argument." );
+
+	if( atomic_load( &iPool->stop ) )
+		return TRH_END;
+
+	TTrhJob *lJob = (TTrhJob*)malloc( sizeof( TTrhJob ) );
+	if( lJob == 0 ) return TRH_OUT_OF_MEM;
+
+	lJob->handle = iJob;
+	lJob->handle_done = iDone;
+	lJob->arg = iArg;
+	lJob->result = TRH_OK;
+	lJob->loop = trh_loop_current();
+	lJob->submitted = trh_time_ns();
+	lJob->next = 0;
+
+	// Job is counted before it is queued - a thief can't take it before it is counted.
+	atomic_fetch_add( &iPool->pending, 1 );
+
+	// Job submitted by a job stays on the same worker, unless its deque is full.
+	if( gsPoolWorker != 0 && gsPoolWorker->pool == iPool && local_deque_push( &gsPoolWorker->deque, lJob ) ) {
+		atomic_fetch_add_explicit( &iPool->submitted, 1, memory_order_relaxed );
+		local_pool_signal( iPool );
+		return TRH_OK;
+	}
+
+	pthread_mutex_lock( &iPool->mutex );
+
+	// Workers could have already exited.
+	if( atomic_load( &iPool->stop ) ) {
+		pthread_mutex_unlock( &iPool->mutex );
+		atomic_fetch_sub( &iPool->pending, 1 );
+		free( lJob );
+		return TRH_END;
+	}
+
+	if( iPool->queue_tail != 0 )
+		iPool->queue_tail->next = lJob;
+	else
+		iPool->queue_head = lJob;
+	iPool->queue_tail = lJob;
+
+	atomic_fetch_add_explicit( &iPool->submitted, 1, memory_order_relaxed );
+	if( atomic_load( &iPool->idle ) > 0 )
+		pthread_cond_signal( &iPool->cond );
+
+	pthread_mutex_unlock( &iPool->mutex );
+
+	return TRH_OK;
+}
+
+void trh_pool_stats( TTrhPool *iPool, TTrhPoolStats *oStats )
+{
+	if( iPool == 0 || oStats == 0 )
+		return;
+
+	const uint64_t lCompleted = atomic_load_explicit( &iPool->completed, memory_order_relaxed );
+
+	oStats->queued = atomic_load_explicit( &iPool->pending, memory_order_relaxed );
+	oStats->running = atomic_load_explicit( &iPool->running, memory_order_relaxed );
+	oStats->submitted = atomic_load_explicit( &iPool->submitted, memory_order_relaxed );
+	oStats->completed = lCompleted;
+	oStats->stolen = atomic_load_explicit( &iPool->stolen, memory_order_relaxed );
+	oStats->wait_avg = lCompleted > 0 ? atomic_load_explicit( &iPool->wait_sum, memory_order_relaxed ) / lCompleted : 0;
+	oStats->wait_max = atomic_load_explicit( &iPool->wait_max, memory_order_relaxed );
+	oStats->run_avg = lCompleted > 0 ? atomic_load_explicit( &iPool->run_sum, memory_order_relaxed ) / lCompleted : 0;
+	oStats->run_max = atomic_load_explicit( &iPool->run_max, memory_order_relaxed );
+}
+
+void trh_pool_release( TTrhPool *iPool )
+{
+	if( iPool == 0 )
+		return;
+
+	// Workers exit when all queued jobs are done.
+	pthread_mutex_lock( &iPool->mutex );
+	atomic_store( &iPool->stop, true );
+	pthread_cond_broadcast( &iPool->cond );
+	pthread_mutex_unlock( &iPool->mutex );
+
+	for( size_t ii = 0; iPool->workers != 0 && ii < iPool->count; ii++ ) {
+		if( iPool->workers[ii].started )
+			pthread_join( iPool->workers[ii].thread, 0 );
+
+		FREE_PTR( iPool->workers[ii].deque.buffer );
+	}
+
+	FREE_PTR( iPool->workers );
+	pthread_cond_destroy( &iPool->cond );
+	pthread_mutex_destroy( &iPool->mutex );
+	free( iPool );
+}
+
+// #endregion
+
+
+// #region Deque
+
+int local_deque_init( TTrhDeque *iDeque, size_t iSize )
+{
+	size_t lSize = 1;
+
+	while( lSize < ( iSize != 0 ? iSize : POOL_DEQUE_SIZE ) )
+		lSize <<= 1;
+
+	iDeque->buffer = (_Atomic( TTrhJob* )*)calloc( lSize, sizeof( *iDeque->buffer ) );
+	if( iDeque->buffer == 0 ) return TRH_OUT_OF_MEM;
+
+	iDeque->mask = (int64_t)lSize - 1;
+	atomic_init( &iDeque->top, 0 );
+	atomic_init( &iDeque->bottom, 0 );
+
+	return TRH_OK;
+}
+
+// Owner only. Return false if the deque is full.
+bool local_deque_push( TTrhDeque *iDeque, TTrhJob *iJob )
+{
+	const int64_t lBottom = atomic_load_explicit( &iDeque->bottom, memory_order_relaxed );
+	const int64_t lTop = atomic_load_explicit( &iDeque->top, memory_order_acquire );
+
+	if( lBottom - lTop > iDeque->mask )
+		return false;
+
+	atomic_store_explicit( &iDeque->buffer[lBottom & iDeque->mask], iJob, memory_order_relaxed );
+	atomic_thread_fence( memory_order_release );
+	atomic_store_explicit( &iDeque->bottom, lBottom + 1, memory_order_relaxed );
+
+	return true;
+}
+
+// Owner only. Take the most recently pushed job (LIFO - warm cache).
+TTrhJob *local_deque_take( TTrhDeque *iDeque )
+{
+	const int64_t lBottom = atomic_load_explicit( &iDeque->bottom, memory_order_relaxed ) - 1;
+	atomic_store_explicit( &iDeque->bottom, lBottom, memory_order_relaxed );
+	atomic_thread_fence( memory_order_seq_cst );
+	int64_t lTop = atomic_load_explicit( &iDeque->top, memory_order_relaxed );
+
+	if( lTop > lBottom ) {
+		atomic_store_explicit( &iDeque->bottom, lBottom + 1, memory_order_relaxed );
+		return 0;
+	}
+
+	TTrhJob *lJob = atomic_load_explicit( &iDeque->buffer[lBottom & iDeque->mask], memory_order_relaxed );
+
+	// Last job - race with thieves.
+	if( lTop == lBottom ) {
+		if( ! atomic_compare_exchange_strong_explicit( &iDeque->top, &lTop, lTop + 1, memory_order_seq_cst, memory_order_relaxed ) )
+			lJob = 0;
+		atomic_store_explicit( &iDeque->bottom, lBottom + 1, memory_order_relaxed );
+	}
+
+	return lJob;
+}
+
+// Any thread. Take the oldest job; return null if the deque is empty or another thread has won the race.
+TTrhJob *local_deque_steal( TTrhDeque *iDeque )
+{
+	int64_t lTop = atomic_load_explicit( &iDeque->top, memory_order_acquire );
+	atomic_thread_fence( memory_order_seq_cst );
+	const int64_t lBottom = atomic_load_explicit( &iDeque->bottom, memory_order_acquire );
+
+	if( lTop >= lBottom )
+		return 0;
+
+	TTrhJob *lJob = atomic_load_explicit( &iDeque->buffer[lTop & iDeque->mask], memory_order_relaxed );
+
+	if( ! atomic_compare_exchange_strong_explicit( &iDeque->top, &lTop, lTop + 1, memory_order_seq_cst, memory_order_relaxed ) )
+		return 0;
+
+	return lJob;
+}
+
+// #endregion
+
+
+// #region Workers
+
+TTrhJob *local_pool_next( TTrhPoolWorker *iWorker )
+{
+	TTrhPool *lPool = iWorker->pool;
+	TTrhJob *lJob = local_deque_take( &iWorker->deque );
+
+	if( lJob != 0 )
+		return lJob;
+
+	// Shared queue
+	if( atomic_load_explicit( &lPool->pending, memory_order_relaxed ) > 0 ) {
+		pthread_mutex_lock( &lPool->mutex );
+		if( ( lJob = lPool->queue_head ) != 0 ) {
+			lPool->queue_head = lJob->next;
+			if( lPool->queue_head == 0 )
+				lPool->queue_tail = 0;
+		}
+		pthread_mutex_unlock( &lPool->mutex );
+
+		if( lJob != 0 )
+			return lJob;
+	}
+
+	// Steal from other workers, starting with the next one.
+	for( size_t ii = 1; ii < lPool->count; ii++ ) {
+		if( ( lJob = local_deque_steal( &lPool->workers[( iWorker->index + ii ) % lPool->count].deque ) ) != 0 ) {
+			atomic_fetch_add_explicit( &lPool->stolen, 1, memory_order_relaxed );
+			return lJob;
+		}
+	}
+
+	return 0;
+}
+
+void local_pool_signal( TTrhPool *iPool )
+{
+	// Worker increments `idle` under the mutex before it checks `pending`, so the wake-up can't be lost.
+	if( atomic_load( &iPool->idle ) == 0 )
+		return;
+
+	pthread_mutex_lock( &iPool->mutex );
+	pthread_cond_signal( &iPool->cond );
+	pthread_mutex_unlock( &iPool->mutex );
+}
+
+void local_pool_run( TTrhPool *iPool, TTrhJob *iJob )
+{
+	const uint64_t lStart = trh_time_ns();
+
+	atomic_fetch_add_explicit( &iPool->running, 1, memory_order_relaxed );
+	iJob->result = iJob->handle( iJob->arg );
+	atomic_fetch_sub_explicit( &iPool->running, 1, memory_order_relaxed );
+
+	const uint64_t lEnd = trh_time_ns();
+
+	atomic_fetch_add_explicit( &iPool->wait_sum, lStart - iJob->submitted, memory_order_relaxed );
+	atomic_fetch_add_explicit( &iPool->run_sum, lEnd - lStart, memory_order_relaxed );
+	local_pool_max( &iPool->wait_max, lStart - iJob->submitted );
+	local_pool_max( &iPool->run_max, lEnd - lStart );
+	atomic_fetch_add_explicit( &iPool->completed, 1, memory_order_relaxed );
+
+	if( iJob->handle_done == 0 ) {
+		free( iJob );
+		return;
+	}
+
+	if( trh_post_on( iJob->loop, local_pool_done, iJob ) != TRH_OK ) {
+		trh_log( LOG_ERROR, "Failed to post job completion.\n" );
+		free( iJob );
+	}
+}
+
+void local_pool_done( void *iJob )
+{
+	TTrhJob *lJob = (TTrhJob*)iJob;
+
+	lJob->handle_done( lJob->result, lJob->arg );
+	free( lJob );
+}
+
+void local_pool_max( _Atomic uint64_t *oMax, uint64_t iValue )
+{
+	uint64_t lMax = atomic_load_explicit( oMax, memory_order_relaxed );
+
+	while( iValue > lMax && ! atomic_compare_exchange_weak_explicit( oMax, &lMax, iValue, memory_order_relaxed, memory_order_relaxed ) );
+}
+
+void *local_pool_thread( void *iWorker )
+{
+	TTrhPoolWorker *lWorker = (TTrhPoolWorker*)iWorker;
+	TTrhPool *lPool = lWorker->pool;
+	char lName[16];
+
+	snprintf( lName, sizeof( lName ), "trh-pool-%zu", lWorker->index );
+	pthread_setname_np( pthread_self(), lName );
+
+	if( lPool->properties.pin ) {
+		long lCpus = sysconf( _SC_NPROCESSORS_ONLN );
+		cpu_set_t lSet;
+
+		CPU_ZERO( &lSet );
+		CPU_SET( (int)( ( (size_t)lPool->properties.cpu_first + lWorker->index ) % (size_t)( lCpus > 0 ? lCpus : 1 ) ), &lSet );
+
+		if( pthread_setaffinity_np( pthread_self(), sizeof( lSet ), &lSet ) != 0 )
+			trh_log( LOG_WARNING, "Failed to pin pool thread %zu to CPU.\n", lWorker->index );
+	}
+
+	gsPoolWorker = lWorker;
+
+	size_t lSpins = 0;
+
+	for( ;; ) {
+		TTrhJob *lJob = local_pool_next( lWorker );
+
+		if( lJob != 0 ) {
+			atomic_fetch_sub( &lPool->pending, 1 );
+			local_pool_run( lPool, lJob );
+			lSpins = 0;
+			continue;
+		}
+
+		// Job is counted in `pending` before it is queued; it could be in flight - try again a few times.
+		if( atomic_load( &lPool->pending ) > 0 && lSpins++ < POOL_SPIN_MAX ) {
+			sched_yield();
+			continue;
+		}
+
+		lSpins = 0;
+
+		pthread_mutex_lock( &lPool->mutex );
+		atomic_fetch_add( &lPool->idle, 1 );
+
+		if( atomic_load( &lPool->stop ) && atomic_load( &lPool->pending ) == 0 ) {
+			atomic_fetch_sub( &lPool->idle, 1 );
+			pthread_mutex_unlock( &lPool->mutex );
+			break;
+		}
+
+		if( atomic_load( &lPool->pending ) == 0 )
+			pthread_cond_wait( &lPool->cond, &lPool->mutex );
+		else {
+			// Job is still in flight (e.g. being stolen) - park instead of burning the core.
+			// Submitter could have skipped the signal, so the wait is bounded.
+			struct timespec lTime;
+			clock_gettime( CLOCK_REALTIME, &lTime );
+			lTime.tv_nsec += POOL_PARK_NSEC;
+			if( lTime.tv_nsec >= (long)TRH_NSEC_PER_SEC ) {
+				lTime.tv_sec++;
+				lTime.tv_nsec -= (long)TRH_NSEC_PER_SEC;
+			}
+			pthread_cond_timedwait( &lPool->cond, &lPool->mutex, &lTime );
+		}
+
+		atomic_fetch_sub( &lPool->idle, 1 );
+		pthread_mutex_unlock( &lPool->mutex );
+	}
+
+	gsPoolWorker = 0;
+
+	return 0;
+}
+
+// #endregion
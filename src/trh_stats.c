@@ -0,0 +1,137 @@
+/*
+ * @brief Latency histograms and loop instrumentation (TRH_LOOP_STATS)
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+// dladdr
+#define _GNU_SOURCE
+
+// #region Includes
+
+#include <string.h>
+#include <dlfcn.h>
+
+#include "trihlav.h"
+#include "trh_stats.h"
+
+// #endregion
+
+// Number of buckets per power of 2.
+#define HISTOGRAM_SUB_COUNT		( 1u << TRH_HISTOGRAM_SUB_BITS )
+
+// #region Static functions
+
+static size_t local_histogram_index( uint64_t iValue );
+
+// #endregion
+
+
+// #region Exported functions
+
+void trh_histogram_record( TTrhHistogram *iHistogram, uint64_t iValue )
+{
+	iHistogram->count++;
+	iHistogram->sum += iValue;
+	if( iValue > iHistogram->max )
+		iHistogram->max = iValue;
+
+	iHistogram->buckets[local_histogram_index( iValue )]++;
+}
+
+uint64_t trh_histogram_quantile( const TTrhHistogram *iHistogram, double iQuantile )
+{
+	if( iHistogram->count == 0 )
+		return 0;
+
+	uint64_t lRank = (uint64_t)( iQuantile * (double)iHistogram->count );
+	uint64_t lSeen = 0;
+
+	if( lRank >= iHistogram->count )
+		return iHistogram->max;
+
+	for( size_t ii = 0; ii < TRH_HISTOGRAM_BUCKETS; ii++ ) {
+		lSeen += iHistogram->buckets[ii];
+
+		// Bucket bound can't be above the largest recorded value.
+		if( lSeen > lRank ) {
+			uint64_t lMax = trh_histogram_bucket_max( ii );
+			return lMax < iHistogram->max ? lMax : iHistogram->max;
+		}
+	}
+
+	return iHistogram->max;
+}
+
+uint64_t trh_histogram_bucket_max( size_t iIndex )
+{
+	if( iIndex < HISTOGRAM_SUB_COUNT )
+		return iIndex;
+
+	unsigned lShift = (unsigned)( iIndex >> TRH_HISTOGRAM_SUB_BITS ) - 1;
+	uint64_t lLow = (uint64_t)( HISTOGRAM_SUB_COUNT + ( iIndex & ( HISTOGRAM_SUB_COUNT - 1 ) ) ) << lShift;
+
+	return lLow + ( ( 1ull << lShift ) - 1 );
+}
+
+uint64_t trh_histogram_mean( const TTrhHistogram *iHistogram )
+{
+	return iHistogram->count > 0 ? iHistogram->sum / iHistogram->count : 0;
+}
+
+chars trh_stats_handler_name( const void *iHandler, char *oName, size_t iSize )
+{
+	Dl_info lInfo;
+
+	if( iHandler == 0 )
+		snprintf( oName, iSize, "(other)" );
+	else if( dladdr( (void*)(uintptr_t)iHandler, &lInfo ) != 0 && lInfo.dli_sname != 0 )
+		snprintf( oName, iSize, "%s", lInfo.dli_sname );
+	else
+		snprintf( oName, iSize, "%p", iHandler );
+
+	return oName;
+}
+
+void trh_stats_handler( TTrhLoopStats *iStats, const void *iHandler, uint64_t iRuntime )
+{
+	size_t ii = 0;
+
+	// Few handlers per loop - linear search in the order they appeared.
+	while( ii < iStats->handler_count && iStats->handlers[ii].handler != iHandler )
+		ii++;
+
+	if( ii == iStats->handler_count ) {
+		if( iStats->handler_count < TRH_LOOP_STATS_HANDLERS - 1 ) {
+			iStats->handlers[ii].handler = iHandler;
+			iStats->handler_count++;
+		}
+		// Table is full - the last slot collects the rest.
+		else {
+			ii = TRH_LOOP_STATS_HANDLERS - 1;
+			iStats->handlers[ii].handler = 0;
+			iStats->handler_count = TRH_LOOP_STATS_HANDLERS;
+		}
+	}
+
+	trh_histogram_record( &iStats->handlers[ii].runtime, iRuntime );
+}
+
+// #endregion
+
+
+// #region Static functions
+
+// Values below 2^SUB_BITS have their own bucket; above it every power of 2 has SUB_COUNT buckets.
+size_t local_histogram_index( uint64_t iValue )
+{
+	if( iValue < HISTOGRAM_SUB_COUNT )
+		return (size_t)iValue;
+
+	unsigned lMsb = 63 - (unsigned)__builtin_clzll( iValue );
+	unsigned lShift = lMsb - TRH_HISTOGRAM_SUB_BITS;
+
+	return ( (size_t)( lShift + 1 ) << TRH_HISTOGRAM_SUB_BITS ) + (size_t)( ( iValue >> lShift ) & ( HISTOGRAM_SUB_COUNT - 1 ) );
+}
+
+// #endregion
@@ -4,6 +4,9 @@
  * @license MIT License / see LICENSE file
  */
 
+// copy_file_range, fallocate
+#define _GNU_SOURCE
+
 // #region Includes
 
 #include <string.h>
@@ -13,22 +16,39 @@
 #include <sys/stat.h>
 #include <sys/sendfile.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <linux/fs.h>
 
 #include "trihlav.h"
 #include "trh_logger.h"
 #include "trh_std.h"
+#include "trh_loop.h"
 
 // #endregion
 
 #define PATH_SEP				"/"
 #define PATH_SEP_C				'/'
 
+/// Mode of directories created by trh_create_directory() and trh_create_path().
+#define PATH_MODE				0750
+/// Number of recently created paths remembered by trh_create_path().
+#define PATH_CACHE_SIZE			16
+
 
 // #region Static variables
 
 /// Application paths
 char *gsPaths[TRH_ASSETS+1] = { 0 };
 
+/// Recently created (or verified) absolute directory paths; every ancestor of an entry exists too.
+static struct {
+	pthread_mutex_t mutex;
+	char *paths[PATH_CACHE_SIZE];
+	size_t lengths[PATH_CACHE_SIZE];
+	size_t next;
+} gsPathCache = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
 // #endregion
 
 
@@ -52,6 +72,26 @@ double trh_time()
 	return (double)( lTime.tv_sec ) + (double)( lTime.tv_nsec ) / 1000000000.0;
 }
 
+// Get monotonic time in nanoseconds
+uint64_t trh_time_ns()
+{
+	struct timespec lTime;
+
+	clock_gettime( CLOCK_MONOTONIC, &lTime );
+
+	return (uint64_t)lTime.tv_sec * TRH_NSEC_PER_SEC + (uint64_t)lTime.tv_nsec;
+}
+
+// Get coarse monotonic time in nanoseconds
+uint64_t trh_time_coarse_ns()
+{
+	struct timespec lTime;
+
+	clock_gettime( CLOCK_MONOTONIC_COARSE, &lTime );
+
+	return (uint64_t)lTime.tv_sec * TRH_NSEC_PER_SEC + (uint64_t)lTime.tv_nsec;
+}
+
 
 // #region GET PATH
 
@@ -159,53 +199,178 @@ bool trh_file_exists( chars iFilepath, FileType iFileType )
 	}
 }
 
-// Skopiruje subor na nove miesto.
+// #region COPY FILE
+
+/// Progress report posted to the loop.
+typedef struct TTrhCopyProgress {
+	handle_copy_progress handle_progress;
+	void *arg;
+	uint64_t copied;
+	uint64_t total;
+} TTrhCopyProgress;
+
+static void local_copy_progress_task( void *iProgress )
+{
+	TTrhCopyProgress *lProgress = (TTrhCopyProgress*)iProgress;
+	lProgress->handle_progress( lProgress->copied, lProgress->total, lProgress->arg );
+	free( lProgress );
+}
+
+static void local_copy_progress( const TTrhCopyOptions *iOptions, uint64_t iCopied, uint64_t iTotal )
+{
+	if( iOptions == 0 || iOptions->handle_progress == 0 )
+		return;
+
+	if( iOptions->loop == 0 ) {
+		iOptions->handle_progress( iCopied, iTotal, iOptions->arg );
+		return;
+	}
+
+	TTrhCopyProgress *lProgress = (TTrhCopyProgress*)malloc( sizeof( TTrhCopyProgress ) );
+	if( lProgress == 0 )
+		return;
+
+	lProgress->handle_progress = iOptions->handle_progress;
+	lProgress->arg = iOptions->arg;
+	lProgress->copied = iCopied;
+	lProgress->total = iTotal;
+
+	if( trh_post_on( iOptions->loop, local_copy_progress_task, lProgress ) != TRH_OK )
+		free( lProgress );
+}
+
+// Copy iSize bytes from the current offsets. Returns number of copied bytes or -1 (errno is set).
+static int64_t local_copy_data( int iSrc, int iDst, uint64_t iSize, const TTrhCopyOptions *iOptions )
+{
+	size_t lChunk = iOptions != 0 && iOptions->chunk > 0 ? iOptions->chunk : TRH_COPY_CHUNK_DEFAULT;
+	bool lCopyRange = true;
+	uint64_t lCopied = 0;
+
+	while( lCopied < iSize ) {
+		size_t lLength = iSize - lCopied < lChunk ? (size_t)( iSize - lCopied ) : lChunk;
+		ssize_t lTransferred;
+
+		if( lCopyRange ) {
+			lTransferred = copy_file_range( iSrc, 0, iDst, 0, lLength, 0 );
+
+			// Not supported for this pair of files (older kernels, cross-filesystem) - continue with sendfile.
+			if( lTransferred < 0 && ( errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP ) ) {
+				lCopyRange = false;
+				continue;
+			}
+		}
+		else
+			lTransferred = sendfile( iDst, iSrc, 0, lLength );
+
+		if( lTransferred < 0 ) {
+			if( errno == EINTR )
+				continue;
+			return -1;
+		}
+
+		// Source has been truncated while copying.
+		if( lTransferred == 0 )
+			break;
+
+		lCopied += lTransferred;
+		local_copy_progress( iOptions, lCopied, iSize );
+	}
+
+	return (int64_t)lCopied;
+}
+
+// #endregion // COPY FILE
+
 int trh_copy_file( chars iSourceFileName, chars iDestFileName )
+{
+	return trh_copy_file_ex( iSourceFileName, iDestFileName, 0 );
+}
+
+// Skopiruje subor na nove miesto.
+int trh_copy_file_ex( chars iSourceFileName, chars iDestFileName, const TTrhCopyOptions *iOptions )
 {
  	TRH_ASSERT_ARG( iSourceFileName != 0 && iSourceFileName[0] != 0, "Failed to copy file, source file name is invalid" );
  	TRH_ASSERT_ARG( iDestFileName != 0 && iDestFileName[0] != 0, "Failed to copy file, destination is invalid" );
 
-	if( ! trh_file_exists( iSourceFileName, TRH_FILE ) ) {
-		trh_log( LOG_WARNING, "File '%s' does not exists.\n", iSourceFileName );
-		return TRH_SKIP;
-	}
-
+	int lFlags = iOptions != 0 ? iOptions->flags : 0;
 	struct stat lStatBuf;
 	int lFileSrc;
 	int lFileDst;
-	ssize_t lTransferred;
+	int lError;
 
 	// Try open the source file
-	if( ( lFileSrc = open( iSourceFileName, O_RDONLY ) ) < 0 ) {
+	if( ( lFileSrc = open( iSourceFileName, O_RDONLY | O_CLOEXEC ) ) < 0 ) {
+		if( errno == ENOENT ) {
+			trh_log( LOG_WARNING, "File '%s' does not exists.\n", iSourceFileName );
+			return TRH_SKIP;
+		}
+
 		trh_log( LOG_WARNING, "Failed to open file '%s'. Error: %s\n", iSourceFileName, strerror(errno) );
 		return TRH_FILE_ERROR;
 	}
 
  	// Stat the input file to obtain its size.
- 	fstat( lFileSrc, &lStatBuf );
+ 	if( fstat( lFileSrc, &lStatBuf ) != 0 || ! S_ISREG( lStatBuf.st_mode ) ) {
+		lError = errno;
+		trh_log( LOG_WARNING, "File '%s' is not a regular file.\n", iSourceFileName );
+		close( lFileSrc );
+		errno = lError;
+		return TRH_SKIP;
+	}
 
  	// Try open the output file for writing, with the same permissions as the source file.
- 	if( ( lFileDst = open( iDestFileName, O_WRONLY | O_CREAT | O_TRUNC, lStatBuf.st_mode ) ) < 0 ) {
+ 	if( ( lFileDst = open( iDestFileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, lStatBuf.st_mode & 07777 ) ) < 0 ) {
+		lError = errno;
 		trh_log( LOG_WARNING, "Failed to open file '%s'. Error: %s\n", iDestFileName, strerror(errno) );
  		close( lFileSrc );
+		errno = lError;
  		return TRH_FILE_ERROR;
  	}
 
-	// Blast the bytes from one file to the other.
-	do {
-		lTransferred = sendfile( lFileDst, lFileSrc, 0, lStatBuf.st_size );
+	uint64_t lSize = (uint64_t)lStatBuf.st_size;
+	int64_t lCopied = -1;
+	bool lAllocated = false;
+	lError = 0;
 
-		if( lTransferred < 0 || lTransferred > lStatBuf.st_size ) {
-			trh_log( LOG_WARNING, "Failed to copy file '%s' to '%s'. Error: %s\n", iSourceFileName, iDestFileName, strerror(errno) );
-			break;
-		}
+	// Share the extents if the filesystem supports it (btrfs, xfs, ...).
+	if( ! ( lFlags & TRH_COPY_NO_REFLINK ) && ioctl( lFileDst, FICLONE, lFileSrc ) == 0 ) {
+		lCopied = lSize;
+		local_copy_progress( iOptions, lSize, lSize );
+	}
+
+	if( lCopied < 0 && ( lFlags & TRH_COPY_FALLOCATE ) && lSize > 0 ) {
+		if( fallocate( lFileDst, 0, 0, lSize ) == 0 )
+			lAllocated = true;
+		// Not enough space - do not even start.
+		else if( errno == ENOSPC || errno == EFBIG || errno == EDQUOT )
+			lError = errno;
+	}
 
-		lStatBuf.st_size -= lTransferred;
-	} while( lStatBuf.st_size > 0 );
+	if( lCopied < 0 && lError == 0 ) {
+		if( ( lCopied = local_copy_data( lFileSrc, lFileDst, lSize, iOptions ) ) < 0 )
+			lError = errno;
+		else if( lSize == 0 )
+			local_copy_progress( iOptions, 0, 0 );
+		else if( (uint64_t)lCopied < lSize ) {
+			trh_log( LOG_WARNING, "File '%s' has been truncated while copying (%" PRIi64 " of %" PRIu64 " bytes).\n", iSourceFileName, lCopied, lSize );
+
+			// Preallocated tail would look like copied zeros - cut it off.
+			if( lAllocated && ftruncate( lFileDst, lCopied ) != 0 )
+				trh_log( LOG_WARNING, "Failed to truncate file '%s'. Error: %s\n", iDestFileName, strerror(errno) );
+			lError = ENODATA;
+		}
+	}
 
-	// Close the files.
+	// Close the files. Delayed write errors (NFS) are reported by close.
 	close( lFileSrc );
-	close( lFileDst );
+	if( close( lFileDst ) != 0 && lError == 0 )
+		lError = errno;
+
+	if( lError != 0 ) {
+		trh_log( LOG_WARNING, "Failed to copy file '%s' to '%s'. Error: %s\n", iSourceFileName, iDestFileName, strerror(lError) );
+		errno = lError;
+		return TRH_FILE_ERROR;
+	}
 
 	return TRH_OK;
 }
@@ -229,7 +394,7 @@ int trh_create_directory( chars iPath, bool iLog  )
 {
 	TRH_ASSERT_ARG( iPath != 0 && iPath[0] != 0, "Failed to create directory - path invalid" );
 
-	if( mkdir( iPath, 0750) != 0 ) {
+	if( mkdir( iPath, PATH_MODE ) != 0 ) {
 		if( errno == EEXIST ) {
 			if( iLog ) trh_log( LOG_NOTE, "Can't create directory '%s'. Directory already exists.\n", iPath );
 			return trh_file_exists( iPath, TRH_DIRECTORY ) ? TRH_SKIP : TRH_FILE_ERROR;
@@ -242,42 +407,222 @@ int trh_create_directory( chars iPath, bool iLog  )
 	return TRH_OK;
 }
 
+// #region CREATE PATH
+
+// Length of the deepest ancestor of iPath (or iPath itself) known to exist.
+static size_t local_path_cache_find( chars iPath, size_t iLength )
+{
+	size_t lKnown = 0;
+
+	pthread_mutex_lock( &gsPathCache.mutex );
+
+	for( size_t ii = 0; ii < PATH_CACHE_SIZE; ii++ ) {
+		chars lEntry = gsPathCache.paths[ii];
+		size_t lLength = gsPathCache.lengths[ii];
+
+		if( lEntry == 0 )
+			continue;
+
+		// Entry is an ancestor of the path.
+		if( lLength <= iLength && memcmp( lEntry, iPath, lLength ) == 0 && ( iPath[lLength] == 0 || iPath[lLength] == PATH_SEP_C ) ) {
+			if( lLength > lKnown )
+				lKnown = lLength;
+		}
+		// Path is an ancestor of the entry.
+		else if( lLength > iLength && memcmp( lEntry, iPath, iLength ) == 0 && lEntry[iLength] == PATH_SEP_C ) {
+			lKnown = iLength;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock( &gsPathCache.mutex );
+
+	return lKnown;
+}
+
+static void local_path_cache_add( chars iPath, size_t iLength )
+{
+	char *lPath = strndup( iPath, iLength );
+	if( lPath == 0 )
+		return;
+
+	pthread_mutex_lock( &gsPathCache.mutex );
+
+	// Replace an ancestor of the path (e.g. the previous day of a date tree), otherwise the oldest entry.
+	size_t lSlot = gsPathCache.next;
+	for( size_t ii = 0; ii < PATH_CACHE_SIZE; ii++ ) {
+		size_t lLength = gsPathCache.lengths[ii];
+
+		if( gsPathCache.paths[ii] != 0 && lLength < iLength && memcmp( gsPathCache.paths[ii], iPath, lLength ) == 0 && iPath[lLength] == PATH_SEP_C ) {
+			lSlot = ii;
+			break;
+		}
+	}
+
+	if( lSlot == gsPathCache.next )
+		gsPathCache.next = ( gsPathCache.next + 1 ) % PATH_CACHE_SIZE;
+
+	free( gsPathCache.paths[lSlot] );
+	gsPathCache.paths[lSlot] = lPath;
+	gsPathCache.lengths[lSlot] = iLength;
+
+	pthread_mutex_unlock( &gsPathCache.mutex );
+}
+
+static void local_path_cache_clear()
+{
+	pthread_mutex_lock( &gsPathCache.mutex );
+
+	for( size_t ii = 0; ii < PATH_CACHE_SIZE; ii++ ) {
+		FREE_PTR( gsPathCache.paths[ii] );
+		gsPathCache.lengths[ii] = 0;
+	}
+	gsPathCache.next = 0;
+
+	pthread_mutex_unlock( &gsPathCache.mutex );
+}
+
+// Position of the separator before the last component of first iLength chars of iPath, 0 if there is none.
+static size_t local_path_parent( chars iPath, size_t iLength )
+{
+	while( iLength > 0 && iPath[iLength - 1] != PATH_SEP_C )
+		iLength--;
+
+	while( iLength > 1 && iPath[iLength - 2] == PATH_SEP_C )
+		iLength--;
+
+	return iLength > 0 ? iLength - 1 : 0;
+}
+
+// Create directory ioPath (and its parents). iKnown is length of the ancestor that is expected to exist.
+// Returns TRH_OK, TRH_SKIP or TRH_FILE_ERROR (errno is set).
+static int local_path_create( char *ioPath, size_t iLength, size_t iKnown )
+{
+	struct stat lStat;
+	int lError;
+
+	// Parent usually exists - try the leaf first.
+	if( mkdir( ioPath, PATH_MODE ) == 0 )
+		return TRH_OK;
+
+	if( errno == EEXIST ) {
+		if( iKnown == iLength || ( stat( ioPath, &lStat ) == 0 && S_ISDIR( lStat.st_mode ) ) )
+			return TRH_SKIP;
+
+		errno = ENOTDIR;
+		return TRH_FILE_ERROR;
+	}
+
+	if( errno != ENOENT || iKnown == iLength )
+		return TRH_FILE_ERROR;
+
+	// Find the deepest existing ancestor - known from the cache, or walk up the path.
+	size_t lBase = iKnown;
+
+	if( lBase == 0 ) {
+		lBase = iLength;
+
+		while( ( lBase = local_path_parent( ioPath, lBase ) ) > 0 ) {
+			ioPath[lBase] = 0;
+			int lResult = mkdir( ioPath, PATH_MODE );
+			lError = errno;
+			ioPath[lBase] = PATH_SEP_C;
+
+			if( lResult == 0 || lError == EEXIST )
+				break;
+
+			if( lError != ENOENT ) {
+				errno = lError;
+				return TRH_FILE_ERROR;
+			}
+		}
+	}
+
+	// Create the rest relative to the ancestor, so the kernel does not resolve the whole path again.
+	int lDir = AT_FDCWD;
+	char *lName = ioPath;
+
+	if( lBase > 0 ) {
+		ioPath[lBase] = 0;
+		lDir = open( ioPath, O_PATH | O_DIRECTORY | O_CLOEXEC );
+		ioPath[lBase] = PATH_SEP_C;
+
+		if( lDir < 0 )
+			return TRH_FILE_ERROR;
+
+		lName = ioPath + lBase + 1;
+	}
+
+	int lCode = TRH_OK;
+
+	for( char *lSep = strchr( lName + 1, PATH_SEP_C ); ; lSep = strchr( lSep + 1, PATH_SEP_C ) ) {
+		if( lSep != 0 )
+			*lSep = 0;
+
+		int lResult = mkdirat( lDir, lName, PATH_MODE );
+		lError = errno;
+
+		if( lSep != 0 )
+			*lSep = PATH_SEP_C;
+
+		// EEXIST - created concurrently by another thread or process.
+		if( lResult != 0 && lError != EEXIST ) {
+			lCode = TRH_FILE_ERROR;
+			break;
+		}
+
+		if( lSep == 0 )
+			break;
+	}
+
+	if( lDir != AT_FDCWD )
+		close( lDir );
+
+	errno = lError;
+	return lCode;
+}
+
+// #endregion // CREATE PATH
+
 int trh_create_path( chars iPath )
 {
 	TRH_ASSERT_ARG( iPath != 0 && strlen( iPath ) > 1, "Failed to create path - path invalid" );
 
-	// Cesta uz existuje. Vrat true.
-	if( trh_file_exists( iPath, TRH_DIRECTORY ) )
-		return TRH_SKIP;
+	size_t lLength = strlen( iPath );
+	char lPath[PATH_MAX];
+	int lCode;
 
-	char lPathCopy[PATH_MAX];
-	char *lPathIdx;
-	int32_t lCode;
-
-	memset( lPathCopy, 0, PATH_MAX );
-	// Create a copy of the path, so we can modify it.
-	strncpy( lPathCopy, iPath, PATH_MAX - 2 );
-	// Last character of the path must be a directory separator.
-	if( lPathCopy[ strlen( lPathCopy ) - 1 ] != PATH_SEP_C )
-		strcat( lPathCopy, PATH_SEP );
-	// Create index.
-	lPathIdx = strchr( lPathCopy + 1, PATH_SEP_C );
-
-	// Create every directory in the path.
-	while( lPathIdx != 0 )
-	{
-		lPathIdx[0] = 0;
-
-		// If top levels of path already exist, trh_create_directory will return TRH_SKIP:
-		// Do not exit loop, but continue creating the rest of the path.
-		if( ( lCode = trh_create_directory( lPathCopy, false ) ) < TRH_OK )
-			return lCode;
-
-		lPathIdx[0] = PATH_SEP_C;
-		lPathIdx = strchr( lPathIdx + 1, PATH_SEP_C );
+	if( lLength >= PATH_MAX ) {
+		trh_log( LOG_WARNING, "Failed to create path '%s'. Path is too long.\n", iPath );
+		return TRH_ARG_INVALID;
 	}
 
-	return TRH_OK;
+	// Create a copy of the path without trailing separators, so we can modify it.
+	memcpy( lPath, iPath, lLength + 1 );
+	while( lLength > 1 && lPath[lLength - 1] == PATH_SEP_C )
+		lPath[--lLength] = 0;
+
+	// Relative paths depend on the working directory - do not cache them.
+	bool lCache = lPath[0] == PATH_SEP_C;
+	size_t lKnown = lCache ? local_path_cache_find( lPath, lLength ) : 0;
+
+	lCode = local_path_create( lPath, lLength, lKnown );
+
+	// Cached directory has been removed - forget the cache and walk the path.
+	if( lCode == TRH_FILE_ERROR && errno == ENOENT && lKnown > 0 ) {
+		local_path_cache_clear();
+		lCode = local_path_create( lPath, lLength, lKnown = 0 );
+	}
+
+	if( lCode < TRH_OK ) {
+		trh_log( LOG_WARNING, "Failed to create path '%s'. Error: %s\n", iPath, strerror(errno) );
+		return lCode;
+	}
+
+	if( lCache && lKnown < lLength )
+		local_path_cache_add( lPath, lLength );
+
+	return lCode;
 }
 
 void trh_std_release()
@@ -287,6 +632,8 @@ void trh_std_release()
 			FREE_PTR( gsPaths[ii] );
 		}
 	}
+
+	local_path_cache_clear();
 }
 
 
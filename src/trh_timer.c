@@ -8,23 +8,235 @@
 
 #include "trihlav.h"
 #include "trh_logger.h"
+#include "trh_loop.h"
+#include "trh_std.h"
 #include "trh_timer.h"
+#include "trh_stats.h"
 
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/timerfd.h>
 
 // #endregion
 
-static int local_timer_init( TTrhTimerProperties *iProperties, TTrhEvent *iEvent );
-static int local_timer_set( TTrhEvent *iEvent, time_t iSec, time_t iNsec );
+// Initial capacity of the timer queue.
+#define TIMER_QUEUE_SIZE		64
+// Timer is not present in the timer queue.
+#define TIMER_NOT_QUEUED		SIZE_MAX
+// Number of timers allocated at once by the timer pool.
+#define TIMER_CHUNK_SIZE		256
+
+// #region Typedefs
+
+/**
+ * @brief Timer queue - binary min-heap of running timers, ordered by deadline.
+ *
+ * Only one timerfd is registered with epoll of the loop. It is armed for the earliest deadline.
+ * Every loop has its own queue; queue is accessed only from the thread running the loop.
+ */
+typedef struct TTrhTimerQueue {
+	/// Event registered with epoll (timerfd).
+	TTrhEvent event;
+
+	/// Heap of running timers.
+	TTrhEvent **heap;
+	size_t count;
+	size_t capacity;
+
+	/// Deadline the timerfd is currently armed for. 0 if timerfd is not armed.
+	uint64_t armed;
+
+	/// True while expired timers are dispatched; timerfd is armed once afterwards.
+	bool dispatching;
+} TTrhTimerQueue;
+
+/**
+ * @brief Timer object - event with inline timer properties; one allocation per timer.
+ *
+ * Event must be the first member; TTrhEvent pointer returned to the application is the slot address.
+ */
+typedef struct TTrhTimerSlot {
+	TTrhEvent event;
+	TTrhTimerProperties timer;
+
+	/// Next free slot in the pool.
+	struct TTrhTimerSlot *next_free;
+} TTrhTimerSlot;
+
+/**
+ * @brief Block of timer slots.
+ */
+typedef struct TTrhTimerChunk {
+	struct TTrhTimerChunk *next;
+	size_t count;
+	TTrhTimerSlot slots[];
+} TTrhTimerChunk;
+
+/**
+ * @brief Pool of timer slots (free list). Shared by all loops.
+ */
+typedef struct TTrhTimerPool {
+	pthread_mutex_t mutex;
+
+	TTrhTimerSlot *free;
+	TTrhTimerChunk *chunks;
+
+	/// Number of allocated / free slots.
+	size_t capacity;
+	size_t available;
+} TTrhTimerPool;
+
+// #endregion
+
+
+// #region Static functions
+
+static int local_timer_init( TTrhTimerQueue *iQueue, TTrhTimerProperties *iProperties, TTrhEvent *iEvent );
+static int local_pool_grow( size_t iCount );
+static TTrhTimerSlot *local_pool_alloc();
+static void local_pool_free( TTrhTimerSlot *iSlot );
 static int local_timer_event( TTrhEvent *iEvent );
 static int local_timer_error( TTrhEvent *iEvent );
 
+/**
+ * @brief Return true if the timer can be changed by the calling thread (it owns the loop of the timer).
+ */
+static bool local_timer_owned( const TTrhEvent *iEvent );
+
+static int local_timer_schedule( TTrhEvent *iEvent, uint64_t iDeadline );
+static uint64_t local_timer_period( const TTrhTimerProperties *iTimer );
+static int local_queue_event( TTrhEvent *iEvent );
+static int local_queue_push( TTrhTimerQueue *iQueue, TTrhEvent *iEvent );
+static void local_queue_remove( TTrhEvent *iEvent );
+static void local_queue_sift_up( TTrhTimerQueue *iQueue, size_t iIndex );
+static void local_queue_sift_down( TTrhTimerQueue *iQueue, size_t iIndex );
+static void local_queue_arm( TTrhTimerQueue *iQueue );
+
+// #endregion
+
+
+// #region Static variables
+
+static TTrhTimerPool gsTimerPool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.free = 0,
+	.chunks = 0,
+	.capacity = 0,
+	.available = 0
+};
+
+// #endregion
+
 
 // #region Exported functions
 
+int trh_timer_reserve( size_t iCount )
+{
+	int lCode = TRH_OK;
+
+	pthread_mutex_lock( &gsTimerPool.mutex );
+	if( gsTimerPool.available < iCount )
+		lCode = local_pool_grow( iCount - gsTimerPool.available );
+	pthread_mutex_unlock( &gsTimerPool.mutex );
+
+	return lCode;
+}
+
+void trh_timer_pool_release()
+{
+	pthread_mutex_lock( &gsTimerPool.mutex );
+
+	// Timers still in use keep the pool alive - releasing them later must not touch freed memory.
+	if( gsTimerPool.available != gsTimerPool.capacity ) {
+		trh_log( LOG_WARNING, "%zu timers have not been released.\n", gsTimerPool.capacity - gsTimerPool.available );
+		pthread_mutex_unlock( &gsTimerPool.mutex );
+		return;
+	}
+
+	while( gsTimerPool.chunks != 0 ) {
+		TTrhTimerChunk *lChunk = gsTimerPool.chunks;
+		gsTimerPool.chunks = lChunk->next;
+		free( lChunk );
+	}
+
+	gsTimerPool.free = 0;
+	gsTimerPool.capacity = 0;
+	gsTimerPool.available = 0;
+
+	pthread_mutex_unlock( &gsTimerPool.mutex );
+}
+
+int trh_timer_queue_init( struct TTrhLoop *iLoop, TTrhTimerQueue **oQueue )
+{
+	TRH_ASSERT_ARG( iLoop != 0 && oQueue != 0, "Failed to create timer queue - invalid argument." );
+
+	TTrhTimerQueue *lQueue = (TTrhTimerQueue*)calloc( 1, sizeof( TTrhTimerQueue ) );
+	if( lQueue == 0 ) return TRH_OUT_OF_MEM;
+
+	lQueue->event.fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+	lQueue->event.handle_triggered = local_queue_event;
+	lQueue->event.handle_error = local_timer_error;
+	lQueue->event.ext.data = lQueue;
+
+	if( lQueue->event.fd == -1 ) {
+		trh_log( LOG_ERROR, "Failed to create timer. Error: %s\n", strerror( errno ) );
+		free( lQueue );
+		return TRH_TIMER_FAILED;
+	}
+
+	int lCode = trh_event_register_on( iLoop, &lQueue->event );
+	if( lCode != TRH_OK ) {
+		CLOSE_FD( lQueue->event.fd );
+		free( lQueue );
+		return lCode;
+	}
+
+	*oQueue = lQueue;
+
+	return TRH_OK;
+}
+
+void trh_timer_queue_release( TTrhTimerQueue *iQueue )
+{
+	if( iQueue == 0 )
+		return;
+
+	// Timers are owned by the application; only detach them from the queue.
+	for( size_t ii = 0; ii < iQueue->count; ii++ ) {
+		iQueue->heap[ii]->ext.timer->queue_index = TIMER_NOT_QUEUED;
+		iQueue->heap[ii]->ext.timer->state = TRH_TIMER_STOPPED;
+		iQueue->heap[ii]->ext.timer->queue = 0;
+	}
+
+	trh_event_unregister( &iQueue->event );
+	CLOSE_FD( iQueue->event.fd );
+	FREE_PTR( iQueue->heap );
+	free( iQueue );
+}
+
+size_t trh_timer_queue_clear( TTrhTimerQueue *iQueue )
+{
+	size_t lCount = 0;
+
+	if( iQueue == 0 )
+		return 0;
+
+	// Handler can release other timers - take the last one each time.
+	while( iQueue->count > 0 ) {
+		trh_timer_release( iQueue->heap[iQueue->count - 1] );
+		lCount++;
+	}
+
+	return lCount;
+}
+
 int trh_timer_init( TTrhTimerProperties *iProperties, TTrhEvent **oEvent )
+{
+	return trh_timer_init_on( trh_loop_current(), iProperties, oEvent );
+}
+
+int trh_timer_init_on( struct TTrhLoop *iLoop, TTrhTimerProperties *iProperties, TTrhEvent **oEvent )
 {
 	TTrhEvent *lEvent = 0;
 	int lCode = TRH_OK;
@@ -32,23 +244,21 @@ int trh_timer_init( TTrhTimerProperties *iProperties, TTrhEvent **oEvent )
 	// Validate input arguments
 	TRH_ASSERT_ARG( iProperties != 0, "Failed to init timer - invalid setup." );
 	TRH_ASSERT_ARG( oEvent != 0, "Failed to init timer - invalid output argument." );
+	TRH_ASSERT_ARG( trh_loop_timers( iLoop ) != 0, "Failed to init timer - loop is not initialized." );
+	TRH_ASSERT_ARG( trh_loop_owned( iLoop ), "Failed to init timer - loop is owned by another thread (use trh_post_on)." );
 
-	// Allocate memory for timer object
-	lEvent = (TTrhEvent*)malloc( sizeof( TTrhEvent ) );
-	if( lEvent == 0 ) return TRH_OUT_OF_MEM;
+	// Take timer object (event with inline properties) from the pool
+	TTrhTimerSlot *lSlot = local_pool_alloc();
+	if( lSlot == 0 ) return TRH_OUT_OF_MEM;
+	lEvent = &lSlot->event;
 	memset( lEvent, 0, sizeof( TTrhEvent ) );
 	lEvent->fd = -1;
+	lEvent->ext.timer = &lSlot->timer;
 	lEvent->handle_triggered = local_timer_event;
 	lEvent->handle_error = local_timer_error;
 
 	// Create timer
-	if( ( lCode = local_timer_init( iProperties, lEvent ) ) != TRH_OK ) {
-		trh_timer_release( lEvent );
-		return lCode;
-	}
-
-	// Register timer with epoll
-	if( ( lCode = trh_event_register( lEvent ) ) != TRH_OK ) {
+	if( ( lCode = local_timer_init( trh_loop_timers( iLoop ), iProperties, lEvent ) ) != TRH_OK ) {
 		trh_timer_release( lEvent );
 		return lCode;
 	}
@@ -62,82 +272,75 @@ int trh_timer_init( TTrhTimerProperties *iProperties, TTrhEvent **oEvent )
 int trh_timer_start( TTrhEvent *iEvent )
 {
 	TRH_ASSERT_ARG( iEvent != 0, "Failed to start timer" );
-	int lCode = local_timer_set( iEvent, iEvent->ext.timer->sec, iEvent->ext.timer->nsec );
-	iEvent->ext.timer->state = lCode == TRH_OK ? TRH_TIMER_RUNNING : TRH_TIMER_STOPPED;
-	return TRH_OK;
+	TRH_ASSERT_ARG( local_timer_owned( iEvent ), "Failed to start timer - loop is owned by another thread (use trh_post_on)." );
+
+	TTrhTimerProperties *lTimer = iEvent->ext.timer;
+
+	// Restart timer if it is already running
+	local_queue_remove( iEvent );
+
+	// Zero duration disarms the timer (same as timerfd_settime).
+	if( lTimer->sec == 0 && lTimer->nsec == 0 ) {
+		lTimer->state = TRH_TIMER_RUNNING;
+		return TRH_OK;
+	}
+
+	return local_timer_schedule( iEvent, trh_time_ns() + local_timer_period( lTimer ) );
 }
 
 void trh_timer_stop( TTrhEvent *iEvent )
 {
 	assert( iEvent != 0 );
+
+	if( ! local_timer_owned( iEvent ) ) {
+		trh_log( LOG_ERROR, "Failed to stop timer - loop is owned by another thread (use trh_post_on).\n" );
+		assert( false );
+		return;
+	}
+
 	iEvent->ext.timer->state = TRH_TIMER_STOPPED;
-	local_timer_set( iEvent, 0, 0 );
+	local_queue_remove( iEvent );
 }
 
-// Unregister timer from epoll and release it.
+// Remove timer from the queue and release it.
 void trh_timer_release( TTrhEvent *iEvent )
 {
 	if( iEvent == 0 )
 		return;
 
-	// Unregister timer from epoll
-	trh_event_unregister( iEvent );
+	if( ! local_timer_owned( iEvent ) ) {
+		trh_log( LOG_ERROR, "Failed to release timer - loop is owned by another thread (use trh_post_on).\n" );
+		assert( false );
+		return;
+	}
 
-	// Close timer socket
-	CLOSE_FD( iEvent->fd );
+	local_queue_remove( iEvent );
 
-	// Free timer object.
-	if( iEvent->ext.timer != 0 )
-	{
-		if( iEvent->ext.timer->handle_timer_stopped )
-			iEvent->ext.timer->handle_timer_stopped( iEvent );
-	
-		FREE_PTR( iEvent->ext.timer );
-	}
+	if( iEvent->ext.timer->handle_timer_stopped )
+		iEvent->ext.timer->handle_timer_stopped( iEvent );
 
-	// Free memory
-	free( iEvent );
+	// Return timer object to the pool
+	local_pool_free( (TTrhTimerSlot*)iEvent );
 }
 
 // #endregion
 
 
-// #region Local types
+// #region Local functions
 
-int local_timer_init( TTrhTimerProperties *iProperties, TTrhEvent *iEvent )
+int local_timer_init( TTrhTimerQueue *iQueue, TTrhTimerProperties *iProperties, TTrhEvent *iEvent )
 {
-	// Create timer fd
-	iEvent->fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
-	if( iEvent->fd == -1 ) {
-		trh_log( LOG_ERROR, "Failed to create timer. Error: %s\n", strerror( errno ) );
-		return TRH_TIMER_FAILED;
-	}
-
-	// Create timer properties - clone timer object in memory
-	iEvent->ext.timer = (TTrhTimerProperties*)malloc( sizeof( TTrhTimerProperties ) );
-	if( iEvent->ext.timer == 0 ) return TRH_OUT_OF_MEM;
+	// Clone timer properties into the timer object
 	memcpy( iEvent->ext.timer, iProperties, sizeof( TTrhTimerProperties ) );
+	iEvent->ext.timer->deadline = 0;
+	iEvent->ext.timer->expirations = 0;
+	iEvent->ext.timer->queue_index = TIMER_NOT_QUEUED;
+	iEvent->ext.timer->queue = iQueue;
 
 	// Timer should be initialized in started state.
 	return trh_timer_start( iEvent );
 }
 
-int local_timer_set( TTrhEvent *iEvent, time_t iSec, time_t iNsec )
-{
-	struct itimerspec lSpec = {
-		.it_interval = { .tv_sec = 0, .tv_nsec = 0 },
-		.it_value = { .tv_sec = iSec, .tv_nsec = iNsec }
-	};
-
-	// Set timer properties
-	if( timerfd_settime( iEvent->fd, 0, &lSpec, 0 ) == -1 ) {
-		trh_log( LOG_ERROR, "Failed to set timer. Error: %s\n", strerror( errno ) );
-		return TRH_TIMER_FAILED;
-	}
-
-	return TRH_OK;
-}
-
 int local_timer_event( TTrhEvent *iEvent )
 {
 	int lCode = TRH_OK;
@@ -153,11 +356,26 @@ int local_timer_event( TTrhEvent *iEvent )
 		trh_timer_release( iEvent );
 	}
 
+	// Handler has restarted the timer - keep its new deadline.
+	else if( iEvent->ext.timer->queue_index != TIMER_NOT_QUEUED ) {
+		return TRH_OK;
+	}
+
 	// If timer is not repeating, unregister it
 	else if( iEvent->ext.timer->repeat == false ) {
 		trh_timer_stop( iEvent );
 	}
 
+	// Absolute timer continues from its previous deadline, skipping periods reported in `expirations`.
+	else if( iEvent->ext.timer->absolute && local_timer_period( iEvent->ext.timer ) > 0 ) {
+		const uint64_t lDeadline = iEvent->ext.timer->deadline + iEvent->ext.timer->expirations * local_timer_period( iEvent->ext.timer );
+		local_queue_remove( iEvent );
+		if( ( lCode = local_timer_schedule( iEvent, lDeadline ) ) != TRH_OK ) {
+			trh_timer_release( iEvent );
+			return lCode;
+		}
+	}
+
 	// Renew the timer if it is repeating
 	else if( ( lCode = trh_timer_start( iEvent ) ) != TRH_OK ) {
 		trh_timer_release( iEvent );
@@ -173,4 +391,269 @@ int local_timer_error( TTrhEvent *iEvent )
 	return TRH_TIMER_FAILED;
 }
 
+// Insert timer into the queue with absolute deadline.
+int local_timer_schedule( TTrhEvent *iEvent, uint64_t iDeadline )
+{
+	int lCode = TRH_OK;
+
+	if( iEvent->ext.timer->queue == 0 )
+		return TRH_UNINITIALIZED;
+
+	iEvent->ext.timer->deadline = iDeadline;
+	lCode = local_queue_push( iEvent->ext.timer->queue, iEvent );
+	iEvent->ext.timer->state = lCode == TRH_OK ? TRH_TIMER_RUNNING : TRH_TIMER_STOPPED;
+
+	return lCode;
+}
+
+bool local_timer_owned( const TTrhEvent *iEvent )
+{
+	const TTrhTimerQueue *lQueue = iEvent->ext.timer->queue;
+
+	// Timer detached from a released loop (or its queue) is not shared anymore.
+	return lQueue == 0 || lQueue->event.loop == 0 || trh_loop_owned( lQueue->event.loop );
+}
+
+uint64_t local_timer_period( const TTrhTimerProperties *iTimer )
+{
+	return (uint64_t)iTimer->sec * TRH_NSEC_PER_SEC + (uint64_t)iTimer->nsec;
+}
+
+// #endregion
+
+
+// #region Timer pool
+
+// Allocate chunks for iCount slots. Pool mutex must be locked.
+int local_pool_grow( size_t iCount )
+{
+	while( iCount > 0 ) {
+		const size_t lCount = iCount > TIMER_CHUNK_SIZE ? iCount : TIMER_CHUNK_SIZE;
+		TTrhTimerChunk *lChunk = (TTrhTimerChunk*)malloc( sizeof( TTrhTimerChunk ) + lCount * sizeof( TTrhTimerSlot ) );
+
+		if( lChunk == 0 ) {
+			trh_log( LOG_ERROR, "Failed to allocate timers - out of memory.\n" );
+			return TRH_OUT_OF_MEM;
+		}
+
+		lChunk->count = lCount;
+		lChunk->next = gsTimerPool.chunks;
+		gsTimerPool.chunks = lChunk;
+
+		// Link slots in address order - consecutive timers are adjacent in memory.
+		for( size_t ii = lCount; ii > 0; ii-- ) {
+			lChunk->slots[ii - 1].next_free = gsTimerPool.free;
+			gsTimerPool.free = &lChunk->slots[ii - 1];
+		}
+
+		gsTimerPool.capacity += lCount;
+		gsTimerPool.available += lCount;
+		// Chunk is never smaller than TIMER_CHUNK_SIZE - it can cover more than requested.
+		iCount = lCount >= iCount ? 0 : iCount - lCount;
+	}
+
+	return TRH_OK;
+}
+
+TTrhTimerSlot *local_pool_alloc()
+{
+	TTrhTimerSlot *lSlot = 0;
+
+	pthread_mutex_lock( &gsTimerPool.mutex );
+
+	if( gsTimerPool.free != 0 || local_pool_grow( TIMER_CHUNK_SIZE ) == TRH_OK ) {
+		lSlot = gsTimerPool.free;
+		gsTimerPool.free = lSlot->next_free;
+		gsTimerPool.available--;
+	}
+
+	pthread_mutex_unlock( &gsTimerPool.mutex );
+
+	return lSlot;
+}
+
+void local_pool_free( TTrhTimerSlot *iSlot )
+{
+	pthread_mutex_lock( &gsTimerPool.mutex );
+
+	// LIFO - the most recently released (cache-warm) slot is reused first.
+	iSlot->next_free = gsTimerPool.free;
+	gsTimerPool.free = iSlot;
+	gsTimerPool.available++;
+
+	pthread_mutex_unlock( &gsTimerPool.mutex );
+}
+
+// #endregion
+
+
+// #region Timer queue
+
+// Dispatch all expired timers and re-arm timerfd for the next deadline.
+int local_queue_event( TTrhEvent *iEvent )
+{
+	TTrhTimerQueue *lQueue = (TTrhTimerQueue*)iEvent->ext.data;
+	uint64_t lExpirations = 0;
+
+	// Reset timerfd counter. Fails with EAGAIN if the timer has been re-armed in the meantime.
+	if( read( iEvent->fd, &lExpirations, sizeof( lExpirations ) ) < 0 && errno != EAGAIN )
+		trh_log( LOG_WARNING, "Failed to read timer. Error: %s\n", strerror( errno ) );
+
+	lQueue->armed = 0;
+
+	const uint64_t lNow = trh_time_ns();
+	lQueue->dispatching = true;
+
+	// Dispatch at most `count` timers - a timer with very short period must not block the loop.
+	for( size_t lLimit = lQueue->count; lLimit > 0 && lQueue->count > 0; lLimit-- ) {
+		TTrhEvent *lEvent = lQueue->heap[0];
+
+		if( lEvent->ext.timer->deadline > lNow )
+			break;
+
+		TTrhTimerProperties *lTimer = lEvent->ext.timer;
+		const uint64_t lPeriod = local_timer_period( lTimer );
+
+		// Count the periods elapsed since deadline (including the current one).
+		lTimer->expirations = lTimer->absolute && lTimer->repeat && lPeriod > 0 ? 1 + ( lNow - lTimer->deadline ) / lPeriod : 1;
+
+		local_queue_remove( lEvent );
+
+#ifdef TRH_LOOP_STATS
+		// Handler can release the timer - read what is measured before the call.
+		TTrhLoopStats *lStats = trh_loop_stats_data( lQueue->event.loop );
+		const void *lHandler = (const void*)(uintptr_t)lTimer->handle_timer_event;
+		const uint64_t lStart = trh_time_ns();
+		trh_histogram_record( &lStats->timer_lateness, lStart - lTimer->deadline );
+		lEvent->handle_triggered( lEvent );
+		if( lHandler != 0 )
+			trh_stats_handler( lStats, lHandler, trh_time_ns() - lStart );
+#else
+		lEvent->handle_triggered( lEvent );
+#endif
+	}
+
+	lQueue->dispatching = false;
+	local_queue_arm( lQueue );
+
+	return TRH_OK;
+}
+
+int local_queue_push( TTrhTimerQueue *iQueue, TTrhEvent *iEvent )
+{
+	if( iQueue->count == iQueue->capacity ) {
+		size_t lCapacity = iQueue->capacity == 0 ? TIMER_QUEUE_SIZE : iQueue->capacity * 2;
+		TTrhEvent **lHeap = (TTrhEvent**)realloc( iQueue->heap, lCapacity * sizeof( TTrhEvent* ) );
+
+		if( lHeap == 0 ) {
+			trh_log( LOG_ERROR, "Failed to start timer - out of memory.\n" );
+			return TRH_OUT_OF_MEM;
+		}
+
+		iQueue->heap = lHeap;
+		iQueue->capacity = lCapacity;
+	}
+
+	iEvent->ext.timer->queue_index = iQueue->count;
+	iQueue->heap[iQueue->count++] = iEvent;
+	local_queue_sift_up( iQueue, iEvent->ext.timer->queue_index );
+
+	// Syscall is needed only if the new timer expires before the armed deadline.
+	if( ! iQueue->dispatching && ( iQueue->armed == 0 || iEvent->ext.timer->deadline < iQueue->armed ) )
+		local_queue_arm( iQueue );
+
+	return TRH_OK;
+}
+
+// Remove timer from the queue. Timerfd is not disarmed - spurious wake-up only re-arms the next deadline.
+void local_queue_remove( TTrhEvent *iEvent )
+{
+	TTrhTimerQueue *lQueue = iEvent->ext.timer->queue;
+	size_t lIndex = iEvent->ext.timer->queue_index;
+
+	if( lIndex == TIMER_NOT_QUEUED )
+		return;
+
+	assert( lIndex < lQueue->count && lQueue->heap[lIndex] == iEvent );
+
+	iEvent->ext.timer->queue_index = TIMER_NOT_QUEUED;
+
+	if( --lQueue->count == lIndex )
+		return;
+
+	// Move the last timer to the vacant position and restore heap order.
+	lQueue->heap[lIndex] = lQueue->heap[lQueue->count];
+	lQueue->heap[lIndex]->ext.timer->queue_index = lIndex;
+	local_queue_sift_up( lQueue, lIndex );
+	local_queue_sift_down( lQueue, lQueue->heap[lIndex]->ext.timer->queue_index );
+}
+
+void local_queue_sift_up( TTrhTimerQueue *iQueue, size_t iIndex )
+{
+	TTrhEvent *lEvent = iQueue->heap[iIndex];
+
+	while( iIndex > 0 ) {
+		size_t lParent = ( iIndex - 1 ) / 2;
+
+		if( iQueue->heap[lParent]->ext.timer->deadline <= lEvent->ext.timer->deadline )
+			break;
+
+		iQueue->heap[iIndex] = iQueue->heap[lParent];
+		iQueue->heap[iIndex]->ext.timer->queue_index = iIndex;
+		iIndex = lParent;
+	}
+
+	iQueue->heap[iIndex] = lEvent;
+	lEvent->ext.timer->queue_index = iIndex;
+}
+
+void local_queue_sift_down( TTrhTimerQueue *iQueue, size_t iIndex )
+{
+	TTrhEvent *lEvent = iQueue->heap[iIndex];
+
+	for( ;; ) {
+		size_t lChild = iIndex * 2 + 1;
+
+		if( lChild >= iQueue->count )
+			break;
+
+		if( lChild + 1 < iQueue->count && iQueue->heap[lChild + 1]->ext.timer->deadline < iQueue->heap[lChild]->ext.timer->deadline )
+			lChild++;
+
+		if( lEvent->ext.timer->deadline <= iQueue->heap[lChild]->ext.timer->deadline )
+			break;
+
+		iQueue->heap[iIndex] = iQueue->heap[lChild];
+		iQueue->heap[iIndex]->ext.timer->queue_index = iIndex;
+		iIndex = lChild;
+	}
+
+	iQueue->heap[iIndex] = lEvent;
+	lEvent->ext.timer->queue_index = iIndex;
+}
+
+// Arm timerfd for the earliest deadline in the queue.
+void local_queue_arm( TTrhTimerQueue *iQueue )
+{
+	if( iQueue->count == 0 || iQueue->event.fd == -1 )
+		return;
+
+	const uint64_t lDeadline = iQueue->heap[0]->ext.timer->deadline;
+
+	if( lDeadline == iQueue->armed )
+		return;
+
+	struct itimerspec lSpec = {
+		.it_interval = { .tv_sec = 0, .tv_nsec = 0 },
+		.it_value = { .tv_sec = lDeadline / TRH_NSEC_PER_SEC, .tv_nsec = lDeadline % TRH_NSEC_PER_SEC }
+	};
+
+	if( timerfd_settime( iQueue->event.fd, TFD_TIMER_ABSTIME, &lSpec, 0 ) == -1 ) {
+		trh_log( LOG_ERROR, "Failed to set timer. Error: %s\n", strerror( errno ) );
+		return;
+	}
+
+	iQueue->armed = lDeadline;
+}
+
 // #endregion
@@ -0,0 +1,505 @@
+/*
+ * @brief File watching (inotify)
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ */
+
+// #region Includes
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "trihlav.h"
+#include "trh_logger.h"
+#include "trh_loop.h"
+#include "trh_std.h"
+#include "trh_timer.h"
+#include "trh_watch.h"
+
+// #endregion
+
+// Initial capacity of the watch index.
+#define WATCH_INDEX_SIZE		16
+// Size of the inotify read buffer; fits at least one event with the longest name.
+#define WATCH_BUFFER_SIZE		( 4096 + sizeof( struct inotify_event ) + NAME_MAX + 1 )
+// Flags reported to every watch regardless of its mask.
+#define WATCH_ALWAYS			( IN_IGNORED | IN_Q_OVERFLOW | IN_UNMOUNT )
+
+// #region Typedefs
+
+/**
+ * @brief Watch - one callback of an inotify watch descriptor.
+ */
+typedef struct TTrhWatch {
+	struct TTrhWatcher *watcher;
+
+	/// Watch descriptor; the watch stays in the index until trh_watch_remove(), also when it is not active.
+	int wd;
+	/// False when the kernel has removed the watch descriptor.
+	bool active;
+	uint32_t mask;
+	/// Coalescing window (ns).
+	uint64_t window;
+
+	handle_watch handle_watch;
+	void *arg;
+
+	/// Next watch of the same watch descriptor.
+	struct TTrhWatch *next;
+} TTrhWatch;
+
+/**
+ * @brief Coalesced event waiting for the end of its window.
+ */
+typedef struct TTrhWatchPending {
+	/// Null if the watch has been removed in the meantime.
+	TTrhWatch *watch;
+	uint32_t mask;
+	uint32_t hash;
+	uint64_t deadline;
+
+	struct TTrhWatchPending *next;
+
+	/// Name of the file in the watched directory; empty for the watched path itself.
+	char name[];
+} TTrhWatchPending;
+
+/**
+ * @brief Watcher of the loop. Accessed only from the thread running the loop.
+ */
+typedef struct TTrhWatcher {
+	struct TTrhLoop *loop;
+
+	/// Inotify fd registered with the loop.
+	TTrhEvent event;
+	/// One-shot timer armed for the earliest pending deadline.
+	TTrhEvent *timer;
+
+	/// Watches sorted by watch descriptor; watches sharing the descriptor are chained.
+	TTrhWatch **watches;
+	size_t count;
+	size_t capacity;
+
+	/// Coalesced events in arrival order.
+	TTrhWatchPending *pending;
+	TTrhWatchPending **pending_tail;
+	/// Events being delivered.
+	TTrhWatchPending *delivering;
+} TTrhWatcher;
+
+// #endregion
+
+
+// #region Static functions
+
+static size_t local_watch_find( TTrhWatcher *iWatcher, int iWd, bool *oFound );
+static int local_watch_insert( TTrhWatcher *iWatcher, TTrhWatch *iWatch );
+static void local_watch_detach( TTrhWatch *iWatch );
+static int local_watch_event( TTrhEvent *iEvent );
+static int local_watch_timer( TTrhEvent *iEvent );
+static void local_watch_read( TTrhWatcher *iWatcher, const struct inotify_event *iEvent, uint64_t iNow );
+static void local_watch_queue( TTrhWatch *iWatch, uint32_t iMask, chars iName, uint64_t iNow );
+static void local_watch_flush( TTrhWatcher *iWatcher, uint64_t iNow );
+static void local_watch_arm( TTrhWatcher *iWatcher, uint64_t iNow );
+
+// #endregion
+
+
+// #region Exported functions
+
+int trh_watcher_init( struct TTrhLoop *iLoop, TTrhWatcher **oWatcher )
+{
+	TRH_ASSERT_ARG( iLoop != 0 && oWatcher != 0, "Failed to create watcher - invalid argument." );
+
+	int lCode;
+	TTrhWatcher *lWatcher = (TTrhWatcher*)calloc( 1, sizeof( TTrhWatcher ) );
+	if( lWatcher == 0 ) return TRH_OUT_OF_MEM;
+
+	lWatcher->loop = iLoop;
+	lWatcher->pending_tail = &lWatcher->pending;
+
+	lWatcher->event.fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+	lWatcher->event.handle_triggered = local_watch_event;
+	lWatcher->event.ext.data = lWatcher;
+
+	if( lWatcher->event.fd == -1 ) {
+		trh_log( LOG_ERROR, "Failed to create inotify fd. Error: %s\n", strerror( errno ) );
+		trh_watcher_release( lWatcher );
+		return TRH_EPOLL_FAILED;
+	}
+
+	if( ( lCode = trh_event_register_on( iLoop, &lWatcher->event ) ) != TRH_OK ) {
+		trh_watcher_release( lWatcher );
+		return lCode;
+	}
+
+	// Zero duration - timer is created stopped and armed with the first windowed event.
+	TTrhTimerProperties lTimer = {
+		.repeat = false,
+		.ext = lWatcher,
+		.handle_timer_event = local_watch_timer
+	};
+
+	if( ( lCode = trh_timer_init_on( iLoop, &lTimer, &lWatcher->timer ) ) != TRH_OK ) {
+		lWatcher->timer = 0;
+		trh_watcher_release( lWatcher );
+		return lCode;
+	}
+
+	*oWatcher = lWatcher;
+
+	return TRH_OK;
+}
+
+void trh_watcher_release( TTrhWatcher *iWatcher )
+{
+	if( iWatcher == 0 )
+		return;
+
+	trh_timer_release( iWatcher->timer );
+
+	// Closing the inotify fd removes all watch descriptors.
+	if( iWatcher->event.loop != 0 )
+		trh_event_unregister( &iWatcher->event );
+	CLOSE_FD( iWatcher->event.fd );
+
+	for( TTrhWatchPending *lItem = iWatcher->pending, *lNext; lItem != 0; lItem = lNext ) {
+		lNext = lItem->next;
+		free( lItem );
+	}
+
+	for( size_t ii = 0; ii < iWatcher->count; ii++ ) {
+		for( TTrhWatch *lWatch = iWatcher->watches[ii], *lNext; lWatch != 0; lWatch = lNext ) {
+			lNext = lWatch->next;
+			free( lWatch );
+		}
+	}
+
+	free( iWatcher->watches );
+	free( iWatcher );
+}
+
+int trh_watch_add( chars iPath, uint32_t iMask, handle_watch iCallback, void *iArg, TTrhWatch **oWatch )
+{
+	TRH_ASSERT_ARG( iPath != 0 && iPath[0] != 0 && iCallback != 0, "Failed to add watch - invalid argument." );
+
+	if( ( iMask & IN_ALL_EVENTS ) == 0 ) {
+		trh_log( LOG_WARNING, "Failed to watch '%s' - no events requested.\n", iPath );
+		return TRH_ARG_INVALID;
+	}
+
+	TTrhWatcher *lWatcher = trh_loop_watcher( trh_loop_current() );
+	if( lWatcher == 0 )
+		return TRH_UNINITIALIZED;
+
+	TTrhWatch *lWatch = (TTrhWatch*)calloc( 1, sizeof( TTrhWatch ) );
+	if( lWatch == 0 ) return TRH_OUT_OF_MEM;
+
+	lWatch->watcher = lWatcher;
+	lWatch->active = true;
+	lWatch->mask = iMask & IN_ALL_EVENTS;
+	lWatch->window = TRH_WATCH_WINDOW_DEFAULT * 1000000ull;
+	lWatch->handle_watch = iCallback;
+	lWatch->arg = iArg;
+
+	// Path watched already returns its descriptor; masks of all watches are merged.
+	if( ( lWatch->wd = inotify_add_watch( lWatcher->event.fd, iPath, lWatch->mask | IN_MASK_ADD ) ) < 0 ) {
+		trh_log( LOG_WARNING, "Failed to watch '%s'. Error: %s\n", iPath, strerror( errno ) );
+		free( lWatch );
+		return TRH_FILE_ERROR;
+	}
+
+	if( local_watch_insert( lWatcher, lWatch ) != TRH_OK ) {
+		local_watch_detach( lWatch );
+		free( lWatch );
+		return TRH_OUT_OF_MEM;
+	}
+
+	if( oWatch != 0 )
+		*oWatch = lWatch;
+
+	return TRH_OK;
+}
+
+void trh_watch_set_window( TTrhWatch *iWatch, uint32_t iMilliseconds )
+{
+	if( iWatch != 0 )
+		iWatch->window = iMilliseconds * 1000000ull;
+}
+
+void trh_watch_remove( TTrhWatch *iWatch )
+{
+	if( iWatch == 0 )
+		return;
+
+	TTrhWatcher *lWatcher = iWatch->watcher;
+
+	local_watch_detach( iWatch );
+
+	// Drop coalesced events of the watch (also those being delivered right now).
+	for( TTrhWatchPending *lItem = lWatcher->pending; lItem != 0; lItem = lItem->next ) {
+		if( lItem->watch == iWatch )
+			lItem->watch = 0;
+	}
+
+	for( TTrhWatchPending *lItem = lWatcher->delivering; lItem != 0; lItem = lItem->next ) {
+		if( lItem->watch == iWatch )
+			lItem->watch = 0;
+	}
+
+	free( iWatch );
+}
+
+// #endregion
+
+
+// #region Static functions
+
+// Binary search for the watch descriptor; return its index, or index where it should be inserted.
+size_t local_watch_find( TTrhWatcher *iWatcher, int iWd, bool *oFound )
+{
+	size_t lLow = 0;
+	size_t lHigh = iWatcher->count;
+
+	while( lLow < lHigh ) {
+		size_t lMid = ( lLow + lHigh ) / 2;
+		int lWd = iWatcher->watches[lMid]->wd;
+
+		if( lWd == iWd ) {
+			*oFound = true;
+			return lMid;
+		}
+
+		if( lWd < iWd )
+			lLow = lMid + 1;
+		else
+			lHigh = lMid;
+	}
+
+	*oFound = false;
+	return lLow;
+}
+
+int local_watch_insert( TTrhWatcher *iWatcher, TTrhWatch *iWatch )
+{
+	bool lFound;
+	size_t lIndex = local_watch_find( iWatcher, iWatch->wd, &lFound );
+
+	if( lFound ) {
+		iWatch->next = iWatcher->watches[lIndex];
+		iWatcher->watches[lIndex] = iWatch;
+		return TRH_OK;
+	}
+
+	if( iWatcher->count == iWatcher->capacity ) {
+		size_t lCapacity = iWatcher->capacity == 0 ? WATCH_INDEX_SIZE : iWatcher->capacity * 2;
+		TTrhWatch **lWatches = (TTrhWatch**)realloc( iWatcher->watches, lCapacity * sizeof( TTrhWatch* ) );
+		if( lWatches == 0 ) return TRH_OUT_OF_MEM;
+
+		iWatcher->watches = lWatches;
+		iWatcher->capacity = lCapacity;
+	}
+
+	// Descriptors are allocated in increasing order - insert is usually an append.
+	memmove( iWatcher->watches + lIndex + 1, iWatcher->watches + lIndex, ( iWatcher->count - lIndex ) * sizeof( TTrhWatch* ) );
+	iWatcher->watches[lIndex] = iWatch;
+	iWatcher->count++;
+
+	return TRH_OK;
+}
+
+// Remove the watch from the index; remove the descriptor if it was its last watch.
+void local_watch_detach( TTrhWatch *iWatch )
+{
+	TTrhWatcher *lWatcher = iWatch->watcher;
+	bool lFound;
+	size_t lIndex = local_watch_find( lWatcher, iWatch->wd, &lFound );
+
+	if( lFound ) {
+		TTrhWatch **lLink = &lWatcher->watches[lIndex];
+
+		while( *lLink != 0 && *lLink != iWatch )
+			lLink = &( *lLink )->next;
+
+		if( *lLink == iWatch )
+			*lLink = iWatch->next;
+
+		if( lWatcher->watches[lIndex] != 0 )
+			return;
+
+		lWatcher->count--;
+		memmove( lWatcher->watches + lIndex, lWatcher->watches + lIndex + 1, ( lWatcher->count - lIndex ) * sizeof( TTrhWatch* ) );
+	}
+
+	// Mask of the descriptor is not reduced while other watches use it; their callbacks filter the events.
+	if( iWatch->active )
+		inotify_rm_watch( lWatcher->event.fd, iWatch->wd );
+	iWatch->active = false;
+}
+
+int local_watch_event( TTrhEvent *iEvent )
+{
+	TTrhWatcher *lWatcher = (TTrhWatcher*)iEvent->ext.data;
+	char lBuffer[WATCH_BUFFER_SIZE] __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+	uint64_t lNow = trh_time_ns();
+
+	for( ;; ) {
+		ssize_t lSize = read( iEvent->fd, lBuffer, sizeof( lBuffer ) );
+
+		if( lSize < 0 && errno == EINTR )
+			continue;
+
+		if( lSize <= 0 ) {
+			if( lSize < 0 && errno != EAGAIN )
+				trh_log( LOG_ERROR, "Failed to read inotify events. Error: %s\n", strerror( errno ) );
+			break;
+		}
+
+		for( char *lPtr = lBuffer; lPtr < lBuffer + lSize; ) {
+			const struct inotify_event *lEvent = (const struct inotify_event*)lPtr;
+			local_watch_read( lWatcher, lEvent, lNow );
+			lPtr += sizeof( struct inotify_event ) + lEvent->len;
+		}
+	}
+
+	// Events without window are delivered right away - coalesced within this read only.
+	local_watch_flush( lWatcher, lNow );
+	local_watch_arm( lWatcher, lNow );
+
+	return TRH_OK;
+}
+
+int local_watch_timer( TTrhEvent *iEvent )
+{
+	TTrhWatcher *lWatcher = (TTrhWatcher*)iEvent->ext.timer->ext;
+	uint64_t lNow = trh_time_ns();
+
+	local_watch_flush( lWatcher, lNow );
+	local_watch_arm( lWatcher, lNow );
+
+	return TRH_OK;
+}
+
+void local_watch_read( TTrhWatcher *iWatcher, const struct inotify_event *iEvent, uint64_t iNow )
+{
+	chars lName = iEvent->len > 0 ? iEvent->name : 0;
+	bool lFound;
+
+	// Events have been lost - every watch should rescan.
+	if( iEvent->mask & IN_Q_OVERFLOW ) {
+		for( size_t ii = 0; ii < iWatcher->count; ii++ ) {
+			for( TTrhWatch *lWatch = iWatcher->watches[ii]; lWatch != 0; lWatch = lWatch->next ) {
+				if( lWatch->active )
+					local_watch_queue( lWatch, IN_Q_OVERFLOW, 0, iNow );
+			}
+		}
+		return;
+	}
+
+	size_t lIndex = local_watch_find( iWatcher, iEvent->wd, &lFound );
+	if( ! lFound )
+		return;
+
+	for( TTrhWatch *lWatch = iWatcher->watches[lIndex]; lWatch != 0; lWatch = lWatch->next ) {
+		if( lWatch->active && ( iEvent->mask & ( lWatch->mask | WATCH_ALWAYS ) ) )
+			local_watch_queue( lWatch, iEvent->mask & ( lWatch->mask | WATCH_ALWAYS | IN_ISDIR ), lName, iNow );
+
+		// Kernel has removed the descriptor (path deleted or unmounted).
+		if( iEvent->mask & IN_IGNORED )
+			lWatch->active = false;
+	}
+}
+
+// Merge the event with a pending event of the same file, or queue a new one.
+void local_watch_queue( TTrhWatch *iWatch, uint32_t iMask, chars iName, uint64_t iNow )
+{
+	TTrhWatcher *lWatcher = iWatch->watcher;
+	size_t lLength = iName != 0 ? strlen( iName ) : 0;
+	uint32_t lHash = 2166136261u;
+
+	for( size_t ii = 0; ii < lLength; ii++ ) {
+		lHash ^= (unsigned char)iName[ii];
+		lHash *= 16777619u;
+	}
+
+	for( TTrhWatchPending *lItem = lWatcher->pending; lItem != 0; lItem = lItem->next ) {
+		if( lItem->watch == iWatch && lItem->hash == lHash && strcmp( lItem->name, iName != 0 ? iName : "" ) == 0 ) {
+			lItem->mask |= iMask;
+			return;
+		}
+	}
+
+	TTrhWatchPending *lItem = (TTrhWatchPending*)malloc( sizeof( TTrhWatchPending ) + lLength + 1 );
+	if( lItem == 0 ) {
+		trh_log( LOG_ERROR, "Failed to queue watch event - out of memory.\n" );
+		return;
+	}
+
+	lItem->watch = iWatch;
+	lItem->mask = iMask;
+	lItem->hash = lHash;
+	lItem->deadline = iNow + iWatch->window;
+	lItem->next = 0;
+	memcpy( lItem->name, iName != 0 ? iName : "", lLength + 1 );
+
+	*lWatcher->pending_tail = lItem;
+	lWatcher->pending_tail = &lItem->next;
+}
+
+// Deliver pending events whose window has expired.
+void local_watch_flush( TTrhWatcher *iWatcher, uint64_t iNow )
+{
+	TTrhWatchPending **lDeliverTail = &iWatcher->delivering;
+	TTrhWatchPending **lLink = &iWatcher->pending;
+
+	// Move due events to the delivery list first - callbacks can add or remove watches.
+	while( *lLink != 0 ) {
+		TTrhWatchPending *lItem = *lLink;
+
+		if( lItem->watch != 0 && lItem->deadline > iNow ) {
+			lLink = &lItem->next;
+			continue;
+		}
+
+		*lLink = lItem->next;
+		lItem->next = 0;
+		*lDeliverTail = lItem;
+		lDeliverTail = &lItem->next;
+	}
+
+	iWatcher->pending_tail = lLink;
+
+	while( iWatcher->delivering != 0 ) {
+		TTrhWatchPending *lItem = iWatcher->delivering;
+		iWatcher->delivering = lItem->next;
+
+		if( lItem->watch != 0 )
+			lItem->watch->handle_watch( lItem->watch, lItem->mask, lItem->name[0] != 0 ? lItem->name : 0, lItem->watch->arg );
+
+		free( lItem );
+	}
+}
+
+// Arm the timer for the earliest pending deadline.
+void local_watch_arm( TTrhWatcher *iWatcher, uint64_t iNow )
+{
+	uint64_t lDeadline = UINT64_MAX;
+
+	for( TTrhWatchPending *lItem = iWatcher->pending; lItem != 0; lItem = lItem->next ) {
+		if( lItem->deadline < lDeadline )
+			lDeadline = lItem->deadline;
+	}
+
+	if( lDeadline == UINT64_MAX ) {
+		trh_timer_stop( iWatcher->timer );
+		return;
+	}
+
+	uint64_t lDelay = lDeadline > iNow ? lDeadline - iNow : 1;
+	iWatcher->timer->ext.timer->sec = lDelay / TRH_NSEC_PER_SEC;
+	iWatcher->timer->ext.timer->nsec = lDelay % TRH_NSEC_PER_SEC;
+	trh_timer_start( iWatcher->timer );
+}
+
+// #endregion
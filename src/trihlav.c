@@ -9,17 +9,21 @@
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <sys/signalfd.h>
+#include <stdatomic.h>
 #include <execinfo.h>
-#include <sys/epoll.h>
 
 #include "trihlav.h"
+#include "trh_arena.h"
 #include "trh_std.h"
 #include "trh_logger.h"
+#include "trh_loop.h"
+#include "trh_timer.h"
+#include "trh_config.h"
+#include "trh_dbus.h"
 
 // #endregion
 
-#define EPOLL_EVENTS 16
-
 // #region Typedefs
 
 /**
@@ -27,29 +31,37 @@
  */
 typedef struct TApplication {
 	/// System time (unix timestamp)
-	double time_system;
+	/// Time values are written only by the main loop and read lock-free from any thread.
+	_Atomic double time_system;
+
+	/// Monotonic time (ns) of the last iteration of main application loop. Main loop only.
+	uint64_t time_monotonic;
 
-	/// Time (in seconds) since application started
-	double time_app;
+	/// Time (in nanoseconds) since application started
+	_Atomic uint64_t time_app;
 
-	/// Delta time since last iteration of main application loop.
-	double dt;
+	/// Delta time (in nanoseconds) since last iteration of main application loop.
+	_Atomic uint64_t dt;
 
 	/// If true, application is terminating.
-	bool terminate;
+	atomic_bool terminate;
 
 	/// If true, application should reload its settings and reset its state.
-	bool reload;
+	/// Set from signal handler; lock-free atomics are async-signal-safe.
+	atomic_bool reload;
+
+	/// Default event loop (epoll, wake-up event, timer queue).
+	struct TTrhLoop *loop;
 
-	/// Epoll file descriptor.
-	int epoll_fd;
+	/// Signalfd registered with the default loop; fd is -1 if signals are delivered to signal handlers.
+	TTrhEvent signal_event;
+
+	/// Handlers set by trh_set_signal_handler(); executed on the main loop in signalfd mode.
+	handle_signal_usr signal_handlers[NSIG];
 
 	/// Protect application object in multi-threaded environment.
 	pthread_mutex_t mutex;
 
-	/// Callback function executed on main loop error.
-	handle_loop_error handle_error;
-
 	/// Pointer to extended object.
 	void* ext;
 } TApplication;
@@ -72,29 +84,19 @@ static int local_signal_failed( int iSignum );
 static int local_signal_register();
 
 /**
- * @brief Initialize epoll object.
- */
-static int local_epoll_init();
-
-/**
- * @brief Executed when epoll_wait() returns -1.
- * @return TRH_WAITING An interrupt signal has been received and callback handler returned OK.
- * @return TRH_EPOLL_FAILED An error has been detected or callback handler did not return OK.
- *
- * If callback handler is null, function always returns TRH_EPOLL_FAILED.
- * Callback handler is set (or disabled) using function \a trh_set_loop_error_handler.
+ * @brief Signals delivered through signalfd.
  */
-static int local_epoll_error();
+static void local_signal_mask( sigset_t *oMask );
 
 /**
- * @brief Handle epoll event.
+ * @brief Read signals from signalfd and dispatch them on the main loop.
  */
-static int local_epoll_event( struct epoll_event *iEvent );
+static int local_signal_event( TTrhEvent *iEvent );
 
 /**
- * @brief Release epoll object.
+ * @brief Update system time, application time and dt. Called only from the main loop.
  */
-static void local_epoll_release();
+static void local_update_time();
 
 // #endregion
 
@@ -130,8 +132,14 @@ TApplication *trh_init( void *iExt )
 {
 	memset( &gsApplication, 0, sizeof( gsApplication ) );
 
-	gsApplication.time_system = trh_time();
+	atomic_init( &gsApplication.time_system, trh_time() );
+	atomic_init( &gsApplication.time_app, 0 );
+	atomic_init( &gsApplication.dt, 0 );
+	gsApplication.time_monotonic = trh_time_ns();
+	atomic_init( &gsApplication.terminate, false );
+	atomic_init( &gsApplication.reload, false );
 	gsApplication.ext = iExt;
+	gsApplication.signal_event.fd = -1;
 
 	// Register system signals.
 	if( local_signal_register() != TRH_OK )
@@ -144,10 +152,13 @@ TApplication *trh_init( void *iExt )
 	// Initialize main thread mutex.
 	pthread_mutex_init( &gsApplication.mutex, 0 );
 
-	// Create epoll object
-	if( local_epoll_init() != TRH_OK )
+	// Create default loop (epoll, wake-up event for blocking wait, timer queue)
+	if( trh_loop_init( &gsApplication.loop ) != TRH_OK )
 		return 0;
 
+	// Shutdown drains the loop without trh_update_wait() - the clock is updated by the loop.
+	trh_loop_set_clock_handler( gsApplication.loop, local_update_time );
+
 	return &gsApplication;
 }
 
@@ -160,66 +171,148 @@ int trh_set_signal_handler( int iSignal, handle_signal_usr iHandler )
 	if( iHandler == 0 )
 		return TRH_ARG_INVALID;
 
-	if( signal( iSignal, iHandler ) == SIG_ERR )
+	gsApplication.signal_handlers[iSignal] = iHandler;
+
+	// In signalfd mode the handler is called from the main loop.
+	if( gsApplication.signal_event.fd == -1 && signal( iSignal, iHandler ) == SIG_ERR )
 		return local_signal_failed( iSignal );
 
 	return TRH_OK;
 }
 
+int trh_set_signal_fd( bool iEnable )
+{
+	if( gsApplication.loop == 0 )
+		return TRH_UNINITIALIZED;
+
+	if( iEnable == ( gsApplication.signal_event.fd != -1 ) )
+		return TRH_OK;
+
+	sigset_t lMask;
+	local_signal_mask( &lMask );
+
+	if( ! iEnable ) {
+		trh_event_unregister( &gsApplication.signal_event );
+		CLOSE_FD( gsApplication.signal_event.fd );
+
+		// Signals pending in the mask are delivered to the handlers right after unblocking.
+		for( int lSignal = 1; lSignal < NSIG; lSignal++ ) {
+			if( gsApplication.signal_handlers[lSignal] != 0 && sigismember( &lMask, lSignal ) == 1 )
+				signal( lSignal, gsApplication.signal_handlers[lSignal] );
+		}
+
+		pthread_sigmask( SIG_UNBLOCK, &lMask, 0 );
+		return TRH_OK;
+	}
+
+	pthread_sigmask( SIG_BLOCK, &lMask, 0 );
+
+	gsApplication.signal_event.fd = signalfd( -1, &lMask, SFD_NONBLOCK | SFD_CLOEXEC );
+	gsApplication.signal_event.handle_triggered = local_signal_event;
+
+	if( gsApplication.signal_event.fd == -1 ) {
+		trh_log( LOG_ERROR, "Failed to create signalfd. Error: %s\n", strerror( errno ) );
+		pthread_sigmask( SIG_UNBLOCK, &lMask, 0 );
+		return TRH_SIGNAL_FAILED;
+	}
+
+	int lCode = trh_event_register_on( gsApplication.loop, &gsApplication.signal_event );
+
+	if( lCode != TRH_OK ) {
+		CLOSE_FD( gsApplication.signal_event.fd );
+		pthread_sigmask( SIG_UNBLOCK, &lMask, 0 );
+	}
+
+	return lCode;
+}
+
 void trh_set_loop_error_handler( handle_loop_error iHandler )
 {
-	gsApplication.handle_error = iHandler;
+	trh_loop_set_error_handler( gsApplication.loop, iHandler );
 }
 
 int trh_update()
 {
-	double lTime = trh_time();
-	struct epoll_event lEvents[EPOLL_EVENTS];
+	return trh_update_wait( 0 );
+}
+
+int trh_update_wait( int iTimeout )
+{
+	local_update_time();
+	if( trh_is_reloading() ) return TRH_RELOAD;
+
+	int lCode = trh_loop_wait( gsApplication.loop, iTimeout );
+	if( lCode != TRH_OK )
+		return lCode;
+
+	// Application could sleep for a while - event handlers should see the wake-up time.
+	if( iTimeout != 0 )
+		local_update_time();
+
+	trh_loop_dispatch( gsApplication.loop );
+
+	return TRH_OK;
+}
 
-	trh_app_lock();
-	gsApplication.dt = lTime - gsApplication.time_system;
-	gsApplication.time_system = lTime;
-	gsApplication.time_app += gsApplication.dt;
-	if( gsApplication.reload ) return TRH_RELOAD;
-	trh_app_unlock();
+int trh_run()
+{
+	int lCode = TRH_OK;
 
-	int lEventCount = epoll_wait( gsApplication.epoll_fd, lEvents, EPOLL_EVENTS, 0 );
+	while( ! trh_is_terminating() ) {
+		lCode = trh_update_wait( -1 );
 
-	if( lEventCount == -1 )
-		return local_epoll_error();
+		// Reload request is passed to the caller; it can be handled and the loop restarted.
+		if( lCode == TRH_RELOAD ) {
+			trh_reload();
+			return TRH_RELOAD;
+		}
 
-	for( int ii = 0; ii < lEventCount; ii++ )
-		local_epoll_event( &lEvents[ii] );
+		if( lCode < TRH_OK )
+			return lCode;
+	}
 
 	return TRH_OK;
 }
 
+void trh_wakeup()
+{
+	trh_loop_wakeup( gsApplication.loop );
+}
+
+int trh_set_event_batch( size_t iCount )
+{
+	return trh_loop_set_event_batch( gsApplication.loop, iCount );
+}
+
+struct TTrhLoop *trh_loop_default()
+{
+	return gsApplication.loop;
+}
+
 double trh_get_sys_time()
 {
-	double lResult = 0;
-	trh_app_lock();
-	lResult = gsApplication.time_system;
-	trh_app_unlock();
-	return lResult;
+	return atomic_load_explicit( &gsApplication.time_system, memory_order_relaxed );
 }
 
 double trh_get_app_time()
 {
-	double lResult = 0;
-	trh_app_lock();
-	lResult = gsApplication.time_app;
-	trh_app_unlock();
-	return lResult;
+	return (double)atomic_load_explicit( &gsApplication.time_app, memory_order_relaxed ) / (double)TRH_NSEC_PER_SEC;
+}
+
+uint64_t trh_get_app_time_ns()
+{
+	return atomic_load_explicit( &gsApplication.time_app, memory_order_relaxed );
 }
 
 // Get time difference between two calls of trh_update().
 double trh_get_dt()
 {
-	double lResult = 0;
-	trh_app_lock();
-	lResult = gsApplication.dt;
-	trh_app_unlock();
-	return lResult;
+	return (double)atomic_load_explicit( &gsApplication.dt, memory_order_relaxed ) / (double)TRH_NSEC_PER_SEC;
+}
+
+uint64_t trh_get_dt_ns()
+{
+	return atomic_load_explicit( &gsApplication.dt, memory_order_relaxed );
 }
 
 // Lock application mutex.
@@ -237,39 +330,80 @@ void trh_app_unlock()
 // Set flag 'application is now terminating'.
 void trh_terminate()
 {
-	trh_app_lock();
-	gsApplication.terminate = true;
-	trh_app_unlock();
+	atomic_store( &gsApplication.terminate, true );
+
+	// Interrupt blocking wait, if any.
+	trh_loop_wakeup( gsApplication.loop );
 }
 
 // Return 'true' if application is terminating.
 bool trh_is_terminating()
 {
-	bool lResult = false;
-	trh_app_lock();
-	lResult = gsApplication.terminate;
-	trh_app_unlock();
-	return lResult;
+	return atomic_load( &gsApplication.terminate );
 }
 
 // Return 'true' if application should reload its settings and reset its state.
 bool trh_is_reloading()
 {
-	bool lResult = false;
-	trh_app_lock();
-	lResult = gsApplication.reload;
-	trh_app_unlock();
-	return lResult;
+	return atomic_load( &gsApplication.reload );
+}
+
+void trh_reload()
+{
+	atomic_store( &gsApplication.reload, false );
+	// Config is swapped before the application handles the reload.
+	trh_config_reload();
+	// Log file could have been moved by logrotate.
+	trh_log_reopen();
+}
+
+int trh_shutdown( int iTimeout )
+{
+	if( gsApplication.loop == 0 )
+		return TRH_UNINITIALIZED;
+
+	const uint64_t lDeadline = trh_time_ns() + (uint64_t)( iTimeout > 0 ? iTimeout : 0 ) * TRH_NSEC_PER_MSEC;
+
+	trh_log( LOG_NOTE, "Shutting down...\n" );
+	trh_terminate();
+
+	// Coalesced signals are not delayed by their window.
+	trh_dbus_flush_signals();
+
+	int lCode = trh_loop_drain( gsApplication.loop, lDeadline, trh_dbus_pending );
+	if( lCode == TRH_WAITING )
+		trh_log( LOG_WARNING, "Shutdown timeout expired - pending work is dropped.\n" );
+
+	// Owners of events and timers of the default loop release them first.
+	trh_config_release();
+	trh_set_signal_fd( false );
+	trh_dbus_release();
+	trh_loop_close( gsApplication.loop );
+
+	// Logger gets the rest of the timeout.
+	const uint64_t lNow = trh_time_ns();
+	const int lFlushCode = trh_log_flush( lNow < lDeadline ? (int)( ( lDeadline - lNow ) / TRH_NSEC_PER_MSEC ) : 0 );
+
+	return lCode == TRH_OK ? lFlushCode : lCode;
 }
 
 void trh_release()
 {
     // Destroy the mutex
     pthread_mutex_destroy( &gsApplication.mutex );
-	// Release epoll object
-	local_epoll_release();
+	// Release config (its watch belongs to the default loop)
+	trh_config_release();
+	// Release signalfd (registered with the default loop)
+	trh_set_signal_fd( false );
+	// Release default loop (timer queue, wake-up event, epoll object)
+	trh_loop_release( gsApplication.loop );
+	gsApplication.loop = 0;
+	// Release timer pool
+	trh_timer_pool_release();
 	// Release std resources
 	trh_std_release();
+	// Release scratch arena of the main thread
+	trh_arena_thread_release();
 }
 
 // #endregion
@@ -278,32 +412,7 @@ void trh_release()
 
 int trh_event_register( TTrhEvent *iEvent )
 {
-	TRH_ASSERT_ARG( iEvent != 0, "Failed to register event. Event is null.\n" );
-
-	struct epoll_event lEvent = {
-		.events = EPOLLIN,
-		.data.ptr = iEvent
-	};
-
-	if( epoll_ctl( gsApplication.epoll_fd, EPOLL_CTL_ADD, iEvent->fd, &lEvent ) == -1 ) {
-		trh_log( LOG_ERROR, "Failed to register event: %s.\n", strerror( errno ) );
-		return TRH_EPOLL_FAILED;
-	}
-
-	return TRH_OK;
-}
-
-void trh_event_unregister( TTrhEvent *iEvent )
-{
-	if( iEvent == 0 ) {
-		trh_log( LOG_ERROR, "Failed to unregister event. Event is null.\n" );
-		return;
-	}
-
-	if( gsApplication.epoll_fd == -1 )
-		return;
-
-	epoll_ctl( gsApplication.epoll_fd, EPOLL_CTL_DEL, iEvent->fd, 0 );
+	return trh_event_register_on( trh_loop_current(), iEvent );
 }
 
 // #endregion // Events
@@ -322,7 +431,8 @@ int local_signal_failed( int iSignum )
 static void local_signal_handle_reload( int iSignum )
 {
 	trh_log( LOG_NOTE, "SIGNAL %d HAS BEEN RECEIVED. RELOADING CONFIGURATION.\n", iSignum );
-	gsApplication.reload = true;
+	atomic_store( &gsApplication.reload, true );
+	trh_loop_wakeup( gsApplication.loop );
 }
 
 static void local_signal_handle_exit( int iSignum )
@@ -393,65 +503,66 @@ static int local_signal_register()
 	return TRH_OK;
 }
 
-// #endregion // Signal handling
-
-
-// #region Epoll
-
-// Initialize epoll object.
-int local_epoll_init()
+void local_signal_mask( sigset_t *oMask )
 {
-	gsApplication.epoll_fd = epoll_create1( 0 );
-
-	if( gsApplication.epoll_fd == -1 ) {
-		trh_log( LOG_ERROR, "Failed to create epoll. Error: %s\n", strerror( errno ) );
-		return TRH_EPOLL_FAILED;
-	}
-
-	return TRH_OK;
+	sigemptyset( oMask );
+	sigaddset( oMask, SIGINT );
+	sigaddset( oMask, SIGTERM );
+	sigaddset( oMask, SIGQUIT );
+	sigaddset( oMask, SIGHUP );
+	sigaddset( oMask, SIGUSR1 );
+	sigaddset( oMask, SIGUSR2 );
 }
 
-int local_epoll_error()
+int local_signal_event( TTrhEvent *iEvent )
 {
-	if( errno == EINTR && gsApplication.handle_error != 0 && gsApplication.handle_error() == TRH_OK )
-		return TRH_WAITING;
+	struct signalfd_siginfo lInfo[16];
+	ssize_t lSize;
+
+	while( ( lSize = read( iEvent->fd, lInfo, sizeof( lInfo ) ) ) > 0 ) {
+		for( size_t ii = 0; ii < (size_t)lSize / sizeof( lInfo[0] ); ii++ ) {
+			int lSignal = (int)lInfo[ii].ssi_signo;
+
+			// User handler replaces the default handling (same as signal()).
+			if( lSignal > 0 && lSignal < NSIG && gsApplication.signal_handlers[lSignal] != 0 ) {
+				gsApplication.signal_handlers[lSignal]( lSignal );
+			}
+			else if( lSignal == SIGHUP ) {
+				trh_log( LOG_NOTE, "SIGNAL %d HAS BEEN RECEIVED FROM PID %u. RELOADING CONFIGURATION.\n", lSignal, lInfo[ii].ssi_pid );
+				atomic_store( &gsApplication.reload, true );
+			}
+			else if( lSignal == SIGINT || lSignal == SIGTERM || lSignal == SIGQUIT ) {
+				trh_log( LOG_NOTE, "SIGNAL %d HAS BEEN RECEIVED FROM PID %u. APPLICATION WILL NOW STOP.\n", lSignal, lInfo[ii].ssi_pid );
+				trh_terminate();
+			}
+		}
+	}
 
-	if( errno == EINTR )
-		trh_log( LOG_WARNING, "Application loop terminated by interrupt signal.\n" );
-	else
-		trh_log( LOG_ERROR, "Error while checking for epoll events. Error: %s\n", strerror( errno ) );
+	if( lSize < 0 && errno != EAGAIN && errno != EINTR )
+		trh_log( LOG_ERROR, "Failed to read signals. Error: %s\n", strerror( errno ) );
 
-	return TRH_EPOLL_FAILED;
+	return TRH_OK;
 }
 
-int local_epoll_event( struct epoll_event *iEvent )
-{
-	TTrhEvent *lEvent = (TTrhEvent*)iEvent->data.ptr;
-
-	// Check if file descriptor has been closed, or network connection has been lost.
-	if( iEvent->events & EPOLLERR ) {
-		trh_log( LOG_WARNING, "EPOLLERR on fd %d\n", iEvent->data.fd );
-		if( lEvent->handle_error != 0 )
-			lEvent->handle_error( lEvent );
-		return TRH_EPOLL_ERROR;
-	}
+// #endregion // Signal handling
 
-	// Check if file descriptor is ready for reading.
-	if( iEvent->events & EPOLLIN ) {
-		assert( lEvent->handle_triggered != 0 );
-		lEvent->handle_triggered( lEvent );
-	}
 
-	return TRH_OK;
-}
+// #region Time
 
-// Release epoll object.
-void local_epoll_release()
+void local_update_time()
 {
-	CLOSE_FD( gsApplication.epoll_fd );
+	// Application time and dt are measured by monotonic clock - system clock steps do not affect them.
+	const uint64_t lNow = trh_time_ns();
+	const uint64_t lDt = lNow - gsApplication.time_monotonic;
+	gsApplication.time_monotonic = lNow;
+
+	// Main loop is the only writer - plain read-modify-write; readers never block.
+	atomic_store_explicit( &gsApplication.dt, lDt, memory_order_relaxed );
+	atomic_store_explicit( &gsApplication.time_app, atomic_load_explicit( &gsApplication.time_app, memory_order_relaxed ) + lDt, memory_order_relaxed );
+	atomic_store_explicit( &gsApplication.time_system, trh_time(), memory_order_relaxed );
 }
 
-// #endregion // Epoll
+// #endregion // Time
 
 
 // #endregion // Static functions
@@ -0,0 +1,120 @@
+/*
+ * @brief Tests of the event loop
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ *
+ * Usage: trihlav_test_loop
+ *
+ * Returns 0 if all tests pass; failures are printed to stderr.
+ */
+
+// #region Includes
+
+#include <string.h>
+
+#include "trihlav.h"
+#include "trh_arena.h"
+#include "trh_loop.h"
+
+// #endregion
+
+// Number of loop iterations of one test.
+#define TEST_ITERATIONS			1000
+// Scratch memory allocated by one callback - iterations together exceed the arena chunk.
+#define TEST_ALLOC_SIZE			4096
+
+// #region Static functions
+
+static int gsFailed = 0;
+static int gsCalls = 0;
+
+#define TEST_CHECK( iCondition, ... ) do { if( ! ( iCondition ) ) { fprintf( stderr, __VA_ARGS__ ); gsFailed++; } } while( 0 )
+
+static void local_alloc_scratch()
+{
+	char *lData = (char*)trh_arena_alloc( 0, TEST_ALLOC_SIZE );
+	if( lData != 0 ) memset( lData, 0xAB, TEST_ALLOC_SIZE );
+	gsCalls++;
+}
+
+// Deferred task deferring itself - runs once per iteration.
+static void local_task_defer( void *iLoop )
+{
+	local_alloc_scratch();
+
+	if( gsCalls < TEST_ITERATIONS )
+		trh_defer_on( (struct TTrhLoop*)iLoop, local_task_defer, iLoop );
+}
+
+static void local_task_idle( void *iArg )
+{
+	(void)iArg;
+	local_alloc_scratch();
+}
+
+static bool local_mark_equal( TTrhArenaMark iMark )
+{
+	const TTrhArenaMark lMark = trh_arena_mark( trh_arena_thread( false ) );
+	return lMark.chunk == iMark.chunk && lMark.used == iMark.used;
+}
+
+// Scratch memory of deferred tasks is released although the loop dispatches no events.
+static void local_test_defer_arena( struct TTrhLoop *iLoop )
+{
+	const TTrhArenaMark lMark = trh_arena_mark( trh_arena_current() );
+
+	gsCalls = 0;
+	trh_defer_on( iLoop, local_task_defer, iLoop );
+
+	for( int ii = 0; ii < TEST_ITERATIONS && gsCalls < TEST_ITERATIONS; ii++ )
+		trh_loop_update_wait( iLoop, 0 );
+
+	TEST_CHECK( gsCalls == TEST_ITERATIONS, "defer: %d of %d tasks executed\n", gsCalls, TEST_ITERATIONS );
+	TEST_CHECK( local_mark_equal( lMark ), "defer: scratch arena has grown\n" );
+}
+
+// Scratch memory of idle hooks is released on the iteration without events.
+static void local_test_idle_arena( struct TTrhLoop *iLoop )
+{
+	const TTrhArenaMark lMark = trh_arena_mark( trh_arena_current() );
+
+	gsCalls = 0;
+	TEST_CHECK( trh_hook_add_on( iLoop, TRH_LOOP_IDLE, local_task_idle, 0 ) == TRH_OK, "idle: failed to add hook\n" );
+
+	for( int ii = 0; ii < TEST_ITERATIONS; ii++ )
+		trh_loop_update_wait( iLoop, 0 );
+
+	trh_hook_remove_on( iLoop, TRH_LOOP_IDLE, local_task_idle, 0 );
+
+	TEST_CHECK( gsCalls == TEST_ITERATIONS, "idle: %d of %d hooks executed\n", gsCalls, TEST_ITERATIONS );
+	TEST_CHECK( local_mark_equal( lMark ), "idle: scratch arena has grown\n" );
+}
+
+// #endregion
+
+
+int main()
+{
+	struct TTrhLoop *lLoop = 0;
+
+	if( trh_loop_init( &lLoop ) != TRH_OK ) {
+		fprintf( stderr, "Failed to create loop.\n" );
+		return 1;
+	}
+
+	// Scratch arena with its first chunk - marks of the tests point into it.
+	trh_arena_alloc( 0, 1 );
+
+	local_test_defer_arena( lLoop );
+	local_test_idle_arena( lLoop );
+
+	trh_loop_release( lLoop );
+	trh_arena_thread_release();
+
+	if( gsFailed > 0 ) {
+		fprintf( stderr, "%d checks failed.\n", gsFailed );
+		return 1;
+	}
+
+	return 0;
+}
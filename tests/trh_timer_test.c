@@ -0,0 +1,47 @@
+/*
+ * @brief Tests of the timers
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ *
+ * Usage: trihlav_test_timer
+ *
+ * Returns 0 if all tests pass; failures are printed to stderr.
+ */
+
+// #region Includes
+
+#include "trihlav.h"
+#include "trh_timer.h"
+
+// #endregion
+
+// #region Static functions
+
+static int gsFailed = 0;
+
+#define TEST_CHECK( iCondition, ... ) do { if( ! ( iCondition ) ) { fprintf( stderr, __VA_ARGS__ ); gsFailed++; } } while( 0 )
+
+// Reserve smaller than one pool chunk (256 timers) - on the empty pool and on top of the reserved timers.
+static void local_test_reserve()
+{
+	TEST_CHECK( trh_timer_reserve( 100 ) == TRH_OK, "reserve: 100 timers on the empty pool failed\n" );
+	TEST_CHECK( trh_timer_reserve( 300 ) == TRH_OK, "reserve: 300 timers failed\n" );
+	TEST_CHECK( trh_timer_reserve( 0 ) == TRH_OK, "reserve: 0 timers failed\n" );
+}
+
+// #endregion
+
+
+int main()
+{
+	local_test_reserve();
+
+	trh_timer_pool_release();
+
+	if( gsFailed > 0 ) {
+		fprintf( stderr, "%d checks failed.\n", gsFailed );
+		return 1;
+	}
+
+	return 0;
+}
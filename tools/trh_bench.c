@@ -0,0 +1,702 @@
+/*
+ * @brief Benchmarks of the event loop, timers, logger and dbus
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ *
+ * Usage: trihlav_bench [--json] [--quick] [--repeat <count>] [<name prefix>...]
+ *
+ * Every benchmark runs once to warm up and then <count> times (default 5); median and minimum
+ * time per operation are reported. Workloads use fixed sizes and a fixed random seed.
+ * Library output (stdout) is redirected to /dev/null while benchmarks run; results are printed
+ * as a table, or as JSON with --json.
+ */
+
+// #region Includes
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "trihlav.h"
+#include "trh_dbus.h"
+#include "trh_logger.h"
+#include "trh_std.h"
+#include "trh_timer.h"
+
+// #endregion
+
+// Default number of measured runs of one benchmark.
+#define BENCH_REPEAT			5
+// Max number of measured runs.
+#define BENCH_REPEAT_MAX		101
+
+// Bus name, path and interface of the dbus echo service.
+#define BENCH_DBUS_NAME			"org.trihlav.Bench"
+#define BENCH_DBUS_PATH			"/org/trihlav/Bench"
+
+// #region Typedefs
+
+struct TBench;
+
+/// Run benchmark once; return elapsed time (ns) of \a ops operations, or 0 if the benchmark is skipped.
+typedef uint64_t (*bench_run)( struct TBench *iBench );
+
+typedef struct TBench {
+	/// Name of the benchmark group, e.g. "timer.create".
+	chars name;
+	bench_run run;
+	/// Size of the workload (fds, timers, threads); 0 if not used.
+	size_t param;
+	/// Operations per run (full / --quick).
+	uint64_t ops;
+	uint64_t ops_quick;
+
+	/// Benchmark has been selected on the command line.
+	bool selected;
+	/// Reason the benchmark has been skipped (set by \a run).
+	chars skipped;
+	/// Median and minimum time per run (ns).
+	uint64_t median;
+	uint64_t min;
+} TBench;
+
+typedef struct TBenchAppTime {
+	atomic_bool start;
+	atomic_int running;
+	uint64_t reads;
+} TBenchAppTime;
+
+// #endregion
+
+
+// #region Static globals
+
+/// Results are written here; stdout of the process is redirected to /dev/null.
+static FILE *gsOut = 0;
+static bool gsQuick = false;
+
+/// Log file of the logger benchmarks.
+static char gsLogFile[] = "/tmp/trihlav_bench_XXXXXX";
+
+/// Counter of events dispatched by the loop benchmark.
+static uint64_t gsDispatched = 0;
+
+/// Dbus echo service: 1 registered, -1 not available, 0 not initialized yet.
+static int gsDbusState = 0;
+/// Set by the echo reply callback; 1 reply received, -1 call failed.
+static int gsDbusReply = 0;
+
+// #endregion
+
+
+// #region Helpers
+
+static uint64_t local_ops( const TBench *iBench )
+{
+	return gsQuick ? iBench->ops_quick : iBench->ops;
+}
+
+// xorshift64 - workloads are the same in every run.
+static uint64_t local_random( uint64_t *ioState )
+{
+	uint64_t lValue = *ioState;
+	lValue ^= lValue << 13;
+	lValue ^= lValue >> 7;
+	lValue ^= lValue << 17;
+	return *ioState = lValue;
+}
+
+static int local_compare( const void *iLeft, const void *iRight )
+{
+	uint64_t lLeft = *(const uint64_t*)iLeft;
+	uint64_t lRight = *(const uint64_t*)iRight;
+	return ( lLeft > lRight ) - ( lLeft < lRight );
+}
+
+static void local_bench_name( const TBench *iBench, char *oName, size_t iSize )
+{
+	if( iBench->param > 0 )
+		snprintf( oName, iSize, "%s/%zu", iBench->name, iBench->param );
+	else
+		snprintf( oName, iSize, "%s", iBench->name );
+}
+
+static bool local_bench_selected( const TBench *iBench, int iCount, char **iFilters )
+{
+	char lName[64];
+
+	if( iCount == 0 )
+		return true;
+
+	local_bench_name( iBench, lName, sizeof( lName ) );
+	for( int ii = 0; ii < iCount; ii++ )
+		if( strncmp( lName, iFilters[ii], strlen( iFilters[ii] ) ) == 0 )
+			return true;
+
+	return false;
+}
+
+// #endregion
+
+
+// #region Event loop
+
+static int local_loop_event( TTrhEvent *iEvent )
+{
+	// Eventfd is not read - it stays readable and is reported again in the next iteration.
+	(void)iEvent;
+	gsDispatched++;
+	return TRH_OK;
+}
+
+// trh_update() dispatch throughput with N readable fds (level-triggered). Operation = one dispatched event.
+static uint64_t local_bench_dispatch( TBench *iBench )
+{
+	const uint64_t lOps = local_ops( iBench );
+	TTrhEvent *lEvents = (TTrhEvent*)calloc( iBench->param, sizeof( TTrhEvent ) );
+	size_t lCount = 0;
+	uint64_t lElapsed = 0;
+
+	if( lEvents == 0 ) {
+		iBench->skipped = "out of memory";
+		return 0;
+	}
+
+	for( ; lCount < iBench->param; lCount++ ) {
+		TTrhEvent *lEvent = &lEvents[lCount];
+		lEvent->fd = eventfd( 1, EFD_NONBLOCK | EFD_CLOEXEC );
+		lEvent->handle_triggered = local_loop_event;
+
+		if( lEvent->fd == -1 || trh_event_register( lEvent ) != TRH_OK ) {
+			if( lEvent->fd != -1 ) close( lEvent->fd );
+			iBench->skipped = "failed to create fds (RLIMIT_NOFILE)";
+			break;
+		}
+	}
+
+	if( iBench->skipped == 0 ) {
+		trh_set_event_batch( 64 );
+		gsDispatched = 0;
+
+		uint64_t lStart = trh_time_ns();
+		while( gsDispatched < lOps )
+			trh_update();
+		lElapsed = trh_time_ns() - lStart;
+
+		trh_set_event_batch( TRH_EVENT_BATCH_DEFAULT );
+	}
+
+	for( size_t ii = 0; ii < lCount; ii++ ) {
+		trh_event_unregister( &lEvents[ii] );
+		close( lEvents[ii].fd );
+	}
+	free( lEvents );
+
+	// Last batch can overshoot; scale to the requested number of operations.
+	return lElapsed > 0 ? (uint64_t)( (double)lElapsed * (double)lOps / (double)gsDispatched ) : 0;
+}
+
+// #endregion
+
+
+// #region Timers
+
+static int local_timer_event( TTrhEvent *iEvent )
+{
+	(void)iEvent;
+	return TRH_OK;
+}
+
+// Create N timers with random durations (1 - 60 s, they never expire during the benchmark).
+static TTrhEvent **local_timers_create( TBench *iBench, uint64_t *oElapsed )
+{
+	TTrhEvent **lTimers = (TTrhEvent**)calloc( iBench->param, sizeof( TTrhEvent* ) );
+	TTrhTimerProperties lProperties;
+	uint64_t lSeed = 0x9E3779B97F4A7C15ull;
+
+	if( lTimers == 0 || trh_timer_reserve( iBench->param ) != TRH_OK ) {
+		free( lTimers );
+		iBench->skipped = "out of memory";
+		return 0;
+	}
+
+	memset( &lProperties, 0, sizeof( lProperties ) );
+	lProperties.handle_timer_event = local_timer_event;
+
+	uint64_t lStart = trh_time_ns();
+	for( size_t ii = 0; ii < iBench->param; ii++ ) {
+		uint64_t lDuration = TRH_NSEC_PER_SEC + local_random( &lSeed ) % ( 59 * TRH_NSEC_PER_SEC );
+		lProperties.sec = (time_t)( lDuration / TRH_NSEC_PER_SEC );
+		lProperties.nsec = (time_t)( lDuration % TRH_NSEC_PER_SEC );
+
+		if( trh_timer_init( &lProperties, &lTimers[ii] ) != TRH_OK ) {
+			for( size_t jj = 0; jj < ii; jj++ )
+				trh_timer_release( lTimers[jj] );
+			free( lTimers );
+			iBench->skipped = "failed to create timer";
+			return 0;
+		}
+	}
+	*oElapsed = trh_time_ns() - lStart;
+
+	return lTimers;
+}
+
+static void local_timers_release( TBench *iBench, TTrhEvent **iTimers )
+{
+	for( size_t ii = 0; ii < iBench->param; ii++ )
+		trh_timer_release( iTimers[ii] );
+	free( iTimers );
+}
+
+// Operation = trh_timer_init() of a timer (the timer is armed).
+static uint64_t local_bench_timer_create( TBench *iBench )
+{
+	uint64_t lElapsed = 0;
+	TTrhEvent **lTimers = local_timers_create( iBench, &lElapsed );
+	if( lTimers == 0 ) return 0;
+
+	local_timers_release( iBench, lTimers );
+	return lElapsed;
+}
+
+// Operation = trh_timer_start() of a running timer (re-arm, new deadline).
+static uint64_t local_bench_timer_arm( TBench *iBench )
+{
+	uint64_t lElapsed = 0;
+	TTrhEvent **lTimers = local_timers_create( iBench, &lElapsed );
+	if( lTimers == 0 ) return 0;
+
+	// Restart in a different order than created - timers move inside the queue.
+	uint64_t lSeed = 0x2545F4914F6CDD1Dull;
+	size_t lStep = (size_t)( local_random( &lSeed ) % iBench->param ) | 1;
+	while( lStep > 1 && iBench->param % lStep == 0 ) lStep += 2;
+
+	uint64_t lStart = trh_time_ns();
+	for( size_t ii = 0, jj = 0; ii < iBench->param; ii++, jj = ( jj + lStep ) % iBench->param )
+		trh_timer_start( lTimers[jj] );
+	lElapsed = trh_time_ns() - lStart;
+
+	local_timers_release( iBench, lTimers );
+	return lElapsed;
+}
+
+// Operation = trh_timer_stop() of a running timer.
+static uint64_t local_bench_timer_cancel( TBench *iBench )
+{
+	uint64_t lElapsed = 0;
+	TTrhEvent **lTimers = local_timers_create( iBench, &lElapsed );
+	if( lTimers == 0 ) return 0;
+
+	uint64_t lStart = trh_time_ns();
+	for( size_t ii = 0; ii < iBench->param; ii++ )
+		trh_timer_stop( lTimers[ii] );
+	lElapsed = trh_time_ns() - lStart;
+
+	local_timers_release( iBench, lTimers );
+	return lElapsed;
+}
+
+// #endregion
+
+
+// #region Logger
+
+// Operation = trh_log() of a message below the minimal severity.
+static uint64_t local_bench_log_disabled( TBench *iBench )
+{
+	const uint64_t lOps = local_ops( iBench );
+
+	trh_log_set_min_severity( LOG_WARNING );
+
+	uint64_t lStart = trh_time_ns();
+	for( uint64_t ii = 0; ii < lOps; ii++ )
+		trh_log( LOG_DEBUG, "Benchmark message %" PRIu64 " of %s.\n", ii, iBench->name );
+	uint64_t lElapsed = trh_time_ns() - lStart;
+
+	trh_log_set_min_severity( LOG_DEBUG );
+
+	return lElapsed;
+}
+
+// Operation = trh_log() written synchronously to the log file (and stdout, i.e. /dev/null).
+static uint64_t local_bench_log_file( TBench *iBench )
+{
+	const uint64_t lOps = local_ops( iBench );
+
+	if( trh_log_init( gsLogFile ) != TRH_OK ) {
+		iBench->skipped = "failed to open log file";
+		return 0;
+	}
+
+	uint64_t lStart = trh_time_ns();
+	for( uint64_t ii = 0; ii < lOps; ii++ )
+		trh_log( LOG_NOTE, "Benchmark message %" PRIu64 " of %s.\n", ii, iBench->name );
+	trh_log_release();
+	uint64_t lElapsed = trh_time_ns() - lStart;
+
+	// Growing log file would skew the following runs.
+	if( truncate( gsLogFile, 0 ) != 0 ) {
+		iBench->skipped = "failed to truncate log file";
+		return 0;
+	}
+	return lElapsed;
+}
+
+// Operation = trh_log() with asynchronous logger. Measure time of the caller only, or until all messages are written.
+static uint64_t local_bench_log_async( TBench *iBench, bool iDrain )
+{
+	const uint64_t lOps = local_ops( iBench );
+
+	if( trh_log_init( gsLogFile ) != TRH_OK || trh_log_async_init( 65536, LOG_OVERFLOW_BLOCK, 50 ) != TRH_OK ) {
+		trh_log_release();
+		iBench->skipped = "failed to start async logger";
+		return 0;
+	}
+
+	uint64_t lStart = trh_time_ns();
+	for( uint64_t ii = 0; ii < lOps; ii++ )
+		trh_log( LOG_NOTE, "Benchmark message %" PRIu64 " of %s.\n", ii, iBench->name );
+	uint64_t lElapsed = trh_time_ns() - lStart;
+	trh_log_release();
+
+	if( iDrain )
+		lElapsed = trh_time_ns() - lStart;
+
+	// Growing log file would skew the following runs.
+	if( truncate( gsLogFile, 0 ) != 0 ) {
+		iBench->skipped = "failed to truncate log file";
+		return 0;
+	}
+	return lElapsed;
+}
+
+static uint64_t local_bench_log_async_enqueue( TBench *iBench )
+{
+	return local_bench_log_async( iBench, false );
+}
+
+static uint64_t local_bench_log_async_total( TBench *iBench )
+{
+	return local_bench_log_async( iBench, true );
+}
+
+// #endregion
+
+
+// #region Application time
+
+static void *local_app_time_reader( void *iArg )
+{
+	TBenchAppTime *lState = (TBenchAppTime*)iArg;
+	volatile double lSum = 0;
+
+	while( ! atomic_load_explicit( &lState->start, memory_order_acquire ) );
+
+	for( uint64_t ii = 0; ii < lState->reads; ii++ )
+		lSum += trh_get_app_time();
+
+	atomic_fetch_sub( &lState->running, 1 );
+	return 0;
+}
+
+// trh_get_app_time() from N threads while the main thread updates the time in trh_update().
+// Operation = one read; reads are split between the threads.
+static uint64_t local_bench_app_time( TBench *iBench )
+{
+	TBenchAppTime lState;
+	pthread_t lThreads[64];
+	size_t lCount = 0;
+
+	atomic_init( &lState.start, false );
+	atomic_init( &lState.running, 0 );
+	lState.reads = local_ops( iBench ) / iBench->param;
+
+	for( ; lCount < iBench->param && lCount < 64; lCount++ ) {
+		atomic_fetch_add( &lState.running, 1 );
+		if( pthread_create( &lThreads[lCount], 0, local_app_time_reader, &lState ) != 0 ) {
+			atomic_fetch_sub( &lState.running, 1 );
+			iBench->skipped = "failed to create thread";
+			break;
+		}
+	}
+
+	uint64_t lStart = trh_time_ns();
+	atomic_store_explicit( &lState.start, true, memory_order_release );
+	while( atomic_load( &lState.running ) > 0 )
+		trh_update();
+	uint64_t lElapsed = trh_time_ns() - lStart;
+
+	for( size_t ii = 0; ii < lCount; ii++ )
+		pthread_join( lThreads[ii], 0 );
+
+	return iBench->skipped == 0 ? lElapsed : 0;
+}
+
+// #endregion
+
+
+// #region Dbus
+
+static int local_dbus_echo( sd_bus_message *iMsg, void *iUserData, sd_bus_error *oError )
+{
+	chars lText = 0;
+	int lCode;
+
+	(void)iUserData;
+	(void)oError;
+
+	if( ( lCode = sd_bus_message_read( iMsg, "s", &lText ) ) < 0 )
+		return lCode;
+
+	return sd_bus_reply_method_return( iMsg, "s", lText );
+}
+
+static const sd_bus_vtable gsDbusVtable[] = {
+	SD_BUS_VTABLE_START( 0 ),
+	SD_BUS_METHOD( "Echo", "s", "s", local_dbus_echo, SD_BUS_VTABLE_UNPRIVILEGED ),
+	SD_BUS_VTABLE_END
+};
+
+static void local_dbus_reply( sd_bus_message *iReply, const sd_bus_error *iError, void *iUserData )
+{
+	(void)iReply;
+	(void)iUserData;
+	gsDbusReply = iError == 0 ? 1 : -1;
+}
+
+// Round trip of a method call to the own service through the bus daemon. Operation = one call.
+static uint64_t local_bench_dbus_echo( TBench *iBench )
+{
+	const uint64_t lOps = local_ops( iBench );
+	TTrhDbusMessage lMsg = { BENCH_DBUS_NAME, BENCH_DBUS_PATH, BENCH_DBUS_NAME, "Echo", "s", 0 };
+
+	if( gsDbusState == 0 )
+		gsDbusState = trh_dbus_init( BENCH_DBUS_NAME, BENCH_DBUS_PATH, BENCH_DBUS_NAME, gsDbusVtable, 0 ) >= 0 ? 1 : -1;
+
+	if( gsDbusState < 0 ) {
+		iBench->skipped = "system bus or bus name " BENCH_DBUS_NAME " not available";
+		return 0;
+	}
+
+	uint64_t lStart = trh_time_ns();
+	for( uint64_t ii = 0; ii < lOps; ii++ ) {
+		gsDbusReply = 0;
+
+		if( trh_dbus_method_async( &lMsg, local_dbus_reply, 0, "benchmark" ) != TRH_OK ) {
+			iBench->skipped = "failed to call method";
+			return 0;
+		}
+
+		for( int jj = 0; gsDbusReply == 0 && jj < 100; jj++ )
+			trh_update_wait( 10 );
+
+		if( gsDbusReply != 1 ) {
+			iBench->skipped = "method call failed";
+			return 0;
+		}
+	}
+
+	return trh_time_ns() - lStart;
+}
+
+// #endregion
+
+
+// #region Runner
+
+static TBench gsBenches[] = {
+	{ "loop.dispatch", local_bench_dispatch, 1, 2000000, 200000 },
+	{ "loop.dispatch", local_bench_dispatch, 64, 2000000, 200000 },
+	{ "loop.dispatch", local_bench_dispatch, 1000, 2000000, 200000 },
+	{ "timer.create", local_bench_timer_create, 1000, 1000, 1000 },
+	{ "timer.create", local_bench_timer_create, 100000, 100000, 100000 },
+	{ "timer.create", local_bench_timer_create, 1000000, 1000000, 0 },
+	{ "timer.arm", local_bench_timer_arm, 1000, 1000, 1000 },
+	{ "timer.arm", local_bench_timer_arm, 100000, 100000, 100000 },
+	{ "timer.arm", local_bench_timer_arm, 1000000, 1000000, 0 },
+	{ "timer.cancel", local_bench_timer_cancel, 1000, 1000, 1000 },
+	{ "timer.cancel", local_bench_timer_cancel, 100000, 100000, 100000 },
+	{ "timer.cancel", local_bench_timer_cancel, 1000000, 1000000, 0 },
+	{ "log.disabled", local_bench_log_disabled, 0, 10000000, 1000000 },
+	{ "log.file", local_bench_log_file, 0, 200000, 20000 },
+	{ "log.async.enqueue", local_bench_log_async_enqueue, 0, 200000, 20000 },
+	{ "log.async.total", local_bench_log_async_total, 0, 200000, 20000 },
+	{ "app_time.threads", local_bench_app_time, 1, 20000000, 2000000 },
+	{ "app_time.threads", local_bench_app_time, 2, 20000000, 2000000 },
+	{ "app_time.threads", local_bench_app_time, 4, 20000000, 2000000 },
+	{ "app_time.threads", local_bench_app_time, 8, 20000000, 2000000 },
+	{ "dbus.echo", local_bench_dbus_echo, 0, 10000, 1000 },
+};
+
+#define BENCH_COUNT				( sizeof( gsBenches ) / sizeof( gsBenches[0] ) )
+
+static void local_bench_execute( TBench *iBench, int iRepeat )
+{
+	uint64_t lTimes[BENCH_REPEAT_MAX];
+
+	// Warm-up run (page faults, pool growth, caches).
+	if( iBench->run( iBench ) == 0 && iBench->skipped == 0 )
+		iBench->skipped = "no result";
+
+	for( int ii = 0; ii < iRepeat && iBench->skipped == 0; ii++ ) {
+		if( ( lTimes[ii] = iBench->run( iBench ) ) == 0 && iBench->skipped == 0 )
+			iBench->skipped = "no result";
+	}
+
+	if( iBench->skipped != 0 )
+		return;
+
+	qsort( lTimes, (size_t)iRepeat, sizeof( uint64_t ), local_compare );
+	iBench->median = lTimes[iRepeat / 2];
+	iBench->min = lTimes[0];
+}
+
+static void local_print_table()
+{
+	char lName[64];
+
+	fprintf( gsOut, "%-28s %12s %12s %12s %16s\n", "benchmark", "ops", "ns/op", "min ns/op", "ops/s" );
+
+	for( size_t ii = 0; ii < BENCH_COUNT; ii++ ) {
+		TBench *lBench = &gsBenches[ii];
+		const uint64_t lOps = local_ops( lBench );
+		if( ! lBench->selected ) continue;
+		local_bench_name( lBench, lName, sizeof( lName ) );
+
+		if( lBench->skipped != 0 )
+			fprintf( gsOut, "%-28s skipped: %s\n", lName, lBench->skipped );
+		else
+			fprintf( gsOut, "%-28s %12" PRIu64 " %12.2f %12.2f %16.0f\n", lName, lOps,
+				(double)lBench->median / (double)lOps, (double)lBench->min / (double)lOps,
+				(double)lOps * 1e9 / (double)lBench->median );
+	}
+}
+
+static void local_print_json( int iRepeat )
+{
+	TAppVersion lVersion;
+	char lName[64];
+	bool lFirst = true;
+
+	trh_version( &lVersion );
+
+	fprintf( gsOut, "{\n\t\"library\": \"%s\",\n\t\"version\": \"%d.%02d.%02d\",\n\t\"quick\": %s,\n\t\"repeat\": %d,\n\t\"results\": [",
+		LIB_TRH_NAME, lVersion.major, lVersion.minor, lVersion.patch, gsQuick ? "true" : "false", iRepeat );
+
+	for( size_t ii = 0; ii < BENCH_COUNT; ii++ ) {
+		TBench *lBench = &gsBenches[ii];
+		const uint64_t lOps = local_ops( lBench );
+		if( ! lBench->selected ) continue;
+		local_bench_name( lBench, lName, sizeof( lName ) );
+
+		fprintf( gsOut, "%s\n\t\t{ \"name\": \"%s\", \"param\": %zu, ", lFirst ? "" : ",", lName, lBench->param );
+		lFirst = false;
+
+		if( lBench->skipped != 0 )
+			fprintf( gsOut, "\"skipped\": \"%s\" }", lBench->skipped );
+		else
+			fprintf( gsOut, "\"ops\": %" PRIu64 ", \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, \"ops_per_sec\": %.0f }", lOps,
+				(double)lBench->median / (double)lOps, (double)lBench->min / (double)lOps,
+				(double)lOps * 1e9 / (double)lBench->median );
+	}
+
+	fprintf( gsOut, "\n\t]\n}\n" );
+}
+
+// #endregion
+
+
+int main( int argc, char **argv )
+{
+	char *lFilters[64];
+	int lFilterCount = 0;
+	int lRepeat = BENCH_REPEAT;
+	bool lJson = false;
+	struct rlimit lLimit;
+
+	for( int ii = 1; ii < argc; ii++ ) {
+		if( strcmp( argv[ii], "--json" ) == 0 )
+			lJson = true;
+		else if( strcmp( argv[ii], "--quick" ) == 0 )
+			gsQuick = true;
+		else if( strcmp( argv[ii], "--repeat" ) == 0 && ii + 1 < argc )
+			lRepeat = atoi( argv[++ii] );
+		else if( argv[ii][0] != '-' && lFilterCount < 64 )
+			lFilters[lFilterCount++] = argv[ii];
+		else {
+			fprintf( stderr, "Usage: %s [--json] [--quick] [--repeat <count>] [<name prefix>...]\n", argv[0] );
+			return 1;
+		}
+	}
+
+	if( lRepeat < 1 || lRepeat > BENCH_REPEAT_MAX ) {
+		fprintf( stderr, "Repeat count must be 1 - %d.\n", BENCH_REPEAT_MAX );
+		return 1;
+	}
+
+	// Keep results on the original stdout; library output goes to /dev/null.
+	int lNull = open( "/dev/null", O_WRONLY | O_CLOEXEC );
+	int lStdout = dup( STDOUT_FILENO );
+	if( lNull == -1 || lStdout == -1 || ( gsOut = fdopen( lStdout, "w" ) ) == 0 ) {
+		fprintf( stderr, "Failed to redirect stdout. Error: %s\n", strerror( errno ) );
+		return 1;
+	}
+	fflush( stdout );
+	dup2( lNull, STDOUT_FILENO );
+	close( lNull );
+
+	int lLogFd = mkstemp( gsLogFile );
+	if( lLogFd == -1 ) {
+		fprintf( stderr, "Failed to create log file. Error: %s\n", strerror( errno ) );
+		return 1;
+	}
+	close( lLogFd );
+
+	// Loop benchmark needs up to 1000 fds.
+	if( getrlimit( RLIMIT_NOFILE, &lLimit ) == 0 && lLimit.rlim_cur < lLimit.rlim_max ) {
+		lLimit.rlim_cur = lLimit.rlim_max;
+		setrlimit( RLIMIT_NOFILE, &lLimit );
+	}
+
+	if( trh_init( 0 ) == 0 ) {
+		fprintf( stderr, "Failed to initialize the library.\n" );
+		unlink( gsLogFile );
+		return 1;
+	}
+
+	for( size_t ii = 0; ii < BENCH_COUNT; ii++ ) {
+		TBench *lBench = &gsBenches[ii];
+
+		if( local_ops( lBench ) == 0 || ! local_bench_selected( lBench, lFilterCount, lFilters ) )
+			continue;
+
+		if( ! lJson ) {
+			char lName[64];
+			local_bench_name( lBench, lName, sizeof( lName ) );
+			fprintf( stderr, "Running %s...\n", lName );
+		}
+
+		lBench->selected = true;
+		local_bench_execute( lBench, lRepeat );
+	}
+
+	if( lJson )
+		local_print_json( lRepeat );
+	else
+		local_print_table();
+
+	if( gsDbusState > 0 )
+		trh_dbus_release();
+
+	trh_release();
+	unlink( gsLogFile );
+	fclose( gsOut );
+
+	return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * @brief Decode binary log file (trh_log_binary) to text
+ * @copyright Copyright © 2022-2025 Trihlav, s.r.o.
+ * @license MIT License / see LICENSE file
+ *
+ * Usage: trihlav_logdecode <binary log file>
+ *
+ * Output follows the layout of the text log file: "YYYY-MM-DD HH:MM:SS [SEVERITY] message".
+ */
+
+// #region Includes
+
+#include <string.h>
+#include <time.h>
+
+#include "trihlav.h"
+#include "trh_logger.h"
+
+// #endregion
+
+// Same severity tags as the text log file.
+#define TRH_LOG_DEBUG			"[DEBUG]  "
+#define TRH_LOG_NOTE			"[...]    "
+#define TRH_LOG_WARN			"[WARN]   "
+#define TRH_LOG_ERROR			"[ERROR]  "
+
+// #region Typedefs
+
+typedef struct TDecoderFormat {
+	char *format;
+	char types[TRH_LOG_BIN_ARGS + 1];
+} TDecoderFormat;
+
+typedef struct TDecoder {
+	FILE *file;
+
+	/// Formats of the current session.
+	TDecoderFormat formats[TRH_LOG_BIN_FORMATS];
+
+	/// Session anchor - wall clock and monotonic time at the same instant (ns).
+	uint64_t realtime;
+	uint64_t monotonic;
+} TDecoder;
+
+// #endregion
+
+
+// #region Static functions
+
+static chars local_severity_text( uint8_t iSeverity )
+{
+	switch( iSeverity ) {
+		case LOG_DEBUG: return TRH_LOG_DEBUG;
+		case LOG_NOTE: return TRH_LOG_NOTE;
+		case LOG_WARNING: return TRH_LOG_WARN;
+		case LOG_ERROR: return TRH_LOG_ERROR;
+		default: return TRH_LOG_NOTE;
+	}
+}
+
+static void local_reset_formats( TDecoder *iDecoder )
+{
+	for( int ii = 0; ii < TRH_LOG_BIN_FORMATS; ii++ )
+		FREE_PTR( iDecoder->formats[ii].format );
+}
+
+// Render one conversion (iSpec .. iEnd) using value from payload. Return number of consumed payload bytes.
+static int local_render_arg( FILE *oOut, chars iSpec, chars iEnd, char iType, const uint8_t *iData, size_t iSize, const int *iStars, int iStarCount )
+{
+	char lSpec[64];
+	size_t lSpecLen = 0;
+
+	// Copy spec without length modifiers; 8-byte integers are rendered with "ll".
+	for( chars lPtr = iSpec; lPtr < iEnd && lSpecLen < sizeof( lSpec ) - 4; lPtr++ ) {
+		if( strchr( "lqztjL", *lPtr ) == 0 )
+			lSpec[lSpecLen++] = *lPtr;
+	}
+
+	const char lConversion = *iEnd;
+	if( strchr( "lLqQzZjJ", iType ) != 0 ) {
+		lSpec[lSpecLen++] = 'l';
+		lSpec[lSpecLen++] = 'l';
+	}
+	lSpec[lSpecLen++] = lConversion;
+	lSpec[lSpecLen] = 0;
+
+	union { int32_t i32; int64_t i64; double f64; uint16_t u16; } lValue;
+	size_t lSize = strchr( "iI", iType ) != 0 ? 4 : 8;
+
+	if( iType == 's' ) {
+		if( iSize < 2 ) return -1;
+		memcpy( &lValue.u16, iData, 2 );
+		if( iSize < 2u + lValue.u16 ) return -1;
+
+		char *lText = strndup( (chars)iData + 2, lValue.u16 );
+		if( lText == 0 ) return -1;
+
+		if( iStarCount == 2 ) fprintf( oOut, lSpec, iStars[0], iStars[1], lText );
+		else if( iStarCount == 1 ) fprintf( oOut, lSpec, iStars[0], lText );
+		else fprintf( oOut, lSpec, lText );
+
+		free( lText );
+		return 2 + lValue.u16;
+	}
+
+	if( iSize < lSize ) return -1;
+	memcpy( &lValue, iData, lSize );
+
+	#define RENDER( value ) \
+		if( iStarCount == 2 ) fprintf( oOut, lSpec, iStars[0], iStars[1], value ); \
+		else if( iStarCount == 1 ) fprintf( oOut, lSpec, iStars[0], value ); \
+		else fprintf( oOut, lSpec, value );
+
+	switch( iType ) {
+		case 'i': RENDER( (int)lValue.i32 ); break;
+		case 'I': RENDER( (unsigned int)lValue.i32 ); break;
+		case 'l': case 'q': case 'z': case 'j': RENDER( (long long)lValue.i64 ); break;
+		case 'L': case 'Q': case 'Z': case 'J': RENDER( (unsigned long long)lValue.i64 ); break;
+		case 'd': case 'D': RENDER( lValue.f64 ); break;
+		case 'p': RENDER( (void*)(uintptr_t)lValue.i64 ); break;
+		default: return -1;
+	}
+
+	#undef RENDER
+
+	return (int)lSize;
+}
+
+// Render message using its format and payload.
+static void local_render_message( TDecoder *iDecoder, const TTrhLogBinRecord *iRecord, const uint8_t *iPayload )
+{
+	const TDecoderFormat *lFormat = iRecord->format < TRH_LOG_BIN_FORMATS ? &iDecoder->formats[iRecord->format] : 0;
+
+	// Date is rendered from session anchor.
+	char lDate[32];
+	time_t lSeconds = (time_t)( ( iDecoder->realtime + ( iRecord->time - iDecoder->monotonic ) ) / 1000000000ull );
+	struct tm lTm;
+	localtime_r( &lSeconds, &lTm );
+	strftime( lDate, sizeof( lDate ), "%Y-%m-%d %T", &lTm );
+
+	printf( "%s %s", lDate, local_severity_text( iRecord->severity ) );
+
+	if( lFormat == 0 || lFormat->format == 0 ) {
+		printf( "<unknown format %u>\n", iRecord->format );
+		return;
+	}
+
+	size_t lOffset = 0;
+	int lArg = 0;
+
+	for( chars lPtr = lFormat->format; *lPtr != 0; lPtr++ ) {
+		if( *lPtr != '%' ) {
+			putchar( *lPtr );
+			continue;
+		}
+
+		if( lPtr[1] == '%' ) {
+			putchar( '%' );
+			lPtr++;
+			continue;
+		}
+
+		// Collect '*' arguments and find the conversion character.
+		chars lSpec = lPtr++;
+		int lStars[2] = { 0, 0 };
+		int lStarCount = 0;
+
+		while( *lPtr != 0 && strchr( "-+ #0123456789.*'hlqztjL", *lPtr ) != 0 ) {
+			if( *lPtr == '*' && lStarCount < 2 && lOffset + 4 <= iRecord->length ) {
+				memcpy( &lStars[lStarCount++], iPayload + lOffset, 4 );
+				lOffset += 4;
+				lArg++;
+			}
+			lPtr++;
+		}
+
+		if( *lPtr == 0 ) break;
+
+		int lUsed = local_render_arg( stdout, lSpec, lPtr, lFormat->types[lArg++], iPayload + lOffset, iRecord->length - lOffset, lStars, lStarCount );
+		if( lUsed < 0 ) {
+			printf( "<invalid payload>\n" );
+			return;
+		}
+
+		lOffset += lUsed;
+	}
+}
+
+// Decode one record. Return false at end of file or on error.
+static bool local_decode_record( TDecoder *iDecoder )
+{
+	TTrhLogBinRecord lRecord;
+	uint8_t lPayload[TRH_LOG_BIN_PAYLOAD];
+
+	if( fread( &lRecord, sizeof( lRecord ), 1, iDecoder->file ) != 1 )
+		return false;
+
+	if( lRecord.length > TRH_LOG_BIN_PAYLOAD || fread( lPayload, 1, lRecord.length, iDecoder->file ) != lRecord.length ) {
+		fprintf( stderr, "Corrupted record.\n" );
+		return false;
+	}
+
+	switch( lRecord.type ) {
+		case LOG_BIN_SESSION:
+			if( lRecord.length < 16 ) return false;
+			memcpy( &iDecoder->realtime, lPayload, 8 );
+			memcpy( &iDecoder->monotonic, lPayload + 8, 8 );
+			local_reset_formats( iDecoder );
+			break;
+
+		case LOG_BIN_FORMAT:
+			if( lRecord.format >= TRH_LOG_BIN_FORMATS ) return false;
+			FREE_PTR( iDecoder->formats[lRecord.format].format );
+			iDecoder->formats[lRecord.format].format = strndup( (chars)lPayload, lRecord.length );
+			if( iDecoder->formats[lRecord.format].format == 0 || trh_log_format_types( iDecoder->formats[lRecord.format].format, iDecoder->formats[lRecord.format].types ) < 0 )
+				FREE_PTR( iDecoder->formats[lRecord.format].format );
+			break;
+
+		case LOG_BIN_MESSAGE:
+			local_render_message( iDecoder, &lRecord, lPayload );
+			break;
+
+		default:
+			fprintf( stderr, "Unknown record type %u.\n", lRecord.type );
+			return false;
+	}
+
+	return true;
+}
+
+// #endregion
+
+
+int main( int argc, char **argv )
+{
+	static TDecoder lDecoder = { 0 };
+	char lMagic[8];
+
+	if( argc != 2 ) {
+		fprintf( stderr, "Usage: %s <binary log file>\n", argv[0] );
+		return 1;
+	}
+
+	if( ( lDecoder.file = fopen( argv[1], "rb" ) ) == 0 ) {
+		fprintf( stderr, "Failed to open '%s'.\n", argv[1] );
+		return 1;
+	}
+
+	if( fread( lMagic, 1, sizeof( lMagic ), lDecoder.file ) != sizeof( lMagic ) || memcmp( lMagic, TRH_LOG_BIN_MAGIC, sizeof( lMagic ) ) != 0 ) {
+		fprintf( stderr, "'%s' is not a binary log file.\n", argv[1] );
+		fclose( lDecoder.file );
+		return 1;
+	}
+
+	while( local_decode_record( &lDecoder ) );
+
+	local_reset_formats( &lDecoder );
+	fclose( lDecoder.file );
+
+	return 0;
+}